@@ -31,6 +31,8 @@ void radosfs::PyDir::export_bindings()
       .def( "create",         &PyDir::create0 )
       // 'entryList' method
       .def( "entryList",      &PyDir::entryList )
+      // 'entryListWithStats' method
+      .def( "entryListWithStats", &PyDir::entryListWithStats )
       // 'refresh' method
       .def( "refresh",        &PyDir::refresh )
       // 'entry' method
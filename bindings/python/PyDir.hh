@@ -123,6 +123,24 @@ class PyDir : public Dir, public PyFsObj
       return py::make_tuple( rc, l );
     }
 
+    /////////////////////////////////////////////////////////////////////////////////////
+    //
+    // 'entryListWithStats' method
+    //
+    /////////////////////////////////////////////////////////////////////////////////////
+
+    py::tuple entryListWithStats()
+    {
+      std::map<std::string, struct stat> entries;
+      int rc = Dir::entryListWithStats( entries );
+
+      py::dict d;
+      for( std::map<std::string, struct stat>::iterator it = entries.begin(); it != entries.end(); ++it )
+        d[py::str( it->first )] = PyStat( it->second );
+
+      return py::make_tuple( rc, d );
+    }
+
     /////////////////////////////////////////////////////////////////////////////////////
     //
     // 'entry' method
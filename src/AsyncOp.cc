@@ -22,6 +22,8 @@
 #include "AsyncOp.hh"
 #include "AsyncOpPriv.hh"
 #include "Logger.hh"
+#include "SlowOpTracker.hh"
+#include "Tracer.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -30,12 +32,17 @@ AyncOpPriv::AyncOpPriv(const std::string &id)
     complete(false),
     returnCode(-EINPROGRESS),
     ready(-1),
+    failure(0),
     callback(0),
-    callbackArg(0)
+    callbackArg(0),
+    slowOpTracker(0)
 {}
 
 AyncOpPriv::~AyncOpPriv()
 {
+  // An op that was never waited for stops being tracked when it is released
+  finishSlowOp();
+
   boost::unique_lock<boost::mutex> lock(opMutex);
 
   CompletionList::iterator it = operations.begin();
@@ -49,6 +56,9 @@ AyncOpPriv::~AyncOpPriv()
 int
 AyncOpPriv::waitForCompletion(void)
 {
+  TraceSpan span("AsyncOp::waitForCompletion", "async", id);
+  SlowOpStage stage(SlowOp::STAGE_RADOS);
+
   while (returnCode == -EINPROGRESS)
   {
     boost::unique_lock<boost::mutex> lock(opMutex);
@@ -96,9 +106,16 @@ AyncOpPriv::waitForCompletion(void)
 
   {
     boost::unique_lock<boost::mutex> lock(opMutex);
+
+    // The operation failed before (all of) its completions were added
+    if (failure != 0)
+      returnCode = failure;
+
     complete = true;
   }
 
+  finishSlowOp();
+
   if (callback)
   {
     callback(id, returnCode, callbackArg);
@@ -134,6 +151,13 @@ AyncOpPriv::setPartialReady()
     ready--;
 }
 
+void
+AyncOpPriv::setFailed(int ret)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  failure = ret;
+}
+
 void
 AyncOpPriv::setOverriddenReturnCode(librados::completion_t comp, int ret)
 {
@@ -155,6 +179,31 @@ AyncOpPriv::overriddenReturnCode(librados::AioCompletion *comp, int *ret)
   return false;
 }
 
+void
+AyncOpPriv::setSlowOp(SlowOpTracker *tracker, const SlowOpSP &op)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  slowOpTracker = tracker;
+  slowOp = op;
+}
+
+void
+AyncOpPriv::finishSlowOp(void)
+{
+  SlowOpTracker *tracker;
+  SlowOpSP op;
+
+  {
+    boost::unique_lock<boost::mutex> lock(opMutex);
+    tracker = slowOpTracker;
+    op.swap(slowOp);
+    slowOpTracker = 0;
+  }
+
+  if (tracker)
+    tracker->finish(op);
+}
+
 AsyncOp::AsyncOp(const std::string &id)
   : mPriv(new AyncOpPriv(id))
 {}
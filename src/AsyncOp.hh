@@ -51,6 +51,7 @@ private:
   boost::scoped_ptr<AyncOpPriv> mPriv;
 
   friend class FileIO;
+  friend class SlowOpTracker;
 };
 
 RADOS_FS_END_NAMESPACE
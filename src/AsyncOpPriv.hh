@@ -24,6 +24,7 @@
 #include <rados/librados.hpp>
 
 #include "Filesystem.hh"
+#include "SlowOpTracker.hh"
 #include "radosfsdefines.h"
 
 RADOS_FS_BEGIN_NAMESPACE
@@ -43,18 +44,24 @@ public:
   void addCompletion(librados::AioCompletion *comp);
   void setReady(void);
   void setPartialReady(void);
+  void setFailed(int ret);
   void setOverriddenReturnCode(librados::completion_t comp, int ret);
   bool overriddenReturnCode(librados::AioCompletion *comp, int *ret);
+  void setSlowOp(SlowOpTracker *tracker, const SlowOpSP &op);
+  void finishSlowOp(void);
 
   std::string id;
   bool complete;
   int returnCode;
   int ready;
+  int failure;
   AsyncOpCallback callback;
   void *callbackArg;
   boost::mutex opMutex;
   CompletionList operations;
   CompletionRetCodesMap opsReturnCodes;
+  SlowOpTracker *slowOpTracker;
+  SlowOpSP slowOp;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -171,7 +171,12 @@ DirPriv::makeDirsRecursively(Stat *stat, const char *path, uid_t uid, gid_t gid)
     if (ret != 0)
       return ret;
 
+    // The dir may have been cached as a missing one
+    radosFsPriv->removeDirInode(dir);
+
     indexObject(&parentStat, stat, '+');
+    radosFsPriv->clearMissingEntries(parentStat.translatedPath);
+    radosFsPriv->expireDirCacheLease(parentStat.translatedPath);
   }
 
   return ret;
@@ -233,9 +238,9 @@ DirPriv::find(std::set<std::string> &entries, std::set<std::string> &results,
     mutex.unlock();
 
     jobs.push_back(data);
-    radosFsPriv()->getIoService()->post(boost::bind(&findInThread, &finder,
-                                                    data, boost::ref(mutex),
-                                                    boost::ref(cond)));
+    radosFsPriv()->post(boost::bind(&findInThread, &finder, data,
+                                    boost::ref(mutex), boost::ref(cond)),
+                        Filesystem::WORK_PRIORITY_METADATA);
   }
 
   entries.clear();
@@ -394,6 +399,9 @@ DirPriv::rename(const std::string &destination)
   stat.path = newPath;
   ret = indexObject(&parentStat, &stat, '+');
 
+  radosFsPriv()->clearMissingEntries(parentStat.translatedPath);
+  radosFsPriv()->expireDirCacheLease(parentStat.translatedPath);
+
   if (ret != 0)
     return ret;
 
@@ -402,9 +410,13 @@ DirPriv::rename(const std::string &destination)
 
   ret = indexObject(oldParentStat, &oldStat, '-');
 
+  radosFsPriv()->expireDirCacheLease(oldParentStat->translatedPath);
+
   if (ret != 0)
     return ret;
 
+  radosFsPriv()->removeLinkPrefixes(oldStat.path);
+
   ret = moveDirTreeObjects(&oldStat, &stat);
 
   if (ret == 0)
@@ -782,6 +794,9 @@ Dir::entryList(std::set<std::string> &entries, bool withAbsolutePath)
     return -ENOLINK;
   }
 
+  MetricsTimer timer(mPriv->radosFsPriv()->metrics,
+                     MetricsRegistry::HISTOGRAM_DIR_LIST);
+
   if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
     return -ENOENT;
 
@@ -803,6 +818,182 @@ Dir::entryList(std::set<std::string> &entries, bool withAbsolutePath)
   return 0;
 }
 
+/**
+ * Gets the list of files and directories in the directory together with their
+ * stat information.
+ *
+ * This is equivalent to calling Dir::entryList and then Filesystem::stat with
+ * the entries' paths but much cheaper: the files' entries are read at once
+ * from this directory's object (whose inode is already known) and the sizes
+ * that are not stored in the entries are read in parallel, as are the
+ * subdirectories' stats.
+ *
+ * @note Like Dir::entryList, this method uses the entries cached in this
+ * instance since the last call to Dir::refresh.
+ *
+ * @param[out] entries a map to store the directory's entries (as they are
+ *        returned by Dir::entryList) and their stat information; entries that
+ *        could not be statted (e.g. because they were removed in the meanwhile)
+ *        are not included.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::entryListWithStats(std::map<std::string, struct stat> &entries)
+{
+  if (isFile())
+  {
+    radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
+                  path().c_str());
+    return -ENOTDIR;
+  }
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->entryListWithStats(entries);
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
+  }
+
+  if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return -ENOENT;
+
+  if (!isReadable())
+    return -EACCES;
+
+  const Stat *stat = mPriv->fsStat();
+  const std::set<std::string> &contents = mPriv->dirInfo->contents();
+  std::map<std::string, std::pair<int, Stat> > stats;
+
+  mPriv->radosFsPriv()->statDirEntries(*stat, contents, &stats);
+
+  std::set<std::string>::const_iterator it;
+  for (it = contents.begin(); it != contents.end(); it++)
+  {
+    const std::string &entry = *it;
+    std::map<std::string, std::pair<int, Stat> >::const_iterator statIt;
+
+    statIt = stats.find(stat->path + entry);
+
+    if (statIt == stats.end() || (*statIt).second.first != 0)
+      continue;
+
+    entries[entry] = (*statIt).second.second.statBuff;
+  }
+
+  return 0;
+}
+
+/**
+ * Lists the regular files in the directory and in its subdirectories
+ * (recursively), e.g. for moving them to another data pool.
+ *
+ * @note Each directory in the tree is refreshed before it is listed, so the
+ * files are read from the cluster even if this instance's filesystem has
+ * nothing cached.
+ *
+ * @param[out] files a vector to which the files' absolute paths are appended.
+ * @return 0 on success, an error code otherwise; a subdirectory that cannot be
+ *         listed does not stop the others from being listed but its error is
+ *         returned.
+ */
+int
+Dir::listFilesRecursively(std::vector<std::string> &files)
+{
+  std::map<std::string, struct stat> entries;
+
+  refresh();
+
+  int ret = entryListWithStats(entries);
+
+  if (ret != 0)
+  {
+    radosfs_debug("Error listing %s: %s (retcode=%d)", path().c_str(),
+                  strerror(abs(ret)), ret);
+    return ret;
+  }
+
+  std::map<std::string, struct stat>::const_iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+  {
+    const std::string entryPath = path() + (*it).first;
+    const struct stat &buff = (*it).second;
+
+    if (S_ISDIR(buff.st_mode))
+    {
+      Dir subDir(filesystem(), entryPath, false);
+      int subDirRet = subDir.listFilesRecursively(files);
+
+      if (ret == 0)
+        ret = subDirRet;
+    }
+    else if (S_ISREG(buff.st_mode))
+    {
+      files.push_back(entryPath);
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * Lists the entries in the directory, page by page, directly from the
+ * directory object.
+ *
+ * Unlike Dir::entryList, this method does not need the directory to have been
+ * refreshed, nor does it read the whole directory log before delivering
+ * entries if the directory has been compacted. The entries are delivered in
+ * alphabetical order to the given \a callback as they are read. This is
+ * specially useful for listing only a few entries of very large directories:
+ * the entries of a compacted directory are stored sorted, so listing from
+ * \a startAfter does not need to read the entries before it (a directory that
+ * has never been compacted is read into its cache and listed from there). If
+ * the directory is compacted while being listed, the listing is resumed after
+ * the last entry delivered.
+ *
+ * @param startAfter only the entries whose names come after this one will be
+ *        listed (use an empty string for listing from the first entry). This is
+ *        usually the last entry of the previous page.
+ * @param maxEntries the maximum number of entries to list (0 for no limit).
+ * @param callback a function to be called with each entry's name (and the
+ *        given \a args); if it returns a value different from 0, the listing
+ *        stops.
+ * @param args the arguments to be passed to the \a callback.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::list(const std::string &startAfter, size_t maxEntries,
+          DirListCallback callback, void *args)
+{
+  if (isFile())
+  {
+    radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
+                  path().c_str());
+    return -ENOTDIR;
+  }
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->list(startAfter, maxEntries, callback, args);
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
+  }
+
+  if (!callback)
+    return -EINVAL;
+
+  if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return -ENOENT;
+
+  if (!isReadable())
+    return -EACCES;
+
+  return mPriv->dirInfo->listEntries(startAfter, maxEntries, callback, args);
+}
+
 /**
  * Creates the directory object in the system.
  *
@@ -901,7 +1092,12 @@ Dir::create(int mode,
     return ret;
   }
 
+  // The dir may have been cached as a missing one
+  mPriv->radosFsPriv()->removeDirInode(stat.path);
+
   indexObject(&parentStat, &stat, '+');
+  mPriv->radosFsPriv()->clearMissingEntries(parentStat.translatedPath);
+  mPriv->radosFsPriv()->expireDirCacheLease(parentStat.translatedPath);
 
   FsObj::refresh();
   mPriv->updateDirInfoPtr();
@@ -968,7 +1164,11 @@ Dir::remove()
   }
 
   if (ret == 0)
+  {
     indexObject(&stat, statPtr, '-');
+    mPriv->radosFsPriv()->expireDirCacheLease(stat.translatedPath);
+    mPriv->radosFsPriv()->removeLinkPrefixes(path());
+  }
 
   FsObj::refresh();
 
@@ -1013,7 +1213,10 @@ Dir::refresh()
 
   if (mPriv->dirInfo || mPriv->updateDirInfoPtr())
   {
-    mPriv->dirInfo->update();
+    SlowOpScope slowOpScope(mPriv->radosFsPriv()->slowOps, "Dir::refresh", "",
+                            path());
+
+    mPriv->dirInfo->update(filesystem()->dirCacheLeaseTime());
 
     const float ratio = mPriv->dirInfo->logRatio();
     if (ratio != -1 && ratio <= filesystem()->dirCompactRatio())
@@ -1181,10 +1384,7 @@ Dir::compact()
   }
 
   if (mPriv->dirInfo)
-  {
-    mPriv->dirInfo->compactDirOpLog();
-    return 0;
-  }
+    return mPriv->dirInfo->compactDirOpLog();
 
   return -1;
 }
@@ -1222,13 +1422,15 @@ Dir::setMetadata(const std::string &entry, const std::string &key,
   {
     if (mPriv->dirInfo->hasEntry(entry))
     {
-      librados::IoCtx ioctx = mPriv->dirInfo->ioctx();
+      PoolSP pool = mPriv->dirInfo->pool();
       std::map<std::string, std::string> metadata;
       metadata[key] = value;
 
-      int ret = indexObjectMetadata(ioctx, mPriv->dirInfo->inode(), entry,
+      int ret = indexObjectMetadata(pool.get(), mPriv->dirInfo->inode(), entry,
                                     metadata, '+');
 
+      mPriv->dirInfo->expireLease();
+
       mPriv->radosFsPriv()->updateTMId(mPriv->fsStat());
 
       return ret;
@@ -1345,14 +1547,16 @@ Dir::removeMetadata(const std::string &entry, const std::string &key)
     if (mPriv->dirInfo->hasEntry(entry) &&
         mPriv->dirInfo->getMetadata(entry, key, value) == 0)
     {
-      librados::IoCtx ioctx = mPriv->dirInfo->ioctx();
+      PoolSP pool = mPriv->dirInfo->pool();
       std::map<std::string, std::string> metadata;
       metadata[key] = "";
 
-      int ret = indexObjectMetadata(ioctx,
+      int ret = indexObjectMetadata(pool.get(),
                                     mPriv->dirInfo->inode(), entry, metadata,
                                     '-');
 
+      mPriv->dirInfo->expireLease();
+
 
       mPriv->radosFsPriv()->updateTMId(mPriv->fsStat());
 
@@ -1443,6 +1647,10 @@ Dir::find(const std::string args, std::set<std::string> &results)
     return -ENOLINK;
   }
 
+  MetricsTimer timer(mPriv->radosFsPriv()->metrics,
+                     MetricsRegistry::HISTOGRAM_DIR_FIND);
+  SlowOpScope slowOpScope(mPriv->radosFsPriv()->slowOps, "Dir::find", "",
+                          path());
   int ret = 0;
   std::set<std::string> dirs, files, entries;
   std::map<Finder::FindOptions, FinderArg> finderArgs;
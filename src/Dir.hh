@@ -23,6 +23,7 @@
 #include <cstdlib>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "Filesystem.hh"
 #include "Quota.hh"
@@ -58,6 +59,13 @@ public:
 
   int entryList(std::set<std::string> &entries, bool withAbsolutePath=false);
 
+  int entryListWithStats(std::map<std::string, struct stat> &entries);
+
+  int listFilesRecursively(std::vector<std::string> &files);
+
+  int list(const std::string &startAfter, size_t maxEntries,
+           DirListCallback callback, void *args = 0);
+
   void refresh(void);
 
   //lhh add
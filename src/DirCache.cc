@@ -17,25 +17,165 @@
  * for more details.
  */
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iostream>
 #include <sstream>
 
 #include "radosfscommon.h"
 #include "DirCache.hh"
+#include "Logger.hh"
+#include "Tracer.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
-DirCache::DirCache(const std::string &dirpath, PoolSP pool)
+DirCacheWatcher::DirCacheWatcher(librados::IoCtx ioctx,
+                                 const std::string &inode)
+  : mIoctx(ioctx),
+    mInode(inode),
+    mChanged(true),
+    mFailed(false)
+{}
+
+void
+DirCacheWatcher::handle_notify(uint64_t notifyId, uint64_t cookie,
+                               uint64_t notifierId, librados::bufferlist &bl)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mChanged = true;
+  }
+
+  librados::bufferlist reply;
+  mIoctx.notify_ack(mInode, notifyId, cookie, reply);
+}
+
+void
+DirCacheWatcher::handle_error(uint64_t cookie, int err)
+{
+  radosfs_debug("Lost the watch on dir %s: %s (retcode=%d)", mInode.c_str(),
+                strerror(abs(err)), err);
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mChanged = true;
+  mFailed = true;
+}
+
+bool
+DirCacheWatcher::changed(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mChanged;
+}
+
+bool
+DirCacheWatcher::failed(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mFailed;
+}
+
+void
+DirCacheWatcher::reset(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mChanged = false;
+}
+
+DirCache::DirCache(const std::string &dirpath, PoolSP pool,
+                   librados::Rados *cluster)
   : mInode(dirpath),
     mPool(pool),
     mLastCachedSize(0),
     mLastReadByte(0),
-    mLogNrLines(0)
+    mGeneration(0),
+    mContentsMutex("dir_cache_contents"),
+    mLogMutex("dir_cache_log"),
+    mLogNrLines(0),
+    mMemorySize(0),
+    mCluster(cluster),
+    mWatcher(0),
+    mWatchHandle(0)
 {}
 
 DirCache::~DirCache()
-{}
+{
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+  stopWatching();
+}
+
+void
+DirCache::stopWatching(void)
+{
+  if (!mWatcher)
+    return;
+
+  ioctx().unwatch2(mWatchHandle);
+
+  // Make sure no notification is being handled before deleting the watcher
+  mCluster->watch_flush();
+
+  delete mWatcher;
+  mWatcher = 0;
+  mWatchHandle = 0;
+}
+
+bool
+DirCache::hasValidLease(void)
+{
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+  if (!mWatcher || mWatcher->failed() || mWatcher->changed())
+    return false;
+
+  return boost::chrono::steady_clock::now() < mLeaseExpiration;
+}
+
+void
+DirCache::renewLease(float leaseTime)
+{
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+  // Without the cluster we cannot safely dispose of the watcher, so we do not
+  // watch the dir and its contents are always read
+  if (!mCluster)
+    return;
+
+  if (mWatcher && mWatcher->failed())
+    stopWatching();
+
+  if (!mWatcher)
+  {
+    mWatcher = new DirCacheWatcher(ioctx(), mInode);
+
+    int ret = mPool->ioctx.watch2(mInode, &mWatchHandle, mWatcher);
+
+    if (ret != 0)
+    {
+      radosfs_debug("Failed to watch dir %s: %s (retcode=%d)", mInode.c_str(),
+                    strerror(abs(ret)), ret);
+
+      delete mWatcher;
+      mWatcher = 0;
+      mWatchHandle = 0;
+
+      return;
+    }
+  }
+
+  // The watcher is reset before the contents are read, so any change that
+  // happens meanwhile will be noticed in the next update
+  mWatcher->reset();
+  mLeaseExpiration = boost::chrono::steady_clock::now() +
+                     boost::chrono::milliseconds((int64_t) (leaseTime * 1000));
+}
+
+void
+DirCache::expireLease(void)
+{
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+  mLeaseExpiration = boost::chrono::steady_clock::now();
+}
 
 int
 DirCache::getContentsSize(uint64_t *size) const
@@ -43,6 +183,43 @@ DirCache::getContentsSize(uint64_t *size) const
   return ioctx().stat(mInode, size, 0);
 }
 
+static void
+getLogLineEntry(const std::string &line, std::string &name, bool *removed)
+{
+  int startPos = 0, lastPos = 0;
+  std::string key, value;
+
+  while ((lastPos = splitToken(line, startPos, key, value)) != startPos)
+  {
+    if (key != "" && key.compare(1, std::string::npos, INDEX_NAME_KEY) == 0)
+    {
+      name = unescapeObjName(value);
+      *removed = key[0] == '-';
+
+      return;
+    }
+
+    startPos = lastPos;
+    key = value = "";
+  }
+}
+
+static size_t
+entryMemorySize(const DirEntry &entry)
+{
+  // The name is kept both in the contents' map and in the entry names' set
+  size_t size = DIR_CACHE_ENTRY_OVERHEAD + 2 * entry.name.length();
+
+  std::map<std::string, std::string>::const_iterator it;
+  for (it = entry.metadata.begin(); it != entry.metadata.end(); it++)
+  {
+    size += DIR_CACHE_ENTRY_OVERHEAD + (*it).first.length() +
+            (*it).second.length();
+  }
+
+  return size;
+}
+
 void
 DirCache::parseContents(char *buff, int length)
 {
@@ -91,12 +268,14 @@ DirCache::parseContents(char *buff, int length)
       key = value = "";
     }
 
-    boost::unique_lock<boost::mutex> lock(mContentsMutex);
+    boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
 
     mLogNrLines++;
 
     if (mContents.count(name.c_str()) > 0)
     {
+      mMemorySize -= entryMemorySize(mContents[name]);
+
       if (deleteEntry)
       {
         mContents.erase(name.c_str());
@@ -120,6 +299,8 @@ DirCache::parseContents(char *buff, int length)
           if (mContents[name].metadata.count(mdKey) > 0)
             mContents[name].metadata.erase(mdKey);
         }
+
+        mMemorySize += entryMemorySize(mContents[name]);
       }
     }
     else
@@ -128,52 +309,124 @@ DirCache::parseContents(char *buff, int length)
       entry.name = name;
       mContents[name] = entry;
       mEntryNames.insert(name);
+      mMemorySize += entryMemorySize(entry);
     }
   }
 }
 
 int
-DirCache::update()
+DirCache::update(float leaseTime)
 {
-  uint64_t size;
+  // If the dir is being watched and no changes were notified since the last
+  // time it was read, there is no need to read it until the lease expires
+  if (leaseTime > 0)
+  {
+    if (hasValidLease())
+      return 0;
 
-  int ret = getContentsSize(&size);
+    renewLease(leaseTime);
+  }
 
-  if (ret != 0)
-    return ret;
+  TraceSpan span("DirCache::update", "dir", "", mInode);
+  int ret;
 
-  // If the dir has been compacted, we have to read it from scratch
-  if (size < mLastCachedSize)
   {
-    clear();
+    boost::unique_lock<InstrumentedMutex> logLock(mLogMutex);
+    ret = readContents();
   }
 
-  uint64_t buffLength = size - mLastCachedSize;
+  if (ret != 0 && leaseTime > 0)
+    expireLease();
+
+  return ret;
+}
 
-  // If the contents' size is the same that was read before, then we do not read.
-  // This has to be changed to avoid the (not so common) case of compacting
-  // something and getting the same size that the contents had originally.
-  if (buffLength == 0)
+int
+DirCache::readContents()
+{
+  uint64_t readLength = DIR_LOG_READ_CHUNK_SIZE;
+
+  // The log's size, its generation (which changes every time it is compacted)
+  // and its contents from where it was last read are all obtained in the same
+  // operation, so usually updating the cache takes only one round trip. More
+  // are needed only if the log has grown more than what is read at once or if
+  // it has been compacted.
+  while (true)
   {
-    return 0;
-  }
+    int statRet, readRet;
+    uint64_t size;
+    std::set<std::string> keys;
+    std::map<std::string, librados::bufferlist> omap;
+    librados::bufferlist buff;
+    librados::ObjectReadOperation op;
 
-  librados::bufferlist buff;
+    keys.insert(DIR_LOG_GENERATION);
 
-  ret = ioctx().read(mInode, buff, buffLength, mLastReadByte);
+    op.stat(&size, 0, &statRet);
+    op.omap_get_vals_by_keys(keys, &omap, 0);
+    op.read(mLastReadByte, readLength, &buff, &readRet);
 
-  if (ret > 0)
-  {
-    mLastReadByte = ret;
-    parseContents(buff.c_str(), buffLength);
-  }
-  else
-  {
-    clear();
-    return ret;
+    int ret = ioctx().operate(mInode, &op, 0);
+
+    if (ret != 0)
+      return ret;
+
+    if (statRet != 0)
+      return statRet;
+
+    if (readRet < 0)
+    {
+      clear();
+      return readRet;
+    }
+
+    uint64_t generation = 0;
+
+    if (omap.count(DIR_LOG_GENERATION) > 0)
+    {
+      librados::bufferlist &generationBl = omap[DIR_LOG_GENERATION];
+      generation = strtoull(std::string(generationBl.c_str(),
+                                        generationBl.length()).c_str(), 0, 10);
+    }
+
+    // If the dir has been compacted, we have to read it from scratch
+    if (mLastReadByte > 0 && (generation != mGeneration || size < mLastReadByte))
+    {
+      clear();
+      mGeneration = generation;
+      continue;
+    }
+
+    mGeneration = generation;
+
+    const uint64_t length = buff.length();
+    uint64_t parseLength = length;
+
+    if (mLastReadByte + length < size)
+    {
+      // There is more to read, so only complete lines are parsed now
+      const std::string contents(buff.c_str(), length);
+      const size_t lastLineEnd = contents.rfind('\n');
+
+      if (lastLineEnd == std::string::npos)
+      {
+        readLength *= 2;
+        continue;
+      }
+
+      parseLength = lastLineEnd + 1;
+    }
+
+    if (parseLength > 0)
+      parseContents(buff.c_str(), parseLength);
+
+    mLastReadByte += parseLength;
+
+    if (mLastReadByte >= size)
+      break;
   }
 
-  mLastCachedSize = mLastReadByte = size;
+  mLastCachedSize = mLastReadByte;
 
   return 0;
 }
@@ -182,7 +435,7 @@ const std::string
 DirCache::getEntry(int index)
 {
   std::string entry("");
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
 
   const int size = (int) mEntryNames.size();
 
@@ -197,10 +450,19 @@ DirCache::getEntry(int index)
   return entry;
 }
 
-void
+int
 DirCache::compactDirOpLog(void)
 {
-  update();
+  // Compaction may be triggered by the user and by the background compactor
+  // at the same time as the dir is refreshed, so the log lock is held for the
+  // whole compaction: only one of them rewrites the log and the read state
+  // cannot be advanced while the cached contents are being written
+  boost::unique_lock<InstrumentedMutex> logLock(mLogMutex);
+
+  int ret = readContents();
+
+  if (ret != 0)
+    return ret;
 
   librados::ObjectWriteOperation omapWriteOp, writeOp;
   std::map<std::string, librados::bufferlist> omap;
@@ -211,22 +473,29 @@ DirCache::compactDirOpLog(void)
 
   ioctx().operate(mInode, &omapWriteOp);
 
-  std::map<std::string, DirEntry>::iterator it;
   std::string compactContents;
+  size_t numEntries;
 
-  for (it = mContents.begin(); it != mContents.end(); it++)
   {
-    const DirEntry &entry = (*it).second;
-    compactContents += '+';
-    compactContents += INDEX_NAME_KEY "=\"" + escapeObjName(entry.name) + "\" ";
+    boost::unique_lock<InstrumentedMutex> contentsLock(mContentsMutex);
+    std::map<std::string, DirEntry>::iterator it;
 
-    std::map<std::string, std::string>::const_iterator mdIt;
-    for (mdIt = entry.metadata.begin(); mdIt != entry.metadata.end(); mdIt++)
+    for (it = mContents.begin(); it != mContents.end(); it++)
     {
-      compactContents += "+" + (*mdIt).first + "=\"" + (*mdIt).second + "\" ";
+      const DirEntry &entry = (*it).second;
+      compactContents += '+';
+      compactContents += INDEX_NAME_KEY "=\"" + escapeObjName(entry.name) + "\" ";
+
+      std::map<std::string, std::string>::const_iterator mdIt;
+      for (mdIt = entry.metadata.begin(); mdIt != entry.metadata.end(); mdIt++)
+      {
+        compactContents += "+" + (*mdIt).first + "=\"" + (*mdIt).second + "\" ";
+      }
+
+      compactContents += "\n";
     }
 
-    compactContents += "\n";
+    numEntries = mContents.size();
   }
 
   writeOp.truncate(0);
@@ -238,23 +507,443 @@ DirCache::compactDirOpLog(void)
     writeOp.write_full(buff);
   }
 
+  // Since the entries are written sorted by name, keeping the size of the
+  // compacted contents allows listing them without reading the whole log
+  std::map<std::string, librados::bufferlist> compactedOmap;
+  std::stringstream compactedSize;
+  compactedSize << compactContents.length();
+  compactedOmap[DIR_LOG_COMPACTED_SIZE].append(compactedSize.str());
+
+  // Bump the log's generation so other clients know that it has been
+  // rewritten (even if it has the same size as before)
+  std::stringstream generation;
+  generation << mGeneration + 1;
+  compactedOmap[DIR_LOG_GENERATION].append(generation.str());
+
+  writeOp.omap_set(compactedOmap);
+
   int cmpRet;
   std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
   librados::bufferlist cmpValue;
   cmpValue.append(DIR_LOG_UPDATED_FALSE);
   std::pair<librados::bufferlist, int> cmp(cmpValue, LIBRADOS_CMPXATTR_OP_EQ);
   omapCmp[DIR_LOG_UPDATED] = cmp;
+
+  // The generation needs to be the one we read, otherwise someone else
+  // compacted the log in the meanwhile (a missing key is compared as empty)
+  librados::bufferlist generationCmpValue;
+
+  if (mGeneration > 0)
+  {
+    std::stringstream currentGeneration;
+    currentGeneration << mGeneration;
+    generationCmpValue.append(currentGeneration.str());
+  }
+
+  omapCmp[DIR_LOG_GENERATION] =
+      std::pair<librados::bufferlist, int>(generationCmpValue,
+                                           LIBRADOS_CMPXATTR_OP_EQ);
   writeOp.omap_cmp(omapCmp, &cmpRet);
 
-  ioctx().operate(mInode, &writeOp);
+  ret = ioctx().operate(mInode, &writeOp);
+
+  // If the log has been changed meanwhile (-ECANCELED), it has not been
+  // rewritten so the cached state is still valid
+  if (ret != 0)
+    return ret;
+
+  {
+    boost::unique_lock<InstrumentedMutex> contentsLock(mContentsMutex);
+
+    mGeneration++;
+    mLastCachedSize = mLastReadByte = compactContents.length();
+    mLogNrLines = numEntries;
+  }
+
+  notifyDirLogChanged(mPool.get(), mInode);
+
+  return 0;
+}
+
+int
+DirCache::readLog(uint64_t offset, uint64_t length, uint64_t generation,
+                  librados::bufferlist &buff)
+{
+  // The read is only done if the log still has the given generation, i.e.
+  // it has not been rewritten by a compaction since we started reading it
+  // (a missing key is compared as empty)
+  librados::ObjectReadOperation op;
+  std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+  librados::bufferlist generationCmpValue;
+  int cmpRet, readRet;
+
+  if (generation > 0)
+  {
+    std::stringstream generationStr;
+    generationStr << generation;
+    generationCmpValue.append(generationStr.str());
+  }
+
+  omapCmp[DIR_LOG_GENERATION] =
+      std::pair<librados::bufferlist, int>(generationCmpValue,
+                                           LIBRADOS_CMPXATTR_OP_EQ);
+  op.omap_cmp(omapCmp, &cmpRet);
+  op.read(offset, length, &buff, &readRet);
+
+  int ret = ioctx().operate(mInode, &op, 0);
+
+  if (ret < 0)
+    return ret;
+
+  if (readRet < 0)
+    return readRet;
+
+  return buff.length();
+}
+
+int
+DirCache::readLogLines(uint64_t offset, uint64_t end, uint64_t generation,
+                       std::vector<std::string> &lines, uint64_t *nextOffset)
+{
+  uint64_t length = DIR_LOG_READ_CHUNK_SIZE;
+
+  lines.clear();
+
+  while (true)
+  {
+    if (offset + length > end)
+      length = end - offset;
+
+    librados::bufferlist buff;
+    int ret = readLog(offset, length, generation, buff);
+
+    if (ret < 0)
+      return ret;
+
+    // The log got shorter while we read it, meaning it has been compacted
+    if ((uint64_t) ret < length)
+      return -ECANCELED;
+
+    const std::string contents(buff.c_str(), length);
+    size_t contentsEnd = contents.rfind('\n');
+
+    if (contentsEnd == std::string::npos)
+    {
+      // The chunk does not hold a complete line so we read a bigger one,
+      // unless there is nothing else to read
+      if (offset + length < end)
+      {
+        length *= 2;
+        continue;
+      }
+
+      contentsEnd = length;
+    }
+
+    std::istringstream iss(contents.substr(0, contentsEnd));
+
+    for (std::string line; getline(iss, line, '\n');)
+    {
+      if (line != "")
+        lines.push_back(line);
+    }
+
+    *nextOffset = offset + std::min((uint64_t) contentsEnd + 1, length);
+
+    return 0;
+  }
+}
+
+int
+DirCache::findCompactedLogOffset(const std::string &startAfter,
+                                 uint64_t compactedSize, uint64_t generation,
+                                 uint64_t *offset)
+{
+  uint64_t low = 0, high = compactedSize;
+
+  // The compacted part of the log has its entries sorted by name, so we do
+  // a binary search by reading small portions of it; the offset found is
+  // always the beginning of a line that is not after the first entry whose
+  // name is greater than startAfter
+  while (high - low > DIR_LOG_READ_CHUNK_SIZE)
+  {
+    const uint64_t middle = low + (high - low) / 2;
+    librados::bufferlist buff;
+
+    int ret = readLog(middle, DIR_LOG_PROBE_SIZE, generation, buff);
+
+    if (ret < 0)
+      return ret;
+
+    const std::string contents(buff.c_str(), ret);
+    size_t lineStart = contents.find('\n');
+
+    if (lineStart == std::string::npos)
+      break;
+
+    lineStart++;
+
+    size_t lineEnd = contents.find('\n', lineStart);
+
+    if (lineEnd == std::string::npos)
+      break;
+
+    std::string name;
+    bool removed = false;
+    getLogLineEntry(contents.substr(lineStart, lineEnd - lineStart), name,
+                    &removed);
+
+    if (name <= startAfter)
+      low = middle + lineEnd + 1;
+    else
+      high = middle + lineStart;
+  }
+
+  *offset = low;
+
+  return 0;
+}
+
+bool
+DirCache::deliverEntry(const std::string &entry, size_t maxEntries,
+                       DirListCallback callback, void *args,
+                       std::string *lastListed, size_t *numListed)
+{
+  // Returns whether the listing is done
+  *lastListed = entry;
+
+  return callback(entry, args) != 0 ||
+         (maxEntries > 0 && ++(*numListed) == maxEntries);
+}
+
+int
+DirCache::listCachedEntries(const std::string &startAfter, size_t maxEntries,
+                            DirListCallback callback, void *args,
+                            std::string *lastListed, size_t *numListed)
+{
+  std::vector<std::string> entries;
+  const size_t numToList = maxEntries > 0 ? maxEntries - *numListed : 0;
+
+  {
+    boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
+
+    std::set<std::string>::const_iterator it;
+    for (it = mEntryNames.upper_bound(startAfter);
+         it != mEntryNames.end() &&
+         (numToList == 0 || entries.size() < numToList);
+         it++)
+    {
+      entries.push_back(*it);
+    }
+  }
+
+  std::vector<std::string>::const_iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+  {
+    if (deliverEntry(*it, maxEntries, callback, args, lastListed, numListed))
+      break;
+  }
+
+  return 0;
+}
+
+int
+DirCache::listEntries(const std::string &startAfter, size_t maxEntries,
+                      DirListCallback callback, void *args)
+{
+  std::string lastListed(startAfter);
+  size_t numListed = 0;
+
+  // If the log is compacted while it is being listed, the listing is resumed
+  // from a fresh read of the log after the last entry that was delivered
+  while (true)
+  {
+    int ret = listLogEntries(maxEntries, callback, args, &lastListed,
+                             &numListed);
+
+    if (ret != -ECANCELED)
+      return ret;
+
+    radosfs_debug("The log of %s was compacted while being listed. Resuming "
+                  "the listing after '%s'.", mInode.c_str(),
+                  lastListed.c_str());
+  }
+}
 
+int
+DirCache::listLogEntries(size_t maxEntries, DirListCallback callback,
+                         void *args, std::string *lastListed,
+                         size_t *numListed)
+{
+  const std::string startAfter(*lastListed);
+  int ret, statRet;
   uint64_t size;
+  librados::ObjectReadOperation op;
+  std::set<std::string> keys;
+  std::map<std::string, librados::bufferlist> omap;
+
+  keys.insert(DIR_LOG_COMPACTED_SIZE);
+  keys.insert(DIR_LOG_GENERATION);
+
+  op.stat(&size, 0, &statRet);
+  op.omap_get_vals_by_keys(keys, &omap, 0);
+
+  ret = ioctx().operate(mInode, &op, 0);
+
+  if (ret != 0)
+    return ret;
+
+  if (statRet != 0)
+    return statRet;
+
+  uint64_t generation = 0;
+
+  if (omap.count(DIR_LOG_GENERATION) > 0)
+  {
+    librados::bufferlist &generationBl = omap[DIR_LOG_GENERATION];
+    generation = strtoull(std::string(generationBl.c_str(),
+                                      generationBl.length()).c_str(), 0, 10);
+  }
+
+  bool cached;
+
+  {
+    boost::unique_lock<InstrumentedMutex> logLock(mLogMutex);
+    cached = size > 0 && size == mLastCachedSize && generation == mGeneration;
+  }
+
+  // If the whole log is already cached, there is no need to read it (the log
+  // may have been compacted and grown back to the same size meanwhile, in
+  // which case its generation is different)
+  if (cached)
+    return listCachedEntries(startAfter, maxEntries, callback, args,
+                             lastListed, numListed);
+
+  uint64_t compactedSize = 0;
+
+  if (omap.count(DIR_LOG_COMPACTED_SIZE) > 0)
+  {
+    librados::bufferlist &buff = omap[DIR_LOG_COMPACTED_SIZE];
+    compactedSize = strtoull(std::string(buff.c_str(), buff.length()).c_str(),
+                             0, 10);
+  }
+
+  if (compactedSize > size)
+    compactedSize = 0;
+
+  // If the log has not been compacted, all of its entries are in its unsorted
+  // tail, so they are only known once the whole log is read; in that case it
+  // is read into the cache (from where it was last read) and listed from there
+  // instead of being read into a temporary copy
+  if (compactedSize == 0)
+  {
+    {
+      boost::unique_lock<InstrumentedMutex> logLock(mLogMutex);
+      ret = readContents();
+    }
+
+    if (ret != 0)
+      return ret;
+
+    return listCachedEntries(startAfter, maxEntries, callback, args,
+                             lastListed, numListed);
+  }
+
+  // Entries that have been added or removed after the last compaction (the
+  // last operation for each entry is the one that counts)
+  std::map<std::string, bool> tailEntries;
+  std::vector<std::string> lines;
+  std::vector<std::string>::const_iterator lineIt;
+  uint64_t offset = compactedSize;
 
-  getContentsSize(&size);
+  while (offset < size)
+  {
+    ret = readLogLines(offset, size, generation, lines, &offset);
+
+    if (ret != 0)
+      return ret;
+
+    for (lineIt = lines.begin(); lineIt != lines.end(); lineIt++)
+    {
+      std::string name;
+      bool removed = false;
+      getLogLineEntry(*lineIt, name, &removed);
+
+      if (name != "")
+        tailEntries[name] = !removed;
+    }
+  }
+
+  std::set<std::string> addedEntries;
+  std::map<std::string, bool>::const_iterator tailIt;
+
+  for (tailIt = tailEntries.upper_bound(startAfter);
+       tailIt != tailEntries.end(); tailIt++)
+  {
+    if ((*tailIt).second)
+      addedEntries.insert((*tailIt).first);
+  }
+
+  offset = 0;
+
+  if (startAfter != "")
+  {
+    ret = findCompactedLogOffset(startAfter, compactedSize, generation,
+                                 &offset);
+
+    if (ret != 0)
+      return ret;
+  }
+
+  bool done = false;
 
-  mLastCachedSize = mLastReadByte = size;
+  // Merge the sorted compacted entries with the ones from the tail of the log,
+  // delivering them as they are read
+  while (offset < compactedSize && !done)
+  {
+    ret = readLogLines(offset, compactedSize, generation, lines, &offset);
 
-  mLogNrLines = mContents.size();
+    if (ret != 0)
+      return ret;
+
+    for (lineIt = lines.begin(); lineIt != lines.end() && !done; lineIt++)
+    {
+      std::string name;
+      bool removed = false;
+      getLogLineEntry(*lineIt, name, &removed);
+
+      if (name == "" || name <= startAfter)
+        continue;
+
+      while (!done && !addedEntries.empty() && *addedEntries.begin() < name)
+      {
+        done = deliverEntry(*addedEntries.begin(), maxEntries, callback, args,
+                            lastListed, numListed);
+        addedEntries.erase(addedEntries.begin());
+      }
+
+      if (done)
+        break;
+
+      addedEntries.erase(name);
+      tailIt = tailEntries.find(name);
+
+      if (tailIt != tailEntries.end() && !(*tailIt).second)
+        continue;
+
+      done = deliverEntry(name, maxEntries, callback, args, lastListed,
+                          numListed);
+    }
+  }
+
+  std::set<std::string>::const_iterator it;
+  for (it = addedEntries.begin(); it != addedEntries.end() && !done; it++)
+  {
+    done = deliverEntry(*it, maxEntries, callback, args, lastListed,
+                        numListed);
+  }
+
+  return 0;
 }
 
 float
@@ -270,7 +959,7 @@ bool
 DirCache::hasEntry(const std::string &entry)
 {
   bool entryExists(false);
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
 
   entryExists = mContents.count(entry) > 0;
 
@@ -283,7 +972,7 @@ DirCache::getMetadata(const std::string &entry,
                       std::string &value)
 {
   int ret = -ENOENT;
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
 
   if (mContents.count(entry) > 0)
   {
@@ -304,7 +993,7 @@ DirCache::getMetadataMap(const std::string &entry,
                          std::map<std::string, std::string> &mtdMap)
 {
   int ret = -ENOENT;
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
   std::map<std::string, DirEntry>::iterator it = mContents.find(entry);
 
   if (it != mContents.end())
@@ -319,13 +1008,23 @@ DirCache::getMetadataMap(const std::string &entry,
 void
 DirCache::clear(void)
 {
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
 
   mEntryNames.clear();
   mContents.clear();
   mLastCachedSize = 0;
   mLastReadByte = 0;
+  mGeneration = 0;
   mLogNrLines = 0;
+  mMemorySize = 0;
+}
+
+size_t
+DirCache::memorySize(void)
+{
+  boost::unique_lock<InstrumentedMutex> lock(mContentsMutex);
+
+  return sizeof(DirCache) + mInode.length() + mMemorySize;
 }
 
 RADOS_FS_END_NAMESPACE
@@ -24,10 +24,13 @@
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 #include <rados/librados.hpp>
 
 #include "radosfscommon.h"
 #include "radosfsdefines.h"
+#include "Filesystem.hh"
+#include "InstrumentedMutex.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -37,19 +40,46 @@ typedef struct
   std::map<std::string, std::string> metadata;
 } DirEntry;
 
+class DirCacheWatcher : public librados::WatchCtx2
+{
+public:
+  DirCacheWatcher(librados::IoCtx ioctx, const std::string &inode);
+
+  void handle_notify(uint64_t notifyId, uint64_t cookie, uint64_t notifierId,
+                     librados::bufferlist &bl);
+
+  void handle_error(uint64_t cookie, int err);
+
+  bool changed(void);
+
+  bool failed(void);
+
+  void reset(void);
+
+private:
+  librados::IoCtx mIoctx;
+  std::string mInode;
+  bool mChanged;
+  bool mFailed;
+  boost::mutex mMutex;
+};
+
 class DirCache
 {
 public:
-  DirCache(const std::string &inode, PoolSP pool);
+  DirCache(const std::string &inode, PoolSP pool,
+           librados::Rados *cluster = 0);
   virtual ~DirCache(void);
 
-  int update(void);
+  int update(float leaseTime = 0);
   const std::string getEntry(int index);
   librados::IoCtx ioctx(void) const { return mPool->ioctx; }
+  PoolSP pool(void) const { return mPool; }
   std::set<std::string> contents(void) const { return mEntryNames; }
   std::string inode(void) const { return mInode; }
-  void compactDirOpLog(void);
+  int compactDirOpLog(void);
   float logRatio(void) const;
+  uint64_t lastCachedSize(void) const { return mLastCachedSize; }
   bool hasEntry(const std::string &entry);
   int getMetadata(const std::string &entry,
                   const std::string &key,
@@ -57,9 +87,32 @@ public:
   int getMetadataMap(const std::string &entry,
                      std::map<std::string, std::string> &mtdMap);
   int getContentsSize(uint64_t *size) const;
+  int listEntries(const std::string &startAfter, size_t maxEntries,
+                  DirListCallback callback, void *args);
+  size_t memorySize(void);
+  void expireLease(void);
 
 private:
+  int readContents(void);
+  bool hasValidLease(void);
+  void renewLease(float leaseTime);
+  void stopWatching(void);
   void parseContents(char *buff, int length);
+  int readLog(uint64_t offset, uint64_t length, uint64_t generation,
+              librados::bufferlist &buff);
+  int readLogLines(uint64_t offset, uint64_t end, uint64_t generation,
+                   std::vector<std::string> &lines, uint64_t *nextOffset);
+  int findCompactedLogOffset(const std::string &startAfter,
+                             uint64_t compactedSize, uint64_t generation,
+                             uint64_t *offset);
+  bool deliverEntry(const std::string &entry, size_t maxEntries,
+                    DirListCallback callback, void *args,
+                    std::string *lastListed, size_t *numListed);
+  int listCachedEntries(const std::string &startAfter, size_t maxEntries,
+                        DirListCallback callback, void *args,
+                        std::string *lastListed, size_t *numListed);
+  int listLogEntries(size_t maxEntries, DirListCallback callback, void *args,
+                     std::string *lastListed, size_t *numListed);
   void clear(void);
 
   std::string mInode;
@@ -67,9 +120,17 @@ private:
   std::map<std::string, DirEntry> mContents;
   std::set<std::string> mEntryNames;
   uint64_t mLastCachedSize;
-  int mLastReadByte;
-  boost::mutex mContentsMutex;
+  uint64_t mLastReadByte;
+  uint64_t mGeneration;
+  InstrumentedMutex mContentsMutex;
+  InstrumentedMutex mLogMutex;
   size_t mLogNrLines;
+  size_t mMemorySize;
+  librados::Rados *mCluster;
+  DirCacheWatcher *mWatcher;
+  uint64_t mWatchHandle;
+  boost::chrono::steady_clock::time_point mLeaseExpiration;
+  boost::mutex mWatchMutex;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -35,7 +35,8 @@ FilePriv::FilePriv(File *fsFile, File::OpenMode mode)
     target(0),
     permissions(File::MODE_NONE),
     mode(mode),
-    inlineBufferSize(DEFAULT_FILE_INLINE_BUFFER_SIZE)
+    inlineBufferSize(DEFAULT_FILE_INLINE_BUFFER_SIZE),
+    wroteData(false)
 {
   FileInodePriv *mPriv = new FileInodePriv(fsFile->filesystem(), FileIOSP());
   inode = new FileInode(mPriv);
@@ -49,6 +50,15 @@ FilePriv::~FilePriv()
     delete target;
 
   delete inode;
+
+  // The file may now belong to a different data pool tier; moving it can take
+  // long so it is done in the background (once this instance stopped using it)
+  FilesystemPriv *radosFsPriv = fsFile->filesystem()->mPriv;
+
+  if (wroteData && radosFsPriv->hasDataPoolTiers())
+    radosFsPriv->post(boost::bind(&FilesystemPriv::moveFileToTier, radosFsPriv,
+                                  fsFile->path()),
+                      Filesystem::WORK_PRIORITY_BACKGROUND);
 }
 
 void
@@ -57,6 +67,15 @@ FilePriv::updateDataPool(const std::string &pool)
   dataPool = fsFile->filesystem()->mPriv->getDataPool(fsFile->path(), pool);
 }
 
+void
+FilePriv::placeDataPool()
+{
+  PoolSP pool = fsFile->filesystem()->mPriv->placeDataPool(fsFile->path());
+
+  if (pool)
+    dataPool = pool;
+}
+
 void
 FilePriv::updatePath()
 {
@@ -73,7 +92,7 @@ FilePriv::updatePath()
 
   updatePermissions();
 
-  inode->mPriv->io.reset();
+  inode->mPriv->setFileIO(FileIOSP());
 
   if (!fsFile->exists())
   {
@@ -116,7 +135,15 @@ FilePriv::updatePath()
   else if (stat && stat->translatedPath != "")
   {
     inode->mPriv->setFileIO(radosFs->mPriv->getOrCreateFileIO(stat->translatedPath,
-                                                              stat));
+                                                              stat),
+                            false);
+
+    // The file may have been moved to another data pool since it was stat'ed
+    if (inode->mPriv->io->pool() != dataPool)
+    {
+      dataPool = inode->mPriv->io->pool();
+      stat->pool = dataPool;
+    }
     if (inlineBufferSize > 0)
     {
       const Stat *parentStat = parentFsStat();
@@ -294,6 +321,10 @@ FilePriv::rename(const std::string &destination)
 
   ret = moveLogicalFile(*oldParentStat, parentStat, fsFile->path(), newPath);
 
+  getFsPriv()->clearMissingEntries(parentStat.translatedPath);
+  getFsPriv()->expireDirCacheLease(parentStat.translatedPath);
+  getFsPriv()->expireDirCacheLease(oldParentStat->translatedPath);
+
   if (ret != 0)
     return ret;
 
@@ -515,7 +546,9 @@ File::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
  *        operation is finished
  * @param callbackArg a pointer to the user arguments that will be passed to the
  *        \a callback .
- * @return 0 if the operation was initialized, an error code otherwise.
+ * @return 0 if the operation was initialized, -EAGAIN if it was refused
+ *         because too many writes are in flight (see
+ *         Filesystem::setWriteThrottleMode), an error code otherwise.
  */
 int
 File::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
@@ -535,6 +568,9 @@ File::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
     ret = mPriv->inode->write(buff, offset, blen, copyBuffer, asyncOpId,
                                callback, callbackArg);
 
+    if (ret == 0)
+      mPriv->wroteData = true;
+
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
     return ret;
@@ -565,6 +601,9 @@ File::writeSync(const char *buff, off_t offset, size_t blen)
 
     ret = mPriv->inode->writeSync(buff, offset, blen);
 
+    if (ret == 0)
+      mPriv->wroteData = true;
+
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
     return ret;
@@ -610,6 +649,8 @@ File::create(int mode, const std::string pool, size_t chunk,
 
   if (pool != "")
     mPriv->updateDataPool(pool);
+  else if (!exists())
+    mPriv->placeDataPool();
 
   // we don't allow object names that end in a path separator
   const std::string filePath = path();
@@ -692,6 +733,9 @@ File::remove()
     Stat *parentStat = reinterpret_cast<Stat *>(parentFsStat());
     indexObject(parentStat, stat, '-');
 
+    mPriv->getFsPriv()->expireDirCacheLease(parentStat->translatedPath);
+    mPriv->getFsPriv()->removeMovedInodes(*stat);
+
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
   }
   else
@@ -732,6 +776,9 @@ File::truncate(unsigned long long size)
 
   ret = mPriv->inode->truncate(size);
 
+  if (ret == 0)
+    mPriv->wroteData = true;
+
   mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
   return ret;
@@ -825,33 +872,10 @@ File::stat(struct stat *buff)
     getTimeFromXAttr(stat, XATTR_MTIME, &stat->statBuff.st_mtim,
                      &stat->statBuff.st_mtime);
   }
-  else
+  else if (!verifyFileSizeHint(stat))
   {
-    // If there is an inline buffer and it is not fully filled, then it already
-    // gives us the size of the object, otherwise, we need to check the size set
-    // in the inode
-
-    std::string inlineContents;
-    FileInlineBuffer *inlineBuffer = mPriv->getFileIO()->inlineBuffer();
-
-    if (inlineBuffer)
-    {
-      inlineBuffer->read(&stat->statBuff.st_mtim, &inlineContents);
-
-      stat->statBuff.st_mtime = stat->statBuff.st_mtim.tv_sec;
-      stat->statBuff.st_size = inlineContents.length();
-    }
-
-    if (!inlineBuffer || inlineContents.length() == inlineBuffer->capacity())
-    {
-      size_t fileIOSize = mPriv->getFileIO()->getSize();
-
-      if (fileIOSize != 0)
-        stat->statBuff.st_size = fileIOSize;
-
-      getTimeFromXAttr(stat, XATTR_MTIME, &stat->statBuff.st_mtim,
-                       &stat->statBuff.st_mtime);
-    }
+    mPriv->getFsPriv()->statFileData(stat, mPriv->parentFsStat(),
+                                     mPriv->getFileIO());
   }
 
   *buff = stat->statBuff;
@@ -20,6 +20,8 @@
 #include <boost/bind.hpp>
 #include <cassert>
 #include <climits>
+#include <cstdarg>
+#include <deque>
 #include <cstdio>
 #include <errno.h>
 #include <rados/librados.hpp>
@@ -29,6 +31,7 @@
 #include "FileIO.hh"
 #include "Logger.hh"
 #include "FilesystemPriv.hh"
+#include "Tracer.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -42,6 +45,15 @@ expiredLockDuration()
       boost::chrono::seconds(FILE_LOCK_DURATION + 1);
 }
 
+inline static
+boost::chrono::system_clock::time_point
+idleLockTime()
+{
+  return boost::chrono::system_clock::now() +
+      boost::chrono::duration_cast<boost::chrono::system_clock::duration>(
+        boost::chrono::duration<double>(FILE_IDLE_LOCK_TIMEOUT));
+}
+
 FileReadDataImp::FileReadDataImp(char *buff, off_t offset, size_t length,
                                  ssize_t *retValue)
   : FileReadData(buff, offset, length, retValue),
@@ -91,9 +103,12 @@ FileIO::FileIO(Filesystem *radosFs, const PoolSP pool, const std::string &iNode,
     mPath(""),
     mChunkSize(chunkSize),
     mLazyRemoval(false),
+    mLockMutex("file_io_lock"),
     mLocker(""),
     mInlineBuffer(0),
-    mHasBackLink(false)
+    mHasBackLink(false),
+    mSizeHintOutdated(false),
+    mNumClients(0)
 {
   assert(mChunkSize != 0);
 }
@@ -108,11 +123,14 @@ FileIO::FileIO(Filesystem *radosFs, const PoolSP pool, const std::string &iNode,
     mLazyRemoval(false),
     mLockStart(expiredLockDuration()),
     mLockUpdated(mLockStart),
+    mLockMutex("file_io_lock"),
     mLocker(""),
     mInlineBuffer(0),
     // If the path is not set, then we assume the backlink has been set in order
     // to avoid trying to do it when needed
-    mHasBackLink(mPath.empty())
+    mHasBackLink(mPath.empty()),
+    mSizeHintOutdated(false),
+    mNumClients(0)
 {
   assert(mChunkSize != 0);
 }
@@ -128,7 +146,9 @@ FileIO::~FileIO()
     return;
   }
 
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  updateSizeHint();
+
+  boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
   unlockIfTimeIsOut(FILE_IDLE_LOCK_TIMEOUT);
 }
 
@@ -378,6 +398,8 @@ FileIO::vectorReadChunk(size_t fileChunk,
                         AsyncOpSP asyncOp,
                         boost::shared_ptr<ssize_t> inodeSize)
 {
+  TraceSpan span("FileIO::readChunk", "file", asyncOp->id(), mInode,
+                 fileChunk);
   ReadChunkOpArgs *readOp = new ReadChunkOpArgs;
   readOp->fileChunk = fileChunk;
   readOp->readOpMutex = readOpMutex;
@@ -404,6 +426,8 @@ FileIO::vectorReadChunk(size_t fileChunk,
   completion->set_complete_callback(readOp, FileIO::onReadCompleted);
   asyncOp->mPriv->addCompletion(completion);
   mPool->ioctx.aio_operate(chunkName, completion, &op, 0);
+
+  mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_RADOS_CHUNK_READS);
 }
 
 int
@@ -428,6 +452,19 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
   if (asyncOpId)
     asyncOpId->assign(asyncOp->id());
 
+  TraceSpan span("FileIO::read", "file", asyncOp->id(), mInode);
+
+  // Synchronous reads are already tracked by their caller
+  if (!SlowOpTracker::current())
+    mRadosFs->mPriv->slowOps.startAsync("FileIO::read", asyncOp, mInode);
+
+  uint64_t readBytes = 0;
+  for (size_t i = 0; i < intervals.size(); i++)
+    readBytes += intervals[i].length;
+
+  mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_FILE_READ_BYTES,
+                               readBytes);
+
   std::vector<FileReadDataImpSP> inlineReadData, inodeReadData;
   getInlineAndInodeReadData(intervals, &inlineReadData, &inodeReadData);
   boost::shared_ptr<boost::shared_mutex> readOpMutex(new boost::shared_mutex);
@@ -464,6 +501,12 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
 ssize_t
 FileIO::read(char *buff, off_t offset, size_t blen)
 {
+  MetricsTimer timer(mRadosFs->mPriv->metrics,
+                     MetricsRegistry::HISTOGRAM_FILE_READ);
+  TraceSpan span("FileIO::readSync", "file", "", mInode);
+  SlowOpScope slowOpScope(mRadosFs->mPriv->slowOps, "FileIO::readSync", "",
+                          mInode);
+
   mOpManager.sync();
 
   if (blen == 0)
@@ -502,14 +545,22 @@ FileIO::read(char *buff, off_t offset, size_t blen)
 int
 FileIO::writeSync(const char *buff, off_t offset, size_t blen)
 {
+  MetricsTimer timer(mRadosFs->mPriv->metrics,
+                     MetricsRegistry::HISTOGRAM_FILE_WRITE_SYNC);
   int ret;
 
   AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
   mOpManager.addOperation(asyncOp);
 
+  TraceSpan span("FileIO::writeSync", "file", asyncOp->id(), mInode);
+  SlowOpScope slowOpScope(mRadosFs->mPriv->slowOps, "FileIO::writeSync",
+                          asyncOp->id(), mInode);
+
   if ((ret = verifyWriteParams(offset, blen)) != 0)
     return ret;
 
+  mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_FILE_WRITE_BYTES, blen);
+
   return realWrite(const_cast<char *>(buff), offset, blen, false, asyncOp);
 }
 
@@ -518,11 +569,33 @@ FileIO::write(const char *buff, off_t offset, size_t blen, std::string *opId,
               bool copyBuffer, AsyncOpCallback callback, void *arg)
 {
   int ret = 0;
+  MetricsRegistry &metrics = mRadosFs->mPriv->metrics;
 
   if ((ret = verifyWriteParams(offset, blen)) != 0)
     return ret;
 
   AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+  const boost::chrono::steady_clock::time_point startTime =
+      boost::chrono::steady_clock::now();
+
+  // The write is tracked as queued until a worker runs it
+  SlowOpSP slowOp = mRadosFs->mPriv->slowOps.start("FileIO::write",
+                                                   asyncOp->id(), mInode,
+                                                   SlowOp::STAGE_QUEUED);
+
+  // Hold the write back (or refuse it) if too much data is being written
+  ret = mRadosFs->mPriv->writeThrottle.acquire(blen);
+  metrics.record(MetricsRegistry::HISTOGRAM_WRITE_THROTTLE_WAIT, startTime);
+
+  if (ret != 0)
+  {
+    radosfs_debug("Throttled write of %lu bytes to inode '%s'", blen,
+                  inode().c_str());
+    mRadosFs->mPriv->slowOps.finish(slowOp);
+    return ret;
+  }
+
+  metrics.add(MetricsRegistry::COUNTER_FILE_WRITE_BYTES, blen);
 
   if (callback)
     asyncOp->setCallback(callback, arg);
@@ -540,12 +613,44 @@ FileIO::write(const char *buff, off_t offset, size_t blen, std::string *opId,
     memcpy(bufferToWrite, buff, blen);
   }
 
-  mRadosFs->mPriv->getIoService()->post(boost::bind(&FileIO::realWrite, this,
-                                                    bufferToWrite, offset, blen,
-                                                    copyBuffer, asyncOp));
+  mRadosFs->mPriv->post(boost::bind(&FileIO::throttledWrite, this,
+                                    bufferToWrite, offset, blen, copyBuffer,
+                                    asyncOp, slowOp, startTime),
+                        Filesystem::WORK_PRIORITY_DATA);
   return 0;
 }
 
+void
+FileIO::throttledWrite(char *buff, off_t offset, size_t blen,
+                       bool deleteBuffer, AsyncOpSP asyncOp,
+                       SlowOpSP slowOp,
+                       boost::chrono::steady_clock::time_point startTime)
+{
+  SlowOpScope slowOpScope(mRadosFs->mPriv->slowOps, slowOp);
+  const bool traced = Tracer::isEnabled() && Tracer::sample(asyncOp->id());
+  boost::chrono::steady_clock::time_point dequeueTime;
+
+  if (traced)
+  {
+    dequeueTime = boost::chrono::steady_clock::now();
+    Tracer::record("FileIO::write (queued)", "file", startTime, dequeueTime,
+                   asyncOp->id(), mInode, -1);
+  }
+
+  // realWrite only returns once the write's completions are finished
+  realWrite(buff, offset, blen, deleteBuffer, asyncOp);
+  mRadosFs->mPriv->writeThrottle.release(blen);
+
+  if (traced)
+    Tracer::record("FileIO::write", "file", startTime,
+                   boost::chrono::steady_clock::now(), asyncOp->id(), mInode,
+                   -1);
+
+  // The latency of an asynchronous write includes the time it was queued
+  mRadosFs->mPriv->metrics.record(MetricsRegistry::HISTOGRAM_FILE_WRITE,
+                                  startTime);
+}
+
 void
 onCompleted(rados_completion_t comp, void *arg)
 {
@@ -559,22 +664,29 @@ onCompleted(rados_completion_t comp, void *arg)
 
 void
 FileIO::setCompletionDebugMsg(librados::AioCompletion *completion,
-                              const std::string &message)
+                              const char *msg, ...)
 {
-  if (mRadosFs->logLevel() == Filesystem::LOG_LEVEL_DEBUG)
-  {
-    std::string *arg = new std::string(message);
-    completion->set_complete_callback(arg, onCompleted);
-  }
+  if (!Logger::isEnabled(Filesystem::LOG_LEVEL_DEBUG))
+    return;
+
+  char buffer[LOG_MESSAGE_MAX_SIZE];
+  va_list args;
+
+  va_start(args, msg);
+  vsnprintf(buffer, LOG_MESSAGE_MAX_SIZE, msg, args);
+  va_end(args);
+
+  std::string *arg = new std::string(buffer);
+  completion->set_complete_callback(arg, onCompleted);
 }
 
-void
+int
 FileIO::lockShared(const std::string &uuid)
 {
   int ret;
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
     boost::chrono::duration<double> seconds;
     boost::chrono::system_clock::time_point now =
         boost::chrono::system_clock::now();
@@ -587,34 +699,58 @@ FileIO::lockShared(const std::string &uuid)
         mLocker = uuid;
 
       if (mLocker == uuid)
-        return;
+        return 0;
     }
   }
 
   timeval tm;
   tm.tv_sec = FILE_LOCK_DURATION;
   tm.tv_usec = 0;
-  while ((ret = mPool->ioctx.lock_shared(inode(), FILE_CHUNK_LOCKER,
-                                         FILE_CHUNK_LOCKER_COOKIE_WRITE,
-                                         FILE_CHUNK_LOCKER_TAG, "", &tm,
-                                         0)) == -EBUSY)
-  {}
 
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  {
+    MetricsRegistry &metrics = mRadosFs->mPriv->metrics;
+    MetricsTimer timer(metrics, MetricsRegistry::HISTOGRAM_FILE_LOCK_WAIT);
+    TraceSpan span("FileIO::lockShared", "file", uuid, mInode);
+    SlowOpStage stage(SlowOp::STAGE_LOCK);
+
+    do
+    {
+      metrics.add(MetricsRegistry::COUNTER_RADOS_LOCK_ATTEMPTS);
+      SlowOpTracker::countLockAttempt();
+      ret = mPool->ioctx.lock_shared(inode(), FILE_CHUNK_LOCKER,
+                                     FILE_CHUNK_LOCKER_COOKIE_WRITE,
+                                     FILE_CHUNK_LOCKER_TAG, "", &tm, 0);
+    } while (ret == -EBUSY);
+  }
+
+  if (checkMovedAway() != 0)
+  {
+    mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
+                        FILE_CHUNK_LOCKER_COOKIE_WRITE);
+    return -ESTALE;
+  }
+
+  boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
   mLocker = uuid;
   mLockStart = boost::chrono::system_clock::now();
   mLockUpdated = mLockStart;
 
   radosfs_debug("Set/renew shared lock: %s ", mLocker.c_str());
+
+  lock.unlock();
+
+  mRadosFs->mPriv->scheduleFileIOCheck(inode(), idleLockTime());
+
+  return 0;
 }
 
-void
+int
 FileIO::lockExclusive(const std::string &uuid)
 {
   int ret;
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
     boost::chrono::duration<double> seconds;
     boost::chrono::system_clock::time_point now =
         boost::chrono::system_clock::now();
@@ -629,24 +765,79 @@ FileIO::lockExclusive(const std::string &uuid)
       }
 
       if (mLocker == uuid)
-        return;
+        return 0;
     }
   }
 
   timeval tm;
   tm.tv_sec = FILE_LOCK_DURATION;
   tm.tv_usec = 0;
-  while ((ret = mPool->ioctx.lock_exclusive(inode(), FILE_CHUNK_LOCKER,
-                                            FILE_CHUNK_LOCKER_COOKIE_OTHER,
-                                            "", &tm, 0)) == -EBUSY)
-  {}
 
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  {
+    MetricsRegistry &metrics = mRadosFs->mPriv->metrics;
+    MetricsTimer timer(metrics, MetricsRegistry::HISTOGRAM_FILE_LOCK_WAIT);
+    TraceSpan span("FileIO::lockExclusive", "file", uuid, mInode);
+    SlowOpStage stage(SlowOp::STAGE_LOCK);
+
+    do
+    {
+      metrics.add(MetricsRegistry::COUNTER_RADOS_LOCK_ATTEMPTS);
+      SlowOpTracker::countLockAttempt();
+      ret = mPool->ioctx.lock_exclusive(inode(), FILE_CHUNK_LOCKER,
+                                        FILE_CHUNK_LOCKER_COOKIE_OTHER, "",
+                                        &tm, 0);
+    } while (ret == -EBUSY);
+  }
+
+  if (checkMovedAway() != 0)
+  {
+    mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
+                        FILE_CHUNK_LOCKER_COOKIE_OTHER);
+    return -ESTALE;
+  }
+
+  boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
   mLocker = uuid;
   mLockStart = boost::chrono::system_clock::now();
   mLockUpdated = mLockStart;
 
   radosfs_debug("Set/renew exclusive lock: %s ", mLocker.c_str());
+
+  lock.unlock();
+
+  mRadosFs->mPriv->scheduleFileIOCheck(inode(), idleLockTime());
+
+  return 0;
+}
+
+int
+FileIO::checkMovedAway(void)
+{
+  std::string path;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+    path = mPath;
+  }
+
+  // Files can only be moved between the data pools of their prefix, so the
+  // ones in prefixes with a single data pool do not need to be checked
+  if (!path.empty() && mRadosFs->mPriv->getDataPools(path).size() < 2)
+    return 0;
+
+  librados::bufferlist movedTo;
+
+  // An inode that has been moved to another pool leaves its base chunk behind,
+  // marked with the new pool, so whoever still uses the old pool does not
+  // recreate the chunks there (where their contents would be lost)
+  if (mPool->ioctx.getxattr(inode(), XATTR_INODE_MOVED_TO, movedTo) <= 0)
+    return 0;
+
+  radosfs_debug("Inode '%s' has been moved from the data pool %s to %s",
+                inode().c_str(), mPool->name.c_str(),
+                std::string(movedTo.c_str(), movedTo.length()).c_str());
+
+  return -ESTALE;
 }
 
 int
@@ -791,7 +982,7 @@ FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
     }
   }
 
-  updateTimeAsyncInXAttr(mPool, mInode, XATTR_MTIME);
+  TraceSpan span("FileIO::realWrite", "file", asyncOp->id(), mInode);
 
   off_t currentOffset =  offset % mChunkSize;
   size_t bytesToWrite = blen;
@@ -801,23 +992,33 @@ FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
   const std::string &opId = asyncOp->id();
   const size_t totalSize = offset + blen;
 
+  setSizeHintOutdated();
+  updateTimeAsyncInXAttr(mPool, mInode, XATTR_MTIME);
+
   if (totalChunks > 1)
-    lockExclusive(opId);
+    ret = lockExclusive(opId);
   else
-    lockShared(opId);
+    ret = lockShared(opId);
 
-  setSizeIfBigger(totalSize, asyncOp);
+  if (ret == 0)
+    setSizeIfBigger(totalSize, asyncOp);
 
   radosfs_debug("Writing in inode '%s' (op id: '%s') to size %lu affecting "
                 "chunks %lu-%lu", inode().c_str(), opId.c_str(), totalSize,
                 firstChunk, lastChunk);
 
-  for (size_t i = 0; i < totalChunks; i++)
+  for (size_t i = 0; i < totalChunks && ret == 0; i++)
   {
+    TraceSpan chunkSpan("FileIO::writeChunk", "file", opId, mInode,
+                        firstChunk + i);
+
     if (totalChunks > 1)
-      lockExclusive(opId);
+      ret = lockExclusive(opId);
     else
-      lockShared(opId);
+      ret = lockShared(opId);
+
+    if (ret != 0)
+      break;
 
     librados::ObjectWriteOperation op;
     librados::bufferlist contents;
@@ -839,12 +1040,12 @@ FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
 
     completion = librados::Rados::aio_create_completion();
 
-    std::stringstream stream;
-    stream << "Wrote (od id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+    setCompletionDebugMsg(completion, "Wrote (op id='%s') chunk '%s'",
+                          opId.c_str(), fileChunk.c_str());
 
     mPool->ioctx.aio_operate(fileChunk, completion, &op);
     asyncOp->mPriv->addCompletion(completion);
+    mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_RADOS_CHUNK_WRITES);
 
     currentOffset = 0;
     bytesToWrite -= length;
@@ -853,6 +1054,13 @@ FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
                   fileChunk.c_str(), opId.c_str());
   }
 
+  if (ret != 0)
+  {
+    radosfs_debug("Error writing to inode '%s' (op id='%s'): %s (retcode=%d)",
+                  inode().c_str(), opId.c_str(), strerror(abs(ret)), ret);
+    asyncOp->mPriv->setFailed(ret);
+  }
+
   asyncOp->mPriv->setReady();
   syncAndResetLocker(asyncOp);
 
@@ -865,17 +1073,24 @@ FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
 int
 FileIO::remove()
 {
+  MetricsTimer timer(mRadosFs->mPriv->metrics,
+                     MetricsRegistry::HISTOGRAM_FILE_REMOVE);
   const std::string &opId = generateUuid();
+  TraceSpan span("FileIO::remove", "file", opId, mInode);
+  SlowOpScope slowOpScope(mRadosFs->mPriv->slowOps, "FileIO::remove", opId,
+                          mInode);
   mOpManager.sync();
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
     unlockShared();
   }
 
-  lockExclusive(opId);
+  int ret = lockExclusive(opId);
+
+  if (ret != 0)
+    return ret;
 
-  int ret = 0;
   ssize_t lastChunk = getLastChunkIndex();
 
   if (lastChunk < 0)
@@ -895,7 +1110,11 @@ FileIO::remove()
   // in other calls to the object eventually seeing the removal sooner
   for (size_t i = 0; i <= (size_t) lastChunk; i++)
   {
-    lockExclusive(opId);
+    if ((ret = lockExclusive(opId)) != 0)
+    {
+      asyncOp->mPriv->setFailed(ret);
+      break;
+    }
 
     librados::ObjectWriteOperation op;
     librados::AioCompletion *completion;
@@ -907,12 +1126,12 @@ FileIO::remove()
     op.remove();
     completion = librados::Rados::aio_create_completion();
 
-    std::stringstream stream;
-    stream << "Remove (op id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+    setCompletionDebugMsg(completion, "Remove (op id='%s') chunk '%s'",
+                          opId.c_str(), fileChunk.c_str());
 
     mPool->ioctx.aio_operate(fileChunk, completion, &op);
     asyncOp->mPriv->addCompletion(completion);
+    mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_RADOS_CHUNK_REMOVES);
   }
 
   asyncOp->mPriv->setReady();
@@ -921,9 +1140,209 @@ FileIO::remove()
   return ret;
 }
 
+int
+FileIO::removeMovedChunks()
+{
+  const std::string &opId = generateUuid();
+  TraceSpan span("FileIO::removeMovedChunks", "file", opId, mInode);
+  mOpManager.sync();
+
+  ssize_t lastChunk = getLastChunkIndex();
+
+  if (lastChunk < 0)
+  {
+    radosfs_debug("Error trying to remove the moved inode '%s' (retcode=%d): "
+                  "%s", inode().c_str(), lastChunk,
+                  strerror(std::abs(lastChunk)));
+    return lastChunk;
+  }
+
+  radosfs_debug("Remove (op id='%s') moved inode '%s' affecting chunks 0-%lu",
+                opId.c_str(), inode().c_str(), lastChunk);
+
+  AsyncOpSP asyncOp(new AsyncOp(opId));
+  mOpManager.addOperation(asyncOp);
+
+  // The base chunk is only truncated: it keeps the xattr with the pool the
+  // inode was moved to so other clients that are still writing to this pool
+  // get -ESTALE when they lock it instead of recreating the chunks here. No
+  // lock is taken since any new locker will find the base chunk marked.
+  for (size_t i = 0; i <= (size_t) lastChunk; i++)
+  {
+    librados::ObjectWriteOperation op;
+    librados::AioCompletion *completion;
+    const std::string &fileChunk = makeFileChunkName(inode(), i);
+
+    if (i == 0)
+    {
+      op.assert_exists();
+      op.truncate(0);
+    }
+    else
+    {
+      op.remove();
+    }
+
+    completion = librados::Rados::aio_create_completion();
+
+    setCompletionDebugMsg(completion, "Remove (op id='%s') moved chunk '%s'",
+                          opId.c_str(), fileChunk.c_str());
+
+    mPool->ioctx.aio_operate(fileChunk, completion, &op);
+    asyncOp->mPriv->addCompletion(completion);
+    mRadosFs->mPriv->metrics.add(MetricsRegistry::COUNTER_RADOS_CHUNK_REMOVES);
+  }
+
+  asyncOp->mPriv->setReady();
+  syncAndResetLocker(asyncOp);
+
+  // Let whoever waits for the lock find out that the inode has been moved
+  boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
+  unlockExclusive();
+  mLockStart = expiredLockDuration();
+  mLockUpdated = mLockStart;
+
+  // Chunks may be missing if nothing was written to them
+  int ret = asyncOp->returnValue();
+
+  return ret == -ENOENT ? 0 : ret;
+}
+
+int
+FileIO::copyToPool(const PoolSP &pool, uint64_t maxRate)
+{
+  const std::string &opId = generateUuid();
+  mOpManager.sync();
+
+  ssize_t lastChunk = getLastChunkIndex();
+
+  // The inode may not exist yet if the contents fit in the inline buffer, in
+  // which case a base chunk left in the pool by an earlier move out of it is
+  // removed, or the writes that create the inode there would fail
+  if (lastChunk == -ENOENT)
+  {
+    pool->ioctx.remove(inode());
+    return 0;
+  }
+
+  if (lastChunk < 0)
+  {
+    radosfs_debug("Error trying to copy inode '%s' (retcode=%d): %s",
+                  inode().c_str(), lastChunk, strerror(std::abs(lastChunk)));
+    return lastChunk;
+  }
+
+  {
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
+    unlockShared();
+  }
+
+  int ret = lockExclusive(opId);
+
+  if (ret != 0)
+    return ret;
+
+  radosfs_debug("Copy (op id='%s') inode '%s' chunks 0-%lu from pool %s to %s",
+                opId.c_str(), inode().c_str(), lastChunk, mPool->name.c_str(),
+                pool->name.c_str());
+
+  // The chunks are copied by the OSDs themselves (copy_from) and several of
+  // them are kept in flight; the copies are idempotent so an interrupted copy
+  // can simply be run again
+  std::deque<std::pair<size_t, librados::AioCompletion *> > inFlight;
+  boost::chrono::steady_clock::time_point start =
+      boost::chrono::steady_clock::now();
+  size_t failedChunk = 0;
+
+  size_t next = 0;
+
+  while (next <= (size_t) lastChunk || !inFlight.empty())
+  {
+    while (ret == 0 && next <= (size_t) lastChunk &&
+           inFlight.size() < FILE_MOVE_MAX_INFLIGHT_CHUNKS)
+    {
+      if ((ret = lockExclusive(opId)) != 0)
+      {
+        failedChunk = next;
+        break;
+      }
+
+      if (maxRate > 0)
+      {
+        // Delay the chunk until the chunks issued so far fit the rate
+        boost::chrono::duration<double> expected((double) next * mChunkSize /
+                                                 maxRate);
+        boost::this_thread::sleep_until(start +
+            boost::chrono::duration_cast<boost::chrono::nanoseconds>(expected));
+      }
+
+      const std::string &fileChunk = makeFileChunkName(inode(), next);
+      librados::ObjectWriteOperation op;
+      librados::AioCompletion *completion;
+
+      op.copy_from(fileChunk, mPool->ioctx, 0);
+      completion = librados::Rados::aio_create_completion();
+
+      setCompletionDebugMsg(completion, "Copy (op id='%s') chunk '%s'",
+                            opId.c_str(), fileChunk.c_str());
+
+      pool->ioctx.aio_operate(fileChunk, completion, &op);
+      inFlight.push_back(std::make_pair(next++, completion));
+    }
+
+    if (inFlight.empty())
+      break;
+
+    librados::AioCompletion *completion = inFlight.front().second;
+    completion->wait_for_complete();
+    int chunkRet = completion->get_return_value();
+    completion->release();
+
+    // Chunks may be missing if nothing was written to them
+    if (chunkRet < 0 && chunkRet != -ENOENT && ret == 0)
+    {
+      ret = chunkRet;
+      failedChunk = inFlight.front().first;
+    }
+
+    inFlight.pop_front();
+  }
+
+  if (ret == 0)
+  {
+    // The copy of the base chunk carries the lock that is being held (and the
+    // pool may still have the marked base chunk of an earlier move out of it)
+    pool->ioctx.rmxattr(inode(), FILE_CHUNK_LOCKER_XATTR);
+    pool->ioctx.rmxattr(inode(), XATTR_INODE_MOVED_TO);
+  }
+  else
+  {
+    radosfs_debug("Error copying chunk %lu of inode '%s' to pool %s "
+                  "(retcode=%d): %s", failedChunk, inode().c_str(),
+                  pool->name.c_str(), ret, strerror(std::abs(ret)));
+
+    // Do not leave a partial copy behind
+    for (size_t j = 0; j <= (size_t) lastChunk; j++)
+      pool->ioctx.remove(makeFileChunkName(inode(), j));
+
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
+    unlockExclusive();
+  }
+
+  // On success, the lock is kept so the original chunks are not modified until
+  // they are removed
+  return ret;
+}
+
 int
 FileIO::truncate(size_t newSize)
 {
+  MetricsTimer timer(mRadosFs->mPriv->metrics,
+                     MetricsRegistry::HISTOGRAM_FILE_TRUNCATE);
+  TraceSpan span("FileIO::truncate", "file", "", mInode);
+  SlowOpScope slowOpScope(mRadosFs->mPriv->slowOps, "FileIO::truncate", "",
+                          mInode);
+
   if (newSize > mPool->size)
   {
     radosfs_debug("The size given for truncating is too big for the pool.");
@@ -932,16 +1351,19 @@ FileIO::truncate(size_t newSize)
 
   mOpManager.sync();
 
+  setSizeHintOutdated();
   updateTimeAsyncInXAttr(mPool, mInode, XATTR_MTIME);
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
     unlockShared();
   }
 
   const std::string &opId = generateUuid();
+  int ret = lockExclusive(opId);
 
-  lockExclusive(opId);
+  if (ret != 0)
+    return ret;
 
   if (mInlineBuffer)
   {
@@ -981,7 +1403,11 @@ FileIO::truncate(size_t newSize)
 
   for (ssize_t i = totalChunks - 1; i >= 0; i--)
   {
-    lockExclusive(opId);
+    if ((ret = lockExclusive(opId)) != 0)
+    {
+      asyncOp->mPriv->setFailed(ret);
+      break;
+    }
 
     librados::ObjectWriteOperation op;
     librados::AioCompletion *completion;
@@ -1017,9 +1443,8 @@ FileIO::truncate(size_t newSize)
 
     completion = librados::Rados::aio_create_completion();
 
-    std::stringstream stream;
-    stream << "Truncate (op id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+    setCompletionDebugMsg(completion, "Truncate (op id='%s') chunk '%s'",
+                          opId.c_str(), fileChunk.c_str());
 
     mPool->ioctx.aio_operate(fileChunk, completion, &op);
     asyncOp->mPriv->addCompletion(completion);
@@ -1028,7 +1453,7 @@ FileIO::truncate(size_t newSize)
   asyncOp->mPriv->setReady();
   syncAndResetLocker(asyncOp);
 
-  return 0;
+  return ret;
 }
 
 ssize_t
@@ -1151,10 +1576,9 @@ FileIO::setSizeIfBigger(size_t size, AsyncOpSP asyncOp)
 
   librados::AioCompletion *completion = librados::Rados::aio_create_completion();
 
-  std::stringstream stream;
-  stream << "Set size because it was bigger "
-            "(od id='" << asyncOp->id() << "') on '" << inode() << "'";
-  setCompletionDebugMsg(completion, stream.str());
+  setCompletionDebugMsg(completion, "Set size because it was bigger "
+                        "(op id='%s') on '%s'", asyncOp->id().c_str(),
+                        inode().c_str());
 
   mPool->ioctx.aio_operate(inode(), completion, &writeOp);
   asyncOp->mPriv->addCompletion(completion);
@@ -1191,9 +1615,15 @@ FileIO::setSize(size_t size)
   return ret;
 }
 
-void
+boost::chrono::system_clock::time_point
 FileIO::manageIdleLock(double idleTimeout)
 {
+  const boost::chrono::system_clock::time_point now =
+      boost::chrono::system_clock::now();
+  // If the lock is busy, check it again shortly
+  boost::chrono::system_clock::time_point nextCheck =
+      now + boost::chrono::milliseconds(FILE_OPS_IDLE_CHECKER_SLEEP);
+
   if (mLockMutex.try_lock())
   {
     if (mLocker == "")
@@ -1201,8 +1631,27 @@ FileIO::manageIdleLock(double idleTimeout)
       unlockIfTimeIsOut(idleTimeout);
     }
 
+    boost::chrono::duration<double> seconds = now - mLockUpdated;
+
+    if (seconds.count() > FILE_LOCK_DURATION)
+    {
+      // There is no lock to check anymore
+      nextCheck = boost::chrono::system_clock::time_point();
+    }
+    else
+    {
+      boost::chrono::system_clock::time_point idleTime = mLockUpdated +
+          boost::chrono::duration_cast<boost::chrono::system_clock::duration>(
+            boost::chrono::duration<double>(idleTimeout));
+
+      if (idleTime > now)
+        nextCheck = idleTime;
+    }
+
     mLockMutex.unlock();
   }
+
+  return nextCheck;
 }
 
 void
@@ -1231,7 +1680,8 @@ FileIO::unlockIfTimeIsOut(double idleTimeout)
 void
 FileIO::syncAndResetLocker(AsyncOpSP op)
 {
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  TraceSpan span("FileIO::syncAndResetLocker", "file", op->id(), mInode);
+  boost::unique_lock<InstrumentedMutex> lock(mLockMutex);
   op->waitForCompletion();
   mLocker = "";
 }
@@ -1239,9 +1689,32 @@ FileIO::syncAndResetLocker(AsyncOpSP op)
 bool
 FileIO::hasSingleClient(const FileIOSP &io)
 {
-  // If there is only one client using an instance of the given FileIO, then
-  // the use count is 2 because there is a reference hold in FsPriv's map.
-  return io.use_count() == 2;
+  return io->numClients() <= 1;
+}
+
+size_t
+FileIO::addClient(void)
+{
+  boost::unique_lock<boost::mutex> lock(mNumClientsMutex);
+  return ++mNumClients;
+}
+
+size_t
+FileIO::removeClient(void)
+{
+  boost::unique_lock<boost::mutex> lock(mNumClientsMutex);
+
+  if (mNumClients > 0)
+    mNumClients--;
+
+  return mNumClients;
+}
+
+size_t
+FileIO::numClients(void)
+{
+  boost::unique_lock<boost::mutex> lock(mNumClientsMutex);
+  return mNumClients;
 }
 
 void
@@ -1307,6 +1780,97 @@ FileIO::updateBackLink(const std::string *oldBackLink)
                         this);
 }
 
+int
+FileIO::getSizeHintLocation(Inode &parent, std::string &baseName)
+{
+  std::string path;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+    path = mPath;
+  }
+
+  // Inodes used without a path may still have been linked to a file
+  if (path.empty())
+  {
+    int ret = getFileInodeBackLink(mPool.get(), mInode, &path);
+
+    if (ret == -ENODATA)
+      return -ENOENT;
+
+    if (ret != 0)
+      return ret;
+  }
+
+  const std::string parentPath = getParentDir(path, 0);
+
+  if (parentPath.empty())
+    return -ENOENT;
+
+  baseName = path.substr(parentPath.length());
+
+  return mRadosFs->mPriv->getDirInode(parentPath, parent);
+}
+
+void
+FileIO::setSizeHintOutdated(void)
+{
+  boost::unique_lock<boost::mutex> lock(mSizeHintMutex);
+  mSizeHintOutdated = true;
+}
+
+void
+FileIO::updateSizeHint(void)
+{
+  boost::unique_lock<boost::mutex> lock(mSizeHintMutex);
+
+  if (!mSizeHintOutdated)
+    return;
+
+  mSizeHintOutdated = false;
+
+  Inode parent;
+  std::string baseName;
+
+  if (getSizeHintLocation(parent, baseName) != 0)
+    return;
+
+  librados::ObjectReadOperation op;
+  librados::bufferlist sizeXAttr, mtimeXAttr;
+  int sizeRet, mtimeRet;
+
+  op.getxattr(XATTR_FILE_SIZE, &sizeXAttr, &sizeRet);
+  op.getxattr(XATTR_MTIME, &mtimeXAttr, &mtimeRet);
+
+  int ret = mPool->ioctx.operate(mInode, &op, 0);
+
+  if (ret < 0)
+    return;
+
+  uint64_t size = 0;
+  timespec mtime;
+  bool hasMtime = mtimeXAttr.length() > 0;
+
+  if (sizeXAttr.length() > 0)
+  {
+    const std::string sizeStr(sizeXAttr.c_str(), sizeXAttr.length());
+    size = strtoull(sizeStr.c_str(), 0, 16);
+  }
+
+  if (hasMtime)
+    strToTimespec(std::string(mtimeXAttr.c_str(), mtimeXAttr.length()), &mtime);
+
+  // Other writers may set the hint meanwhile; it is checked against the inode
+  // whenever it is used, so the one set last does not need to be the newest
+  ret = setFileSizeHint(parent.pool->ioctx, parent.inode, baseName,
+                        makeFileSizeHint(mInode, size, hasMtime ? &mtime : 0),
+                        0);
+
+  if (ret != 0)
+    radosfs_debug("Failed to update the size hint of inode %s: %s "
+                  "(retcode=%d)", mInode.c_str(), strerror(abs(ret)), ret);
+}
+
 bool
 FileIO::hasRunningAsyncOps()
 {
@@ -1318,7 +1882,7 @@ OpsManager::sync(bool removeOps)
 {
   int ret = 0;
   std::map<std::string, AsyncOpSP>::iterator it, oldIt;
-  boost::unique_lock<boost::mutex> lock(opsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(opsMutex);
 
   it = mOperations.begin();
   while (it != mOperations.end())
@@ -1342,11 +1906,11 @@ int
 OpsManager::sync(const std::string &opId, bool lock, bool removeOps)
 {
   int ret = -ENOENT;
-  boost::unique_lock<boost::mutex> uniqueLock;
+  boost::unique_lock<InstrumentedMutex> uniqueLock;
   AsyncOpSP asyncOp;
 
   if (lock)
-    uniqueLock = boost::unique_lock<boost::mutex>(opsMutex);
+    uniqueLock = boost::unique_lock<InstrumentedMutex>(opsMutex);
 
   if (mOperations.count(opId) == 0)
     return ret;
@@ -1369,7 +1933,7 @@ OpsManager::waitForLoneOps(void)
   while (numOps > 0)
   {
     {
-      boost::unique_lock<boost::mutex> lock(opsMutex);
+      boost::unique_lock<InstrumentedMutex> lock(opsMutex);
       std::map<std::string, AsyncOpSP>::iterator it;
       for (it = mOperations.begin(); it != mOperations.end(); ++it)
       {
@@ -1391,7 +1955,7 @@ OpsManager::waitForLoneOps(void)
 void
 OpsManager::addOperation(AsyncOpSP op)
 {
-  boost::unique_lock<boost::mutex> lock(opsMutex);
+  boost::unique_lock<InstrumentedMutex> lock(opsMutex);
 
   mOperations[op->id()] = op;
 }
@@ -33,12 +33,16 @@
 #include "Filesystem.hh"
 #include "FileInlineBuffer.hh"
 #include "AsyncOp.hh"
+#include "InstrumentedMutex.hh"
+#include "SlowOpTracker.hh"
 #include "radosfscommon.h"
 
 #define FILE_CHUNK_LOCKER "file-chunk-locker"
 #define FILE_CHUNK_LOCKER_COOKIE_WRITE "file-chunk-locker-cookie-write"
 #define FILE_CHUNK_LOCKER_COOKIE_OTHER "file-chunk-locker-cookie-other"
 #define FILE_CHUNK_LOCKER_TAG "file-chunk-locker-tag"
+// The xattr in which the objects' lock is stored
+#define FILE_CHUNK_LOCKER_XATTR "lock." FILE_CHUNK_LOCKER
 #define FILE_LOCK_DURATION 120 // seconds
 
 RADOS_FS_BEGIN_NAMESPACE
@@ -91,7 +95,9 @@ struct ReadChunkOpArgs : ReadOpArgs
 
 struct OpsManager
 {
-  boost::mutex opsMutex;
+  OpsManager(void) : opsMutex("file_io_ops") {}
+
+  InstrumentedMutex opsMutex;
   std::map<std::string, AsyncOpSP> mOperations;
 
   int sync(bool removeOps=true);
@@ -144,11 +150,15 @@ public:
 
   int remove(void);
 
+  int removeMovedChunks(void);
+
+  int copyToPool(const PoolSP &pool, uint64_t maxRate = 0);
+
   int truncate(size_t newSize);
 
-  void lockShared(const std::string &uuid);
+  int lockShared(const std::string &uuid);
 
-  void lockExclusive(const std::string &uuid);
+  int lockExclusive(const std::string &uuid);
 
   int unlockShared(void);
 
@@ -156,10 +166,16 @@ public:
 
   int unlock(void);
 
-  void manageIdleLock(double idleTimeout);
+  boost::chrono::system_clock::time_point manageIdleLock(double idleTimeout);
 
   static bool hasSingleClient(const FileIOSP &io);
 
+  size_t addClient(void);
+
+  size_t removeClient(void);
+
+  size_t numClients(void);
+
   int sync(const std::string &opId) { return mOpManager.sync(opId); }
 
   PoolSP pool(void) const { return mPool; }
@@ -181,6 +197,8 @@ public:
 
   bool hasRunningAsyncOps(void);
 
+  void updateSizeHint(void);
+
 private:
   Filesystem *mRadosFs;
   const PoolSP mPool;
@@ -191,7 +209,7 @@ private:
   std::vector<rados_completion_t> mCompletionList;
   boost::chrono::system_clock::time_point mLockStart;
   boost::chrono::system_clock::time_point mLockUpdated;
-  boost::mutex mLockMutex;
+  InstrumentedMutex mLockMutex;
   std::string mLocker;
   OpsManager mOpManager;
   boost::scoped_ptr<FileInlineBuffer> mInlineBuffer;
@@ -199,15 +217,26 @@ private:
   boost::mutex mInlineMemBufferMutex;
   bool mHasBackLink;
   boost::mutex mHasBackLinkMutex;
+  bool mSizeHintOutdated;
+  boost::mutex mSizeHintMutex;
+  size_t mNumClients;
+  boost::mutex mNumClientsMutex;
 
   int verifyWriteParams(off_t offset, size_t length);
   int realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
                 AsyncOpSP asyncOp);
+  void throttledWrite(char *buff, off_t offset, size_t blen,
+                      bool deleteBuffer, AsyncOpSP asyncOp,
+                      SlowOpSP slowOp,
+                      boost::chrono::steady_clock::time_point startTime);
   int setSizeIfBigger(size_t size, AsyncOpSP asyncOp);
   int setSize(size_t size);
   void setCompletionDebugMsg(librados::AioCompletion *completion,
-                             const std::string &message);
+                             const char *msg, ...);
   void syncAndResetLocker(AsyncOpSP op);
+  int checkMovedAway(void);
+  int getSizeHintLocation(Inode &parent, std::string &baseName);
+  void setSizeHintOutdated(void);
   void getInlineAndInodeReadData(const std::vector<FileReadData> &intervals,
                                  std::vector<FileReadDataImpSP> *dataInline,
                                  std::vector<FileReadDataImpSP> *dataInode);
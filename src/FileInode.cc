@@ -37,7 +37,7 @@ FileInodePriv::FileInodePriv(Filesystem *fs, const std::string &poolName,
   size_t chunk = alignChunkSize(chunkSize, pool->alignment);
 
   if (pool)
-    io = FileIOSP(new FileIO(fs, pool, name, chunk));
+    setFileIO(FileIOSP(new FileIO(fs, pool, name, chunk)));
 }
 
 FileInodePriv::FileInodePriv(Filesystem *fs, PoolSP &pool,
@@ -48,7 +48,7 @@ FileInodePriv::FileInodePriv(Filesystem *fs, PoolSP &pool,
   size_t chunk = alignChunkSize(chunkSize, pool->alignment);
 
   if (pool)
-    io = FileIOSP(new FileIO(fs, pool, name, chunk));
+    setFileIO(FileIOSP(new FileIO(fs, pool, name, chunk)));
 }
 
 FileInodePriv::FileInodePriv(Filesystem *fs, FileIOSP fileIO)
@@ -58,15 +58,36 @@ FileInodePriv::FileInodePriv(Filesystem *fs, FileIOSP fileIO)
 }
 
 FileInodePriv::~FileInodePriv()
-{}
+{
+  setFileIO(FileIOSP());
+}
 
 void
-FileInodePriv::setFileIO(FileIOSP fileIO)
+FileInodePriv::setFileIO(FileIOSP fileIO, bool addClient)
 {
+  if (fileIO == io)
+  {
+    if (io && !addClient)
+      io->removeClient();
+
+    return;
+  }
+
+  FileIOSP oldIO = io;
+
   io = fileIO;
 
   if (io)
+  {
     name = io->inode();
+
+    // FileIO objects from the filesystem's registry already count this client
+    if (addClient)
+      io->addClient();
+  }
+
+  if (oldIO)
+    fs->mPriv->releaseFileIO(oldIO);
 }
 
 int
@@ -106,6 +127,9 @@ FileInodePriv::registerFileWithStats(const std::string &path, uid_t uid,
 
   int ret = indexObject(&parentStat, &fileStat, '+');
 
+  fs->mPriv->clearMissingEntries(parentStat.translatedPath);
+  fs->mPriv->expireDirCacheLease(parentStat.translatedPath);
+
   if (ret == -ECANCELED)
   {
     return -EEXIST;
@@ -314,7 +338,9 @@ FileInode::read(const std::vector<FileReadData> &intervals,
  *        operation is finished
  * @param callbackArg a pointer to the user arguments that will be passed to the
  *        \a callback .
- * @return 0 if the operation was initialized, an error code otherwise.
+ * @return 0 if the operation was initialized, -EAGAIN if it was refused
+ *         because too many writes are in flight (see
+ *         Filesystem::setWriteThrottleMode), an error code otherwise.
 
  */
 int
@@ -40,7 +40,7 @@ public:
   FileInodePriv(Filesystem *fs, FileIOSP fileIO);
   ~FileInodePriv(void);
 
-  void setFileIO(FileIOSP fileIO);
+  void setFileIO(FileIOSP fileIO, bool addClient = true);
 
   int registerFile(const std::string &path, uid_t uid, gid_t gid, int mode,
                    size_t inlineBufferSize=0);
@@ -56,6 +56,8 @@ public:
 
   void updateDataPool(const std::string &pool);
 
+  void placeDataPool(void);
+
   void setInode(const size_t chunkSize);
 
   FileIOSP getFileIO(void) const { return inode->mPriv->io; }
@@ -73,6 +75,7 @@ public:
   File::OpenMode permissions;
   File::OpenMode mode;
   size_t inlineBufferSize;
+  bool wroteData;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -17,10 +17,11 @@
  * for more details.
  */
 
-#include <boost/asio.hpp>
+#include <algorithm>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/progress.hpp>
+#include <fstream>
 #include <rados/librados.hpp>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,6 +30,7 @@
 #include "Filesystem.hh"
 #include "File.hh"
 #include "FilesystemPriv.hh"
+#include "Tracer.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -38,75 +40,82 @@ __thread gid_t FilesystemPriv::gid;
 FilesystemPriv::FilesystemPriv(Filesystem *radosFs)
   : radosFs(radosFs),
     initialized(false),
+    poolMutex("pool"),
+    mtdPoolMutex("mtd_pool"),
+    dataPoolPlacement(Filesystem::DATA_POOL_PLACEMENT_FIRST),
+    dataMoveRate(0),
     dirCompactRatio(DEFAULT_DIR_COMPACT_RATIO),
+    dirCacheLeaseTime(DEFAULT_DIR_CACHE_LEASE_TIME),
+    dirCompactMinLogSize(DEFAULT_DIR_COMPACT_MIN_LOG_SIZE),
+    backgroundDirCompaction(true),
     fileChunkSize(FILE_CHUNK_SIZE),
     numGenericWorkers(DEFAULT_NUM_WORKER_THREADS),
-    ioService(new boost::asio::io_service),
-    asyncWork(new boost::asio::io_service::work(*ioService)),
-    fileOpsIdleChecker(boost::bind(&FilesystemPriv::checkFileLocks, this))
+    maxNumGenericWorkers(0),
+    workScheduler(DEFAULT_NUM_WORKER_THREADS),
+    metricsDumpInterval(DEFAULT_METRICS_DUMP_INTERVAL),
+    fileOpsIdleChecker(boost::bind(&FilesystemPriv::checkFileLocks, this)),
+    dirLogsChecker(boost::bind(&FilesystemPriv::checkDirLogs, this)),
+    dataPoolsUsageChecker(boost::bind(&FilesystemPriv::checkDataPoolsUsage,
+                                      this)),
+    metricsDumper(boost::bind(&FilesystemPriv::dumpMetrics, this)),
+    slowOpsChecker(boost::bind(&FilesystemPriv::checkSlowOps, this))
 {
   uid = 0;
   gid = 0;
-  dirCache.maxCacheSize = DEFAULT_DIR_CACHE_MAX_SIZE;
 }
 
 FilesystemPriv::~FilesystemPriv()
 {
-  asyncWork.reset();
-  generalWorkerThreads.join_all();
+  slowOpsChecker.interrupt();
+  slowOpsChecker.join();
+
+  metricsDumper.interrupt();
+  metricsDumper.join();
+
+  dataPoolsUsageChecker.interrupt();
+  dataPoolsUsageChecker.join();
+
+  dirLogsChecker.interrupt();
+  dirLogsChecker.join();
+
+  workScheduler.stop();
 
   fileOpsIdleChecker.interrupt();
-  operationsMutex.lock();
+  fileOpsIdleChecker.join();
   operations.clear();
-  operationsMutex.unlock();
 
   poolMap.clear();
   mtdPoolMap.clear();
-  dirPathInodeMap.clear();
+  boost::atomic_store(&dataPoolRouter, PoolRouterSP());
+  boost::atomic_store(&mtdPoolRouter, PoolRouterSP());
+  dirPathCache.clear();
+  missingEntries.clear();
+  linkPrefixes.clear();
+
+  // The cached dirs may be watching their objects so they need to be cleaned
+  // before the cluster is shut down
+  dirCache.cleanCache();
 
   if (initialized)
     radosCluster.shutdown();
-
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
-
-  dirCache.cleanCache();
 }
 
-PriorityCache::PriorityCache()
+PriorityCacheShard::PriorityCacheShard()
   : head(0),
     tail(0),
     cacheSize(0),
-    maxCacheSize(DEFAULT_DIR_CACHE_MAX_SIZE)
+    mutex("dir_cache")
 {}
 
-PriorityCache::~PriorityCache()
+PriorityCacheShard::~PriorityCacheShard()
 {}
 
-void
-PriorityCache::cleanCache()
-{
-  std::map<std::string, LinkedList *>::iterator it;
-  for (it = cacheMap.begin(); it != cacheMap.end(); it++)
-  {
-    delete (*it).second;
-  }
-
-  cacheMap.clear();
-}
-
-void
-PriorityCache::removeCache(const std::string &path, bool freeMemory)
+size_t
+PriorityCacheShard::removeCache(LinkedList *link,
+                                std::vector<std::tr1::shared_ptr<DirCache> > &removed)
 {
-  if (cacheMap.count(path) == 0)
-    return;
-
-  LinkedList *link = cacheMap[path];
-  removeCache(link, freeMemory);
-}
+  const size_t linkSize = link->lastSize;
 
-void
-PriorityCache::removeCache(LinkedList *link, bool freeMemory)
-{
   if (head == link)
   {
     head = head->previous;
@@ -129,16 +138,19 @@ PriorityCache::removeCache(LinkedList *link, bool freeMemory)
   if (link->previous != 0)
     link->previous->next = link->next;
 
-  if (freeMemory)
-  {
-    cacheSize -= link->lastNumEntries;
-    cacheMap.erase(link->cachePtr->inode());
-    delete link;
-  }
+  cacheSize -= linkSize;
+  cacheMap.erase(link->cachePtr->inode());
+
+  // The dir caches are only released by the caller (outside of the shard's
+  // lock) since destroying them may need to contact the cluster
+  removed.push_back(link->cachePtr);
+  delete link;
+
+  return linkSize;
 }
 
 void
-PriorityCache::moveToFront(LinkedList *link)
+PriorityCacheShard::moveToFront(LinkedList *link)
 {
   if (head == link || link == 0)
     return;
@@ -169,1064 +181,2846 @@ PriorityCache::moveToFront(LinkedList *link)
   link->next = 0;
 }
 
-void
-PriorityCache::update(std::tr1::shared_ptr<DirCache> cache)
+PriorityCache::PriorityCache()
+  : cacheSize(0),
+    maxCacheSize(DEFAULT_DIR_CACHE_MAX_SIZE)
+{}
+
+PriorityCache::~PriorityCache()
+{}
+
+size_t
+PriorityCache::shardIndex(const std::string &inode) const
 {
-  LinkedList *list = 0;
-  const size_t dirNumEntries = cache->contents().size();
+  return hash(inode.c_str()) % DIR_CACHE_NUM_SHARDS;
+}
 
-  // we add 1 to the number of entries because the size of the
-  // cache is the number of directories plus their entries
-  if (dirNumEntries + 1 > maxCacheSize)
-    return;
+void
+PriorityCache::updateSize(size_t added, size_t removed)
+{
+  boost::unique_lock<boost::mutex> lock(sizeMutex);
+  cacheSize += added;
+  cacheSize -= removed;
+}
 
-  if (cacheMap.count(cache->inode()) == 0)
-  {
-    list = new LinkedList;
-    list->cachePtr = cache;
-    list->next = 0;
-    list->previous = 0;
-    list->lastNumEntries = 0;
+size_t
+PriorityCache::size()
+{
+  boost::unique_lock<boost::mutex> lock(sizeMutex);
+  return cacheSize;
+}
 
-    cacheMap[cache->inode()] = list;
-  }
-  else
-  {
-    list = cacheMap[cache->inode()];
-  }
+size_t
+PriorityCache::numDirs()
+{
+  size_t numDirs = 0;
 
-  if (dirNumEntries != list->lastNumEntries)
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
   {
-    cacheSize += dirNumEntries - list->lastNumEntries;
-    list->lastNumEntries = dirNumEntries;
+    boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
+    numDirs += shards[i].cacheMap.size();
   }
 
-  moveToFront(list);
-
-  adjustCache();
+  return numDirs;
 }
 
 void
-PriorityCache::adjustCache()
+PriorityCache::setMaxSize(size_t size)
 {
-  if (size() <= maxCacheSize || tail == 0 || size() == 1)
-    return;
+  boost::unique_lock<boost::mutex> lock(sizeMutex);
+  maxCacheSize = size;
+}
 
-  size_t minCacheSize = (float) maxCacheSize *
-                        DEFAULT_DIR_CACHE_CLEAN_PERCENTAGE;
+size_t
+PriorityCache::maxSize()
+{
+  boost::unique_lock<boost::mutex> lock(sizeMutex);
+  return maxCacheSize;
+}
 
-  if (minCacheSize == 0)
-    minCacheSize = 1;
+void
+PriorityCache::cleanCache()
+{
+  std::vector<std::tr1::shared_ptr<DirCache> > removed;
 
-  while (size() > minCacheSize)
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
   {
-    if (tail == 0)
-      break;
+    PriorityCacheShard &shard = shards[i];
+    boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-    removeCache(tail);
+    while (shard.tail)
+      updateSize(0, shard.removeCache(shard.tail, removed));
   }
 }
 
-int
-FilesystemPriv::createCluster(const std::string &userName,
-                              const std::string &confFile)
+std::tr1::shared_ptr<DirCache>
+PriorityCache::get(const std::string &inode)
 {
-  int ret;
-  const char *user = 0;
-
-  if (userName != "")
-    user = userName.c_str();
-
-  ret = radosCluster.init(user);
+  std::tr1::shared_ptr<DirCache> cache;
+  PriorityCacheShard &shard = shards[shardIndex(inode)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  if (ret != 0)
-    return ret;
+  std::map<std::string, LinkedList *>::iterator it = shard.cacheMap.find(inode);
 
-  if (confFile != "")
-  {
-    ret = radosCluster.conf_read_file(confFile.c_str());
+  if (it != shard.cacheMap.end())
+    cache = (*it).second->cachePtr;
 
-    if (ret != 0)
-      return ret;
-  }
+  return cache;
+}
 
-  ret = radosCluster.connect();
+void
+PriorityCache::removeCache(const std::string &inode)
+{
+  std::vector<std::tr1::shared_ptr<DirCache> > removed;
+  PriorityCacheShard &shard = shards[shardIndex(inode)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  initialized = (ret == 0);
+  std::map<std::string, LinkedList *>::iterator it = shard.cacheMap.find(inode);
 
-  return ret;
+  if (it != shard.cacheMap.end())
+    updateSize(0, shard.removeCache((*it).second, removed));
 }
 
-int
-FilesystemPriv::statLink(PoolSP mtdPool, Stat *stat, std::string &pool)
+void
+PriorityCache::cachedDirs(std::vector<std::tr1::shared_ptr<DirCache> > &dirs)
 {
-  int ret = 0;
-  const std::string &parentDir = getParentDir(stat->path, 0);
-  const std::string entryName = stat->path.substr(parentDir.length());
-  const std::string &fileEntry = XATTR_FILE_PREFIX + getFilePath(entryName);
-  const std::string &dirEntry = XATTR_FILE_PREFIX + getDirPath(entryName);
-  const std::string *pathXAttr = 0;
-
-  stat->statBuff.st_size = 0;
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
 
-  if (mtdPool == 0)
-    return -ENODEV;
+    for (LinkedList *link = shards[i].head; link != 0; link = link->previous)
+      dirs.push_back(link->cachePtr);
+  }
+}
 
-  Inode inode;
-  ret = getDirInode(parentDir, inode, mtdPool);
+std::tr1::shared_ptr<DirCache>
+PriorityCache::update(std::tr1::shared_ptr<DirCache> cache)
+{
+  const std::string &inode = cache->inode();
+  const size_t dirSize = cache->memorySize();
+  const size_t index = shardIndex(inode);
+  PriorityCacheShard &shard = shards[index];
+  std::vector<std::tr1::shared_ptr<DirCache> > removed;
+  LinkedList *link = 0;
 
-  if (ret != 0)
-    return ret;
+  {
+    boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  std::set<std::string> keys;
-  std::map<std::string, librados::bufferlist> omap;
+    std::map<std::string, LinkedList *>::iterator it;
+    it = shard.cacheMap.find(inode);
 
-  keys.insert(fileEntry);
-  keys.insert(dirEntry);
-  ret = inode.pool->ioctx.omap_get_vals_by_keys(inode.inode, keys, &omap);
+    if (it != shard.cacheMap.end())
+      link = (*it).second;
 
-  if (omap.count(fileEntry) > 0)
-  {
-    pathXAttr = &fileEntry;
-  }
-  else if (omap.count(dirEntry) > 0)
-  {
-    pathXAttr = &dirEntry;
-  }
-  else
-  {
-    ret = -ENOENT;
-  }
+    // A dir that alone is bigger than the cache is not kept in it
+    if (dirSize > maxSize())
+    {
+      if (link)
+        updateSize(0, shard.removeCache(link, removed));
 
-  if (ret < 0)
-    return ret;
+      return cache;
+    }
 
-  librados::bufferlist fileXAttr = omap[*pathXAttr];
-  std::string linkStr(fileXAttr.c_str(), fileXAttr.length());
+    if (link == 0)
+    {
+      link = new LinkedList;
+      link->cachePtr = cache;
+      link->next = 0;
+      link->previous = 0;
+      link->lastSize = 0;
 
-  stat->path = parentDir + pathXAttr->substr(strlen(XATTR_FILE_PREFIX));
+      shard.cacheMap[inode] = link;
+    }
+    else if (link->cachePtr != cache)
+    {
+      // There is already a different cache object for the same dir, so that's
+      // the one that is kept
+      cache = link->cachePtr;
+    }
 
-  ret = statFromXAttr(stat->path, linkStr, &stat->statBuff,
-                      stat->translatedPath, pool, stat->extraData);
+    const size_t previousSize = link->lastSize;
+    link->lastSize = cache->memorySize();
+    shard.cacheSize += link->lastSize;
+    shard.cacheSize -= previousSize;
+    updateSize(link->lastSize, previousSize);
 
-  if (stat->translatedPath == "")
-  {
-    ret = -ENOLINK;
+    shard.moveToFront(link);
   }
 
-  return ret;
+  adjustCache(index);
+
+  return cache;
 }
 
-int
-FilesystemPriv::getRealPath(const std::string &path,  Stat *stat,
-                            std::string &realPath)
+void
+PriorityCache::adjustCache(size_t usedShard)
 {
-  int ret = -ENOENT;
-  realPath = path;
-
-  stat->reset();
-
-  while(true)
+  std::vector<std::tr1::shared_ptr<DirCache> > removed;
+  size_t index = usedShard % DIR_CACHE_NUM_SHARDS;
+
+  // Evict only as much as needed to get back under the maximum size, starting
+  // with the least recently used dirs in the shard that was just used (but
+  // never the dir that was just used) and going through the other shards if
+  // needed, so no more than one shard is locked at a time
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
   {
-    ret = this->stat(realPath, stat);
+    const size_t currentSize = size();
+    const size_t maximumSize = maxSize();
 
-    if (ret == 0)
-    {
-      realPath = stat->path;
+    if (currentSize <= maximumSize)
       break;
-    }
 
-    std::string parent = getParentDir(realPath, 0);
+    size_t excess = currentSize - maximumSize;
+    PriorityCacheShard &shard = shards[index];
 
-    while (parent != "")
     {
-      int ret = this->stat(parent, stat);
+      boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-      if (ret == -ENOENT)
-      {
-        parent = getParentDir(parent, 0);
-      }
-      else if (ret == 0)
+      while (excess > 0 && shard.tail != 0 &&
+             (index != usedShard || shard.tail != shard.head))
       {
-        break;
-      }
-      else
-      {
-        stat->reset();
-        return ret;
+        const size_t freed = shard.removeCache(shard.tail, removed);
+
+        updateSize(0, freed);
+        excess -= std::min(freed, excess);
       }
     }
 
-    if (parent == "")
-      return -ENODEV;
+    index = (index + 1) % DIR_CACHE_NUM_SHARDS;
+  }
+}
 
-    if (S_ISLNK(stat->statBuff.st_mode))
-    {
-      realPath = stat->translatedPath + realPath.substr(parent.length());
-      continue;
-    }
+void
+DirPathCacheShard::remove(std::map<std::string, DirPathCacheEntry>::iterator it)
+{
+  lru.erase((*it).second.lruIt);
+  entries.erase(it);
+}
 
-    break;
-  }
+DirPathCache::DirPathCache()
+  : maxNumEntries(DEFAULT_DIR_PATH_CACHE_MAX_SIZE),
+    entriesTTL(DEFAULT_DIR_PATH_CACHE_TTL)
+{}
 
-  return ret;
+DirPathCache::~DirPathCache()
+{}
+
+size_t
+DirPathCache::shardIndex(const std::string &path) const
+{
+  return hash(path.c_str()) % DIR_PATH_CACHE_NUM_SHARDS;
 }
 
-int
-FilesystemPriv::getDirInode(const std::string &path, Inode &inode,
-                            PoolSP &mtdPool)
+bool
+DirPathCache::get(const std::string &path, Inode &inode)
 {
-  {
-    boost::unique_lock<boost::mutex> (dirPathInodeMutex);
+  DirPathCacheShard &shard = shards[shardIndex(path)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-    if (dirPathInodeMap.count(path) > 0)
-      inode = dirPathInodeMap[path];
-  }
+  std::map<std::string, DirPathCacheEntry>::iterator it;
+  it = shard.entries.find(path);
 
-  if (inode.inode == "")
+  if (it == shard.entries.end())
+    return false;
+
+  DirPathCacheEntry &entry = (*it).second;
+
+  if (entry.expiration <= boost::chrono::steady_clock::now())
   {
-    std::string inodeName, poolName;
+    shard.remove(it);
+    return false;
+  }
 
-    int ret = getInodeAndPool(mtdPool->ioctx, path, inodeName, poolName);
+  shard.lru.splice(shard.lru.begin(), shard.lru, entry.lruIt);
+  inode = entry.inode;
 
-    if (ret != 0)
-      return ret;
+  return true;
+}
 
-    PoolSP pool = getMtdPoolFromName(poolName);
+void
+DirPathCache::insert(const std::string &path, const Inode &inode, float ttl)
+{
+  const size_t maxShardEntries =
+      std::max(maxSize() / DIR_PATH_CACHE_NUM_SHARDS, (size_t) 1);
+  DirPathCacheShard &shard = shards[shardIndex(path)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-    if (!pool)
-      return -ENODEV;
+  std::map<std::string, DirPathCacheEntry>::iterator it;
+  it = shard.entries.find(path);
 
-    inode.inode = inodeName;
-    inode.pool = pool;
-    setDirInode(path, inode);
+  if (it == shard.entries.end())
+  {
+    shard.lru.push_front(path);
+    it = shard.entries.insert(std::make_pair(path, DirPathCacheEntry())).first;
+    (*it).second.lruIt = shard.lru.begin();
+  }
+  else
+  {
+    shard.lru.splice(shard.lru.begin(), shard.lru, (*it).second.lruIt);
   }
 
-  return 0;
+  (*it).second.inode = inode;
+  (*it).second.expiration = boost::chrono::steady_clock::now() +
+                            boost::chrono::milliseconds((int) (ttl * 1000));
+
+  while (shard.entries.size() > maxShardEntries)
+    shard.remove(shard.entries.find(shard.lru.back()));
 }
 
-int
-FilesystemPriv::getDirInode(const std::string &path, Inode &inode)
+void
+DirPathCache::set(const std::string &path, const Inode &inode)
 {
-  PoolSP mtdPool = getMetadataPoolFromPath(path);
-  return getDirInode(path, inode, mtdPool);
+  insert(path, inode, ttl());
 }
 
 void
-FilesystemPriv::setDirInode(const std::string &path, const Inode &inode)
+DirPathCache::setMissing(const std::string &path)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
-  dirPathInodeMap[path] = inode;
+  // Negative entries are kept for a short time only since they cannot be
+  // invalidated when the dir is created by a different client
+  insert(path, Inode(), std::min(ttl(), (float) DIR_PATH_CACHE_NEGATIVE_TTL));
 }
 
 void
-FilesystemPriv::updateDirInode(const std::string &oldPath,
-                               const std::string &newPath)
+DirPathCache::move(const std::string &oldPath, const std::string &newPath)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
+  Inode inode;
+  const bool cached = get(oldPath, inode) && inode.inode != "";
 
-  if (dirPathInodeMap.count(oldPath) > 0)
-  {
-    dirPathInodeMap[newPath] = dirPathInodeMap[oldPath];
-    dirPathInodeMap.erase(oldPath);
-  }
+  remove(oldPath);
+
+  if (cached)
+    set(newPath, inode);
+  else
+    remove(newPath);
 }
 
 void
-FilesystemPriv::removeDirInode(const std::string &path)
+DirPathCache::remove(const std::string &path)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
-  dirPathInodeMap.erase(path);
+  DirPathCacheShard &shard = shards[shardIndex(path)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
+
+  std::map<std::string, DirPathCacheEntry>::iterator it;
+  it = shard.entries.find(path);
+
+  if (it != shard.entries.end())
+    shard.remove(it);
 }
 
 void
-FilesystemPriv::launchThreads(void)
+DirPathCache::clear(void)
 {
-  size_t threadsToLaunch = DEFAULT_NUM_WORKER_THREADS;
-  size_t currentLaunchedThreads = generalWorkerThreads.size();
-
+  for (size_t i = 0; i < DIR_PATH_CACHE_NUM_SHARDS; i++)
   {
-    boost::unique_lock<boost::mutex> lock(genericWorkersMutex);
-
-    threadsToLaunch = numGenericWorkers;
+    boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
+    shards[i].entries.clear();
+    shards[i].lru.clear();
   }
+}
 
-  while (threadsToLaunch < currentLaunchedThreads)
-  {
-    boost::thread *thread = genericWorkersList.back();
-    genericWorkersList.pop_back();
-    currentLaunchedThreads--;
-
-    generalWorkerThreads.remove_thread(thread);
-    delete thread;
-  }
+size_t
+DirPathCache::size(void)
+{
+  size_t numEntries = 0;
 
-  while (threadsToLaunch > currentLaunchedThreads)
+  for (size_t i = 0; i < DIR_PATH_CACHE_NUM_SHARDS; i++)
   {
-    boost::thread *thread = generalWorkerThreads.create_thread(
-                              boost::bind(&FilesystemPriv::generalWorkerThread,
-                                          this, ioService));
-    genericWorkersList.push_back(thread);
-    currentLaunchedThreads++;
+    boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
+    numEntries += shards[i].entries.size();
   }
-}
 
-boost::shared_ptr<boost::asio::io_service>
-FilesystemPriv::getIoService()
-{
-  launchThreads();
-  return ioService;
+  return numEntries;
 }
 
-int
-FilesystemPriv::resetFileEntry(Stat &fileStat)
+void
+DirPathCache::setMaxSize(size_t size)
 {
-  if (!fileStat.pool)
-    return -ENODEV;
-
-  std::string parentDir = getParentDir(fileStat.path, 0);
-  Stat parentStat;
-
-  int ret = stat(parentDir, &parentStat);
+  {
+    boost::unique_lock<boost::mutex> lock(settingsMutex);
+    maxNumEntries = size;
+  }
 
-  if (ret != 0)
-    return ret;
+  const size_t maxShardEntries =
+      std::max(size / DIR_PATH_CACHE_NUM_SHARDS, (size_t) 1);
 
-  std::string omapFileEntry = XATTR_FILE_PREFIX +
-                              fileStat.path.substr(parentDir.length());
-  std::map<std::string, librados::bufferlist> omap;
+  for (size_t i = 0; i < DIR_PATH_CACHE_NUM_SHARDS; i++)
+  {
+    DirPathCacheShard &shard = shards[i];
+    boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  std::string fileEntry = getFileXAttrDirRecord(&fileStat);
-  omap[omapFileEntry].append(fileEntry);
+    while (shard.entries.size() > maxShardEntries)
+      shard.remove(shard.entries.find(shard.lru.back()));
+  }
+}
 
-  librados::ObjectWriteOperation writeOp;
-  writeOp.assert_exists();
-  writeOp.omap_set(omap);
+size_t
+DirPathCache::maxSize(void)
+{
+  boost::unique_lock<boost::mutex> lock(settingsMutex);
+  return maxNumEntries;
+}
 
-  return parentStat.pool->ioctx.operate(parentStat.translatedPath, &writeOp);
+void
+DirPathCache::setTTL(float seconds)
+{
+  boost::unique_lock<boost::mutex> lock(settingsMutex);
+  entriesTTL = seconds;
 }
 
-int
-FilesystemPriv::resetDirLogicalObj(Stat &dirStat)
+float
+DirPathCache::ttl(void)
 {
-  if (!dirStat.pool)
-    return -ENODEV;
+  boost::unique_lock<boost::mutex> lock(settingsMutex);
+  return entriesTTL;
+}
 
-  std::map<std::string, librados::bufferlist> omap;
-  std::string inode = makeInodeXattr(&dirStat);
+MissingEntriesCacheShard::MissingEntriesCacheShard()
+  : numEntries(0)
+{}
 
-  omap[XATTR_INODE].append(inode);
+void
+MissingEntriesCacheShard::remove(std::map<std::string, MissingEntries>::iterator it)
+{
+  numEntries -= (*it).second.entries.size();
+  dirs.erase(it);
+}
 
-  librados::ObjectWriteOperation writeOp;
-  writeOp.assert_exists();
-  writeOp.omap_set(omap);
+void
+MissingEntriesCacheShard::removeExpired(void)
+{
+  const boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+  std::map<std::string, MissingEntries>::iterator it = dirs.begin();
 
-  return dirStat.pool->ioctx.operate(dirStat.path, &writeOp);
+  while (it != dirs.end())
+  {
+    if ((*it).second.expiration <= now)
+      remove(it++);
+    else
+      it++;
+  }
 }
 
-static size_t
-getInlineBufferCapacityFromExtraData(
-                                 const std::map<std::string, std::string> &data)
+size_t
+MissingEntriesCache::shardIndex(const std::string &parentInode) const
 {
-  std::map<std::string, std::string>::const_iterator it;
-  it = data.find(XATTR_FILE_INLINE_BUFFER_SIZE);
+  return hash(parentInode.c_str()) % MISSING_ENTRIES_CACHE_NUM_SHARDS;
+}
 
-  if (it == data.end())
-    return 0;
+bool
+MissingEntriesCache::isMissing(const std::string &parentInode,
+                               uint64_t generation, const std::string &entry)
+{
+  MissingEntriesCacheShard &shard = shards[shardIndex(parentInode)];
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
 
-  const std::string &sizeStr = (*it).second;
+  std::map<std::string, MissingEntries>::iterator it;
+  it = shard.dirs.find(parentInode);
 
-  return strtoul(sizeStr.c_str(), 0, 10);
+  if (it == shard.dirs.end())
+    return false;
+
+  // The missing entries are only valid for a short time and while the parent
+  // dir's log doesn't grow
+  if ((*it).second.generation != generation ||
+      (*it).second.expiration <= boost::chrono::steady_clock::now())
+  {
+    shard.remove(it);
+    return false;
+  }
+
+  return (*it).second.entries.count(entry) > 0;
 }
 
-int
-FilesystemPriv::statEntry(std::string path, std::string entry,
-                          size_t inlineBufferSize, Stat *stat)
+void
+MissingEntriesCache::setMissing(const std::string &parentInode,
+                                uint64_t generation, const std::string &entry)
 {
-  PoolSP dataPool;
-  std::string pool;
-  int ret = statFromXAttr(path, entry, &stat->statBuff, stat->translatedPath,
-                          pool, stat->extraData);
+  MissingEntriesCacheShard &shard = shards[shardIndex(parentInode)];
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
 
-  if (ret != 0)
+  std::map<std::string, MissingEntries>::iterator it;
+  it = shard.dirs.find(parentInode);
+
+  if (it != shard.dirs.end() && (*it).second.generation != generation)
   {
-    return ret;
+    shard.remove(it);
+    it = shard.dirs.end();
   }
 
-  dataPool = getDataPool(path, pool);
-  stat->pool = dataPool;
-
-  // We only have to check the file inode's chunks if the inline buffer's
-  // capacity is zero of it is completely filled up
-  size_t capacity = getInlineBufferCapacityFromExtraData(stat->extraData);
-  if (capacity > 0 && inlineBufferSize != capacity)
+  if (shard.numEntries >=
+      MISSING_ENTRIES_CACHE_MAX_SIZE / MISSING_ENTRIES_CACHE_NUM_SHARDS)
   {
-    stat->statBuff.st_size = inlineBufferSize;
+    shard.removeExpired();
+
+    if (shard.numEntries >=
+        MISSING_ENTRIES_CACHE_MAX_SIZE / MISSING_ENTRIES_CACHE_NUM_SHARDS)
+    {
+      shard.dirs.clear();
+      shard.numEntries = 0;
+    }
+
+    it = shard.dirs.find(parentInode);
   }
-  else
+
+  if (it == shard.dirs.end())
   {
-    FileIOSP fileIO = getOrCreateFileIO(stat->translatedPath, stat);
-    stat->statBuff.st_size = fileIO->getSize();
+    MissingEntries missingEntries;
+    missingEntries.generation = generation;
+    missingEntries.expiration = boost::chrono::steady_clock::now() +
+                                boost::chrono::seconds(MISSING_ENTRIES_CACHE_TTL);
+
+    it = shard.dirs.insert(std::make_pair(parentInode, missingEntries)).first;
   }
 
-  return ret;
+  if ((*it).second.entries.insert(entry).second)
+    shard.numEntries++;
 }
 
 void
-FilesystemPriv::generalWorkerThread(
-    boost::shared_ptr<boost::asio::io_service> ioService)
+MissingEntriesCache::clear(const std::string &parentInode)
 {
-  ioService->run();
+  MissingEntriesCacheShard &shard = shards[shardIndex(parentInode)];
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
+
+  std::map<std::string, MissingEntries>::iterator it;
+  it = shard.dirs.find(parentInode);
+
+  if (it != shard.dirs.end())
+    shard.remove(it);
 }
 
 void
-FilesystemPriv::statEntries(StatAsyncInfo *info,
-                            std::map<std::string, std::string> &xattrs)
+MissingEntriesCache::clear(void)
 {
-  for (size_t i = 0; i < info->entries->size(); i++)
+  for (size_t i = 0; i < MISSING_ENTRIES_CACHE_NUM_SHARDS; i++)
   {
-    const std::string &entryName = (*info->entries)[i];
-    const std::string &path = info->stat.path + entryName;
-    const std::string &xattr = xattrs[XATTR_FILE_PREFIX + entryName];
+    boost::unique_lock<boost::mutex> lock(shards[i].mutex);
+    shards[i].dirs.clear();
+    shards[i].numEntries = 0;
+  }
+}
 
-    Stat stat;
+size_t
+MissingEntriesCache::size(void)
+{
+  size_t numEntries = 0;
 
-    if (xattr == "")
-    {
-      stat.path = path;
-      info->entryStats[path] = std::pair<int, Stat>(-ENOENT, stat);
-      continue;
-    }
+  for (size_t i = 0; i < MISSING_ENTRIES_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(shards[i].mutex);
+    numEntries += shards[i].numEntries;
+  }
 
-    // Get the inline buffer's size as this might determine the file's size
-    const std::string &inlineBuffer = xattrs[XATTR_FILE_INLINE_BUFFER +
-                                             entryName];
-    size_t inlineBufferSize = 0;
-    if (inlineBuffer.length() > XATTR_FILE_INLINE_BUFFER_HEADER_SIZE)
-    {
-      inlineBufferSize = inlineBuffer.length() -
-                         XATTR_FILE_INLINE_BUFFER_HEADER_SIZE;
-    }
+  return numEntries;
+}
 
-    int ret = statEntry(path, xattr, inlineBufferSize, &stat);
+size_t
+FileIORegistry::shardIndex(const std::string &inode) const
+{
+  return hash(inode.c_str()) % FILE_IO_REGISTRY_NUM_SHARDS;
+}
 
-    if (ret == 0 || info->entryStats.count(path) == 0)
-    {
-      info->entryStats[path] = std::pair<int, Stat>(ret, stat);
-    }
-  }
+FileIOSP
+FileIORegistry::get(const std::string &inode)
+{
+  FileIORegistryShard &shard = shards[shardIndex(inode)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
+
+  std::map<std::string, FileIOSP>::iterator it = shard.entries.find(inode);
+
+  if (it == shard.entries.end())
+    return FileIOSP();
+
+  return (*it).second;
 }
 
-void
-FilesystemPriv::statAsync(StatAsyncInfo *info)
+FileIOSP
+FileIORegistry::acquire(const std::string &inode)
 {
-  std::map<std::string, std::string> xattrs;
-  u_int64_t size;
-  time_t mtime;
-  xattrs[XATTR_PERMISSIONS] = "";
-  xattrs[XATTR_MTIME] = "";
-  xattrs[XATTR_CTIME] = "";
+  FileIORegistryShard &shard = shards[shardIndex(inode)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  for (size_t i = 0; i < info->entries->size(); i++)
-  {
-    const std::string &entryName = (*info->entries)[i];
-    const std::string &entry = XATTR_FILE_PREFIX + entryName;
-    const std::string &inlineBuffer = XATTR_FILE_INLINE_BUFFER + entryName;
-    xattrs[entry] = "";
-    xattrs[inlineBuffer] = "";
-  }
+  // A file being moved to another data pool gets the FileIO of that pool
+  while (shard.moving.count(inode) > 0)
+    shard.movingCond.wait(lock);
 
-  info->statRet = statAndGetXAttrs(info->stat.pool->ioctx,
-                                   info->stat.translatedPath, &size,
-                                   &mtime, xattrs);
+  std::map<std::string, FileIOSP>::iterator it = shard.entries.find(inode);
 
-  genericStatFromAttrs(info->stat.path, xattrs[XATTR_PERMISSIONS],
-                       xattrs[XATTR_CTIME], xattrs[XATTR_MTIME], size, mtime,
-                       &info->stat.statBuff);
+  if (it == shard.entries.end())
+    return FileIOSP();
 
-  if (info->entries->size() == 0 || info->statRet != 0)
-    return;
+  // The client is counted while locked so the entry cannot be found unused
+  // before the caller gets to use it
+  (*it).second->addClient();
 
-  statEntries(info, xattrs);
+  return (*it).second;
 }
 
-int
-FilesystemPriv::statAsyncInfoInThread(const std::string path,
-                                      StatAsyncInfo *info, boost::mutex *mutex,
-                                      boost::condition_variable *cond,
-                                      int *numJobs)
+FileIOSP
+FileIORegistry::add(FileIOSP io)
 {
-  int ret;
-  info->stat.reset();
-  info->stat.path = getDirPath(path);
-  PoolSP mtdPool = getMetadataPoolFromPath(info->stat.path);
+  FileIORegistryShard &shard = shards[shardIndex(io->inode())];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  if (!mtdPool.get())
+  while (shard.moving.count(io->inode()) > 0)
+    shard.movingCond.wait(lock);
+
+  // If another thread registered a FileIO for the same inode meanwhile, that
+  // one is used instead
+  std::pair<std::map<std::string, FileIOSP>::iterator, bool> result =
+      shard.entries.insert(std::make_pair(io->inode(), io));
+
+  (*result.first).second->addClient();
+
+  return (*result.first).second;
+}
+
+void
+FileIORegistry::set(FileIOSP io)
+{
+  FileIOSP oldIO;
+  FileIORegistryShard &shard = shards[shardIndex(io->inode())];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
+
+  FileIOSP &entry = shard.entries[io->inode()];
+
+  // The replaced FileIO is only destroyed (if unused) after unlocking
+  oldIO.swap(entry);
+  entry = io;
+  lock.unlock();
+}
+
+void
+FileIORegistry::remove(FileIOSP io)
+{
+  FileIOSP oldIO;
+  FileIORegistryShard &shard = shards[shardIndex(io->inode())];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
+
+  std::map<std::string, FileIOSP>::iterator it =
+      shard.entries.find(io->inode());
+
+  if (it != shard.entries.end() && (*it).second == io)
   {
-    ret = -ENODEV;
-    return ret;
+    oldIO.swap((*it).second);
+    shard.entries.erase(it);
   }
 
-  Inode inode;
-  ret = getDirInode(info->stat.path, inode, mtdPool);
+  lock.unlock();
+}
 
-  if (ret == 0)
-  {
-    info->stat.pool = inode.pool;
-    info->stat.translatedPath = inode.inode;
+bool
+FileIORegistry::removeIfUnused(const std::string &inode, FileIOSP &io)
+{
+  FileIORegistryShard &shard = shards[shardIndex(inode)];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-    statAsync(info);
-  }
-  else
+  std::map<std::string, FileIOSP>::iterator it = shard.entries.find(inode);
+
+  if (it == shard.entries.end())
   {
-    info->statRet = ret;
+    io.reset();
+    return false;
   }
 
-  mutex->lock();
-  int remaininNumJobs = --*numJobs;
-  mutex->unlock();
+  io = (*it).second;
 
-  if (remaininNumJobs == 0)
-    cond->notify_all();
+  if (io->numClients() > 0 || io->hasRunningAsyncOps() ||
+      shard.moving.count(inode) > 0)
+    return false;
 
-  return ret;
+  // The caller holds the last reference so the FileIO is destroyed outside of
+  // the lock
+  shard.entries.erase(it);
+
+  return true;
 }
 
-static void
-gatherPathsByParentDir(const std::vector<std::string> &paths,
-                       std::map<std::string, std::vector<std::string> > &entries)
+bool
+FileIORegistry::startMove(FileIOSP io)
 {
-  for (size_t i = 0; i < paths.size(); i++)
-  {
-    const std::string &path = paths[i];
+  FileIORegistryShard &shard = shards[shardIndex(io->inode())];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-    if (path == "/" && entries.count(path) == 0)
-    {
-      entries[path].clear();
-      continue;
-    }
+  std::map<std::string, FileIOSP>::iterator it =
+      shard.entries.find(io->inode());
 
-    std::string parentDir = getParentDir(path, 0);
-    entries[parentDir].push_back(path.substr(parentDir.length()));
-  }
+  // Only the caller may be using the FileIO (other clients could keep writing
+  // to its current pool); new clients wait until the move is finished
+  if (it == shard.entries.end() || (*it).second != io ||
+      io->numClients() > 1 || shard.moving.count(io->inode()) > 0)
+    return false;
+
+  shard.moving.insert(io->inode());
+
+  return true;
 }
 
-std::map<std::string, std::pair<int, Stat> >
-FilesystemPriv::stat(const std::vector<std::string> &paths)
+void
+FileIORegistry::finishMove(FileIOSP io, FileIOSP movedIO)
 {
-  std::map<std::string, std::pair<int, Stat> > stats;
-  std::map<std::string, std::vector<std::string> > entries;
+  FileIOSP oldIO;
+  FileIORegistryShard &shard = shards[shardIndex(io->inode())];
+  boost::unique_lock<InstrumentedMutex> lock(shard.mutex);
 
-  gatherPathsByParentDir(paths, entries);
+  // The FileIO of the new pool replaces the old one before any waiting client
+  // can get it
+  if (movedIO)
+  {
+    FileIOSP &entry = shard.entries[io->inode()];
+    oldIO.swap(entry);
+    entry = movedIO;
+  }
 
-  parallelStat(entries, &stats);
+  shard.moving.erase(io->inode());
+  shard.movingCond.notify_all();
+  lock.unlock();
+}
 
-  // Call parallel stat again on the paths that were not found
-  entries.clear();
-  std::map<std::string, std::pair<int, Stat> >::iterator it;
-  for (it = stats.begin(); it != stats.end(); it++)
+void
+FileIORegistry::clear(void)
+{
+  for (size_t i = 0; i < FILE_IO_REGISTRY_NUM_SHARDS; i++)
   {
-    std::pair<int, Stat> statResult = (*it).second;
+    std::map<std::string, FileIOSP> entries;
 
-    if (statResult.first != 0)
     {
-      const std::string &path = (*it).first;
-      entries[path].clear();
+      boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
+      entries.swap(shards[i].entries);
     }
   }
+}
 
-  if (entries.size())
-    parallelStat(entries, &stats);
+size_t
+FileIORegistry::size(void)
+{
+  size_t numEntries = 0;
 
-  return stats;
+  for (size_t i = 0; i < FILE_IO_REGISTRY_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<InstrumentedMutex> lock(shards[i].mutex);
+    numEntries += shards[i].entries.size();
+  }
+
+  return numEntries;
 }
 
-void
+bool
+LinkPrefixCache::resolve(const std::string &path, std::string &resolvedPath)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (links.empty() || path.length() < 2)
+    return false;
+
+  const boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+
+  // Look for the longest parent path of the given one that is a known link
+  size_t pos = path.rfind(PATH_SEP, path.length() - 2);
+
+  while (pos != std::string::npos && pos > 0)
+  {
+    const std::string prefix = path.substr(0, pos + 1);
+    std::map<std::string, LinkPrefixCacheEntry>::iterator it;
+
+    it = links.find(prefix);
+
+    if (it != links.end())
+    {
+      if ((*it).second.expiration > now)
+      {
+        resolvedPath = (*it).second.target + path.substr(prefix.length());
+        return true;
+      }
+
+      links.erase(it);
+    }
+
+    pos = path.rfind(PATH_SEP, pos - 1);
+  }
+
+  return false;
+}
+
+void
+LinkPrefixCache::removeExpired(void)
+{
+  const boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+  std::map<std::string, LinkPrefixCacheEntry>::iterator it = links.begin();
+
+  while (it != links.end())
+  {
+    if ((*it).second.expiration <= now)
+      links.erase(it++);
+    else
+      it++;
+  }
+}
+
+void
+LinkPrefixCache::set(const std::string &linkPath, const std::string &target,
+                     float ttl)
+{
+  // Only links to directories can be prefixes of other paths
+  if (!isDirPath(linkPath) || !isDirPath(target))
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (links.size() >= LINK_PREFIX_CACHE_MAX_SIZE && links.count(linkPath) == 0)
+  {
+    removeExpired();
+
+    if (links.size() >= LINK_PREFIX_CACHE_MAX_SIZE)
+      links.erase(links.begin());
+  }
+
+  LinkPrefixCacheEntry &entry = links[linkPath];
+  entry.target = target;
+  entry.expiration = boost::chrono::steady_clock::now() +
+                     boost::chrono::milliseconds((int) (ttl * 1000));
+}
+
+void
+LinkPrefixCache::remove(const std::string &path)
+{
+  const std::string prefix = getDirPath(path);
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  // Remove the link itself and any link under it (if it is a directory)
+  std::map<std::string, LinkPrefixCacheEntry>::iterator it;
+  it = links.lower_bound(prefix);
+
+  while (it != links.end() &&
+         (*it).first.compare(0, prefix.length(), prefix) == 0)
+  {
+    links.erase(it++);
+  }
+}
+
+void
+LinkPrefixCache::clear(void)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  links.clear();
+}
+
+size_t
+LinkPrefixCache::size(void)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  return links.size();
+}
+
+PoolRouter::PoolRouter(const PoolListMap &map)
+{
+  nodes.push_back(PoolRouterNode());
+
+  PoolListMap::const_iterator it;
+  for (it = map.begin(); it != map.end(); it++)
+    addPrefix((*it).first, (*it).second);
+}
+
+PoolRouter::PoolRouter(const PoolMap &map)
+{
+  nodes.push_back(PoolRouterNode());
+
+  PoolMap::const_iterator it;
+  for (it = map.begin(); it != map.end(); it++)
+    addPrefix((*it).first, PoolList(1, (*it).second));
+}
+
+void
+PoolRouter::addPrefix(const std::string &prefix, const PoolList &pools)
+{
+  // The prefixes are dir paths, so each node of the trie is one of their
+  // components and the root node corresponds to the "/" prefix
+  size_t nodeIndex = 0;
+  size_t pos = 1;
+  size_t next;
+
+  while ((next = prefix.find(PATH_SEP, pos)) != std::string::npos)
+  {
+    const std::string component = prefix.substr(pos, next - pos);
+    std::map<std::string, size_t>::const_iterator it;
+
+    it = nodes[nodeIndex].children.find(component);
+
+    if (it == nodes[nodeIndex].children.end())
+    {
+      nodes.push_back(PoolRouterNode());
+      nodes[nodeIndex].children[component] = nodes.size() - 1;
+      nodeIndex = nodes.size() - 1;
+    }
+    else
+    {
+      nodeIndex = (*it).second;
+    }
+
+    pos = next + 1;
+  }
+
+  nodes[nodeIndex].prefix = prefix;
+  nodes[nodeIndex].pools = pools;
+}
+
+void
+PoolRouter::matchingNodes(const std::string &path,
+                          std::vector<const PoolRouterNode *> &matches) const
+{
+  const PoolRouterNode *node = &nodes[0];
+  size_t pos = 1;
+  size_t next;
+
+  if (path.empty() || path[0] != PATH_SEP)
+    return;
+
+  if (!node->pools.empty())
+    matches.push_back(node);
+
+  while ((next = path.find(PATH_SEP, pos)) != std::string::npos)
+  {
+    std::map<std::string, size_t>::const_iterator it;
+
+    it = node->children.find(path.substr(pos, next - pos));
+
+    if (it == node->children.end())
+      break;
+
+    node = &nodes[(*it).second];
+
+    if (!node->pools.empty())
+      matches.push_back(node);
+
+    pos = next + 1;
+  }
+}
+
+PoolList
+PoolRouter::pools(const std::string &path, std::string *prefix) const
+{
+  std::vector<const PoolRouterNode *> matches;
+
+  matchingNodes(path, matches);
+
+  if (matches.empty())
+    return PoolList();
+
+  if (prefix)
+    prefix->assign(matches.back()->prefix);
+
+  return matches.back()->pools;
+}
+
+PoolSP
+PoolRouter::pool(const std::string &path, const std::string &poolName) const
+{
+  std::vector<const PoolRouterNode *> matches;
+
+  matchingNodes(path, matches);
+
+  // Look for the pool starting with the longest prefix
+  std::vector<const PoolRouterNode *>::const_reverse_iterator it;
+  for (it = matches.rbegin(); it != matches.rend(); it++)
+  {
+    const PoolList &pools = (*it)->pools;
+
+    if (poolName == "")
+      return pools.front();
+
+    PoolList::const_iterator poolIt;
+    for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
+    {
+      if ((*poolIt)->name == poolName)
+        return *poolIt;
+    }
+  }
+
+  return PoolSP();
+}
+
+int
+FilesystemPriv::createCluster(const std::string &userName,
+                              const std::string &confFile)
+{
+  int ret;
+  const char *user = 0;
+
+  if (userName != "")
+    user = userName.c_str();
+
+  ret = radosCluster.init(user);
+
+  if (ret != 0)
+    return ret;
+
+  if (confFile != "")
+  {
+    ret = radosCluster.conf_read_file(confFile.c_str());
+
+    if (ret != 0)
+      return ret;
+  }
+
+  ret = radosCluster.connect();
+
+  initialized = (ret == 0);
+
+  return ret;
+}
+
+static size_t
+getInlineBufferCapacityFromExtraData(
+                                 const std::map<std::string, std::string> &data)
+{
+  std::map<std::string, std::string>::const_iterator it;
+  it = data.find(XATTR_FILE_INLINE_BUFFER_SIZE);
+
+  if (it == data.end())
+    return 0;
+
+  const std::string &sizeStr = (*it).second;
+
+  return strtoul(sizeStr.c_str(), 0, 10);
+}
+
+static void
+setSizeFromParent(Stat *stat, librados::bufferlist &inlineBuffer,
+                  const std::string &sizeHint)
+{
+  // If there is an inline buffer and it is not fully filled, then it already
+  // gives us the size of the file, otherwise, we check the size hint left in
+  // the parent dir by the file's writers
+  const size_t capacity = getInlineBufferCapacityFromExtraData(stat->extraData);
+  std::string inlineContents;
+  timespec mtime = stat->statBuff.st_mtim;
+
+  if (capacity > 0)
+  {
+    FileInlineBuffer::readInlineBuffer(inlineBuffer, &mtime, &inlineContents);
+
+    if (inlineContents.length() < capacity)
+    {
+      stat->statBuff.st_size = inlineContents.length();
+      stat->statBuff.st_mtim = mtime;
+      stat->statBuff.st_mtime = mtime.tv_sec;
+      stat->sizeHint = SIZE_HINT_VALID;
+
+      return;
+    }
+  }
+
+  uint64_t size = 0;
+  timespec hintedMtime;
+  bool hasMtime = false;
+
+  stat->sizeHintValue = sizeHint;
+  stat->sizeHint = readFileSizeHint(sizeHint, stat->translatedPath, &size,
+                                    &hintedMtime, &hasMtime);
+
+  if (stat->sizeHint != SIZE_HINT_VALID)
+    return;
+
+  // The hinted size and mtime are only set once the hint is verified against
+  // the file inode (by the ones using it, since the path resolution does not
+  // need them)
+  stat->sizeHint = SIZE_HINT_UNVERIFIED;
+  stat->statBuff.st_size = inlineContents.length();
+
+  if (capacity > 0)
+  {
+    stat->statBuff.st_mtim = mtime;
+    stat->statBuff.st_mtime = mtime.tv_sec;
+  }
+}
+
+int
+FilesystemPriv::statLink(PoolSP mtdPool, Stat *stat, std::string &pool)
+{
+  int ret = 0;
+  const std::string &parentDir = getParentDir(stat->path, 0);
+  const std::string entryName = stat->path.substr(parentDir.length());
+  const std::string &fileEntry = XATTR_FILE_PREFIX + getFilePath(entryName);
+  const std::string &dirEntry = XATTR_FILE_PREFIX + getDirPath(entryName);
+  const std::string &inlineBufferEntry = XATTR_FILE_INLINE_BUFFER +
+                                         getFilePath(entryName);
+  const std::string &sizeHintEntry = XATTR_FILE_SIZE_HINT +
+                                     getFilePath(entryName);
+  const std::string *pathXAttr = 0;
+
+  stat->statBuff.st_size = 0;
+
+  if (mtdPool == 0)
+    return -ENODEV;
+
+  Inode inode;
+  ret = getDirInode(parentDir, inode, mtdPool);
+
+  if (ret != 0)
+    return ret;
+
+  const std::string missingEntry = getFilePath(entryName);
+  const uint64_t generation = dirGeneration(inode.inode);
+
+  if (missingEntries.isMissing(inode.inode, generation, missingEntry))
+    return -ENOENT;
+
+  std::set<std::string> keys;
+  std::map<std::string, librados::bufferlist> omap;
+
+  keys.insert(fileEntry);
+  keys.insert(dirEntry);
+  keys.insert(inlineBufferEntry);
+  keys.insert(sizeHintEntry);
+  ret = inode.pool->ioctx.omap_get_vals_by_keys(inode.inode, keys, &omap);
+
+  if (omap.count(fileEntry) > 0)
+  {
+    pathXAttr = &fileEntry;
+  }
+  else if (omap.count(dirEntry) > 0)
+  {
+    pathXAttr = &dirEntry;
+  }
+  else
+  {
+    if (ret == 0)
+      missingEntries.setMissing(inode.inode, generation, missingEntry);
+
+    ret = -ENOENT;
+  }
+
+  if (ret < 0)
+    return ret;
+
+  librados::bufferlist fileXAttr = omap[*pathXAttr];
+  std::string linkStr(fileXAttr.c_str(), fileXAttr.length());
+
+  stat->path = parentDir + pathXAttr->substr(strlen(XATTR_FILE_PREFIX));
+
+  ret = statFromXAttr(stat->path, linkStr, &stat->statBuff,
+                      stat->translatedPath, pool, stat->extraData);
+
+  if (stat->translatedPath == "")
+  {
+    ret = -ENOLINK;
+  }
+  else if (ret == 0 && pathXAttr == &fileEntry &&
+           !S_ISLNK(stat->statBuff.st_mode))
+  {
+    librados::bufferlist sizeHintBl = omap[sizeHintEntry];
+
+    setSizeFromParent(stat, omap[inlineBufferEntry],
+                      std::string(sizeHintBl.c_str(), sizeHintBl.length()));
+  }
+
+  return ret;
+}
+
+int
+FilesystemPriv::getRealPath(const std::string &path,  Stat *stat,
+                            std::string &realPath)
+{
+  int ret = -ENOENT;
+  realPath = path;
+
+  stat->reset();
+
+  // Paths under links that have been resolved before do not need to be
+  // checked again
+  for (size_t i = 0; i < MAX_LINK_PREFIX_RESOLUTIONS; i++)
+  {
+    if (!resolveLinkPrefix(realPath))
+      break;
+  }
+
+  while(true)
+  {
+    ret = this->stat(realPath, stat);
+
+    if (ret == 0)
+    {
+      realPath = stat->path;
+      break;
+    }
+
+    std::string parent = getParentDir(realPath, 0);
+
+    while (parent != "")
+    {
+      int ret = this->stat(parent, stat);
+
+      if (ret == -ENOENT)
+      {
+        parent = getParentDir(parent, 0);
+      }
+      else if (ret == 0)
+      {
+        break;
+      }
+      else
+      {
+        stat->reset();
+        return ret;
+      }
+    }
+
+    if (parent == "")
+      return -ENODEV;
+
+    if (S_ISLNK(stat->statBuff.st_mode))
+    {
+      setLinkPrefix(parent, stat->translatedPath);
+      realPath = stat->translatedPath + realPath.substr(parent.length());
+      continue;
+    }
+
+    break;
+  }
+
+  return ret;
+}
+
+int
+FilesystemPriv::getDirInode(const std::string &path, Inode &inode,
+                            PoolSP &mtdPool)
+{
+  if (dirPathCache.get(path, inode))
+  {
+    metrics.add(MetricsRegistry::COUNTER_DIR_PATH_CACHE_HITS);
+
+    // Dirs known not to exist are cached with an empty inode
+    if (inode.inode == "")
+      return -ENOENT;
+
+    return 0;
+  }
+
+  metrics.add(MetricsRegistry::COUNTER_DIR_PATH_CACHE_MISSES);
+
+  {
+    std::string inodeName, poolName;
+
+    int ret = getInodeAndPool(mtdPool->ioctx, path, inodeName, poolName);
+
+    if (ret == -ENOENT)
+      dirPathCache.setMissing(path);
+
+    if (ret != 0)
+      return ret;
+
+    PoolSP pool = getMtdPoolFromName(poolName);
+
+    if (!pool)
+      return -ENODEV;
+
+    inode.inode = inodeName;
+    inode.pool = pool;
+    setDirInode(path, inode);
+  }
+
+  return 0;
+}
+
+int
+FilesystemPriv::getDirInode(const std::string &path, Inode &inode)
+{
+  PoolSP mtdPool = getMetadataPoolFromPath(path);
+  return getDirInode(path, inode, mtdPool);
+}
+
+void
+FilesystemPriv::setDirInode(const std::string &path, const Inode &inode)
+{
+  dirPathCache.set(path, inode);
+}
+
+void
+FilesystemPriv::updateDirInode(const std::string &oldPath,
+                               const std::string &newPath)
+{
+  dirPathCache.move(oldPath, newPath);
+}
+
+void
+FilesystemPriv::removeDirInode(const std::string &path)
+{
+  dirPathCache.remove(path);
+}
+
+uint64_t
+FilesystemPriv::dirGeneration(const std::string &inode)
+{
+  // The size of the dir's log (as last read by this client) changes whenever
+  // entries are added to it, so it is used to invalidate the missing entries
+  std::tr1::shared_ptr<DirCache> cache = dirCache.get(inode);
+
+  if (cache)
+    return cache->lastCachedSize();
+
+  return 0;
+}
+
+void
+FilesystemPriv::clearMissingEntries(const std::string &parentInode)
+{
+  missingEntries.clear(parentInode);
+}
+
+void
+FilesystemPriv::expireDirCacheLease(const std::string &inode)
+{
+  // The notification of a change this client made to a dir may only reach its
+  // own cache later, so the cache is made to read the dir when next updated
+  std::tr1::shared_ptr<DirCache> cache = dirCache.get(inode);
+
+  if (cache)
+    cache->expireLease();
+}
+
+bool
+FilesystemPriv::resolveLinkPrefix(std::string &path)
+{
+  return linkPrefixes.resolve(path, path);
+}
+
+void
+FilesystemPriv::setLinkPrefix(const std::string &linkPath,
+                              const std::string &target)
+{
+  // Links are as likely to be changed by other clients as directories are
+  linkPrefixes.set(linkPath, target, dirPathCache.ttl());
+}
+
+void
+FilesystemPriv::removeLinkPrefixes(const std::string &path)
+{
+  linkPrefixes.remove(path);
+}
+
+void
+FilesystemPriv::post(WorkJob job, Filesystem::WorkPriority priority)
+{
+  workScheduler.post(job, priority);
+}
+
+int
+FilesystemPriv::resetFileEntry(Stat &fileStat)
+{
+  if (!fileStat.pool)
+    return -ENODEV;
+
+  std::string parentDir = getParentDir(fileStat.path, 0);
+  Stat parentStat;
+
+  int ret = stat(parentDir, &parentStat);
+
+  if (ret != 0)
+    return ret;
+
+  std::string omapFileEntry = XATTR_FILE_PREFIX +
+                              fileStat.path.substr(parentDir.length());
+  std::map<std::string, librados::bufferlist> omap;
+
+  std::string fileEntry = getFileXAttrDirRecord(&fileStat);
+  omap[omapFileEntry].append(fileEntry);
+
+  librados::ObjectWriteOperation writeOp;
+  writeOp.assert_exists();
+  writeOp.omap_set(omap);
+
+  return parentStat.pool->ioctx.operate(parentStat.translatedPath, &writeOp);
+}
+
+int
+FilesystemPriv::resetDirLogicalObj(Stat &dirStat)
+{
+  if (!dirStat.pool)
+    return -ENODEV;
+
+  std::map<std::string, librados::bufferlist> omap;
+  std::string inode = makeInodeXattr(&dirStat);
+
+  omap[XATTR_INODE].append(inode);
+
+  librados::ObjectWriteOperation writeOp;
+  writeOp.assert_exists();
+  writeOp.omap_set(omap);
+
+  return dirStat.pool->ioctx.operate(dirStat.path, &writeOp);
+}
+
+int
+FilesystemPriv::statEntry(std::string path, std::string entry,
+                          size_t inlineBufferSize, const std::string &sizeHint,
+                          Stat *stat)
+{
+  PoolSP dataPool;
+  std::string pool;
+  int ret = statFromXAttr(path, entry, &stat->statBuff, stat->translatedPath,
+                          pool, stat->extraData);
+
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  dataPool = getDataPool(path, pool);
+  stat->pool = dataPool;
+
+  // We only have to check the file inode if the inline buffer's capacity is
+  // zero of it is completely filled up, in which case the sizeHint is left
+  // unverified (or invalid) so the caller checks it
+  size_t capacity = getInlineBufferCapacityFromExtraData(stat->extraData);
+  uint64_t hintedSize = 0;
+  timespec hintedMtime;
+  bool hasMtime;
+
+  stat->statBuff.st_size = inlineBufferSize;
+  stat->sizeHintValue = sizeHint;
+
+  if (S_ISLNK(stat->statBuff.st_mode) ||
+      (capacity > 0 && inlineBufferSize != capacity))
+  {
+    stat->sizeHint = SIZE_HINT_VALID;
+  }
+  else if (readFileSizeHint(sizeHint, stat->translatedPath, &hintedSize,
+                            &hintedMtime, &hasMtime) == SIZE_HINT_VALID)
+  {
+    stat->sizeHint = SIZE_HINT_UNVERIFIED;
+  }
+  else
+  {
+    stat->sizeHint = SIZE_HINT_INVALID;
+  }
+
+  return ret;
+}
+
+void
+FilesystemPriv::statEntries(StatAsyncInfo *info,
+                            std::map<std::string, std::string> &xattrs)
+{
+  for (size_t i = 0; i < info->entries->size(); i++)
+  {
+    const std::string &entryName = (*info->entries)[i];
+    const std::string &path = info->stat.path + entryName;
+    const std::string &xattr = xattrs[XATTR_FILE_PREFIX + entryName];
+
+    Stat stat;
+
+    if (xattr == "")
+    {
+      stat.path = path;
+      info->entryStats[path] = std::pair<int, Stat>(-ENOENT, stat);
+      continue;
+    }
+
+    // Get the inline buffer's size as this might determine the file's size
+    const std::string &inlineBuffer = xattrs[XATTR_FILE_INLINE_BUFFER +
+                                             entryName];
+    size_t inlineBufferSize = 0;
+    if (inlineBuffer.length() > XATTR_FILE_INLINE_BUFFER_HEADER_SIZE)
+    {
+      inlineBufferSize = inlineBuffer.length() -
+                         XATTR_FILE_INLINE_BUFFER_HEADER_SIZE;
+    }
+
+    int ret = statEntry(path, xattr, inlineBufferSize,
+                        xattrs[XATTR_FILE_SIZE_HINT + entryName], &stat);
+
+    if (ret == 0 || info->entryStats.count(path) == 0)
+    {
+      info->entryStats[path] = std::pair<int, Stat>(ret, stat);
+    }
+  }
+
+  // Verify the size hints of the files against their inodes and read the size
+  // of the files that could not be told by their entries, all at once; the
+  // files whose hint turns out to be stale have their size read in a second
+  // round
+  std::map<std::string, std::pair<int, Stat> >::iterator it;
+  std::set<std::string> staleHints;
+
+  for (int round = 0; round < 2; round++)
+  {
+    std::map<std::string, librados::bufferlist> sizeXAttrs;
+    std::map<std::string, librados::AioCompletion *> completions;
+
+    for (it = info->entryStats.begin(); it != info->entryStats.end(); it++)
+    {
+      const std::string &path = (*it).first;
+      const Stat &stat = (*it).second.second;
+
+      if ((*it).second.first != 0 || !stat.pool ||
+          (round == 0 && stat.sizeHint == SIZE_HINT_VALID) ||
+          (round == 1 && staleHints.count(path) == 0))
+        continue;
+
+      librados::ObjectReadOperation op;
+      librados::AioCompletion *completion;
+
+      if (stat.sizeHint != SIZE_HINT_UNVERIFIED ||
+          !addFileSizeHintCheck(&stat, op))
+      {
+        op.getxattr(XATTR_FILE_SIZE, &sizeXAttrs[path], 0);
+        op.assert_exists();
+      }
+
+      completion = librados::Rados::aio_create_completion();
+      stat.pool->ioctx.aio_operate(stat.translatedPath, completion, &op, 0);
+      completions[path] = completion;
+    }
+
+    std::map<std::string, librados::AioCompletion *>::iterator compIt;
+    for (compIt = completions.begin(); compIt != completions.end(); compIt++)
+    {
+      const std::string &path = (*compIt).first;
+      librados::AioCompletion *completion = (*compIt).second;
+      const bool checkedHint = sizeXAttrs.count(path) == 0;
+      librados::bufferlist &sizeXAttr = sizeXAttrs[path];
+      Stat &stat = info->entryStats[path].second;
+
+      completion->wait_for_complete();
+
+      if (checkedHint)
+      {
+        setFileSizeHintCheckResult(&stat, completion->get_return_value());
+
+        if (stat.sizeHint != SIZE_HINT_VALID)
+          staleHints.insert(path);
+      }
+      else if (completion->get_return_value() >= 0 && sizeXAttr.length() > 0)
+      {
+        const std::string sizeStr(sizeXAttr.c_str(), sizeXAttr.length());
+        const size_t size = strtoul(sizeStr.c_str(), 0, 16);
+
+        if (size != 0)
+          stat.statBuff.st_size = size;
+      }
+
+      completion->release();
+    }
+
+    if (staleHints.empty())
+      break;
+  }
+}
+
+void
+FilesystemPriv::statAsync(StatAsyncInfo *info)
+{
+  std::map<std::string, std::string> xattrs;
+  u_int64_t size;
+  time_t mtime;
+  xattrs[XATTR_PERMISSIONS] = "";
+  xattrs[XATTR_MTIME] = "";
+  xattrs[XATTR_CTIME] = "";
+
+  for (size_t i = 0; i < info->entries->size(); i++)
+  {
+    const std::string &entryName = (*info->entries)[i];
+    const std::string &entry = XATTR_FILE_PREFIX + entryName;
+    const std::string &inlineBuffer = XATTR_FILE_INLINE_BUFFER + entryName;
+    const std::string &sizeHint = XATTR_FILE_SIZE_HINT + entryName;
+    xattrs[entry] = "";
+    xattrs[inlineBuffer] = "";
+    xattrs[sizeHint] = "";
+  }
+
+  info->statRet = statAndGetXAttrs(info->stat.pool->ioctx,
+                                   info->stat.translatedPath, &size,
+                                   &mtime, xattrs);
+
+  genericStatFromAttrs(info->stat.path, xattrs[XATTR_PERMISSIONS],
+                       xattrs[XATTR_CTIME], xattrs[XATTR_MTIME], size, mtime,
+                       &info->stat.statBuff);
+
+  if (info->entries->size() == 0 || info->statRet != 0)
+    return;
+
+  statEntries(info, xattrs);
+}
+
+int
+FilesystemPriv::statAsyncInfoInThread(const std::string path,
+                                      StatAsyncInfo *info, boost::mutex *mutex,
+                                      boost::condition_variable *cond,
+                                      int *numJobs)
+{
+  int ret;
+  info->stat.reset();
+  info->stat.path = getDirPath(path);
+  PoolSP mtdPool = getMetadataPoolFromPath(info->stat.path);
+
+  if (!mtdPool.get())
+  {
+    ret = -ENODEV;
+    return ret;
+  }
+
+  Inode inode;
+  ret = getDirInode(info->stat.path, inode, mtdPool);
+
+  if (ret == 0)
+  {
+    info->stat.pool = inode.pool;
+    info->stat.translatedPath = inode.inode;
+
+    statAsync(info);
+  }
+  else
+  {
+    info->statRet = ret;
+  }
+
+  mutex->lock();
+  int remaininNumJobs = --*numJobs;
+  mutex->unlock();
+
+  if (remaininNumJobs == 0)
+    cond->notify_all();
+
+  return ret;
+}
+
+static void
+gatherPathsByParentDir(const std::vector<std::string> &paths,
+                       std::map<std::string, std::vector<std::string> > &entries)
+{
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    const std::string &path = paths[i];
+
+    if (path == "/" && entries.count(path) == 0)
+    {
+      entries[path].clear();
+      continue;
+    }
+
+    std::string parentDir = getParentDir(path, 0);
+    entries[parentDir].push_back(path.substr(parentDir.length()));
+  }
+}
+
+std::map<std::string, std::pair<int, Stat> >
+FilesystemPriv::stat(const std::vector<std::string> &paths)
+{
+  TraceSpan span("Filesystem::stat(paths)", "metadata");
+  SlowOpScope slowOpScope(slowOps, "Filesystem::stat(paths)");
+  std::map<std::string, std::pair<int, Stat> > stats;
+  std::map<std::string, std::vector<std::string> > entries;
+
+  gatherPathsByParentDir(paths, entries);
+
+  parallelStat(entries, &stats);
+
+  // Call parallel stat again on the paths that were not found
+  entries.clear();
+  std::map<std::string, std::pair<int, Stat> >::iterator it;
+  for (it = stats.begin(); it != stats.end(); it++)
+  {
+    std::pair<int, Stat> statResult = (*it).second;
+
+    if (statResult.first != 0)
+    {
+      const std::string &path = (*it).first;
+      entries[path].clear();
+    }
+  }
+
+  if (entries.size())
+    parallelStat(entries, &stats);
+
+  return stats;
+}
+
+void
 FilesystemPriv::parallelStat(
     const std::map<std::string, std::vector<std::string> > &paths,
     std::map<std::string, std::pair<int, Stat> > *stats)
 {
-  StatAsyncInfo *statInfoList = new StatAsyncInfo[paths.size()];
-  boost::mutex mutex;
-  boost::condition_variable cond;
-  int numJobs = paths.size();
-  std::map<std::string, std::vector<std::string> >::const_iterator it;
-  size_t i;
+  StatAsyncInfo *statInfoList = new StatAsyncInfo[paths.size()];
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  int numJobs = paths.size();
+  std::map<std::string, std::vector<std::string> >::const_iterator it;
+  size_t i;
+
+  for (it = paths.begin(), i = 0; it != paths.end(); it++, i++)
+  {
+    std::string dir = (*it).first;
+    StatAsyncInfo *info = &statInfoList[i];
+    info->entries = &(*it).second;
+
+    post(boost::bind(&FilesystemPriv::statAsyncInfoInThread, this, dir, info,
+                     &mutex, &cond, &numJobs),
+         Filesystem::WORK_PRIORITY_METADATA);
+  }
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  while (numJobs > 0)
+    cond.wait(lock);
+
+  // Assign the result of statting all the paths to the stats output parameter
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    StatAsyncInfo *statInfo = &statInfoList[i];
+    std::map<std::string, std::pair<int, Stat> >::const_iterator it;
+
+    if (statInfo->statRet == 0)
+    {
+      std::pair<int, Stat> statResult(statInfo->statRet, statInfo->stat);
+      (*stats)[statInfo->stat.path] = statResult;
+    }
+
+    for (it = statInfo->entryStats.begin(); it != statInfo->entryStats.end();
+         it++)
+    {
+      const std::string &path = (*it).first;
+      const std::pair<int, Stat> &statResult = (*it).second;
+
+      if (stats->count(path) > 0 && stats->at(path).first == 0)
+        continue;
+
+      (*stats)[path] = statResult;
+    }
+  }
+
+  delete[] statInfoList;
+}
+
+void
+FilesystemPriv::statDirEntries(const Stat &dirStat,
+                               const std::set<std::string> &entries,
+                               std::map<std::string, std::pair<int, Stat> > *stats)
+{
+  std::vector<std::string> files;
+  std::map<std::string, std::vector<std::string> > subDirs;
+  std::set<std::string>::const_iterator it;
 
-  for (it = paths.begin(), i = 0; it != paths.end(); it++, i++)
+  for (it = entries.begin(); it != entries.end(); it++)
+  {
+    const std::string &entry = *it;
+
+    if (isDirPath(entry))
+      subDirs[dirStat.path + entry].clear();
+    else
+      files.push_back(entry);
+  }
+
+  // Subdirectories have their own objects so they are statted in parallel,
+  // while the files' entries are all read at once from the parent's omap
+  if (subDirs.size() > 0)
+    parallelStat(subDirs, stats);
+
+  if (files.size() == 0)
+    return;
+
+  StatAsyncInfo info;
+  info.stat = dirStat;
+  info.entries = &files;
+  statAsync(&info);
+
+  if (info.statRet != 0)
+  {
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      Stat stat;
+      stat.path = dirStat.path + files[i];
+      (*stats)[stat.path] = std::pair<int, Stat>(info.statRet, stat);
+    }
+
+    return;
+  }
+
+  stats->insert(info.entryStats.begin(), info.entryStats.end());
+}
+
+int
+FilesystemPriv::stat(const std::string &path, Stat *stat)
+{
+  MetricsTimer timer(metrics, MetricsRegistry::HISTOGRAM_STAT);
+  TraceSpan span("Filesystem::stat", "metadata");
+  SlowOpScope slowOpScope(slowOps, "Filesystem::stat", "", path);
+  PoolSP mtdPool;
+  int ret = -ENODEV;
+  stat->reset();
+  stat->path = getDirPath(path);
+  mtdPool = getMetadataPoolFromPath(stat->path);
+
+  if (!mtdPool.get())
+    return -ENODEV;
+
+  if (isDirPath(path))
+  {
+    ret = statDir(mtdPool, stat);
+
+    if (ret == 0 || ret == -ENODEV)
+      return ret;
+  }
+
+  ret = statFile(mtdPool, stat);
+
+  if (ret == 0 || ret == -ENODEV)
+    return ret;
+
+  ret = statDir(mtdPool, stat);
+
+  return ret;
+}
+
+int
+FilesystemPriv::statDir(PoolSP mtdPool, Stat *stat)
+{
+  Inode inode;
+  int ret = getDirInode(stat->path, inode, mtdPool);
+
+  if (ret == 0)
+  {
+    stat->pool = inode.pool;
+    stat->translatedPath = inode.inode;
+
+    ret = statDirObj(*stat);
+  }
+
+  return ret;
+}
+
+int
+FilesystemPriv::statFile(PoolSP mtdPool, Stat *stat)
+{
+  int ret;
+  PoolSP dataPool;
+  std::string poolName("");
+  ret = statLink(mtdPool, stat, poolName);
+
+  if (ret == 0)
+  {
+    if (S_ISLNK(stat->statBuff.st_mode))
+    {
+      if (poolName.empty())
+      {
+        stat->pool = mtdPool;
+      }
+      else
+      {
+        stat->pool = getMtdPoolFromName(poolName);
+      }
+    }
+    else
+    {
+      const PoolList &pools = getDataPools(stat->path);
+      if (poolName != "")
+      {
+        const PoolList &pools = getDataPools(stat->path);
+        PoolList::const_iterator it;
+
+        for (it = pools.begin(); it != pools.end(); it++)
+        {
+          if ((*it)->name == poolName)
+          {
+            dataPool = *it;
+            break;
+          }
+        }
+      }
+      else
+      {
+        dataPool = pools.front();
+      }
+
+      stat->pool = dataPool;
+    }
+  }
+
+  return ret;
+}
+
+void
+FilesystemPriv::statFileData(Stat *stat, const Stat *parentStat, FileIOSP io)
+{
+  // If there is an inline buffer and it is not fully filled, then it already
+  // gives us the size of the object, otherwise, we need to check the size set
+  // in the inode
+
+  std::string inlineContents;
+  FileInlineBuffer *inlineBuffer = io->inlineBuffer();
+
+  if (inlineBuffer)
+  {
+    inlineBuffer->read(&stat->statBuff.st_mtim, &inlineContents);
+
+    stat->statBuff.st_mtime = stat->statBuff.st_mtim.tv_sec;
+    stat->statBuff.st_size = inlineContents.length();
+  }
+
+  if (!inlineBuffer || inlineContents.length() == inlineBuffer->capacity())
+  {
+    uint64_t fileIOSize = 0;
+    ssize_t sizeRet = io->getLastChunkIndexAndSize(&fileIOSize);
+
+    if (fileIOSize != 0)
+      stat->statBuff.st_size = fileIOSize;
+
+    int mtimeRet = getTimeFromXAttr(stat, XATTR_MTIME,
+                                    &stat->statBuff.st_mtim,
+                                    &stat->statBuff.st_mtime);
+
+    // Leave a size hint in the parent dir (or replace the stale one, e.g.
+    // left by a writer that crashed) so the next stat does not need to read
+    // the inode, unless a writer has set it meanwhile; the mtime read above
+    // is not the one kept in the inode's xattr, so it is not hinted
+    if (sizeRet >= 0 && (mtimeRet == 0 || mtimeRet == -ENODATA))
+    {
+      const std::string &hint = makeFileSizeHint(stat->translatedPath,
+                                                 fileIOSize, 0);
+
+      setFileSizeHint(parentStat->pool->ioctx, parentStat->translatedPath,
+                      stat->path.substr(parentStat->path.length()), hint,
+                      &stat->sizeHintValue);
+    }
+  }
+}
+
+int
+FilesystemPriv::statFileData(Stat *stat)
+{
+  // Gets the size of a file that was stat'ed from its parent dir but whose size
+  // hint is not valid, without having to stat it again
+  Inode inode;
+  Stat parentStat;
+  parentStat.path = getParentDir(stat->path, 0);
+
+  int ret = getDirInode(parentStat.path, inode);
+
+  if (ret != 0)
+    return ret;
+
+  parentStat.pool = inode.pool;
+  parentStat.translatedPath = inode.inode;
+
+  FileIOSP io = getOrCreateFileIO(stat->translatedPath, stat);
+
+  if (stat->extraData.count(XATTR_FILE_INLINE_BUFFER_SIZE) > 0)
+  {
+    const std::string &bufferSize =
+        stat->extraData[XATTR_FILE_INLINE_BUFFER_SIZE];
+    size_t inlineBufferSize = strtoul(bufferSize.c_str(), 0, 10);
+
+    if (inlineBufferSize > 0)
+      io->setInlineBuffer(&parentStat, stat->path, inlineBufferSize);
+  }
+
+  statFileData(stat, &parentStat, io);
+
+  releaseFileIO(io);
+
+  return 0;
+}
+
+int
+FilesystemPriv::createPrefixDir(PoolSP pool, const std::string &prefix)
+{
+  int ret = 0;
+
+  if (pool->ioctx.stat(prefix, 0, 0) != 0)
+  {
+    Stat stat;
+    stat.path = prefix;
+    stat.translatedPath = generateUuid();
+    stat.pool = pool;
+    stat.statBuff.st_uid = ROOT_UID;
+    stat.statBuff.st_gid = ROOT_UID;
+    stat.statBuff.st_mode = DEFAULT_MODE_DIR;
+    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_ctim);
+    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_mtim);
+
+    ret = createDirAndInode(&stat);
+
+    if (ret == 0)
+      dirPathCache.remove(prefix);
+  }
+
+  return ret;
+}
+
+int
+FilesystemPriv::addPool(const std::string &name, const std::string &prefix,
+                        PoolMap *map, InstrumentedMutex &mutex, size_t size)
+{
+  int ret = -ENODEV;
+  const std::string &cleanPrefix = sanitizePath(prefix  + "/");
+
+  if (!initialized)
+    return ret;
+
+  if (prefix == "")
+  {
+    radosfs_debug("The pool's prefix cannot be an empty string");
+    return -EINVAL;
+  }
+
+  if (map->count(cleanPrefix) > 0)
+  {
+    radosfs_debug("There is already a pool with the prefix %s. "
+                  "Not adding.", cleanPrefix.c_str());
+    return -EEXIST;
+  }
+
+  librados::IoCtx ioctx;
+
+  ret = radosCluster.ioctx_create(name.c_str(), ioctx);
+
+  if (ret != 0)
+    return ret;
+
+  Pool *pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION,
+                        ioctx);
+  PoolSP poolSP(pool);
+
+  if (size == 0)
+  {
+    ret = createPrefixDir(poolSP, cleanPrefix);
+
+    if (ret < 0)
+      return ret;
+  }
+
+  boost::unique_lock<InstrumentedMutex> lock(mutex);
+
+  std::pair<std::string, PoolSP > entry(cleanPrefix, poolSP);
+  map->insert(entry);
+
+  return ret;
+}
+
+PoolSP
+FilesystemPriv::getDataPool(const std::string &path, const std::string &poolName)
+{
+  PoolRouterSP router = boost::atomic_load(&dataPoolRouter);
+
+  if (!router)
+    return PoolSP();
+
+  return router->pool(path, poolName);
+}
+
+PoolSP
+FilesystemPriv::getDataPoolFromName(const std::string &poolName)
+{
+  PoolSP pool;
+  boost::unique_lock<InstrumentedMutex> lock(poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = poolMap.begin(); it != poolMap.end(); it++)
   {
-    std::string dir = (*it).first;
-    StatAsyncInfo *info = &statInfoList[i];
-    info->entries = &(*it).second;
+    const PoolList &pools = (*it).second;
 
-    getIoService()->post(boost::bind(&FilesystemPriv::statAsyncInfoInThread,
-                                     this, dir, info, &mutex, &cond, &numJobs));
+    if (poolName != "")
+    {
+      PoolList::const_iterator poolIt;
+      for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
+      {
+        if ((*poolIt)->name == poolName)
+        {
+          pool = *poolIt;
+          break;
+        }
+      }
+    }
+    else
+    {
+      pool = pools.front();
+      break;
+    }
   }
 
-  boost::unique_lock<boost::mutex> lock(mutex);
+  return pool;
+}
 
-  if (numJobs > 0)
-    cond.wait(lock);
+PoolSP
+FilesystemPriv::getMtdPoolFromName(const std::string &name)
+{
+  PoolSP pool;
+  boost::unique_lock<InstrumentedMutex> lock(poolMutex);
 
-  // Assign the result of statting all the paths to the stats output parameter
-  for (size_t i = 0; i < paths.size(); i++)
+  PoolMap::const_iterator it;
+  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
   {
-    StatAsyncInfo *statInfo = &statInfoList[i];
-    std::map<std::string, std::pair<int, Stat> >::const_iterator it;
+    PoolSP currentPool = (*it).second;
 
-    if (statInfo->statRet == 0)
+    if (currentPool->name == name)
     {
-      std::pair<int, Stat> statResult(statInfo->statRet, statInfo->stat);
-      (*stats)[statInfo->stat.path] = statResult;
+      pool = currentPool;
+      break;
     }
+  }
 
-    for (it = statInfo->entryStats.begin(); it != statInfo->entryStats.end();
-         it++)
-    {
-      const std::string &path = (*it).first;
-      const std::pair<int, Stat> &statResult = (*it).second;
+  return pool;
+}
 
-      if (stats->count(path) > 0 && stats->at(path).first == 0)
-        continue;
+PoolSP
+FilesystemPriv::getMetadataPoolFromPath(const std::string &path)
+{
+  PoolRouterSP router = boost::atomic_load(&mtdPoolRouter);
 
-      (*stats)[path] = statResult;
+  if (!router)
+    return PoolSP();
+
+  return router->pool(path);
+}
+
+std::string
+FilesystemPriv::poolPrefix(const std::string &pool, PoolMap *map,
+                           InstrumentedMutex &mutex) const
+{
+  std::string prefix("");
+  boost::unique_lock<InstrumentedMutex> lock(mutex);
+
+  PoolMap::iterator it;
+  for (it = map->begin(); it != map->end(); it++)
+  {
+    if ((*it).second->name == pool)
+    {
+      prefix = (*it).first;
+      break;
     }
   }
 
-  delete[] statInfoList;
+  return prefix;
 }
 
 int
-FilesystemPriv::stat(const std::string &path, Stat *stat)
+FilesystemPriv::removePool(const std::string &name, PoolMap *map,
+                           InstrumentedMutex &mutex)
 {
-  PoolSP mtdPool;
-  int ret = -ENODEV;
-  stat->reset();
-  stat->path = getDirPath(path);
-  mtdPool = getMetadataPoolFromPath(stat->path);
+  int ret = -ENOENT;
+  const std::string &prefix = poolPrefix(name, map, mutex);
+  boost::unique_lock<InstrumentedMutex> lock(mutex);
 
-  if (!mtdPool.get())
-    return -ENODEV;
+  if (map->count(prefix) > 0)
+  {
+    map->erase(prefix);
+    ret = 0;
+  }
 
-  if (isDirPath(path))
+  return ret;
+}
+
+std::string
+FilesystemPriv::poolFromPrefix(const std::string &prefix, PoolMap *map,
+                               InstrumentedMutex &mutex) const
+{
+  std::string pool("");
+  boost::unique_lock<InstrumentedMutex> lock(mutex);
+
+  if (map->count(prefix) > 0)
+    pool = map->at(prefix)->name;
+
+  return pool;
+}
+
+std::vector<std::string>
+FilesystemPriv::pools(PoolMap *map,
+                      InstrumentedMutex &mutex) const
+{
+  boost::unique_lock<InstrumentedMutex> lock(mutex);
+  std::vector<std::string> pools;
+
+  PoolMap::iterator it;
+  for (it = map->begin(); it != map->end(); it++)
   {
-    ret = statDir(mtdPool, stat);
+    pools.push_back((*it).second->name);
+  }
 
-    if (ret == 0 || ret == -ENODEV)
-      return ret;
+  return pools;
+}
+
+PoolList
+FilesystemPriv::getDataPools(const std::string &path)
+{
+  PoolRouterSP router = boost::atomic_load(&dataPoolRouter);
+
+  if (!router)
+    return PoolList();
+
+  return router->pools(path);
+}
+
+PoolList
+FilesystemPriv::getDataPools()
+{
+  PoolList pools;
+  boost::unique_lock<InstrumentedMutex> lock(poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  {
+    const PoolList &list = (*it).second;
+    pools.insert(pools.end(), list.begin(), list.end());
   }
 
-  ret = statFile(mtdPool, stat);
+  return pools;
+}
 
-  if (ret == 0 || ret == -ENODEV)
-    return ret;
+PoolList
+FilesystemPriv::getMtdPools()
+{
+  PoolList pools;
+  boost::unique_lock<InstrumentedMutex> lock(mtdPoolMutex);
 
-  ret = statDir(mtdPool, stat);
+  PoolMap::const_iterator it;
+  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
+  {
+    pools.push_back((*it).second);
+  }
 
-  return ret;
+  return pools;
 }
 
-int
-FilesystemPriv::statDir(PoolSP mtdPool, Stat *stat)
+void
+FilesystemPriv::updateDataPoolRouter(void)
 {
-  Inode inode;
-  int ret = getDirInode(stat->path, inode, mtdPool);
+  // The router is rebuilt and swapped while holding the lock so the last one
+  // published always reflects the latest pool map
+  boost::unique_lock<InstrumentedMutex> lock(poolMutex);
+  PoolRouterSP router(new PoolRouter(poolMap));
 
-  if (ret == 0)
+  boost::atomic_store(&dataPoolRouter, router);
+}
+
+void
+FilesystemPriv::updateMtdPoolRouter(void)
+{
+  boost::unique_lock<InstrumentedMutex> lock(mtdPoolMutex);
+  PoolRouterSP router(new PoolRouter(mtdPoolMap));
+
+  boost::atomic_store(&mtdPoolRouter, router);
+}
+
+unsigned int
+FilesystemPriv::dataPoolWeight(const std::string &pool)
+{
+  boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
+  std::map<std::string, unsigned int>::const_iterator it;
+
+  it = dataPoolWeights.find(pool);
+
+  if (it == dataPoolWeights.end())
+    return DEFAULT_DATA_POOL_WEIGHT;
+
+  return (*it).second;
+}
+
+uint64_t
+FilesystemPriv::dataPoolMinFileSize(const std::string &pool) const
+{
+  std::map<std::string, uint64_t>::const_iterator it;
+
+  it = dataPoolMinFileSizes.find(pool);
+
+  if (it == dataPoolMinFileSizes.end())
+    return 0;
+
+  return (*it).second;
+}
+
+uint64_t
+FilesystemPriv::dataPoolsTier(const PoolList &pools, uint64_t fileSize) const
+{
+  // The tier of a file is the greatest minimum file size, of the given pools,
+  // that the file's size reaches
+  uint64_t tier = 0;
+
+  for (size_t i = 0; i < pools.size(); i++)
   {
-    stat->pool = inode.pool;
-    stat->translatedPath = inode.inode;
+    const uint64_t minSize = dataPoolMinFileSize(pools[i]->name);
 
-    ret = statDirObj(*stat);
+    if (minSize <= fileSize && minSize > tier)
+      tier = minSize;
   }
 
-  return ret;
+  return tier;
 }
 
-int
-FilesystemPriv::statFile(PoolSP mtdPool, Stat *stat)
+PoolSP
+FilesystemPriv::placeDataPool(const std::string &path, uint64_t fileSize)
 {
-  int ret;
-  PoolSP dataPool;
-  std::string poolName("");
-  ret = statLink(mtdPool, stat, poolName);
+  PoolRouterSP router = boost::atomic_load(&dataPoolRouter);
 
-  if (ret == 0)
+  if (!router)
+    return PoolSP();
+
+  std::string prefix;
+  const PoolList &allPools = router->pools(path, &prefix);
+
+  if (allPools.size() < 2)
+    return allPools.empty() ? PoolSP() : allPools.front();
+
+  boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
+
+  // Only the pools in the file's tier are considered
+  const uint64_t tier = dataPoolsTier(allPools, fileSize);
+  PoolList pools;
+
+  for (size_t i = 0; i < allPools.size(); i++)
   {
-    if (S_ISLNK(stat->statBuff.st_mode))
+    if (dataPoolMinFileSize(allPools[i]->name) == tier)
+      pools.push_back(allPools[i]);
+  }
+
+  if (dataPoolPlacement == Filesystem::DATA_POOL_PLACEMENT_FIRST ||
+      pools.size() == 1)
+    return pools.front();
+
+  // Pools with a weight of 0 do not get any new files
+  std::vector<unsigned int> weights(pools.size(), DEFAULT_DATA_POOL_WEIGHT);
+  uint64_t totalWeight = 0;
+
+  for (size_t i = 0; i < pools.size(); i++)
+  {
+    std::map<std::string, unsigned int>::const_iterator it;
+    it = dataPoolWeights.find(pools[i]->name);
+
+    if (it != dataPoolWeights.end())
+      weights[i] = (*it).second;
+
+    totalWeight += weights[i];
+  }
+
+  if (totalWeight == 0)
+    return pools.front();
+
+  if (dataPoolPlacement == Filesystem::DATA_POOL_PLACEMENT_LEAST_USED)
+  {
+    // Pick the pool with the least used bytes relative to its weight
+    PoolSP pool;
+    double minUsage = 0;
+
+    for (size_t i = 0; i < pools.size(); i++)
     {
-      if (poolName.empty())
-      {
-        stat->pool = mtdPool;
-      }
-      else
+      if (weights[i] == 0)
+        continue;
+
+      std::map<std::string, uint64_t>::const_iterator it;
+      it = dataPoolsUsage.find(pools[i]->name);
+
+      const double usage = it == dataPoolsUsage.end() ? 0 :
+                           (double) (*it).second / weights[i];
+
+      if (!pool || usage < minUsage)
       {
-        stat->pool = getMtdPoolFromName(poolName);
+        pool = pools[i];
+        minUsage = usage;
       }
     }
-    else
-    {
-      const PoolList &pools = getDataPools(stat->path);
-      if (poolName != "")
-      {
-        const PoolList &pools = getDataPools(stat->path);
-        PoolList::const_iterator it;
 
-        for (it = pools.begin(); it != pools.end(); it++)
-        {
-          if ((*it)->name == poolName)
-          {
-            dataPool = *it;
-            break;
-          }
-        }
-      }
-      else
-      {
-        dataPool = pools.front();
-      }
+    return pool;
+  }
 
-      stat->pool = dataPool;
-    }
+  uint64_t slot;
+
+  if (dataPoolPlacement == Filesystem::DATA_POOL_PLACEMENT_PATH_HASH)
+    slot = hash(path.c_str()) % totalWeight;
+  else
+    slot = dataPoolPlacementCounters[prefix]++ % totalWeight;
+
+  for (size_t i = 0; i < pools.size(); i++)
+  {
+    if (slot < weights[i])
+      return pools[i];
+
+    slot -= weights[i];
   }
 
-  return ret;
+  return pools.front();
 }
 
-int
-FilesystemPriv::createPrefixDir(PoolSP pool, const std::string &prefix)
+PoolSP
+FilesystemPriv::tierDataPool(const std::string &path, const PoolSP &currentPool,
+                             uint64_t fileSize)
 {
-  int ret = 0;
+  PoolRouterSP router = boost::atomic_load(&dataPoolRouter);
+
+  if (!router || !currentPool)
+    return PoolSP();
+
+  const PoolList &pools = router->pools(path);
+
+  if (pools.size() < 2)
+    return PoolSP();
 
-  if (pool->ioctx.stat(prefix, 0, 0) != 0)
   {
-    Stat stat;
-    stat.path = prefix;
-    stat.translatedPath = generateUuid();
-    stat.pool = pool;
-    stat.statBuff.st_uid = ROOT_UID;
-    stat.statBuff.st_gid = ROOT_UID;
-    stat.statBuff.st_mode = DEFAULT_MODE_DIR;
-    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_ctim);
-    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_mtim);
+    boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
 
-    ret = createDirAndInode(&stat);
+    if (dataPoolMinFileSizes.empty() ||
+        dataPoolMinFileSize(currentPool->name) == dataPoolsTier(pools, fileSize))
+      return PoolSP();
   }
 
-  return ret;
+  return placeDataPool(path, fileSize);
 }
 
 int
-FilesystemPriv::addPool(const std::string &name, const std::string &prefix,
-                        PoolMap *map, boost::mutex &mutex, size_t size)
+FilesystemPriv::moveFileData(const FileIOSP &io, const Stat &parentStat,
+                             Stat *stat, const PoolSP &pool)
 {
-  int ret = -ENODEV;
-  const std::string &cleanPrefix = sanitizePath(prefix  + "/");
+  const PoolSP currentPool = io->pool();
 
-  if (!initialized)
+  if (io->getSize() > pool->size)
+    return -EFBIG;
+
+  if (pool->hasAlignment() && io->chunkSize() % pool->alignment != 0)
+    return -EINVAL;
+
+  const std::string &entryKey = XATTR_FILE_PREFIX +
+                                stat->path.substr(parentStat.path.length());
+  std::set<std::string> keys;
+  std::map<std::string, librados::bufferlist> omap;
+
+  keys.insert(entryKey);
+
+  int ret = parentStat.pool->ioctx.omap_get_vals_by_keys(
+                                                      parentStat.translatedPath,
+                                                      keys, &omap);
+
+  if (ret != 0)
     return ret;
 
-  if (prefix == "")
-  {
-    radosfs_debug("The pool's prefix cannot be an empty string");
+  if (omap.count(entryKey) == 0)
+    return -ENOENT;
+
+  // Only the pool is changed in the entry so anything else that may have been
+  // set to it is kept as is
+  const std::string entry(omap[entryKey].c_str(), omap[entryKey].length());
+  const std::string currentPoolKey = POOL_KEY "='" + currentPool->name + "'";
+  size_t poolPos = entry.find(currentPoolKey);
+
+  if (poolPos == std::string::npos)
     return -EINVAL;
-  }
 
-  if (map->count(cleanPrefix) > 0)
+  std::string newEntry(entry);
+  newEntry.replace(poolPos, currentPoolKey.length(),
+                   POOL_KEY "='" + pool->name + "'");
+
+  // Settle the size hint while the current inode still exists
+  io->updateSizeHint();
+
+  uint64_t maxRate;
+
   {
-    radosfs_debug("There is already a pool with the prefix %s. "
-                  "Not adding.", cleanPrefix.c_str());
-    return -EEXIST;
+    boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
+    maxRate = dataMoveRate;
   }
 
-  librados::IoCtx ioctx;
+  ret = io->copyToPool(pool, maxRate);
 
-  ret = radosCluster.ioctx_create(name.c_str(), ioctx);
+  if (ret != 0)
+    return ret;
+
+  // Mark the original inode so its removal can be finished later if it gets
+  // interrupted after the entry is pointed to the new pool, and so clients
+  // still writing to the current pool fail with -ESTALE from then on (the base
+  // chunk is created if the contents were only in the inline buffer since
+  // those clients would otherwise create it when writing past the buffer)
+  librados::bufferlist poolName;
+  poolName.append(pool->name);
+  ret = currentPool->ioctx.setxattr(io->inode(), XATTR_INODE_MOVED_TO,
+                                    poolName);
 
   if (ret != 0)
+  {
+    radosfs_debug("Error marking the inode of %s as moved to the data pool %s: "
+                  "%s (retcode=%d)", stat->path.c_str(), pool->name.c_str(),
+                  strerror(abs(ret)), ret);
+
+    FileIO copy(radosFs, pool, io->inode(), io->chunkSize());
+    copy.remove();
+    io->unlock();
+
     return ret;
+  }
 
-  Pool *pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION,
-                        ioctx);
-  PoolSP poolSP(pool);
+  // Point the entry to the new pool only if it was not changed meanwhile
+  std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+  librados::ObjectWriteOperation entryOp;
 
-  if (size == 0)
+  omapCmp[entryKey] = std::pair<librados::bufferlist, int>(omap[entryKey],
+                                                          LIBRADOS_CMPXATTR_OP_EQ);
+  omap[entryKey].clear();
+  omap[entryKey].append(newEntry);
+
+  entryOp.omap_cmp(omapCmp, 0);
+  entryOp.omap_set(omap);
+
+  ret = parentStat.pool->ioctx.operate(parentStat.translatedPath, &entryOp);
+
+  if (ret != 0)
   {
-    ret = createPrefixDir(poolSP, cleanPrefix);
+    radosfs_debug("Error pointing %s to the data pool %s: %s (retcode=%d)",
+                  stat->path.c_str(), pool->name.c_str(), strerror(abs(ret)),
+                  ret);
 
-    if (ret < 0)
-      return ret;
+    FileIO copy(radosFs, pool, io->inode(), io->chunkSize());
+    copy.remove();
+    currentPool->ioctx.rmxattr(io->inode(), XATTR_INODE_MOVED_TO);
+    io->unlock();
+
+    return ret == -ECANCELED ? -EAGAIN : ret;
   }
 
-  boost::unique_lock<boost::mutex> lock(mutex);
+  ret = io->removeMovedChunks();
 
-  std::pair<std::string, PoolSP > entry(cleanPrefix, poolSP);
-  map->insert(entry);
+  if (ret != 0)
+  {
+    radosfs_debug("Error removing the chunks of %s from the data pool %s: %s "
+                  "(retcode=%d)", stat->path.c_str(), currentPool->name.c_str(),
+                  strerror(abs(ret)), ret);
+  }
 
-  return ret;
+  stat->pool = pool;
+
+  return 0;
 }
 
-PoolSP
-FilesystemPriv::getDataPool(const std::string &path, const std::string &poolName)
+int
+FilesystemPriv::removeMovedInodeCopies(const Stat &stat)
 {
-  PoolSP pool;
-  size_t maxLength = 0;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  const PoolList &pools = getDataPools(stat.path);
+  PoolList::const_iterator it;
+  int ret = 0;
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  for (it = pools.begin(); it != pools.end(); it++)
   {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
+    const PoolSP &pool = *it;
+    librados::bufferlist movedTo;
 
-    if (prefixLength < maxLength)
+    if (pool->name == stat.pool->name ||
+        pool->ioctx.getxattr(stat.translatedPath, XATTR_INODE_MOVED_TO,
+                             movedTo) <= 0)
       continue;
 
-    if (path.compare(0, prefixLength, prefix) == 0)
-    {
-      const PoolList &pools = (*it).second;
+    if (std::string(movedTo.c_str(), movedTo.length()) != stat.pool->name)
+      continue;
 
-      if (poolName != "")
-      {
-        PoolList::const_iterator poolIt;
-        for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
-        {
-          if ((*poolIt)->name == poolName)
-          {
-            pool = *poolIt;
-            maxLength = prefixLength;
+    radosfs_debug("Removing the leftover chunks of %s from the data pool %s",
+                  stat.path.c_str(), pool->name.c_str());
 
-            break;
-          }
-        }
-      }
-      else
-      {
-        pool = pools.front();
-        maxLength = prefixLength;
-      }
-    }
+    FileIOSP io = getOrCreateFileIO(stat.translatedPath, &stat);
+    FileIO leftover(radosFs, pool, stat.translatedPath, io->chunkSize());
 
-    if (pool.get())
-      break;
+    ret = leftover.removeMovedChunks();
+
+    releaseFileIO(io);
   }
 
-  return pool;
+  return ret;
 }
 
-PoolSP
-FilesystemPriv::getDataPoolFromName(const std::string &poolName)
+static void
+removeMovedInodeCB(rados_completion_t comp, void *arg)
 {
-  PoolSP pool;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  rados_aio_release(comp);
+}
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+void
+FilesystemPriv::removeMovedInodes(const Stat &stat)
+{
+  const PoolList &pools = getDataPools(stat.path);
+
+  // Files can only have been moved between the data pools of their prefix
+  if (pools.size() < 2 || !stat.pool)
+    return;
+
+  PoolList::const_iterator it;
+
+  for (it = pools.begin(); it != pools.end(); it++)
   {
-    const PoolList &pools = (*it).second;
+    const PoolSP &pool = *it;
 
-    if (poolName != "")
-    {
-      PoolList::const_iterator poolIt;
-      for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
-      {
-        if ((*poolIt)->name == poolName)
-        {
-          pool = *poolIt;
-          break;
-        }
-      }
-    }
-    else
-    {
-      pool = pools.front();
-      break;
-    }
-  }
+    if (pool->name == stat.pool->name)
+      continue;
 
-  return pool;
+    // The inode's name is unique to the file, so an object with it in another
+    // pool can only be the marked inode left there by moving the file
+    rados_completion_t comp;
+    rados_aio_create_completion(0, 0, removeMovedInodeCB, &comp);
+    librados::AioCompletion completion((librados::AioCompletionImpl *) comp);
+
+    pool->ioctx.aio_remove(stat.translatedPath, &completion);
+  }
 }
 
-PoolSP
-FilesystemPriv::getMtdPoolFromName(const std::string &name)
+int
+FilesystemPriv::moveFileToPool(const std::string &path,
+                               const std::string &poolName)
 {
-  PoolSP pool;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  Stat stat;
+  int ret = this->stat(path, &stat);
 
-  PoolMap::const_iterator it;
-  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
-  {
-    PoolSP currentPool = (*it).second;
+  if (ret != 0)
+    return ret;
 
-    if (currentPool->name == name)
-    {
-      pool = currentPool;
-      break;
-    }
+  if (!S_ISREG(stat.statBuff.st_mode))
+    return -EINVAL;
+
+  if (!statBuffHasPermission(stat.statBuff, uid, gid, O_WRONLY))
+    return -EACCES;
+
+  PoolSP pool = getDataPool(stat.path, poolName);
+
+  if (!pool || pool->name != poolName)
+    return -ENODEV;
+
+  if (stat.pool->name == pool->name)
+    return removeMovedInodeCopies(stat);
+
+  Stat parentStat;
+  ret = this->stat(getParentDir(stat.path, 0), &parentStat);
+
+  if (ret != 0)
+    return ret;
+
+  FileIOSP io = getOrCreateFileIO(stat.translatedPath, &stat);
+
+  // Other instances using the file could keep writing to its current pool
+  if (!operations.startMove(io))
+  {
+    releaseFileIO(io);
+    return -EBUSY;
   }
 
-  return pool;
+  ret = moveFileData(io, parentStat, &stat, pool);
+
+  finishFileMove(io, ret == 0 ? &stat : 0);
+
+  return ret;
 }
 
-PoolSP
-FilesystemPriv::getMetadataPoolFromPath(const std::string &path)
+bool
+FilesystemPriv::hasDataPoolTiers(void)
 {
-  return getPool(path, &mtdPoolMap, mtdPoolMutex);
+  boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
+  return !dataPoolMinFileSizes.empty();
 }
 
-PoolSP
-FilesystemPriv::getPool(const std::string &path,
-                        PoolMap *map,
-                        boost::mutex &mutex)
+void
+FilesystemPriv::moveFileToTier(const std::string &path)
 {
-  PoolSP pool;
-  size_t maxLength = 0;
-  boost::unique_lock<boost::mutex> lock(mutex);
+  Stat stat;
+  int ret = this->stat(path, &stat);
 
-  PoolMap::const_iterator it;
-  for (it = map->begin(); it != map->end(); it++)
+  // The file may have been removed meanwhile
+  if (ret != 0 || !S_ISREG(stat.statBuff.st_mode) || !stat.pool)
+    return;
+
+  FileIOSP io = getOrCreateFileIO(stat.translatedPath, &stat);
+
+  // Other instances using the file could keep writing to its current pool (it
+  // is checked again when the last of them that writes to it is done)
+  if (!operations.startMove(io))
   {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
+    releaseFileIO(io);
+    return;
+  }
 
-    if (prefixLength < maxLength)
-      continue;
+  PoolSP pool = tierDataPool(path, stat.pool, io->getSize());
 
-    if (path.compare(0, prefixLength, prefix) == 0)
-    {
-      pool = map->at(prefix);
-      maxLength = prefixLength;
-    }
+  if (!pool)
+  {
+    finishFileMove(io, 0);
+    return;
   }
 
-  return pool;
-}
+  radosfs_debug("Moving %s from the data pool %s to %s", path.c_str(),
+                stat.pool->name.c_str(), pool->name.c_str());
 
-std::string
-FilesystemPriv::poolPrefix(const std::string &pool, PoolMap *map,
-                           boost::mutex &mutex) const
-{
-  std::string prefix("");
-  boost::unique_lock<boost::mutex> lock(mutex);
+  Stat parentStat;
+  ret = this->stat(getParentDir(path, 0), &parentStat);
 
-  PoolMap::iterator it;
-  for (it = map->begin(); it != map->end(); it++)
+  if (ret == 0)
+    ret = moveFileData(io, parentStat, &stat, pool);
+
+  if (ret == 0)
   {
-    if ((*it).second->name == pool)
-    {
-      prefix = (*it).first;
-      break;
-    }
+    metrics.add(MetricsRegistry::COUNTER_FILE_TIER_MOVES);
+  }
+  else
+  {
+    radosfs_debug("Error moving %s to the data pool %s: %s (retcode=%d)",
+                  path.c_str(), pool->name.c_str(), strerror(abs(ret)), ret);
+    metrics.add(MetricsRegistry::COUNTER_FILE_TIER_MOVE_FAILURES);
   }
 
-  return prefix;
+  finishFileMove(io, ret == 0 ? &stat : 0);
+}
+
+void
+FilesystemPriv::finishFileMove(FileIOSP io, const Stat *movedStat)
+{
+  FileIOSP movedIO;
+
+  // After a move, the FileIO still points to the old pool so it is replaced by
+  // one for the new pool (which is dropped once nothing uses it)
+  if (movedStat)
+    movedIO = FileIOSP(new FileIO(radosFs, movedStat->pool, io->inode(),
+                                  movedStat->path, io->chunkSize()));
+
+  operations.finishMove(io, movedIO);
+
+  if (movedIO)
+    scheduleFileIOCheck(io->inode());
+  else
+    releaseFileIO(io);
 }
 
 int
-FilesystemPriv::removePool(const std::string &name, PoolMap *map,
-                           boost::mutex &mutex)
+FilesystemPriv::updateDataPoolsUsage(void)
 {
-  int ret = -ENOENT;
-  const std::string &prefix = poolPrefix(name, map, mutex);
-  boost::unique_lock<boost::mutex> lock(mutex);
+  const PoolList &pools = getDataPools();
+  std::list<std::string> poolNames;
+  std::map<std::string, librados::pool_stat_t> stats;
 
-  if (map->count(prefix) > 0)
+  for (size_t i = 0; i < pools.size(); i++)
+    poolNames.push_back(pools[i]->name);
+
+  if (poolNames.empty())
+    return 0;
+
+  int ret = radosCluster.get_pool_stats(poolNames, stats);
+
+  if (ret != 0)
   {
-    map->erase(prefix);
-    ret = 0;
+    radosfs_debug("Error getting the data pools' stats: %s (retcode=%d)",
+                  strerror(abs(ret)), ret);
+    return ret;
   }
 
-  return ret;
-}
+  boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
 
-std::string
-FilesystemPriv::poolFromPrefix(const std::string &prefix, PoolMap *map,
-                               boost::mutex &mutex) const
-{
-  std::string pool("");
-  boost::unique_lock<boost::mutex> lock(mutex);
+  dataPoolsUsage.clear();
 
-  if (map->count(prefix) > 0)
-    pool = map->at(prefix)->name;
+  std::map<std::string, librados::pool_stat_t>::const_iterator it;
+  for (it = stats.begin(); it != stats.end(); it++)
+    dataPoolsUsage[(*it).first] = (*it).second.num_bytes;
 
-  return pool;
+  return 0;
 }
 
-std::vector<std::string>
-FilesystemPriv::pools(PoolMap *map,
-                      boost::mutex &mutex) const
+void
+FilesystemPriv::checkDataPoolsUsage(void)
 {
-  boost::unique_lock<boost::mutex> lock(mutex);
-  std::vector<std::string> pools;
+  const boost::chrono::milliseconds sleepTime(DATA_POOLS_USAGE_UPDATE_SLEEP);
 
-  PoolMap::iterator it;
-  for (it = map->begin(); it != map->end(); it++)
+  while (true)
   {
-    pools.push_back((*it).second->name);
-  }
+    boost::this_thread::sleep_for(sleepTime);
+
+    {
+      boost::unique_lock<boost::mutex> lock(dataPoolPlacementMutex);
+
+      if (dataPoolPlacement != Filesystem::DATA_POOL_PLACEMENT_LEAST_USED)
+        continue;
+    }
 
-  return pools;
+    if (initialized)
+      updateDataPoolsUsage();
+  }
 }
 
-PoolList
-FilesystemPriv::getDataPools(const std::string &path)
+void
+FilesystemPriv::getMetrics(Filesystem::Metrics &metrics)
 {
-  size_t maxLength = 0;
-  std::string prefixFound("");
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  this->metrics.get(metrics);
+  InstrumentedMutex::getStats(metrics);
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
-  {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
+  // The gauges are read when the metrics are requested instead of being kept
+  // up to date by the code that changes them
+  const char *priorities[] = {"data", "metadata", "background"};
 
-    if (prefixLength < maxLength)
-      continue;
+  for (int i = 0; i < WORK_PRIORITY_COUNT; i++)
+  {
+    Filesystem::WorkQueueStats stats =
+        workScheduler.stats((Filesystem::WorkPriority) i);
+    const std::string prefix = std::string("work_queue_") + priorities[i];
 
-    if (path.compare(0, prefixLength, prefix) == 0)
-    {
-      prefixFound = prefix;
-      maxLength = prefixLength;
-    }
+    metrics.gauges[prefix + "_queued"] = stats.queued;
+    metrics.gauges[prefix + "_running"] = stats.running;
   }
 
-  if (prefixFound != "")
-    pools = poolMap[prefixFound];
+  metrics.gauges["generic_workers"] = workScheduler.numWorkers();
 
-  return pools;
+  Filesystem::WriteThrottleStats throttleStats = writeThrottle.stats();
+  metrics.gauges["write_throttle_bytes"] = throttleStats.bytes;
+  metrics.gauges["write_throttle_ops"] = throttleStats.ops;
+
+  metrics.gauges["open_files"] = operations.size();
 }
 
-PoolList
-FilesystemPriv::getDataPools()
+void
+FilesystemPriv::checkSlowOps(void)
 {
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
-
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  while (true)
   {
-    const PoolList &list = (*it).second;
-    pools.insert(pools.end(), list.begin(), list.end());
-  }
+    // Check often enough to report the ops not much later than the threshold
+    // (a threshold of 0 disables the reports so there is no hurry then)
+    const float threshold = slowOps.threshold();
+    uint32_t interval = SLOW_OP_CHECK_INTERVAL;
 
-  return pools;
+    if (threshold > 0)
+      interval = std::min(interval, (uint32_t) (threshold * 500));
+
+    boost::this_thread::sleep_for(
+          boost::chrono::milliseconds(std::max(interval, (uint32_t) 10)));
+
+    slowOps.check();
+  }
 }
 
-PoolList
-FilesystemPriv::getMtdPools()
+void
+FilesystemPriv::dumpMetrics(void)
 {
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(mtdPoolMutex);
+  boost::unique_lock<boost::mutex> lock(metricsDumpMutex);
 
-  PoolMap::const_iterator it;
-  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
+  while (true)
   {
-    pools.push_back((*it).second);
-  }
+    if (metricsDumpFile.empty())
+    {
+      metricsDumpCond.wait(lock);
+      continue;
+    }
 
-  return pools;
+    boost::chrono::milliseconds interval(
+          (int64_t) (metricsDumpInterval * 1000));
+
+    if (metricsDumpCond.wait_for(lock, interval) == boost::cv_status::no_timeout)
+      continue;
+
+    const std::string path = metricsDumpFile;
+
+    lock.unlock();
+
+    Filesystem::Metrics currentMetrics;
+    getMetrics(currentMetrics);
+
+    // Write to a temporary file first so readers never see a partial dump
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream stream(tmpPath.c_str(), std::ios_base::trunc);
+
+    stream << metricsToPrometheusText(currentMetrics);
+    stream.close();
+
+    if (stream.fail() || rename(tmpPath.c_str(), path.c_str()) != 0)
+      radosfs_debug("Failed to dump the metrics to %s", path.c_str());
+
+    lock.lock();
+  }
 }
 
 const std::string
@@ -1249,14 +3043,12 @@ FilesystemPriv::getParentDir(const std::string &obj, int *pos)
 void
 FilesystemPriv::updateDirCache(std::tr1::shared_ptr<DirCache> &cache)
 {
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
   dirCache.update(cache);
 }
 
 void
 FilesystemPriv::removeDirCache(std::tr1::shared_ptr<DirCache> &cache)
 {
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
   dirCache.removeCache(cache->inode());
 }
 
@@ -1264,24 +3056,20 @@ std::tr1::shared_ptr<DirCache>
 FilesystemPriv::getDirInfo(const std::string &inode, PoolSP pool,
                            bool addToCache)
 {
-  std::tr1::shared_ptr<DirCache> cache;
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
+  std::tr1::shared_ptr<DirCache> cache = dirCache.get(inode);
 
-  if (dirCache.cacheMap.count(inode) == 0)
-  {
-    if (!pool)
-    {
-      return cache;
-    }
+  metrics.add(cache ? MetricsRegistry::COUNTER_DIR_CACHE_HITS :
+                      MetricsRegistry::COUNTER_DIR_CACHE_MISSES);
 
-    DirCache *dirInfo = new DirCache(inode, pool);
-    cache = std::tr1::shared_ptr<DirCache>(dirInfo);
+  if (cache || !pool)
+    return cache;
 
-    if (addToCache)
-      dirCache.update(cache);
-  }
-  else
-    cache = dirCache.cacheMap[inode]->cachePtr;
+  DirCache *dirInfo = new DirCache(inode, pool, &radosCluster);
+  cache = std::tr1::shared_ptr<DirCache>(dirInfo);
+
+  // If the same dir was cached meanwhile, the cached one is returned
+  if (addToCache)
+    cache = dirCache.update(cache);
 
   return cache;
 }
@@ -1289,19 +3077,13 @@ FilesystemPriv::getDirInfo(const std::string &inode, PoolSP pool,
 FileIOSP
 FilesystemPriv::getFileIO(const std::string &path)
 {
-  FileIOSP io;
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
-
-  if (operations.count(path) != 0)
-    io = operations[path];
-
-  return io;
+  return operations.get(path);
 }
 
 FileIOSP
 FilesystemPriv::getOrCreateFileIO(const std::string &path, const Stat *stat)
 {
-  FileIOSP io = getFileIO(path);
+  FileIOSP io = operations.acquire(path);
 
   if (!io)
   {
@@ -1319,26 +3101,30 @@ FilesystemPriv::getOrCreateFileIO(const std::string &path, const Stat *stat)
     io = FileIOSP(new FileIO(radosFs, stat->pool, stat->translatedPath,
                              stat->path, chunkSize));
 
-    setFileIO(io);
+    io = operations.add(io);
   }
 
   return io;
 }
 
+void
+FilesystemPriv::releaseFileIO(FileIOSP sharedFileIO)
+{
+  // Let the filesystem drop the FileIO if no one else is using it
+  if (sharedFileIO->removeClient() == 0)
+    scheduleFileIOCheck(sharedFileIO->inode());
+}
+
 void
 FilesystemPriv::setFileIO(FileIOSP sharedFileIO)
 {
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
-  operations[sharedFileIO->inode()] = sharedFileIO;
+  operations.set(sharedFileIO);
 }
 
 void
 FilesystemPriv::removeFileIO(FileIOSP sharedFileIO)
 {
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
-
-  if (operations.count(sharedFileIO->inode()))
-    operations.erase(sharedFileIO->inode());
+  operations.remove(sharedFileIO);
 }
 
 void
@@ -1388,42 +3174,223 @@ FilesystemPriv::updateTMIdSync(std::string path)
 void
 FilesystemPriv::updateTMId(Stat *stat)
 {
-  getIoService()->post(boost::bind(&FilesystemPriv::updateTMIdSync, this,
-                                   stat->path));
+  post(boost::bind(&FilesystemPriv::updateTMIdSync, this, stat->path),
+       Filesystem::WORK_PRIORITY_BACKGROUND);
 }
 
 void
-FilesystemPriv::checkFileLocks(void)
+FilesystemPriv::scheduleFileIOCheck(const std::string &inode,
+                                    boost::chrono::system_clock::time_point time)
+{
+  boost::unique_lock<boost::mutex> lock(fileIOTimersMutex);
+  std::map<std::string, boost::chrono::system_clock::time_point>::iterator it;
+
+  it = fileIOChecks.find(inode);
+
+  // An earlier check for the inode will reschedule itself if needed
+  if (it != fileIOChecks.end() && it->second <= time)
+    return;
+
+  fileIOChecks[inode] = time;
+
+  bool isNext = fileIOTimers.empty() || time < fileIOTimers.top().first;
+
+  fileIOTimers.push(FileIOTimer(time, inode));
+
+  if (isNext)
+    fileIOTimersCond.notify_one();
+}
+
+void
+FilesystemPriv::checkFileIO(const std::string &inode)
 {
-  const boost::chrono::milliseconds sleepTime(FILE_OPS_IDLE_CHECKER_SLEEP);
-  std::map<std::string, std::tr1::shared_ptr<FileIO> >::iterator it, oldIt;
+  FileIOSP io;
+
+  // If it was dropped, the FileIO is destroyed when io goes out of scope
+  if (operations.removeIfUnused(inode, io) || !io)
+    return;
+
+  boost::chrono::system_clock::time_point nextCheck =
+      io->manageIdleLock(FILE_IDLE_LOCK_TIMEOUT);
+
+  // Ops keep a reference to the FileIO so it can only be dropped after they
+  // are finished
+  if (io->hasRunningAsyncOps())
+    nextCheck = boost::chrono::system_clock::now() +
+                boost::chrono::milliseconds(FILE_OPS_IDLE_CHECKER_SLEEP);
+
+  // Otherwise, it is checked again when its lock is taken or when a client
+  // (FileInode) stops using it
+  if (nextCheck != boost::chrono::system_clock::time_point())
+    scheduleFileIOCheck(inode, nextCheck);
+}
 
+void
+FilesystemPriv::checkFileLocks(void)
+{
   while (true)
   {
-    boost::unique_lock<boost::mutex> lock(operationsMutex);
-    it = operations.begin();
-    while (it != operations.end())
+    std::vector<std::string> dueInodes;
+
     {
-      boost::this_thread::interruption_point();
-      FileIOSP io = (*it).second;
-      if (io)
+      boost::unique_lock<boost::mutex> lock(fileIOTimersMutex);
+
+      while (fileIOTimers.empty())
+        fileIOTimersCond.wait(lock);
+
+      boost::chrono::system_clock::time_point now =
+          boost::chrono::system_clock::now();
+
+      if (fileIOTimers.top().first > now)
+      {
+        fileIOTimersCond.wait_until(lock, fileIOTimers.top().first);
+        continue;
+      }
+
+      while (!fileIOTimers.empty() && fileIOTimers.top().first <= now)
       {
-        if (!io->hasRunningAsyncOps() && FileIO::hasSingleClient(io))
+        const FileIOTimer &timer = fileIOTimers.top();
+        std::map<std::string, boost::chrono::system_clock::time_point>::iterator
+            it = fileIOChecks.find(timer.second);
+
+        // Timers replaced by earlier ones are just discarded
+        if (it != fileIOChecks.end() && it->second == timer.first)
         {
-          oldIt = it;
-          it++;
-          operations.erase(oldIt);
-          continue;
+          dueInodes.push_back(timer.second);
+          fileIOChecks.erase(it);
         }
-        else
-          io->manageIdleLock(FILE_IDLE_LOCK_TIMEOUT);
+
+        fileIOTimers.pop();
       }
+    }
 
-      it++;
+    std::vector<std::string>::iterator it;
+    for (it = dueInodes.begin(); it != dueInodes.end(); it++)
+    {
+      boost::this_thread::interruption_point();
+      checkFileIO(*it);
     }
-    lock.unlock();
+  }
+}
+
+void
+FilesystemPriv::checkDirLogs(void)
+{
+  const boost::chrono::milliseconds sleepTime(DIR_COMPACTOR_SLEEP);
+
+  while (true)
+  {
     boost::this_thread::sleep_for(sleepTime);
+
+    std::vector<std::tr1::shared_ptr<DirCache> > cachedDirs, candidates;
+    const float compactRatio = dirCompactRatio;
+    size_t minLogSize;
+
+    {
+      boost::unique_lock<boost::mutex> lock(dirCompactMutex);
+
+      if (!backgroundDirCompaction)
+        continue;
+
+      minLogSize = dirCompactMinLogSize;
+    }
+
+    // The cached dirs come sorted from the most recently used ones (in each
+    // shard of the cache) since those are the ones whose logs are most likely
+    // to keep growing
+    dirCache.cachedDirs(cachedDirs);
+
+    std::vector<std::tr1::shared_ptr<DirCache> >::iterator cacheIt;
+    for (cacheIt = cachedDirs.begin(); cacheIt != cachedDirs.end(); cacheIt++)
+    {
+      const float ratio = (*cacheIt)->logRatio();
+
+      if (ratio != -1 && ratio <= compactRatio &&
+          (*cacheIt)->lastCachedSize() >= minLogSize)
+      {
+        candidates.push_back(*cacheIt);
+      }
+    }
+
+    cachedDirs.clear();
+
+    boost::this_thread::interruption_point();
+
+    if (candidates.empty())
+      continue;
+
+    const boost::chrono::steady_clock::time_point now =
+        boost::chrono::steady_clock::now();
+    size_t numJobs = 0;
+
+    boost::unique_lock<boost::mutex> lock(dirCompactMutex);
+
+    std::vector<std::tr1::shared_ptr<DirCache> >::iterator it;
+    for (it = candidates.begin();
+         it != candidates.end() && numJobs < DIR_COMPACTOR_MAX_JOBS_PER_ROUND;
+         it++)
+    {
+      const std::string &inode = (*it)->inode();
+
+      if (dirsBeingCompacted.count(inode) > 0)
+        continue;
+
+      std::map<std::string, DirCompactBackoff>::iterator backoffIt;
+      backoffIt = dirCompactBackoff.find(inode);
+
+      if (backoffIt != dirCompactBackoff.end() &&
+          (*backoffIt).second.nextAttempt > now)
+      {
+        continue;
+      }
+
+      dirsBeingCompacted.insert(inode);
+      numJobs++;
+
+      post(boost::bind(&FilesystemPriv::compactDirAsync, this, *it),
+           Filesystem::WORK_PRIORITY_BACKGROUND);
+    }
+  }
+}
+
+void
+FilesystemPriv::compactDirAsync(std::tr1::shared_ptr<DirCache> cache)
+{
+  const std::string &inode = cache->inode();
+  int ret = cache->compactDirOpLog();
+
+  boost::unique_lock<boost::mutex> lock(dirCompactMutex);
+
+  dirsBeingCompacted.erase(inode);
+
+  if (ret == 0)
+  {
+    dirCompactBackoff.erase(inode);
+    return;
+  }
+
+  // The log was changed by another client while being compacted (-ECANCELED)
+  // or the operation failed, so we back off exponentially before retrying
+  // this dir, to avoid competing with the clients that are writing to it
+  DirCompactBackoff &backoff = dirCompactBackoff[inode];
+  size_t delay = DIR_COMPACTOR_MIN_BACKOFF;
+
+  for (size_t i = 0; i < backoff.numFailures && delay < DIR_COMPACTOR_MAX_BACKOFF;
+       i++)
+  {
+    delay *= 2;
   }
+
+  if (delay > DIR_COMPACTOR_MAX_BACKOFF)
+    delay = DIR_COMPACTOR_MAX_BACKOFF;
+
+  backoff.numFailures++;
+  backoff.nextAttempt = boost::chrono::steady_clock::now() +
+                        boost::chrono::milliseconds(delay);
+
+  radosfs_debug("Failed to compact dir %s in the background: %s (retcode=%d). "
+                "Retrying in %lu ms.", inode.c_str(), strerror(abs(ret)), ret,
+                delay);
 }
 
 /**
@@ -1523,7 +3490,7 @@ Filesystem::addDataPool(const std::string &name, const std::string &prefix,
     return -EINVAL;
   }
 
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mPriv->poolMutex);
 
   map = &mPriv->poolMap;
 
@@ -1562,6 +3529,10 @@ Filesystem::addDataPool(const std::string &name, const std::string &prefix,
 
   pools->push_back(PoolSP(pool));
 
+  lock.unlock();
+
+  mPriv->updateDataPoolRouter();
+
   return ret;
 }
 
@@ -1578,7 +3549,7 @@ Filesystem::removeDataPool(const std::string &name)
 {
   int ret = -ENOENT;
   PoolListMap *map = &mPriv->poolMap;
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mPriv->poolMutex);
 
   PoolListMap::iterator it;
 
@@ -1607,6 +3578,18 @@ Filesystem::removeDataPool(const std::string &name)
       break;
   }
 
+  lock.unlock();
+
+  if (ret == 0)
+  {
+    mPriv->updateDataPoolRouter();
+
+    boost::unique_lock<boost::mutex> placementLock(mPriv->dataPoolPlacementMutex);
+    mPriv->dataPoolWeights.erase(name);
+    mPriv->dataPoolsUsage.erase(name);
+    mPriv->dataPoolMinFileSizes.erase(name);
+  }
+
   return ret;
 }
 
@@ -1620,7 +3603,7 @@ Filesystem::dataPools(const std::string &prefix) const
 {
   std::vector<std::string> pools;
   const std::string &dirPrefix = getDirPath(prefix);
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mPriv->poolMutex);
 
   if (mPriv->poolMap.count(dirPrefix) > 0)
   {
@@ -1645,7 +3628,7 @@ std::string
 Filesystem::dataPoolPrefix(const std::string &pool) const
 {
   std::string prefix("");
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mPriv->poolMutex);
 
   PoolListMap::const_iterator it;
   for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
@@ -1678,7 +3661,7 @@ ssize_t
 Filesystem::dataPoolSize(const std::string &pool) const
 {
   ssize_t size = -ENOENT;
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<InstrumentedMutex> lock(mPriv->poolMutex);
 
   PoolListMap::const_iterator it;
   for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
@@ -1702,6 +3685,192 @@ Filesystem::dataPoolSize(const std::string &pool) const
   return size;
 }
 
+/**
+ * Sets the weight of a data pool, used for choosing the pool of new files when
+ * more than one data pool is associated with the same prefix (see
+ * Filesystem::setDataPoolPlacement).
+ *
+ * A pool with twice the weight of another will get twice as many new files
+ * (or be filled up to twice the space, when placing files by usage). A pool
+ * with a weight of 0 will not get any new files.
+ * @param pool the name of a data pool.
+ * @param weight the new weight of the pool (the default is 1).
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::setDataPoolWeight(const std::string &pool, unsigned int weight)
+{
+  if (!mPriv->getDataPoolFromName(pool))
+    return -ENOENT;
+
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+  mPriv->dataPoolWeights[pool] = weight;
+
+  return 0;
+}
+
+/**
+ * Gets the weight of a data pool.
+ * @param pool the name of a data pool.
+ * @return the weight of the pool or an error code if the pool does not exist.
+ */
+ssize_t
+Filesystem::dataPoolWeight(const std::string &pool) const
+{
+  if (!mPriv->getDataPoolFromName(pool))
+    return -ENOENT;
+
+  return mPriv->dataPoolWeight(pool);
+}
+
+/**
+ * Sets the minimum size of the files stored in a data pool, making it a tier
+ * for the data pools associated with the same prefix.
+ *
+ * New files are created in the pools whose minimum file size is 0 (all pools
+ * have that minimum by default). When a File instance that has written to a
+ * file is destroyed, if the file's size reached the minimum size of another
+ * pool with the same prefix (and not the one of any bigger tier), the file's
+ * contents are moved to that pool in the background (the moves and their
+ * failures are counted in the metrics). This makes it possible to e.g. keep
+ * small files in a replicated pool and big ones in an erasure coded pool. Files
+ * that fit in their inline buffer never need to be moved since their contents
+ * are not stored in the data pool.
+ *
+ * @note A file is only moved if it is not being used by other File instances of
+ *       the same Filesystem. Other clients writing to it after it is moved get
+ *       -ESTALE.
+ * @param pool the name of a data pool.
+ * @param size the minimum file size for the pool (in bytes).
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::setDataPoolMinFileSize(const std::string &pool, uint64_t size)
+{
+  if (!mPriv->getDataPoolFromName(pool))
+    return -ENOENT;
+
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+
+  if (size == 0)
+    mPriv->dataPoolMinFileSizes.erase(pool);
+  else
+    mPriv->dataPoolMinFileSizes[pool] = size;
+
+  return 0;
+}
+
+/**
+ * Gets the minimum size of the files stored in a data pool.
+ * @see Filesystem::setDataPoolMinFileSize
+ * @param pool the name of a data pool.
+ * @return the minimum file size (in bytes) or an error code if the pool does
+ *         not exist.
+ */
+int64_t
+Filesystem::dataPoolMinFileSize(const std::string &pool) const
+{
+  if (!mPriv->getDataPoolFromName(pool))
+    return -ENOENT;
+
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+
+  return mPriv->dataPoolMinFileSize(pool);
+}
+
+/**
+ * Sets how the data pool of new files is chosen when more than one data pool
+ * is associated with the file's prefix:
+ *  - DATA_POOL_PLACEMENT_FIRST: the first pool added for the prefix is always
+ *    used (default);
+ *  - DATA_POOL_PLACEMENT_ROUND_ROBIN: the pools are used in turns, according
+ *    to their weights;
+ *  - DATA_POOL_PLACEMENT_LEAST_USED: the pool with the least used space
+ *    (relative to its weight) is used; the pools' usage is read from the
+ *    cluster in the background, every few seconds;
+ *  - DATA_POOL_PLACEMENT_PATH_HASH: the pool is chosen by hashing the file's
+ *    path, according to the pools' weights.
+ *
+ * Pools given explicitly to File::create are always used instead.
+ * @param placement the placement policy.
+ */
+void
+Filesystem::setDataPoolPlacement(DataPoolPlacement placement)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+    mPriv->dataPoolPlacement = placement;
+  }
+
+  // Do not wait for the background update to have the usage of the pools
+  if (placement == DATA_POOL_PLACEMENT_LEAST_USED && mPriv->initialized)
+    mPriv->updateDataPoolsUsage();
+}
+
+/**
+ * Gets the policy used for choosing the data pool of new files.
+ * @return the placement policy.
+ */
+Filesystem::DataPoolPlacement
+Filesystem::dataPoolPlacement(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+  return mPriv->dataPoolPlacement;
+}
+
+/**
+ * Moves a file's contents to another data pool associated with its prefix.
+ *
+ * The file's chunks are copied by the cluster itself (several at a time), then
+ * the file's entry is pointed to the new pool and the chunks in the old pool
+ * are removed. The entry is only changed if it was not modified while the
+ * chunks were copied. If a move is interrupted after the entry was changed,
+ * calling this method again for the same pool removes the chunks left in the
+ * old one, so a set of files can be moved again until all of them succeed.
+ *
+ * @note The file should not be written by other clients while it is moved.
+ * @see Filesystem::setDataMoveRate
+ * @param path the path of the file.
+ * @param pool the name of the data pool to move the file to.
+ * @return 0 on success (also if the file already is in \a pool), -ENODEV if
+ *         \a pool is not a data pool for the file's path, -EBUSY if the file is
+ *         being used by other File instances, -EAGAIN if the file was changed
+ *         while its contents were copied, or another error code otherwise.
+ * @note Other clients that have the file open in its old pool get -ESTALE
+ *       when writing to it after the move.
+ */
+int
+Filesystem::moveFileToPool(const std::string &path, const std::string &pool)
+{
+  return mPriv->moveFileToPool(path, pool);
+}
+
+/**
+ * Limits the rate at which file contents are copied when moving them between
+ * data pools (either by Filesystem::moveFileToPool or when files change tier).
+ * @see Filesystem::setDataPoolMinFileSize
+ * @param bytesPerSecond the maximum rate in bytes per second (0 means no limit,
+ *        the default).
+ */
+void
+Filesystem::setDataMoveRate(uint64_t bytesPerSecond)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+  mPriv->dataMoveRate = bytesPerSecond;
+}
+
+/**
+ * Gets the maximum rate at which file contents are moved between data pools.
+ * @see Filesystem::setDataMoveRate
+ * @return the rate in bytes per second (0 means no limit).
+ */
+uint64_t
+Filesystem::dataMoveRate(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dataPoolPlacementMutex);
+  return mPriv->dataMoveRate;
+}
+
 /**
  * Sets a pool to be used for the metadata associated with the given \a prefix.
  * Directory objects whose path prefixes match the one set by this method will
@@ -1716,10 +3885,15 @@ Filesystem::dataPoolSize(const std::string &pool) const
 int
 Filesystem::addMetadataPool(const std::string &name, const std::string &prefix)
 {
-  return mPriv->addPool(name,
-                        prefix,
-                        &mPriv->mtdPoolMap,
-                        mPriv->mtdPoolMutex);
+  int ret = mPriv->addPool(name,
+                           prefix,
+                           &mPriv->mtdPoolMap,
+                           mPriv->mtdPoolMutex);
+
+  if (ret == 0)
+    mPriv->updateMtdPoolRouter();
+
+  return ret;
 }
 
 /**
@@ -1734,7 +3908,12 @@ Filesystem::addMetadataPool(const std::string &name, const std::string &prefix)
 int
 Filesystem::removeMetadataPool(const std::string &name)
 {
-  return mPriv->removePool(name, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+  int ret = mPriv->removePool(name, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+
+  if (ret == 0)
+    mPriv->updateMtdPoolRouter();
+
+  return ret;
 }
 
 /**
@@ -1873,6 +4052,19 @@ Filesystem::stat(const std::string &path, struct stat *buff)
 
   if (ret != 0)
   {
+    // Files are statted from a read of their parent dir and a check of their
+    // size hint against the inode (without needing to open them); if the hint
+    // is not valid, their size is read from the inode
+    Stat stat;
+
+    if (mPriv->stat(sanitizedPath, &stat) == 0 &&
+        S_ISREG(stat.statBuff.st_mode) &&
+        (verifyFileSizeHint(&stat) || mPriv->statFileData(&stat) == 0))
+    {
+      *buff = stat.statBuff;
+      return 0;
+    }
+
     File file(this, sanitizedPath, File::MODE_READ);
 
     ret = file.stat(buff);
@@ -2045,23 +4237,28 @@ Filesystem::getXAttrsMap(const std::string &path,
 
 /**
  * Sets the maximum size of the directory cache.
- * @param size the size to set.
+ *
+ * The size of the cache is the (approximate) memory used by the cached
+ * directories and their entries. If the cache is bigger than the new size, the
+ * least recently used directories are removed from it.
+ *
+ * @param size the size to set (in bytes).
  */
 void
 Filesystem::setDirCacheMaxSize(size_t size)
 {
-  mPriv->dirCache.maxCacheSize = size;
+  mPriv->dirCache.setMaxSize(size);
   mPriv->dirCache.adjustCache();
 }
 
 /**
  * Gets the maximum size of the directory cache.
- * @return the maximum size of the directory cache.
+ * @return the maximum size of the directory cache (in bytes).
  */
 size_t
 Filesystem::dirCacheMaxSize(void) const
 {
-  return mPriv->dirCache.maxCacheSize;
+  return mPriv->dirCache.maxSize();
 }
 
 /**
@@ -2084,6 +4281,142 @@ Filesystem::dirCompactRatio(void) const
   return mPriv->dirCompactRatio;
 }
 
+/**
+ * Sets the lease time of the cached directories.
+ *
+ * When this time is greater than 0, the cached directories are watched for
+ * changes (which are notified by the clients that change them) and
+ * Dir::refresh will only read a directory if it has changed or if it has not
+ * been read for longer than the lease time. This saves many round trips to
+ * the cluster for directories that rarely change.
+ *
+ * All the clients notify the changes they make to directories (whatever
+ * their own lease time is), so the clients using leases see each other's
+ * changes as well as the ones of clients that do not use them.
+ *
+ * @note Since the clients do not wait for the notifications to be delivered,
+ *       a change to a directory done by a different client may take a little
+ *       bit to be seen by Dir::refresh (at most the lease time, if the
+ *       notification is lost).
+ * @param seconds the lease time in seconds (0, the default, disables it and
+ *        directories are always read when refreshed).
+ */
+void
+Filesystem::setDirCacheLeaseTime(float seconds)
+{
+  mPriv->dirCacheLeaseTime = seconds;
+}
+
+/**
+ * Gets the lease time of the cached directories.
+ * @return the lease time (in seconds).
+ */
+float
+Filesystem::dirCacheLeaseTime(void) const
+{
+  return mPriv->dirCacheLeaseTime;
+}
+
+/**
+ * Enables or disables the background compaction of directories.
+ *
+ * When enabled, the directories in the cache are periodically checked and
+ * the ones whose compact ratio is lesser than or equal to the one set with
+ * Filesystem::setDirCompactRatio (and whose log is not smaller than the size
+ * set with Filesystem::setDirCompactMinLogSize) are compacted by the generic
+ * workers. Background compaction is enabled by default.
+ *
+ * @param enable whether the background compaction should be enabled.
+ */
+void
+Filesystem::setBackgroundDirCompaction(bool enable)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dirCompactMutex);
+  mPriv->backgroundDirCompaction = enable;
+}
+
+/**
+ * Checks whether the background compaction of directories is enabled.
+ * @return true if the background compaction is enabled, false otherwise.
+ */
+bool
+Filesystem::backgroundDirCompaction(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dirCompactMutex);
+  return mPriv->backgroundDirCompaction;
+}
+
+/**
+ * Sets the minimum size that a directory's log needs to have in order to be
+ * compacted in the background.
+ * @param size the minimum size of the log (in bytes).
+ */
+void
+Filesystem::setDirCompactMinLogSize(size_t size)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dirCompactMutex);
+  mPriv->dirCompactMinLogSize = size;
+}
+
+/**
+ * Gets the minimum size that a directory's log needs to have in order to be
+ * compacted in the background.
+ * @return the minimum size of the log (in bytes).
+ */
+size_t
+Filesystem::dirCompactMinLogSize(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->dirCompactMutex);
+  return mPriv->dirCompactMinLogSize;
+}
+
+/**
+ * Sets the maximum number of entries in the cache that maps directory paths
+ * to their inodes. If the cache has more entries than the new size, the least
+ * recently used ones are removed from it.
+ * @param size the maximum number of entries.
+ */
+void
+Filesystem::setDirPathCacheMaxSize(size_t size)
+{
+  mPriv->dirPathCache.setMaxSize(size);
+}
+
+/**
+ * Gets the maximum number of entries in the cache that maps directory paths
+ * to their inodes.
+ * @return the maximum number of entries.
+ */
+size_t
+Filesystem::dirPathCacheMaxSize(void) const
+{
+  return mPriv->dirPathCache.maxSize();
+}
+
+/**
+ * Sets the time that the entries of the cache that maps directory paths to
+ * their inodes are considered valid. Changes done by this client (e.g. renaming
+ * or removing directories) are applied to the cache immediately, but changes
+ * done by other clients will only be noticed after this time.
+ * @param seconds the time to live of the entries (in seconds).
+ */
+void
+Filesystem::setDirPathCacheTTL(float seconds)
+{
+  mPriv->dirPathCache.setTTL(seconds);
+}
+
+/**
+ * Gets the time that the entries of the cache that maps directory paths to
+ * their inodes are considered valid.
+ * @return the time to live of the entries (in seconds).
+ */
+float
+Filesystem::dirPathCacheTTL(void) const
+{
+  return mPriv->dirPathCache.ttl();
+}
+
 /**
  * Sets the log level to be used.
  * @param level the new log level.
@@ -2217,6 +4550,9 @@ Filesystem::getInodeAndPool(const std::string &path, std::string *inode,
  * @param numWorkers the number of worker threads (minimum is 1).
  * @note The minimum number of generic workers is 1. Setting a lower value will
  *       instead set the minimum value.
+ * @note If a maximum number of generic workers bigger than this number is set,
+ *       this is the minimum number of workers the pool shrinks to.
+ * @see Filesystem::setMaxNumGenericWorkers
  */
 void
 Filesystem::setNumGenericWorkers(size_t numWorkers)
@@ -2229,15 +4565,15 @@ Filesystem::setNumGenericWorkers(size_t numWorkers)
     numWorkers = MIN_NUM_WORKER_THREADS;
   }
 
+  size_t maxNumWorkers;
+
   {
     boost::unique_lock<boost::mutex> lock(mPriv->genericWorkersMutex);
     mPriv->numGenericWorkers = numWorkers;
+    maxNumWorkers = mPriv->maxNumGenericWorkers;
   }
 
-  size_t currentNumWorkers = mPriv->generalWorkerThreads.size();
-
-  if (currentNumWorkers > 0 && currentNumWorkers != numWorkers)
-    mPriv->launchThreads();
+  mPriv->workScheduler.setNumWorkers(numWorkers, maxNumWorkers);
 }
 
 /**
@@ -2253,4 +4589,400 @@ Filesystem::numGenericWorkers(void)
   return mPriv->numGenericWorkers;
 }
 
+/**
+ * Sets the maximum number of generic worker threads, making the number of
+ * workers adapt to the work that is given to them.
+ *
+ * The worker threads spend most of their time waiting for the cluster, so
+ * whenever a job has been queued for more than a few milliseconds, or most
+ * workers are busy while there are jobs queued, a new worker is launched (up
+ * to \a maxNumWorkers). Workers that have been idle for a few seconds leave,
+ * down to the number set by Filesystem::setNumGenericWorkers.
+ * @param maxNumWorkers the maximum number of worker threads (0, the default,
+ *        or a number smaller than Filesystem::numGenericWorkers, means that the
+ *        number of workers is fixed).
+ */
+void
+Filesystem::setMaxNumGenericWorkers(size_t maxNumWorkers)
+{
+  size_t numWorkers;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->genericWorkersMutex);
+    mPriv->maxNumGenericWorkers = maxNumWorkers;
+    numWorkers = mPriv->numGenericWorkers;
+  }
+
+  mPriv->workScheduler.setNumWorkers(numWorkers, maxNumWorkers);
+}
+
+/**
+ * Returns the maximum number of generic worker threads.
+ * @see Filesystem::setMaxNumGenericWorkers
+ * @return the maximum number of generic worker threads (0 if the number of
+ *         workers is fixed).
+ */
+size_t
+Filesystem::maxNumGenericWorkers(void)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->genericWorkersMutex);
+  return mPriv->maxNumGenericWorkers;
+}
+
+/**
+ * Returns the number of generic worker threads currently running.
+ * @return the number of generic worker threads currently running (0 if they
+ *         were not launched yet).
+ */
+size_t
+Filesystem::currentNumGenericWorkers(void)
+{
+  return mPriv->workScheduler.numWorkers();
+}
+
+/**
+ * Returns the number of jobs waiting for a generic worker thread.
+ * @see Filesystem::workQueueStats
+ * @return the number of queued jobs (of all priorities).
+ */
+size_t
+Filesystem::genericWorkQueueDepth(void)
+{
+  return mPriv->workScheduler.queueDepth();
+}
+
+/**
+ * Gets statistics about the jobs of the given priority run by the generic
+ * worker threads.
+ *
+ * The jobs are queued per worker thread and idle workers take jobs from the
+ * other workers' queues (counted as stolen jobs). Jobs of higher priorities
+ * always run first, and jobs of a lower priority are never given all the
+ * workers: data jobs (writes) can use all of them, metadata jobs (stats, finds)
+ * leave one worker free, and background jobs (directory compaction, TM id
+ * propagation) leave two.
+ * @param priority the priority of the jobs.
+ * @return the number of queued and running jobs, the maximum number of jobs
+ *         that have been queued at the same time, and the number of jobs that
+ *         were completed and stolen.
+ */
+Filesystem::WorkQueueStats
+Filesystem::workQueueStats(WorkPriority priority) const
+{
+  return mPriv->workScheduler.stats(priority);
+}
+
+/**
+ * Limits the asynchronous writes that are in flight, i.e. that were issued with
+ * File::write or FileInode::write but are not yet finished.
+ *
+ * Every asynchronous write keeps its data in memory (copied, if it was asked to
+ * copy the buffer) until it is written to the cluster, so when the cluster is
+ * slower than the writers the memory used grows without limit. Once either
+ * limit is reached, new writes are held back according to the mode set with
+ * Filesystem::setWriteThrottleMode. A write bigger than \a maxBytes is let in
+ * when no other writes are in flight.
+ * @param maxBytes the maximum number of bytes in flight (0 means no limit).
+ * @param maxOps the maximum number of writes in flight (0 means no limit).
+ * @note Writes issued from the generic worker threads, e.g. from an
+ *       AsyncOpCallback, are never held back.
+ */
+void
+Filesystem::setWriteThrottle(uint64_t maxBytes, size_t maxOps)
+{
+  mPriv->writeThrottle.setLimits(maxBytes, maxOps);
+}
+
+/**
+ * Gets the limits of the asynchronous writes in flight.
+ * @see Filesystem::setWriteThrottle
+ * @param[out] maxBytes a location to return the maximum number of bytes in
+ *             flight (or a null pointer if this is not desired).
+ * @param[out] maxOps a location to return the maximum number of writes in
+ *             flight (or a null pointer if this is not desired).
+ */
+void
+Filesystem::writeThrottle(uint64_t *maxBytes, size_t *maxOps) const
+{
+  mPriv->writeThrottle.limits(maxBytes, maxOps);
+}
+
+/**
+ * Sets what happens to an asynchronous write that does not fit in the limits
+ * set with Filesystem::setWriteThrottle.
+ *
+ * Filesystem::WRITE_THROTTLE_BLOCK (the default) makes the write call wait
+ * until enough writes in flight are finished. Filesystem::WRITE_THROTTLE_NONBLOCK
+ * makes the write call return -EAGAIN right away. Filesystem::WRITE_THROTTLE_CALLBACK
+ * also returns -EAGAIN and then calls \a callback once, as soon as there is
+ * room for new writes.
+ * @param mode the throttling mode.
+ * @param callback the function to call when there is room for new writes
+ *        (only used by Filesystem::WRITE_THROTTLE_CALLBACK).
+ * @param arg a pointer to the user arguments that will be passed to the
+ *        \a callback .
+ * @note The \a callback is called from the thread that finished a write, so it
+ *       should not block.
+ */
+void
+Filesystem::setWriteThrottleMode(WriteThrottleMode mode,
+                                 WriteSpaceCallback callback, void *arg)
+{
+  mPriv->writeThrottle.setMode(mode, callback, arg);
+}
+
+/**
+ * Returns the throttling mode of the asynchronous writes.
+ * @see Filesystem::setWriteThrottleMode
+ * @return the throttling mode of the asynchronous writes.
+ */
+Filesystem::WriteThrottleMode
+Filesystem::writeThrottleMode(void) const
+{
+  return mPriv->writeThrottle.mode();
+}
+
+/**
+ * Gets statistics about the asynchronous writes in flight.
+ * @return the number of bytes and writes in flight, and the number of writes
+ *         that had to wait or that were refused because of the limits set with
+ *         Filesystem::setWriteThrottle.
+ */
+Filesystem::WriteThrottleStats
+Filesystem::writeThrottleStats(void) const
+{
+  return mPriv->writeThrottle.stats();
+}
+
+/**
+ * Gets the metrics of this filesystem instance.
+ *
+ * The counters (e.g. bytes written or RADOS chunks read) and the latency
+ * histograms of the public operations are always collected; the gauges (e.g.
+ * the work queues' depth or the number of open files) are read at the time of
+ * this call.
+ * @return the counters, gauges and the latency statistics (in microseconds)
+ *         of the operations, indexed by their names.
+ * @see Filesystem::getMetricsText
+ */
+Filesystem::Metrics
+Filesystem::getMetrics(void) const
+{
+  Metrics metrics;
+  mPriv->getMetrics(metrics);
+
+  return metrics;
+}
+
+/**
+ * Gets the metrics of this filesystem instance in the Prometheus text
+ * exposition format, with the latencies reported as summaries in seconds.
+ * @return the text with the metrics.
+ * @see Filesystem::getMetrics
+ */
+std::string
+Filesystem::getMetricsText(void) const
+{
+  return metricsToPrometheusText(getMetrics());
+}
+
+/**
+ * Sets a file to which the metrics are periodically written, in the same format
+ * as returned by Filesystem::getMetricsText. The file is replaced atomically so
+ * it can be read at any time (e.g. by a node exporter's text file collector).
+ * @param path the path of the file (an empty string disables the dump).
+ * @return 0 on success (the errors of the dump itself are only logged).
+ * @see Filesystem::setMetricsDumpInterval
+ */
+int
+Filesystem::setMetricsDumpFile(const std::string &path)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  mPriv->metricsDumpFile = path;
+  mPriv->metricsDumpCond.notify_all();
+
+  return 0;
+}
+
+/**
+ * Gets the file to which the metrics are periodically written.
+ * @return the path of the file or an empty string if the dump is disabled.
+ */
+std::string
+Filesystem::metricsDumpFile(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  return mPriv->metricsDumpFile;
+}
+
+/**
+ * Sets the interval at which the metrics are written to the file set with
+ * Filesystem::setMetricsDumpFile.
+ * @param seconds the interval in seconds (the default is 10).
+ * @return 0 on success, -EINVAL if \a seconds is not greater than 0.
+ */
+int
+Filesystem::setMetricsDumpInterval(float seconds)
+{
+  if (seconds <= 0)
+    return -EINVAL;
+
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  mPriv->metricsDumpInterval = seconds;
+  mPriv->metricsDumpCond.notify_all();
+
+  return 0;
+}
+
+/**
+ * Gets the interval at which the metrics are written to their file.
+ * @return the interval in seconds.
+ */
+float
+Filesystem::metricsDumpInterval(void) const
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  return mPriv->metricsDumpInterval;
+}
+
+/**
+ * Sets the time after which an operation is considered slow.
+ *
+ * Every file operation (including the asynchronous ones, until they finish) and
+ * the synchronous metadata calls (e.g. stat, refreshing or searching a
+ * directory) are tracked while outstanding. When one of them takes longer than
+ * this threshold, it is logged once with the time it spent waiting for the file
+ * lock (and the number of attempts to get it), queued to be run, and waiting
+ * for RADOS operations to complete. The ones still outstanding can be listed
+ * with Filesystem::dumpSlowOps.
+ * @param seconds the threshold in seconds (the default is 30; 0 disables the
+ *        tracking of slow operations, so the operations started while it is 0
+ *        are never logged or listed).
+ */
+void
+Filesystem::setSlowOpThreshold(float seconds)
+{
+  mPriv->slowOps.setThreshold(seconds);
+}
+
+/**
+ * Gets the time after which an operation is considered slow.
+ * @return the threshold in seconds.
+ */
+float
+Filesystem::slowOpThreshold(void) const
+{
+  return mPriv->slowOps.threshold();
+}
+
+/**
+ * Lists the outstanding operations that have been running for longer than the
+ * threshold set with Filesystem::setSlowOpThreshold.
+ * @return a text with one operation per line (from the oldest to the newest),
+ *         with its name, id, target (inode or path), age, current stage, and
+ *         the time spent waiting for the lock, queued and waiting for
+ *         RADOS.
+ */
+std::string
+Filesystem::dumpSlowOps(void) const
+{
+  return mPriv->slowOps.dump();
+}
+
+/**
+ * Enables the tracing of the operations and sets the fraction of them that is
+ * traced.
+ *
+ * Traced operations record spans for their stages (e.g. an asynchronous write
+ * records the time it was queued, the file lock acquisition, the scheduling of
+ * each chunk and the wait for the chunks to be written), together with the
+ * operation's id, the inode and chunk involved. The spans are kept in a bounded
+ * buffer in memory and can be exported with Filesystem::getTrace or
+ * Filesystem::exportTrace. Operations are sampled as a whole, so a low rate
+ * keeps the tracing cheap enough to be left on.
+ * @note The tracing is shared by all the Filesystem instances of the process.
+ * @param rate the fraction of the operations to trace, from 0 (the default,
+ *        which disables the tracing) to 1 (every operation is traced).
+ */
+void
+Filesystem::setTraceSampleRate(float rate)
+{
+  Tracer::setSampleRate(rate);
+}
+
+/**
+ * Gets the fraction of the operations that is traced.
+ * @return the sample rate (0 means the tracing is disabled).
+ */
+float
+Filesystem::traceSampleRate(void) const
+{
+  return Tracer::getSampleRate();
+}
+
+/**
+ * Sets the maximum number of spans kept by the tracing. When the buffer is
+ * full, the oldest spans are discarded. The spans already recorded are cleared.
+ * @param numSpans the maximum number of spans (the default is 65536).
+ */
+void
+Filesystem::setTraceBufferSize(size_t numSpans)
+{
+  Tracer::setBufferSize(numSpans);
+}
+
+/**
+ * Gets the maximum number of spans kept by the tracing.
+ * @return the maximum number of spans.
+ */
+size_t
+Filesystem::traceBufferSize(void) const
+{
+  return Tracer::bufferSize();
+}
+
+/**
+ * Gets the spans recorded by the tracing in the Chrome trace event format (in
+ * JSON), which can be loaded e.g. in Perfetto or in chrome://tracing.
+ * @return the JSON text of the trace.
+ * @see Filesystem::setTraceSampleRate
+ */
+std::string
+Filesystem::getTrace(void) const
+{
+  return Tracer::toJson();
+}
+
+/**
+ * Writes the spans recorded by the tracing to a file, in the same format as
+ * returned by Filesystem::getTrace.
+ * @param path the path of the file to write.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::exportTrace(const std::string &path) const
+{
+  std::ofstream stream(path.c_str(), std::ios_base::trunc);
+
+  if (!stream.is_open())
+    return errno != 0 ? -errno : -EIO;
+
+  stream << Tracer::toJson();
+  stream.close();
+
+  if (stream.fail())
+    return -EIO;
+
+  return 0;
+}
+
+/**
+ * Discards the spans recorded by the tracing.
+ */
+void
+Filesystem::clearTrace(void)
+{
+  Tracer::clear();
+}
+
 RADOS_FS_END_NAMESPACE
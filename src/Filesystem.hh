@@ -37,6 +37,10 @@ RADOS_FS_BEGIN_NAMESPACE
 
 typedef void (*AsyncOpCallback)(const std::string &opId, int retCode, void *args);
 
+typedef void (*WriteSpaceCallback)(void *args);
+
+typedef int (*DirListCallback)(const std::string &entry, void *args);
+
 class FilesystemPriv;
 class FileInodePriv;
 class FsObj;
@@ -68,6 +72,63 @@ public:
     LOG_LEVEL_DEBUG   = 1 << 0
   };
 
+  enum DataPoolPlacement
+  {
+    DATA_POOL_PLACEMENT_FIRST = 0,
+    DATA_POOL_PLACEMENT_ROUND_ROBIN,
+    DATA_POOL_PLACEMENT_LEAST_USED,
+    DATA_POOL_PLACEMENT_PATH_HASH
+  };
+
+  enum WorkPriority
+  {
+    WORK_PRIORITY_DATA = 0,
+    WORK_PRIORITY_METADATA,
+    WORK_PRIORITY_BACKGROUND
+  };
+
+  struct WorkQueueStats
+  {
+    size_t queued;
+    size_t maxQueued;
+    size_t running;
+    uint64_t completed;
+    uint64_t stolen;
+  };
+
+  enum WriteThrottleMode
+  {
+    WRITE_THROTTLE_BLOCK = 0,
+    WRITE_THROTTLE_NONBLOCK,
+    WRITE_THROTTLE_CALLBACK
+  };
+
+  struct WriteThrottleStats
+  {
+    uint64_t bytes;
+    size_t ops;
+    uint64_t waited;
+    uint64_t rejected;
+  };
+
+  struct LatencyStats
+  {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+  };
+
+  struct Metrics
+  {
+    std::map<std::string, uint64_t> counters;
+    std::map<std::string, uint64_t> gauges;
+    std::map<std::string, LatencyStats> latencies;
+  };
+
   int init(const std::string &userName = "",
            const std::string &configurationFile = "");
 
@@ -82,6 +143,24 @@ public:
 
   ssize_t dataPoolSize(const std::string &pool) const;
 
+  int setDataPoolWeight(const std::string &pool, unsigned int weight);
+
+  ssize_t dataPoolWeight(const std::string &pool) const;
+
+  int setDataPoolMinFileSize(const std::string &pool, uint64_t size);
+
+  int64_t dataPoolMinFileSize(const std::string &pool) const;
+
+  void setDataPoolPlacement(DataPoolPlacement placement);
+
+  DataPoolPlacement dataPoolPlacement(void) const;
+
+  int moveFileToPool(const std::string &path, const std::string &pool);
+
+  void setDataMoveRate(uint64_t bytesPerSecond);
+
+  uint64_t dataMoveRate(void) const;
+
   int addMetadataPool(const std::string &name, const std::string &prefix);
 
   int removeMetadataPool(const std::string &name);
@@ -133,6 +212,26 @@ public:
 
   float dirCompactRatio(void) const;
 
+  void setDirCacheLeaseTime(float seconds);
+
+  float dirCacheLeaseTime(void) const;
+
+  void setBackgroundDirCompaction(bool enable);
+
+  bool backgroundDirCompaction(void) const;
+
+  void setDirCompactMinLogSize(size_t size);
+
+  size_t dirCompactMinLogSize(void) const;
+
+  void setDirPathCacheMaxSize(size_t size);
+
+  size_t dirPathCacheMaxSize(void) const;
+
+  void setDirPathCacheTTL(float seconds);
+
+  float dirPathCacheTTL(void) const;
+
   void setLogLevel(const LogLevel level);
 
   LogLevel logLevel(void) const;
@@ -149,6 +248,59 @@ public:
 
   size_t numGenericWorkers(void);
 
+  void setMaxNumGenericWorkers(size_t maxNumWorkers);
+
+  size_t maxNumGenericWorkers(void);
+
+  size_t currentNumGenericWorkers(void);
+
+  size_t genericWorkQueueDepth(void);
+
+  WorkQueueStats workQueueStats(WorkPriority priority) const;
+
+  void setWriteThrottle(uint64_t maxBytes, size_t maxOps);
+
+  void writeThrottle(uint64_t *maxBytes, size_t *maxOps) const;
+
+  void setWriteThrottleMode(WriteThrottleMode mode,
+                            WriteSpaceCallback callback = 0, void *arg = 0);
+
+  WriteThrottleMode writeThrottleMode(void) const;
+
+  WriteThrottleStats writeThrottleStats(void) const;
+
+  Metrics getMetrics(void) const;
+
+  std::string getMetricsText(void) const;
+
+  int setMetricsDumpFile(const std::string &path);
+
+  std::string metricsDumpFile(void) const;
+
+  int setMetricsDumpInterval(float seconds);
+
+  float metricsDumpInterval(void) const;
+
+  void setSlowOpThreshold(float seconds);
+
+  float slowOpThreshold(void) const;
+
+  std::string dumpSlowOps(void) const;
+
+  void setTraceSampleRate(float rate);
+
+  float traceSampleRate(void) const;
+
+  void setTraceBufferSize(size_t numSpans);
+
+  size_t traceBufferSize(void) const;
+
+  std::string getTrace(void) const;
+
+  int exportTrace(const std::string &path) const;
+
+  void clearTrace(void);
+
 private:
   FilesystemPriv *mPriv;
 
@@ -20,9 +20,11 @@
 #ifndef __RADOS_FS_FILESYSTEM_PRIV_HH__
 #define __RADOS_FS_FILESYSTEM_PRIV_HH__
 
-#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <list>
 #include <map>
+#include <queue>
 #include <vector>
 #include <set>
 #include <rados/librados.hpp>
@@ -33,8 +35,13 @@
 #include "radosfsdefines.h"
 #include "DirCache.hh"
 #include "FileIO.hh"
+#include "InstrumentedMutex.hh"
 #include "Logger.hh"
+#include "Metrics.hh"
+#include "SlowOpTracker.hh"
 #include "Finder.hh"
+#include "WorkScheduler.hh"
+#include "WriteThrottle.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -45,12 +52,43 @@ typedef std::vector<PoolSP> PoolList;
 typedef std::map<std::string, PoolSP> PoolMap;
 typedef std::map<std::string, PoolList>  PoolListMap;
 
+typedef struct {
+  std::string prefix;
+  PoolList pools;
+  std::map<std::string, size_t> children;
+} PoolRouterNode;
+
+class PoolRouter
+{
+public:
+  PoolRouter(const PoolListMap &map);
+
+  PoolRouter(const PoolMap &map);
+
+  PoolList pools(const std::string &path, std::string *prefix = 0) const;
+
+  PoolSP pool(const std::string &path, const std::string &poolName = "") const;
+
+private:
+  void addPrefix(const std::string &prefix, const PoolList &pools);
+
+  void matchingNodes(const std::string &path,
+                     std::vector<const PoolRouterNode *> &nodes) const;
+
+  std::vector<PoolRouterNode> nodes;
+};
+
+typedef boost::shared_ptr<const PoolRouter> PoolRouterSP;
+
+typedef std::pair<boost::chrono::system_clock::time_point, std::string>
+  FileIOTimer;
+
 typedef struct _LinkedList LinkedList;
 
 struct _LinkedList
 {
   std::tr1::shared_ptr<DirCache> cachePtr;
-  size_t lastNumEntries;
+  size_t lastSize;
   LinkedList *previous;
   LinkedList *next;
 };
@@ -64,31 +102,227 @@ typedef struct {
   int statRet;
 } StatAsyncInfo;
 
+typedef struct {
+  boost::chrono::steady_clock::time_point nextAttempt;
+  size_t numFailures;
+} DirCompactBackoff;
+
+class PriorityCacheShard
+{
+public:
+  PriorityCacheShard();
+  ~PriorityCacheShard();
+
+  void moveToFront(LinkedList *link);
+
+  size_t removeCache(LinkedList *link,
+                     std::vector<std::tr1::shared_ptr<DirCache> > &removed);
+
+  std::map<std::string, LinkedList *> cacheMap;
+  LinkedList *head;
+  LinkedList *tail;
+  size_t cacheSize;
+  InstrumentedMutex mutex;
+};
+
 class PriorityCache
 {
 public:
   PriorityCache();
   ~PriorityCache();
 
-  void update(std::tr1::shared_ptr<DirCache> cache);
+  std::tr1::shared_ptr<DirCache> get(const std::string &inode);
+
+  std::tr1::shared_ptr<DirCache> update(std::tr1::shared_ptr<DirCache> cache);
 
-  void adjustCache(void);
+  void adjustCache(size_t usedShard = DIR_CACHE_NUM_SHARDS);
 
-  size_t size(void) { return cacheSize + cacheMap.size(); }
+  size_t size(void);
+
+  size_t numDirs(void);
+
+  void setMaxSize(size_t size);
+
+  size_t maxSize(void);
 
   void cleanCache();
 
-  void moveToFront(LinkedList *link);
+  void removeCache(const std::string &inode);
 
-  void removeCache(LinkedList *link, bool freeMemory = true);
+  void cachedDirs(std::vector<std::tr1::shared_ptr<DirCache> > &dirs);
 
-  void removeCache(const std::string &path, bool freeMemory = true);
+private:
+  size_t shardIndex(const std::string &inode) const;
 
-  std::map<std::string, LinkedList *> cacheMap;
-  LinkedList *head;
-  LinkedList *tail;
+  void updateSize(size_t added, size_t removed);
+
+  PriorityCacheShard shards[DIR_CACHE_NUM_SHARDS];
   size_t cacheSize;
   size_t maxCacheSize;
+  boost::mutex sizeMutex;
+};
+
+typedef struct {
+  Inode inode;
+  boost::chrono::steady_clock::time_point expiration;
+  std::list<std::string>::iterator lruIt;
+} DirPathCacheEntry;
+
+class DirPathCacheShard
+{
+public:
+  void remove(std::map<std::string, DirPathCacheEntry>::iterator it);
+
+  DirPathCacheShard(void) : mutex("dir_path_cache") {}
+
+  std::map<std::string, DirPathCacheEntry> entries;
+  std::list<std::string> lru;
+  InstrumentedMutex mutex;
+};
+
+class DirPathCache
+{
+public:
+  DirPathCache();
+  ~DirPathCache();
+
+  bool get(const std::string &path, Inode &inode);
+
+  void set(const std::string &path, const Inode &inode);
+
+  void setMissing(const std::string &path);
+
+  void move(const std::string &oldPath, const std::string &newPath);
+
+  void remove(const std::string &path);
+
+  void clear(void);
+
+  size_t size(void);
+
+  void setMaxSize(size_t size);
+
+  size_t maxSize(void);
+
+  void setTTL(float seconds);
+
+  float ttl(void);
+
+private:
+  size_t shardIndex(const std::string &path) const;
+
+  void insert(const std::string &path, const Inode &inode, float ttl);
+
+  DirPathCacheShard shards[DIR_PATH_CACHE_NUM_SHARDS];
+  size_t maxNumEntries;
+  float entriesTTL;
+  boost::mutex settingsMutex;
+};
+
+typedef struct {
+  uint64_t generation;
+  boost::chrono::steady_clock::time_point expiration;
+  std::set<std::string> entries;
+} MissingEntries;
+
+class MissingEntriesCacheShard
+{
+public:
+  MissingEntriesCacheShard();
+
+  void remove(std::map<std::string, MissingEntries>::iterator it);
+
+  void removeExpired(void);
+
+  std::map<std::string, MissingEntries> dirs;
+  size_t numEntries;
+  boost::mutex mutex;
+};
+
+class MissingEntriesCache
+{
+public:
+  bool isMissing(const std::string &parentInode, uint64_t generation,
+                 const std::string &entry);
+
+  void setMissing(const std::string &parentInode, uint64_t generation,
+                  const std::string &entry);
+
+  void clear(const std::string &parentInode);
+
+  void clear(void);
+
+  size_t size(void);
+
+private:
+  size_t shardIndex(const std::string &parentInode) const;
+
+  MissingEntriesCacheShard shards[MISSING_ENTRIES_CACHE_NUM_SHARDS];
+};
+
+class FileIORegistryShard
+{
+public:
+  FileIORegistryShard(void) : mutex("file_io_registry") {}
+
+  std::map<std::string, FileIOSP> entries;
+  std::set<std::string> moving;
+  boost::condition_variable_any movingCond;
+  InstrumentedMutex mutex;
+};
+
+class FileIORegistry
+{
+public:
+  FileIOSP get(const std::string &inode);
+
+  FileIOSP acquire(const std::string &inode);
+
+  FileIOSP add(FileIOSP io);
+
+  void set(FileIOSP io);
+
+  void remove(FileIOSP io);
+
+  bool removeIfUnused(const std::string &inode, FileIOSP &io);
+
+  bool startMove(FileIOSP io);
+
+  void finishMove(FileIOSP io, FileIOSP movedIO);
+
+  void clear(void);
+
+  size_t size(void);
+
+private:
+  size_t shardIndex(const std::string &inode) const;
+
+  FileIORegistryShard shards[FILE_IO_REGISTRY_NUM_SHARDS];
+};
+
+typedef struct {
+  std::string target;
+  boost::chrono::steady_clock::time_point expiration;
+} LinkPrefixCacheEntry;
+
+class LinkPrefixCache
+{
+public:
+  bool resolve(const std::string &path, std::string &resolvedPath);
+
+  void set(const std::string &linkPath, const std::string &target, float ttl);
+
+  void remove(const std::string &path);
+
+  void clear(void);
+
+  size_t size(void);
+
+private:
+  void removeExpired(void);
+
+  std::map<std::string, LinkPrefixCacheEntry> links;
+  boost::mutex mutex;
 };
 
 class FilesystemPriv
@@ -109,13 +343,11 @@ public:
   int addPool(const std::string &name,
               const std::string &prefix,
               PoolMap *map,
-              boost::mutex &mutex,
+              InstrumentedMutex &mutex,
               size_t size = 0);
 
   int createPrefixDir(PoolSP pool, const std::string &prefix);
 
-  PoolSP getPool(const std::string &path, PoolMap *map, boost::mutex &mutex);
-
   PoolSP getMetadataPoolFromPath(const std::string &path);
 
   PoolSP getMtdPoolFromName(const std::string &name);
@@ -131,19 +363,60 @@ public:
 
   PoolList getMtdPools(void);
 
+
+  void updateDataPoolRouter(void);
+
+  void updateMtdPoolRouter(void);
+
+  PoolSP placeDataPool(const std::string &path, uint64_t fileSize = 0);
+
+  PoolSP tierDataPool(const std::string &path, const PoolSP &currentPool,
+                      uint64_t fileSize);
+
+  int moveFileData(const FileIOSP &io, const Stat &parentStat, Stat *stat,
+                   const PoolSP &pool);
+
+  int removeMovedInodeCopies(const Stat &stat);
+
+  void removeMovedInodes(const Stat &stat);
+
+  int moveFileToPool(const std::string &path, const std::string &poolName);
+
+  bool hasDataPoolTiers(void);
+
+  void moveFileToTier(const std::string &path);
+
+  void finishFileMove(FileIOSP io, const Stat *movedStat);
+
+  uint64_t dataPoolMinFileSize(const std::string &pool) const;
+
+  uint64_t dataPoolsTier(const PoolList &pools, uint64_t fileSize) const;
+
+  unsigned int dataPoolWeight(const std::string &pool);
+
+  int updateDataPoolsUsage(void);
+
+  void checkDataPoolsUsage(void);
+
+  void dumpMetrics(void);
+
+  void getMetrics(Filesystem::Metrics &metrics);
+
+  void checkSlowOps(void);
+
   std::string poolPrefix(const std::string &pool,
                          PoolMap *map,
-                         boost::mutex &mutex) const;
+                         InstrumentedMutex &mutex) const;
 
   int removePool(const std::string &name,
                  PoolMap *map,
-                 boost::mutex &mutex);
+                 InstrumentedMutex &mutex);
 
   std::string poolFromPrefix(const std::string &prefix,
                              PoolMap *map,
-                             boost::mutex &mutex) const;
+                             InstrumentedMutex &mutex) const;
 
-  std::vector<std::string> pools(PoolMap *map, boost::mutex &mutex) const;
+  std::vector<std::string> pools(PoolMap *map, InstrumentedMutex &mutex) const;
 
   const std::string getParentDir(const std::string &obj, int *pos);
 
@@ -155,9 +428,15 @@ public:
 
   FileIOSP getOrCreateFileIO(const std::string &path, const Stat *stat);
 
+  void releaseFileIO(FileIOSP sharedFileIO);
+
   void setFileIO(FileIOSP sharedFileIO);
   void removeFileIO(FileIOSP sharedFileIO);
 
+  void scheduleFileIOCheck(const std::string &inode,
+                           boost::chrono::system_clock::time_point time =
+                               boost::chrono::system_clock::now());
+
   void updateDirCache(std::tr1::shared_ptr<DirCache> &cache);
 
   void removeDirCache(std::tr1::shared_ptr<DirCache> &cache);
@@ -171,6 +450,10 @@ public:
       const std::map<std::string, std::vector<std::string> > &paths,
       std::map<std::string, std::pair<int, Stat> > *stats);
 
+  void statDirEntries(const Stat &dirStat,
+                      const std::set<std::string> &entries,
+                      std::map<std::string, std::pair<int, Stat> > *stats);
+
   void statAsync(StatAsyncInfo *info);
 
   void statEntries(StatAsyncInfo *info,
@@ -184,6 +467,10 @@ public:
 
   int statDir(PoolSP mtdPool, Stat *stat);
 
+  void statFileData(Stat *stat, const Stat *parentStat, FileIOSP io);
+
+  int statFileData(Stat *stat);
+
   int getRealPath(const std::string &path, Stat *stat,
                   std::string &realPath);
 
@@ -198,6 +485,18 @@ public:
 
   void removeDirInode(const std::string &path);
 
+  uint64_t dirGeneration(const std::string &inode);
+
+  void clearMissingEntries(const std::string &parentInode);
+
+  void expireDirCacheLease(const std::string &inode);
+
+  bool resolveLinkPrefix(std::string &path);
+
+  void setLinkPrefix(const std::string &linkPath, const std::string &target);
+
+  void removeLinkPrefixes(const std::string &path);
+
   void updateTMIdSync(std::string path);
 
   void updateTMId(Stat *stat);
@@ -205,19 +504,21 @@ public:
   void updateDirTimes(Stat *stat, timespec *spec = 0);
 
   int statEntry(std::string path, std::string entry, size_t inlineBufferSize,
-                Stat *stat);
+                const std::string &sizeHint, Stat *stat);
 
   int statAsyncInfoInThread(const std::string path, StatAsyncInfo *info,
                             boost::mutex *mutex, boost::condition_variable *cond,
                             int *numJobs);
 
-  void generalWorkerThread(boost::shared_ptr<boost::asio::io_service> ioService);
+  void checkFileLocks(void);
+
+  void checkFileIO(const std::string &inode);
 
-  void launchThreads(void);
+  void checkDirLogs(void);
 
-  void checkFileLocks(void);
+  void compactDirAsync(std::tr1::shared_ptr<DirCache> cache);
 
-  boost::shared_ptr<boost::asio::io_service> getIoService();
+  void post(WorkJob job, Filesystem::WorkPriority priority);
 
   int resetFileEntry(Stat &stat);
 
@@ -230,25 +531,53 @@ public:
   static __thread gid_t gid;
   std::vector<rados_completion_t> completionList;
   PoolListMap poolMap;
-  boost::mutex poolMutex;
+  InstrumentedMutex poolMutex;
   PoolMap mtdPoolMap;
-  boost::mutex mtdPoolMutex;
+  InstrumentedMutex mtdPoolMutex;
+  PoolRouterSP dataPoolRouter;
+  PoolRouterSP mtdPoolRouter;
+  Filesystem::DataPoolPlacement dataPoolPlacement;
+  std::map<std::string, unsigned int> dataPoolWeights;
+  std::map<std::string, uint64_t> dataPoolsUsage;
+  std::map<std::string, uint64_t> dataPoolMinFileSizes;
+  std::map<std::string, uint64_t> dataPoolPlacementCounters;
+  boost::mutex dataPoolPlacementMutex;
+  uint64_t dataMoveRate;
   PriorityCache dirCache;
-  boost::mutex dirCacheMutex;
-  std::map<std::string, std::tr1::shared_ptr<FileIO> > operations;
-  boost::mutex operationsMutex;
-  std::map<std::string, Inode> dirPathInodeMap;
-  boost::mutex dirPathInodeMutex;
+  FileIORegistry operations;
+  std::priority_queue<FileIOTimer, std::vector<FileIOTimer>,
+                      std::greater<FileIOTimer> > fileIOTimers;
+  std::map<std::string, boost::chrono::system_clock::time_point> fileIOChecks;
+  boost::mutex fileIOTimersMutex;
+  boost::condition_variable fileIOTimersCond;
+  DirPathCache dirPathCache;
+  MissingEntriesCache missingEntries;
+  LinkPrefixCache linkPrefixes;
   float dirCompactRatio;
+  float dirCacheLeaseTime;
+  size_t dirCompactMinLogSize;
+  bool backgroundDirCompaction;
+  std::set<std::string> dirsBeingCompacted;
+  std::map<std::string, DirCompactBackoff> dirCompactBackoff;
+  boost::mutex dirCompactMutex;
   Logger logger;
   size_t fileChunkSize;
   boost::mutex genericWorkersMutex;
   size_t numGenericWorkers;
-  std::list<boost::thread *> genericWorkersList;
-  boost::shared_ptr<boost::asio::io_service> ioService;
-  boost::shared_ptr<boost::asio::io_service::work> asyncWork;
-  boost::thread_group generalWorkerThreads;
+  size_t maxNumGenericWorkers;
+  WorkScheduler workScheduler;
+  WriteThrottle writeThrottle;
+  MetricsRegistry metrics;
+  std::string metricsDumpFile;
+  float metricsDumpInterval;
+  boost::mutex metricsDumpMutex;
+  boost::condition_variable metricsDumpCond;
+  SlowOpTracker slowOps;
   boost::thread fileOpsIdleChecker;
+  boost::thread dirLogsChecker;
+  boost::thread dataPoolsUsageChecker;
+  boost::thread metricsDumper;
+  boost::thread slowOpsChecker;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -25,6 +25,7 @@
 #include "radosfscommon.h"
 #include "Finder.hh"
 #include "Logger.hh"
+#include "Tracer.hh"
 
 #define DEFAULT_NUM_FINDER_THREADS 100
 #define MAX_INACTIVE_THREAD_TIME 5
@@ -288,6 +289,7 @@ Finder::checkEntryName(FinderArg &arg, FindOptions option,
 int
 Finder::find(FinderData *data)
 {
+  TraceSpan span("Finder::find", "find");
   int ret;
   std::set<std::string> entries;
   Dir dir(radosFs, data->dir);
@@ -49,6 +49,9 @@ FsObjPriv::makeRealPath(std::string &path)
 
   parentDirStat.reset();
 
+  if (radosFs->mPriv->resolveLinkPrefix(path))
+    return -EAGAIN;
+
   while (parent != "")
   {
     int ret = radosFs->mPriv->stat(parent, &stat);
@@ -68,6 +71,7 @@ FsObjPriv::makeRealPath(std::string &path)
 
   if (S_ISLNK(stat.statBuff.st_mode))
   {
+    radosFs->mPriv->setLinkPrefix(parent, stat.translatedPath);
     path.erase(0, parent.length());
     path = stat.translatedPath + path;
 
@@ -215,7 +219,13 @@ FsObjPriv::makeLink(std::string &linkPath)
   linkStat.statBuff.st_gid = gid;
   linkStat.statBuff.st_mode = DEFAULT_MODE_LINK;
 
-  return indexObject(&parentDirStat, &linkStat, '+');
+  ret = indexObject(&parentDirStat, &linkStat, '+');
+
+  radosFs->mPriv->clearMissingEntries(parentDirStat.translatedPath);
+  radosFs->mPriv->expireDirCacheLease(parentDirStat.translatedPath);
+  radosFs->mPriv->removeLinkPrefixes(linkPath);
+
+  return ret;
 }
 
 /**
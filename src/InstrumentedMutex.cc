@@ -0,0 +1,143 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include "InstrumentedMutex.hh"
+
+#ifdef RADOSFS_INSTRUMENTED_LOCKS
+
+#include <map>
+#include <string>
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// The statistics are kept per name (and not per mutex instance), so e.g. all
+// the FileIO locks are accounted together; they are never freed
+struct LockStatsRegistry
+{
+  boost::mutex mutex;
+  std::map<std::string, LockStats *> stats;
+};
+
+static LockStatsRegistry &
+lockStatsRegistry(void)
+{
+  static LockStatsRegistry registry;
+  return registry;
+}
+
+static uint64_t
+elapsedNanoseconds(boost::chrono::steady_clock::time_point start,
+                   boost::chrono::steady_clock::time_point end)
+{
+  return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        end - start).count();
+}
+
+InstrumentedMutex::InstrumentedMutex(const char *name)
+{
+  LockStatsRegistry &registry = lockStatsRegistry();
+  boost::unique_lock<boost::mutex> lock(registry.mutex);
+
+  LockStats *&stats = registry.stats[name];
+
+  if (!stats)
+  {
+    stats = new LockStats;
+    stats->acquisitions.store(0, boost::memory_order_relaxed);
+    stats->contentions.store(0, boost::memory_order_relaxed);
+    stats->waitTime.store(0, boost::memory_order_relaxed);
+    stats->holdTime.store(0, boost::memory_order_relaxed);
+  }
+
+  mStats = stats;
+}
+
+void
+InstrumentedMutex::lock(void)
+{
+  // Only the locks that have to wait read the clock before locking
+  if (!mMutex.try_lock())
+  {
+    boost::chrono::steady_clock::time_point start =
+        boost::chrono::steady_clock::now();
+
+    mMutex.lock();
+    mLockedAt = boost::chrono::steady_clock::now();
+
+    mStats->contentions.fetch_add(1, boost::memory_order_relaxed);
+    mStats->waitTime.fetch_add(elapsedNanoseconds(start, mLockedAt),
+                               boost::memory_order_relaxed);
+  }
+  else
+  {
+    mLockedAt = boost::chrono::steady_clock::now();
+  }
+
+  mStats->acquisitions.fetch_add(1, boost::memory_order_relaxed);
+}
+
+bool
+InstrumentedMutex::try_lock(void)
+{
+  if (!mMutex.try_lock())
+    return false;
+
+  mLockedAt = boost::chrono::steady_clock::now();
+  mStats->acquisitions.fetch_add(1, boost::memory_order_relaxed);
+
+  return true;
+}
+
+void
+InstrumentedMutex::unlock(void)
+{
+  uint64_t holdTime = elapsedNanoseconds(mLockedAt,
+                                         boost::chrono::steady_clock::now());
+
+  mMutex.unlock();
+
+  mStats->holdTime.fetch_add(holdTime, boost::memory_order_relaxed);
+}
+
+void
+InstrumentedMutex::getStats(Filesystem::Metrics &metrics)
+{
+  LockStatsRegistry &registry = lockStatsRegistry();
+  boost::unique_lock<boost::mutex> lock(registry.mutex);
+  std::map<std::string, LockStats *>::const_iterator it;
+
+  for (it = registry.stats.begin(); it != registry.stats.end(); it++)
+  {
+    const std::string prefix = "lock_" + (*it).first;
+    const LockStats *stats = (*it).second;
+
+    metrics.counters[prefix + "_acquisitions"] =
+        stats->acquisitions.load(boost::memory_order_relaxed);
+    metrics.counters[prefix + "_contentions"] =
+        stats->contentions.load(boost::memory_order_relaxed);
+    metrics.counters[prefix + "_wait_microseconds"] =
+        stats->waitTime.load(boost::memory_order_relaxed) / 1000;
+    metrics.counters[prefix + "_hold_microseconds"] =
+        stats->holdTime.load(boost::memory_order_relaxed) / 1000;
+  }
+}
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* RADOSFS_INSTRUMENTED_LOCKS */
@@ -0,0 +1,78 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __INSTRUMENTED_MUTEX_HH__
+#define __INSTRUMENTED_MUTEX_HH__
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+#ifdef RADOSFS_INSTRUMENTED_LOCKS
+
+struct LockStats
+{
+  boost::atomic<uint64_t> acquisitions;
+  boost::atomic<uint64_t> contentions;
+  boost::atomic<uint64_t> waitTime;
+  boost::atomic<uint64_t> holdTime;
+};
+
+class InstrumentedMutex
+{
+public:
+  InstrumentedMutex(const char *name);
+
+  void lock(void);
+
+  bool try_lock(void);
+
+  void unlock(void);
+
+  static void getStats(Filesystem::Metrics &metrics);
+
+private:
+  InstrumentedMutex(const InstrumentedMutex &);
+  InstrumentedMutex & operator=(const InstrumentedMutex &);
+
+  boost::mutex mMutex;
+  LockStats *mStats;
+  boost::chrono::steady_clock::time_point mLockedAt;
+};
+
+#else
+
+class InstrumentedMutex : public boost::mutex
+{
+public:
+  InstrumentedMutex(const char *name) {}
+
+  static void getStats(Filesystem::Metrics &metrics) {}
+};
+
+#endif
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __INSTRUMENTED_MUTEX_HH__ */
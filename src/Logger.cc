@@ -17,8 +17,14 @@
  * for more details.
  */
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <libgen.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
@@ -29,80 +35,371 @@
 
 RADOS_FS_BEGIN_NAMESPACE
 
-Filesystem::LogLevel Logger::level = Filesystem::LOG_LEVEL_DEBUG;
+boost::atomic<int> Logger::level(Filesystem::LOG_LEVEL_DEBUG);
+
+struct LogMessage
+{
+  boost::atomic<size_t> sequence;
+  struct timespec time;
+  const char *file;
+  int line;
+  char text[LOG_MESSAGE_MAX_SIZE];
+};
+
+// Messages are formatted by the threads logging them into a fixed ring of
+// messages (a bounded multi-producer queue that does not take any locks) and
+// written out by a background thread. If the ring is full, messages are
+// dropped and the number of dropped messages is reported.
+class LogWriter
+{
+public:
+  LogWriter(void);
+  ~LogWriter(void);
+
+  void push(const char *file, int line, const char *msg, va_list args);
+
+  void flush(void);
+
+private:
+  bool writeMessages(void);
+  void writerThread(void);
+
+  LogMessage *mMessages;
+  boost::atomic<size_t> mEnqueuePos;
+  boost::atomic<size_t> mDequeuePos;
+  boost::atomic<uint64_t> mDropped;
+  boost::atomic<bool> mWriterWaiting;
+  boost::mutex mMutex;
+  boost::condition_variable mCond;
+  boost::condition_variable mFlushCond;
+  bool mStopping;
+  time_t mLastSecond;
+  struct tm mLastTime;
+  boost::thread mThread;
+};
+
+static boost::atomic<LogWriter *> startedLogWriter(0);
+
+static LogWriter &
+logWriter(void)
+{
+  // Only launched when the first message is logged
+  static LogWriter writer;
+  return writer;
+}
+
+LogWriter::LogWriter(void)
+  : mMessages(new LogMessage[LOG_BUFFER_NUM_MESSAGES]),
+    mEnqueuePos(0),
+    mDequeuePos(0),
+    mDropped(0),
+    mWriterWaiting(false),
+    mStopping(false),
+    mLastSecond(0)
+{
+  for (size_t i = 0; i < LOG_BUFFER_NUM_MESSAGES; i++)
+    mMessages[i].sequence.store(i, boost::memory_order_relaxed);
+
+  mThread = boost::thread(&LogWriter::writerThread, this);
+  startedLogWriter.store(this);
+}
+
+LogWriter::~LogWriter(void)
+{
+  startedLogWriter.store(0);
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mStopping = true;
+    mCond.notify_all();
+  }
+
+  mThread.join();
+
+  delete[] mMessages;
+}
 
 void
-readConfiguredLogLevel(void *fsLogger)
+LogWriter::push(const char *file, int line, const char *msg, va_list args)
 {
-  FILE *fp;
-  struct stat statBuff;
-  size_t fileSize = 0;
-  const int levelMaxChars = 10;
-  char level[levelMaxChars];
-  level[0] = '\0';
-  Logger *logger = (Logger *) fsLogger;
+  LogMessage *message;
+  size_t pos = mEnqueuePos.load(boost::memory_order_relaxed);
+
+  while (true)
+  {
+    message = &mMessages[pos & (LOG_BUFFER_NUM_MESSAGES - 1)];
+    size_t sequence = message->sequence.load(boost::memory_order_acquire);
+    ssize_t diff = (ssize_t) sequence - (ssize_t) pos;
+
+    if (diff == 0)
+    {
+      if (mEnqueuePos.compare_exchange_weak(pos, pos + 1,
+                                            boost::memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      // The writer did not catch up yet
+      mDropped.fetch_add(1, boost::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = mEnqueuePos.load(boost::memory_order_relaxed);
+    }
+  }
+
+  clock_gettime(CLOCK_REALTIME, &message->time);
+  message->file = file;
+  message->line = line;
+  vsnprintf(message->text, LOG_MESSAGE_MAX_SIZE, msg, args);
+
+  message->sequence.store(pos + 1);
+
+  // The writer checks for messages after saying it is waiting, and this checks
+  // if it is waiting after publishing the message, so one always sees the other
+  if (mWriterWaiting.load())
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mCond.notify_one();
+  }
+}
+
+bool
+LogWriter::writeMessages(void)
+{
+  bool wrote = false;
+  size_t pos = mDequeuePos.load(boost::memory_order_relaxed);
 
   while (true)
   {
-    boost::this_thread::interruption_point();
+    LogMessage &message = mMessages[pos & (LOG_BUFFER_NUM_MESSAGES - 1)];
 
-    if (stat(LOG_LEVEL_CONF_FILE, &statBuff) != 0)
+    if (message.sequence.load(boost::memory_order_acquire) != pos + 1)
       break;
 
-    if (fileSize != (size_t) statBuff.st_size)
+    // The local time is only computed once per second
+    if (message.time.tv_sec != mLastSecond)
     {
-      fileSize = statBuff.st_size;
+      mLastSecond = message.time.tv_sec;
+      localtime_r(&mLastSecond, &mLastTime);
+    }
 
-      fp = fopen(LOG_LEVEL_CONF_FILE, "r");
-      fgets(level, levelMaxChars, fp);
+    fprintf(stderr, "RADOSFS DEBUG %d-%.2d-%.2d %.2d:%.2d:%.2d.%.03d, "
+            "%s:%.2d -- %s\n",
+            mLastTime.tm_year + 1900,
+            mLastTime.tm_mon + 1,
+            mLastTime.tm_mday,
+            mLastTime.tm_hour,
+            mLastTime.tm_min,
+            mLastTime.tm_sec,
+            (int) (message.time.tv_nsec / 1000000),
+            message.file,
+            message.line,
+            message.text);
+
+    message.sequence.store(pos + LOG_BUFFER_NUM_MESSAGES,
+                           boost::memory_order_release);
+    pos++;
+    wrote = true;
+  }
 
-      fclose(fp);
+  uint64_t dropped = mDropped.exchange(0, boost::memory_order_relaxed);
 
-      Filesystem::LogLevel previousLevel, newLevel;
+  if (dropped > 0)
+    fprintf(stderr, "RADOSFS DEBUG -- %lu messages were dropped because the "
+            "log buffer was full\n", dropped);
 
-      newLevel = logger->logLevel();
-      previousLevel = newLevel;
+  if (wrote)
+    fflush(stderr);
 
-      const char *levelNames[] = {"NONE", "DEBUG", 0};
-      const Filesystem::LogLevel levels[] = {Filesystem::LOG_LEVEL_NONE,
-                                     Filesystem::LOG_LEVEL_DEBUG};
+  mDequeuePos.store(pos);
 
-      for (int i = 0; levelNames[i] != 0; i++)
-      {
-        if (strlen(level) < 2)
-        {
-          newLevel = Filesystem::LOG_LEVEL_NONE;
-          break;
-        }
+  return wrote;
+}
 
-        if (strncmp(level, levelNames[i], strlen(levelNames[i])) == 0)
-        {
-          newLevel = levels[i];
-          break;
-        }
-      }
+void
+LogWriter::writerThread(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
 
-      if (newLevel != previousLevel)
-      {
-        logger->setLogLevel(newLevel);
+  while (true)
+  {
+    lock.unlock();
+    bool wrote = writeMessages();
+    lock.lock();
 
-        radosfs_debug("Logger level changed to %s", newLevel);
-      }
+    if (wrote)
+    {
+      mFlushCond.notify_all();
+      continue;
     }
 
-    boost::this_thread::interruption_point();
-    boost::this_thread::sleep_for(boost::chrono::seconds(2));
+    if (mStopping)
+      break;
+
+    mWriterWaiting.store(true);
+
+    size_t pos = mDequeuePos.load(boost::memory_order_relaxed);
+    LogMessage &next = mMessages[pos & (LOG_BUFFER_NUM_MESSAGES - 1)];
+
+    if (next.sequence.load() != pos + 1)
+      mCond.wait(lock);
+
+    mWriterWaiting.store(false);
   }
 }
 
+void
+LogWriter::flush(void)
+{
+  const size_t pos = mEnqueuePos.load();
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  while (mDequeuePos.load() < pos && !mStopping)
+  {
+    mCond.notify_one();
+    mFlushCond.wait_for(lock, boost::chrono::milliseconds(100));
+  }
+}
+
+static Filesystem::LogLevel
+parseLogLevel(const char *level)
+{
+  const char *levelNames[] = {"NONE", "DEBUG", 0};
+  const Filesystem::LogLevel levels[] = {Filesystem::LOG_LEVEL_NONE,
+                                         Filesystem::LOG_LEVEL_DEBUG};
+
+  if (strlen(level) < 2)
+    return Filesystem::LOG_LEVEL_NONE;
+
+  for (int i = 0; levelNames[i] != 0; i++)
+  {
+    if (strncmp(level, levelNames[i], strlen(levelNames[i])) == 0)
+      return levels[i];
+  }
+
+  return Filesystem::LOG_LEVEL_NONE;
+}
+
+void
+Logger::readLevelFile(void)
+{
+  const int levelMaxChars = 10;
+  char level[levelMaxChars];
+  level[0] = '\0';
+
+  FILE *fp = fopen(LOG_LEVEL_CONF_FILE, "r");
+
+  if (!fp)
+    return;
+
+  if (!fgets(level, levelMaxChars, fp))
+    level[0] = '\0';
+
+  fclose(fp);
+
+  Filesystem::LogLevel newLevel = parseLogLevel(level);
+
+  if (newLevel != logLevel())
+  {
+    setLogLevel(newLevel);
+
+    radosfs_debug("Logger level changed to %s",
+                  newLevel == Filesystem::LOG_LEVEL_NONE ? "NONE" : "DEBUG");
+  }
+}
+
+void
+Logger::watchLevelFile(void)
+{
+  struct stat statBuff;
+
+  if (mStopFd < 0 || stat(LOG_LEVEL_CONF_FILE, &statBuff) != 0)
+    return;
+
+  int fd = inotify_init1(IN_CLOEXEC);
+
+  if (fd < 0)
+    return;
+
+  // The directory is watched because editors usually replace the file
+  char path[] = LOG_LEVEL_CONF_FILE;
+  char fileName[] = LOG_LEVEL_CONF_FILE;
+  const char *baseName = basename(fileName);
+
+  if (inotify_add_watch(fd, dirname(path), IN_CLOSE_WRITE | IN_MOVED_TO |
+                        IN_CREATE) < 0)
+  {
+    close(fd);
+    return;
+  }
+
+  readLevelFile();
+
+  char events[4096]
+      __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+  while (true)
+  {
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    if (fds[1].revents != 0)
+      break;
+
+    ssize_t length = read(fd, events, sizeof(events));
+    bool changed = false;
+
+    for (ssize_t i = 0; i < length;)
+    {
+      const struct inotify_event *event = (struct inotify_event *) &events[i];
+
+      if (event->len > 0 && strcmp(event->name, baseName) == 0)
+        changed = true;
+
+      i += sizeof(struct inotify_event) + event->len;
+    }
+
+    if (changed)
+      readLevelFile();
+  }
+
+  close(fd);
+}
+
 Logger::Logger()
-  : thread(&readConfiguredLogLevel, this)
+  : mStopFd(eventfd(0, EFD_CLOEXEC)),
+    thread(&Logger::watchLevelFile, this)
 {}
 
 Logger::~Logger()
 {
-  thread.interrupt();
+  if (mStopFd >= 0)
+  {
+    uint64_t stop = 1;
+
+    if (write(mStopFd, &stop, sizeof(stop)) < 0)
+      thread.interrupt();
+  }
+
   thread.join();
+
+  if (mStopFd >= 0)
+    close(mStopFd);
+
+  flush();
 }
 
 void
@@ -110,60 +407,37 @@ Logger::log(const char *file, const int line, const Filesystem::LogLevel msgLeve
             const char *msg,
             ...)
 {
-  Filesystem::LogLevel currentLevel = Logger::level;
-
-  if (currentLevel == Filesystem::LOG_LEVEL_NONE || (currentLevel & msgLevel) == 0)
+  if (!isEnabled(msgLevel))
     return;
 
   va_list args;
 
   va_start(args, msg);
 
-  char *buffer = new char[mBufferMaxSize];
-
-  vsnprintf(buffer, mBufferMaxSize, msg, args);
-
-  struct timespec times;
-  clock_gettime(CLOCK_REALTIME, &times);
-
-  time_t _time = times.tv_sec;
-  struct tm *currentTime = localtime(&_time);
-
-  int milliseconds = round(static_cast<double>(times.tv_nsec / 1000000));
-
-  fprintf(stderr, "RADOSFS DEBUG %d-%.2d-%.2d %.2d:%.2d:%.2d.%.03d, %s:%.2d -- %s\n",
-          currentTime->tm_year + 1900,
-          currentTime->tm_mon,
-          currentTime->tm_mday,
-          currentTime->tm_hour,
-          currentTime->tm_min,
-          currentTime->tm_sec,
-          milliseconds,
-          file,
-          line,
-          buffer);
+  logWriter().push(file, line, msg, args);
 
   va_end(args);
+}
+
+void
+Logger::flush(void)
+{
+  LogWriter *writer = startedLogWriter.load();
 
-  delete[] buffer;
+  if (writer)
+    writer->flush();
 }
 
 void
 Logger::setLogLevel(const Filesystem::LogLevel newLevel)
 {
-  boost::unique_lock<boost::mutex> lock(mLevelMutex);
-  level = newLevel;
+  level.store(newLevel, boost::memory_order_relaxed);
 }
 
 Filesystem::LogLevel
 Logger::logLevel()
 {
-  Filesystem::LogLevel currentLevel;
-  boost::unique_lock<boost::mutex> lock(mLevelMutex);
-
-  currentLevel = level;
-
-  return currentLevel;
+  return (Filesystem::LogLevel) level.load(boost::memory_order_relaxed);
 }
 
 RADOS_FS_END_NAMESPACE
@@ -1,16 +1,23 @@
 #ifndef __RADOS_FS_LOGGER_HH__
 #define __RADOS_FS_LOGGER_HH__
 
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <string>
 
 #include "radosfsdefines.h"
 #include "Filesystem.hh"
 
-#define radosfs_debug(...) radosfs::Logger::log(__FILE__, \
-                                        __LINE__, \
-                                        radosfs::Filesystem::LOG_LEVEL_DEBUG, \
-                                        __VA_ARGS__)
+// The arguments are only evaluated (and the message formatted) if the level is
+// enabled
+#define radosfs_debug(...) \
+  do { \
+    if (radosfs::Logger::isEnabled(radosfs::Filesystem::LOG_LEVEL_DEBUG)) \
+      radosfs::Logger::log(__FILE__, \
+                           __LINE__, \
+                           radosfs::Filesystem::LOG_LEVEL_DEBUG, \
+                           __VA_ARGS__); \
+  } while (0)
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -20,7 +27,12 @@ public:
   Logger();
   ~Logger();
 
-  static Filesystem::LogLevel level;
+  static boost::atomic<int> level;
+
+  static bool isEnabled(const Filesystem::LogLevel l)
+  {
+    return (level.load(boost::memory_order_relaxed) & l) != 0;
+  }
 
   static void log(const char *file,
                   const int line,
@@ -28,12 +40,16 @@ public:
                   const char *msg,
                   ...);
 
+  static void flush(void);
+
   void setLogLevel(const Filesystem::LogLevel level);
   Filesystem::LogLevel logLevel(void);
 
 private:
-  static const int mBufferMaxSize = 1024;
-  boost::mutex mLevelMutex;
+  void watchLevelFile(void);
+  void readLevelFile(void);
+
+  int mStopFd;
   boost::thread thread;
 };
 
@@ -0,0 +1,251 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "Metrics.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+static const char *counterNames[MetricsRegistry::COUNTER_COUNT] = {
+  "file_read_bytes",
+  "file_write_bytes",
+  "rados_chunk_reads",
+  "rados_chunk_writes",
+  "rados_chunk_removes",
+  "rados_lock_attempts",
+  "dir_cache_hits",
+  "dir_cache_misses",
+  "dir_path_cache_hits",
+  "dir_path_cache_misses",
+  "file_tier_moves",
+  "file_tier_move_failures"
+};
+
+static const char *histogramNames[MetricsRegistry::HISTOGRAM_COUNT] = {
+  "file_read",
+  "file_write",
+  "file_write_sync",
+  "file_truncate",
+  "file_remove",
+  "file_lock_wait",
+  "write_throttle_wait",
+  "stat",
+  "dir_list",
+  "dir_find"
+};
+
+// Each thread always updates the same shard, so the threads are spread over
+// the shards and rarely update the same values at the same time
+static boost::atomic<size_t> nextThreadShard(0);
+static __thread size_t threadShard = METRICS_NUM_SHARDS;
+
+MetricsRegistry::MetricsRegistry(void)
+{
+  for (size_t i = 0; i < METRICS_NUM_SHARDS; i++)
+  {
+    Shard &shard = mShards[i];
+
+    for (int j = 0; j < COUNTER_COUNT; j++)
+      shard.counters[j].store(0, boost::memory_order_relaxed);
+
+    for (int j = 0; j < HISTOGRAM_COUNT; j++)
+    {
+      for (size_t k = 0; k < METRICS_HISTOGRAM_NUM_BUCKETS; k++)
+        shard.buckets[j][k].store(0, boost::memory_order_relaxed);
+
+      shard.sums[j].store(0, boost::memory_order_relaxed);
+      shard.maxs[j].store(0, boost::memory_order_relaxed);
+    }
+  }
+}
+
+MetricsRegistry::Shard &
+MetricsRegistry::shard(void)
+{
+  if (threadShard == METRICS_NUM_SHARDS)
+    threadShard = nextThreadShard.fetch_add(1, boost::memory_order_relaxed) %
+                  METRICS_NUM_SHARDS;
+
+  return mShards[threadShard];
+}
+
+size_t
+MetricsRegistry::bucketIndex(uint64_t value)
+{
+  // Values are grouped by their most significant bit and each group is split
+  // in METRICS_HISTOGRAM_SUB_BUCKETS buckets, so the buckets' width is always
+  // a small fraction of their values
+  const uint64_t maxValue = ((uint64_t) 1 << METRICS_HISTOGRAM_MAX_BITS) - 1;
+
+  if (value > maxValue)
+    value = maxValue;
+
+  if (value < METRICS_HISTOGRAM_SUB_BUCKETS)
+    return value;
+
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - METRICS_HISTOGRAM_SUB_BUCKET_BITS;
+
+  return (shift + 1) * METRICS_HISTOGRAM_SUB_BUCKETS +
+         ((value >> shift) & (METRICS_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint64_t
+MetricsRegistry::bucketMaxValue(size_t index)
+{
+  if (index < METRICS_HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  size_t shift = index / METRICS_HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t subBucket = index % METRICS_HISTOGRAM_SUB_BUCKETS;
+
+  return ((METRICS_HISTOGRAM_SUB_BUCKETS + subBucket + 1) << shift) - 1;
+}
+
+void
+MetricsRegistry::add(Counter counter, uint64_t value)
+{
+  shard().counters[counter].fetch_add(value, boost::memory_order_relaxed);
+}
+
+void
+MetricsRegistry::record(Histogram histogram, uint64_t microseconds)
+{
+  Shard &s = shard();
+
+  s.buckets[histogram][bucketIndex(microseconds)].fetch_add(
+        1, boost::memory_order_relaxed);
+  s.sums[histogram].fetch_add(microseconds, boost::memory_order_relaxed);
+
+  uint64_t max = s.maxs[histogram].load(boost::memory_order_relaxed);
+
+  while (microseconds > max &&
+         !s.maxs[histogram].compare_exchange_weak(max, microseconds,
+                                                  boost::memory_order_relaxed))
+  {}
+}
+
+void
+MetricsRegistry::record(Histogram histogram,
+                        boost::chrono::steady_clock::time_point startTime)
+{
+  boost::chrono::microseconds elapsed =
+      boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now() - startTime);
+
+  record(histogram, elapsed.count());
+}
+
+void
+MetricsRegistry::get(Filesystem::Metrics &metrics)
+{
+  for (int i = 0; i < COUNTER_COUNT; i++)
+  {
+    uint64_t value = 0;
+
+    for (size_t j = 0; j < METRICS_NUM_SHARDS; j++)
+      value += mShards[j].counters[i].load(boost::memory_order_relaxed);
+
+    metrics.counters[counterNames[i]] = value;
+  }
+
+  for (int i = 0; i < HISTOGRAM_COUNT; i++)
+  {
+    uint64_t buckets[METRICS_HISTOGRAM_NUM_BUCKETS];
+    Filesystem::LatencyStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    for (size_t k = 0; k < METRICS_HISTOGRAM_NUM_BUCKETS; k++)
+    {
+      buckets[k] = 0;
+
+      for (size_t j = 0; j < METRICS_NUM_SHARDS; j++)
+        buckets[k] += mShards[j].buckets[i][k].load(boost::memory_order_relaxed);
+
+      stats.count += buckets[k];
+    }
+
+    for (size_t j = 0; j < METRICS_NUM_SHARDS; j++)
+    {
+      stats.sum += mShards[j].sums[i].load(boost::memory_order_relaxed);
+      stats.max = std::max(stats.max,
+                           mShards[j].maxs[i].load(boost::memory_order_relaxed));
+    }
+
+    // The percentiles are the highest value of the bucket they fall in
+    const double quantiles[] = {.5, .9, .99, .999};
+    uint64_t *percentiles[] = {&stats.p50, &stats.p90, &stats.p99,
+                               &stats.p999};
+    uint64_t seen = 0;
+    size_t q = 0;
+
+    for (size_t k = 0; k < METRICS_HISTOGRAM_NUM_BUCKETS && q < 4; k++)
+    {
+      seen += buckets[k];
+
+      while (q < 4 && buckets[k] > 0 && seen >= quantiles[q] * stats.count)
+        *percentiles[q++] = std::min(bucketMaxValue(k), stats.max);
+    }
+
+    metrics.latencies[histogramNames[i]] = stats;
+  }
+}
+
+std::string
+metricsToPrometheusText(const Filesystem::Metrics &metrics)
+{
+  std::ostringstream stream;
+  std::map<std::string, uint64_t>::const_iterator it;
+
+  for (it = metrics.counters.begin(); it != metrics.counters.end(); it++)
+  {
+    stream << "# TYPE radosfs_" << it->first << "_total counter\n"
+           << "radosfs_" << it->first << "_total " << it->second << "\n";
+  }
+
+  for (it = metrics.gauges.begin(); it != metrics.gauges.end(); it++)
+  {
+    stream << "# TYPE radosfs_" << it->first << " gauge\n"
+           << "radosfs_" << it->first << " " << it->second << "\n";
+  }
+
+  std::map<std::string, Filesystem::LatencyStats>::const_iterator latIt;
+
+  for (latIt = metrics.latencies.begin(); latIt != metrics.latencies.end();
+       latIt++)
+  {
+    const std::string name = "radosfs_" + latIt->first + "_latency_seconds";
+    const Filesystem::LatencyStats &stats = latIt->second;
+
+    stream << "# TYPE " << name << " summary\n"
+           << name << "{quantile=\"0.5\"} " << stats.p50 / 1e6 << "\n"
+           << name << "{quantile=\"0.9\"} " << stats.p90 / 1e6 << "\n"
+           << name << "{quantile=\"0.99\"} " << stats.p99 / 1e6 << "\n"
+           << name << "{quantile=\"0.999\"} " << stats.p999 / 1e6 << "\n"
+           << name << "_sum " << stats.sum / 1e6 << "\n"
+           << name << "_count " << stats.count << "\n";
+  }
+
+  return stream.str();
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,126 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <string>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+#define METRICS_HISTOGRAM_SUB_BUCKETS (1 << METRICS_HISTOGRAM_SUB_BUCKET_BITS)
+#define METRICS_HISTOGRAM_NUM_BUCKETS \
+  ((METRICS_HISTOGRAM_MAX_BITS - METRICS_HISTOGRAM_SUB_BUCKET_BITS + 1) * \
+   METRICS_HISTOGRAM_SUB_BUCKETS)
+
+class MetricsRegistry
+{
+public:
+  enum Counter
+  {
+    COUNTER_FILE_READ_BYTES = 0,
+    COUNTER_FILE_WRITE_BYTES,
+    COUNTER_RADOS_CHUNK_READS,
+    COUNTER_RADOS_CHUNK_WRITES,
+    COUNTER_RADOS_CHUNK_REMOVES,
+    COUNTER_RADOS_LOCK_ATTEMPTS,
+    COUNTER_DIR_CACHE_HITS,
+    COUNTER_DIR_CACHE_MISSES,
+    COUNTER_DIR_PATH_CACHE_HITS,
+    COUNTER_DIR_PATH_CACHE_MISSES,
+    COUNTER_FILE_TIER_MOVES,
+    COUNTER_FILE_TIER_MOVE_FAILURES,
+    COUNTER_COUNT
+  };
+
+  enum Histogram
+  {
+    HISTOGRAM_FILE_READ = 0,
+    HISTOGRAM_FILE_WRITE,
+    HISTOGRAM_FILE_WRITE_SYNC,
+    HISTOGRAM_FILE_TRUNCATE,
+    HISTOGRAM_FILE_REMOVE,
+    HISTOGRAM_FILE_LOCK_WAIT,
+    HISTOGRAM_WRITE_THROTTLE_WAIT,
+    HISTOGRAM_STAT,
+    HISTOGRAM_DIR_LIST,
+    HISTOGRAM_DIR_FIND,
+    HISTOGRAM_COUNT
+  };
+
+  MetricsRegistry(void);
+
+  void add(Counter counter, uint64_t value = 1);
+
+  void record(Histogram histogram, uint64_t microseconds);
+
+  void record(Histogram histogram,
+              boost::chrono::steady_clock::time_point startTime);
+
+  void get(Filesystem::Metrics &metrics);
+
+  static size_t bucketIndex(uint64_t value);
+
+  static uint64_t bucketMaxValue(size_t index);
+
+private:
+  struct Shard
+  {
+    boost::atomic<uint64_t> counters[COUNTER_COUNT];
+    boost::atomic<uint64_t> buckets[HISTOGRAM_COUNT]
+                                   [METRICS_HISTOGRAM_NUM_BUCKETS];
+    boost::atomic<uint64_t> sums[HISTOGRAM_COUNT];
+    boost::atomic<uint64_t> maxs[HISTOGRAM_COUNT];
+  };
+
+  Shard &shard(void);
+
+  Shard mShards[METRICS_NUM_SHARDS];
+};
+
+class MetricsTimer
+{
+public:
+  MetricsTimer(MetricsRegistry &metrics, MetricsRegistry::Histogram histogram)
+    : mMetrics(metrics),
+      mHistogram(histogram),
+      mStart(boost::chrono::steady_clock::now())
+  {}
+
+  ~MetricsTimer(void)
+  {
+    mMetrics.record(mHistogram, mStart);
+  }
+
+private:
+  MetricsRegistry &mMetrics;
+  MetricsRegistry::Histogram mHistogram;
+  boost::chrono::steady_clock::time_point mStart;
+};
+
+std::string metricsToPrometheusText(const Filesystem::Metrics &metrics);
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __METRICS_HH__ */
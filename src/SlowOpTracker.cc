@@ -0,0 +1,307 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include "AsyncOp.hh"
+#include "AsyncOpPriv.hh"
+#include "Logger.hh"
+#include "SlowOpTracker.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// The op being run by the current thread, so the code it calls (e.g. the file
+// locking or the wait for a RADOS completion) can account its stages
+static __thread SlowOp *currentOp = 0;
+
+static const char *stageNames[SlowOp::STAGE_COUNT] = {
+  "running",
+  "queued",
+  "lock",
+  "rados"
+};
+
+static int64_t
+nowMicroseconds(void)
+{
+  return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SlowOp::SlowOp(const char *name, const std::string &opId,
+               const std::string &target, Stage stage)
+  : id(0),
+    name(name),
+    opId(opId),
+    target(target),
+    startTime(boost::chrono::steady_clock::now()),
+    stage(stage),
+    stageStart(nowMicroseconds()),
+    lockAttempts(0),
+    reported(false)
+{
+  for (int i = 0; i < STAGE_COUNT; i++)
+    stageTimes[i].store(0, boost::memory_order_relaxed);
+}
+
+void
+SlowOp::setStage(Stage newStage)
+{
+  // Only the thread running the op changes its stage, the others just read it
+  int64_t now = nowMicroseconds();
+  int64_t elapsed = now - stageStart.load(boost::memory_order_relaxed);
+  int oldStage = stage.load(boost::memory_order_relaxed);
+
+  stageTimes[oldStage].fetch_add(elapsed, boost::memory_order_relaxed);
+  stageStart.store(now, boost::memory_order_relaxed);
+  stage.store(newStage, boost::memory_order_relaxed);
+}
+
+uint64_t
+SlowOp::stageTime(Stage requestedStage,
+                  boost::chrono::steady_clock::time_point now)
+{
+  uint64_t time = stageTimes[requestedStage].load(boost::memory_order_relaxed);
+
+  if (stage.load(boost::memory_order_relaxed) == requestedStage)
+  {
+    int64_t nowUs = boost::chrono::duration_cast<boost::chrono::microseconds>(
+          now.time_since_epoch()).count();
+    int64_t elapsed = nowUs - stageStart.load(boost::memory_order_relaxed);
+
+    if (elapsed > 0)
+      time += elapsed;
+  }
+
+  return time;
+}
+
+SlowOpTracker::SlowOpTracker(void)
+  : mNextId(0),
+    mThreshold(DEFAULT_SLOW_OP_THRESHOLD * 1000)
+{}
+
+SlowOpSP
+SlowOpTracker::start(const char *name, const std::string &opId,
+                     const std::string &target, SlowOp::Stage stage)
+{
+  // Ops are not tracked at all (so they cost nothing) while the threshold is 0
+  if (mThreshold.load(boost::memory_order_relaxed) == 0)
+    return SlowOpSP();
+
+  SlowOpSP op(new SlowOp(name, opId, target, stage));
+  op->id = mNextId.fetch_add(1, boost::memory_order_relaxed);
+
+  SlowOpTrackerShard &shard = mShards[op->id % SLOW_OP_TRACKER_NUM_SHARDS];
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
+  shard.ops[op->id] = op;
+
+  return op;
+}
+
+void
+SlowOpTracker::startAsync(const char *name,
+                          std::tr1::shared_ptr<AsyncOp> asyncOp,
+                          const std::string &target)
+{
+  // Ops that finish in the background are finished by their AsyncOp once it
+  // completes (or is released)
+  SlowOpSP op = start(name, asyncOp->id(), target, SlowOp::STAGE_RADOS);
+
+  if (op)
+    asyncOp->mPriv->setSlowOp(this, op);
+}
+
+void
+SlowOpTracker::finish(const SlowOpSP &op)
+{
+  if (!op)
+    return;
+
+  SlowOpTrackerShard &shard = mShards[op->id % SLOW_OP_TRACKER_NUM_SHARDS];
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
+  shard.ops.erase(op->id);
+}
+
+void
+SlowOpTracker::setThreshold(float seconds)
+{
+  mThreshold.store((uint32_t) (std::max(seconds, 0.0f) * 1000),
+                   boost::memory_order_relaxed);
+}
+
+float
+SlowOpTracker::threshold(void) const
+{
+  return mThreshold.load(boost::memory_order_relaxed) / 1000.0;
+}
+
+SlowOp *
+SlowOpTracker::current(void)
+{
+  return currentOp;
+}
+
+void
+SlowOpTracker::setCurrent(SlowOp *op)
+{
+  currentOp = op;
+}
+
+void
+SlowOpTracker::countLockAttempt(void)
+{
+  if (currentOp)
+    currentOp->lockAttempts.fetch_add(1, boost::memory_order_relaxed);
+}
+
+static bool
+isOlder(const SlowOpSP &op1, const SlowOpSP &op2)
+{
+  return op1->startTime < op2->startTime;
+}
+
+void
+SlowOpTracker::collect(std::vector<SlowOpSP> &ops)
+{
+  for (size_t i = 0; i < SLOW_OP_TRACKER_NUM_SHARDS; i++)
+  {
+    SlowOpTrackerShard &shard = mShards[i];
+    boost::unique_lock<boost::mutex> lock(shard.mutex);
+    std::map<uint64_t, SlowOpSP>::const_iterator it;
+
+    for (it = shard.ops.begin(); it != shard.ops.end(); it++)
+      ops.push_back((*it).second);
+  }
+
+  std::sort(ops.begin(), ops.end(), isOlder);
+}
+
+static std::string
+describeOp(const SlowOpSP &op, boost::chrono::steady_clock::time_point now)
+{
+  char description[LOG_MESSAGE_MAX_SIZE];
+  boost::chrono::duration<double> age = now - op->startTime;
+
+  snprintf(description, sizeof(description),
+           "%s op='%s' target='%s' age=%.3fs stage=%s lock=%.3fs "
+           "queued=%.3fs rados=%.3fs lock_attempts=%lu", op->name,
+           op->opId.c_str(), op->target.c_str(), age.count(),
+           stageNames[op->stage.load(boost::memory_order_relaxed)],
+           op->stageTime(SlowOp::STAGE_LOCK, now) / 1e6,
+           op->stageTime(SlowOp::STAGE_QUEUED, now) / 1e6,
+           op->stageTime(SlowOp::STAGE_RADOS, now) / 1e6,
+           (unsigned long) op->lockAttempts.load(boost::memory_order_relaxed));
+
+  return description;
+}
+
+void
+SlowOpTracker::check(void)
+{
+  std::vector<SlowOpSP> ops;
+  collect(ops);
+
+  const uint32_t thresholdMs = mThreshold.load(boost::memory_order_relaxed);
+
+  if (thresholdMs == 0)
+    return;
+
+  boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+  boost::chrono::milliseconds threshold(thresholdMs);
+
+  // Each op is only reported once, when it crosses the threshold; the ones
+  // still outstanding can be listed with Filesystem::dumpSlowOps
+  for (size_t i = 0; i < ops.size() && now - ops[i]->startTime >= threshold;
+       i++)
+  {
+    if (ops[i]->reported)
+      continue;
+
+    ops[i]->reported = true;
+    radosfs_debug("Slow op: %s", describeOp(ops[i], now).c_str());
+  }
+}
+
+std::string
+SlowOpTracker::dump(void)
+{
+  std::vector<SlowOpSP> ops;
+  collect(ops);
+
+  boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+  boost::chrono::milliseconds threshold(
+        mThreshold.load(boost::memory_order_relaxed));
+  std::ostringstream stream;
+
+  for (size_t i = 0; i < ops.size() && now - ops[i]->startTime >= threshold;
+       i++)
+  {
+    stream << describeOp(ops[i], now) << "\n";
+  }
+
+  return stream.str();
+}
+
+size_t
+SlowOpTracker::size(void)
+{
+  std::vector<SlowOpSP> ops;
+  collect(ops);
+
+  return ops.size();
+}
+
+SlowOpScope::SlowOpScope(SlowOpTracker &tracker, const char *name,
+                         const std::string &opId, const std::string &target)
+  : mTracker(tracker),
+    mOp(tracker.start(name, opId, target)),
+    mPrevious(SlowOpTracker::current())
+{
+  if (mOp)
+    SlowOpTracker::setCurrent(mOp.get());
+}
+
+SlowOpScope::SlowOpScope(SlowOpTracker &tracker, const SlowOpSP &op)
+  : mTracker(tracker),
+    mOp(op),
+    mPrevious(SlowOpTracker::current())
+{
+  if (mOp)
+  {
+    mOp->setStage(SlowOp::STAGE_RUNNING);
+    SlowOpTracker::setCurrent(mOp.get());
+  }
+}
+
+SlowOpScope::~SlowOpScope(void)
+{
+  if (mOp)
+  {
+    SlowOpTracker::setCurrent(mPrevious);
+    mTracker.finish(mOp);
+  }
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,156 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __SLOW_OP_TRACKER_HH__
+#define __SLOW_OP_TRACKER_HH__
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <tr1/memory>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+class AsyncOp;
+
+struct SlowOp
+{
+  enum Stage
+  {
+    STAGE_RUNNING = 0,
+    STAGE_QUEUED,
+    STAGE_LOCK,
+    STAGE_RADOS,
+    STAGE_COUNT
+  };
+
+  SlowOp(const char *name, const std::string &opId, const std::string &target,
+         Stage stage);
+
+  void setStage(Stage stage);
+  uint64_t stageTime(Stage stage, boost::chrono::steady_clock::time_point now);
+
+  uint64_t id;
+  const char *name;
+  std::string opId;
+  std::string target;
+  boost::chrono::steady_clock::time_point startTime;
+  boost::atomic<int> stage;
+  boost::atomic<int64_t> stageStart;
+  boost::atomic<uint64_t> stageTimes[STAGE_COUNT];
+  boost::atomic<uint64_t> lockAttempts;
+  bool reported;
+};
+
+typedef std::tr1::shared_ptr<SlowOp> SlowOpSP;
+
+class SlowOpTrackerShard
+{
+public:
+  std::map<uint64_t, SlowOpSP> ops;
+  boost::mutex mutex;
+};
+
+class SlowOpTracker
+{
+public:
+  SlowOpTracker(void);
+
+  SlowOpSP start(const char *name, const std::string &opId,
+                 const std::string &target,
+                 SlowOp::Stage stage = SlowOp::STAGE_RUNNING);
+
+  void startAsync(const char *name, std::tr1::shared_ptr<AsyncOp> asyncOp,
+                  const std::string &target);
+
+  void finish(const SlowOpSP &op);
+
+  void setThreshold(float seconds);
+
+  float threshold(void) const;
+
+  void check(void);
+
+  std::string dump(void);
+
+  size_t size(void);
+
+  static SlowOp * current(void);
+
+  static void setCurrent(SlowOp *op);
+
+  static void countLockAttempt(void);
+
+private:
+  void collect(std::vector<SlowOpSP> &ops);
+
+  boost::atomic<uint64_t> mNextId;
+  boost::atomic<uint32_t> mThreshold;
+  SlowOpTrackerShard mShards[SLOW_OP_TRACKER_NUM_SHARDS];
+};
+
+class SlowOpScope
+{
+public:
+  SlowOpScope(SlowOpTracker &tracker, const char *name,
+              const std::string &opId = "", const std::string &target = "");
+
+  SlowOpScope(SlowOpTracker &tracker, const SlowOpSP &op);
+
+  ~SlowOpScope(void);
+
+private:
+  SlowOpTracker &mTracker;
+  SlowOpSP mOp;
+  SlowOp *mPrevious;
+};
+
+class SlowOpStage
+{
+public:
+  SlowOpStage(SlowOp::Stage stage)
+    : mOp(SlowOpTracker::current()),
+      mPrevious(SlowOp::STAGE_RUNNING)
+  {
+    if (mOp)
+    {
+      mPrevious = (SlowOp::Stage) mOp->stage.load(boost::memory_order_relaxed);
+      mOp->setStage(stage);
+    }
+  }
+
+  ~SlowOpStage(void)
+  {
+    if (mOp)
+      mOp->setStage(mPrevious);
+  }
+
+private:
+  SlowOp *mOp;
+  SlowOp::Stage mPrevious;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __SLOW_OP_TRACKER_HH__ */
@@ -0,0 +1,328 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+#include <sstream>
+#include <sys/syscall.h>
+#include <tr1/functional>
+#include <unistd.h>
+#include <vector>
+
+#include "Tracer.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// The sample rate in parts of TRACE_SAMPLE_RATE_SCALE (0 disables the tracing)
+boost::atomic<uint32_t> Tracer::sampleRate(0);
+
+struct TraceEvent
+{
+  const char *name;
+  const char *category;
+  int64_t startTime;
+  int64_t duration;
+  long threadId;
+  std::string opId;
+  std::string inode;
+  int64_t chunk;
+};
+
+// The spans are kept in a ring so the tracing can stay on indefinitely using a
+// fixed amount of memory: once it is full, the oldest spans are overwritten
+struct TraceBuffer
+{
+  TraceBuffer(void) : capacity(DEFAULT_TRACE_BUFFER_SIZE), next(0) {}
+
+  boost::mutex mutex;
+  std::vector<TraceEvent> events;
+  size_t capacity;
+  size_t next;
+};
+
+static TraceBuffer &
+traceBuffer(void)
+{
+  static TraceBuffer buffer;
+  return buffer;
+}
+
+// The spans started in a thread while another one is open inherit its sampling
+// decision, so a sampled operation is always traced with all its stages
+static __thread int threadSpanDepth = 0;
+static __thread bool threadSampled = false;
+static __thread uint32_t threadRandom = 0;
+static __thread long threadId = 0;
+
+static long
+currentThreadId(void)
+{
+  if (threadId == 0)
+    threadId = syscall(SYS_gettid);
+
+  return threadId;
+}
+
+static uint32_t
+nextRandom(void)
+{
+  if (threadRandom == 0)
+    threadRandom = (uint32_t) currentThreadId() * 2654435761u | 1;
+
+  // xorshift32
+  threadRandom ^= threadRandom << 13;
+  threadRandom ^= threadRandom >> 17;
+  threadRandom ^= threadRandom << 5;
+
+  return threadRandom;
+}
+
+static int64_t
+toMicroseconds(boost::chrono::steady_clock::time_point time)
+{
+  return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        time.time_since_epoch()).count();
+}
+
+static void
+appendJsonString(std::ostringstream &stream, const std::string &str)
+{
+  stream << '"';
+
+  for (size_t i = 0; i < str.length(); i++)
+  {
+    const char c = str[i];
+
+    if (c == '"' || c == '\\')
+    {
+      stream << '\\' << c;
+    }
+    else if ((unsigned char) c < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      stream << escaped;
+    }
+    else
+    {
+      stream << c;
+    }
+  }
+
+  stream << '"';
+}
+
+void
+Tracer::setSampleRate(float rate)
+{
+  rate = std::min(std::max(rate, 0.0f), 1.0f);
+  sampleRate.store((uint32_t) (rate * TRACE_SAMPLE_RATE_SCALE),
+                   boost::memory_order_relaxed);
+}
+
+float
+Tracer::getSampleRate(void)
+{
+  return sampleRate.load(boost::memory_order_relaxed) /
+      (float) TRACE_SAMPLE_RATE_SCALE;
+}
+
+void
+Tracer::setBufferSize(size_t numSpans)
+{
+  TraceBuffer &buffer = traceBuffer();
+  boost::unique_lock<boost::mutex> lock(buffer.mutex);
+
+  buffer.capacity = std::max(numSpans, (size_t) 1);
+  buffer.events.clear();
+  buffer.next = 0;
+}
+
+size_t
+Tracer::bufferSize(void)
+{
+  TraceBuffer &buffer = traceBuffer();
+  boost::unique_lock<boost::mutex> lock(buffer.mutex);
+
+  return buffer.capacity;
+}
+
+bool
+Tracer::sample(const std::string &opId)
+{
+  uint32_t rate = sampleRate.load(boost::memory_order_relaxed);
+
+  if (rate == 0)
+    return false;
+
+  if (rate >= TRACE_SAMPLE_RATE_SCALE)
+    return true;
+
+  // Spans of the same operation are sampled from its id, so they are kept or
+  // dropped together even if they are recorded in different threads
+  uint32_t value = opId.empty() ? nextRandom() :
+                                  std::tr1::hash<std::string>()(opId);
+
+  return value % TRACE_SAMPLE_RATE_SCALE < rate;
+}
+
+void
+Tracer::record(const char *name, const char *category,
+               boost::chrono::steady_clock::time_point startTime,
+               boost::chrono::steady_clock::time_point endTime,
+               const std::string &opId, const std::string &inode,
+               int64_t chunk)
+{
+  TraceEvent event;
+  event.name = name;
+  event.category = category;
+  event.startTime = toMicroseconds(startTime);
+  event.duration = toMicroseconds(endTime) - event.startTime;
+  event.threadId = currentThreadId();
+  event.opId = opId;
+  event.inode = inode;
+  event.chunk = chunk;
+
+  TraceBuffer &buffer = traceBuffer();
+  boost::unique_lock<boost::mutex> lock(buffer.mutex);
+
+  if (buffer.events.size() < buffer.capacity)
+  {
+    buffer.events.push_back(event);
+  }
+  else
+  {
+    buffer.events[buffer.next] = event;
+  }
+
+  buffer.next = (buffer.next + 1) % buffer.capacity;
+}
+
+std::string
+Tracer::toJson(void)
+{
+  std::vector<TraceEvent> events;
+
+  {
+    TraceBuffer &buffer = traceBuffer();
+    boost::unique_lock<boost::mutex> lock(buffer.mutex);
+
+    // Copy the spans from the oldest to the newest
+    if (buffer.events.size() < buffer.capacity)
+    {
+      events = buffer.events;
+    }
+    else
+    {
+      events.assign(buffer.events.begin() + buffer.next, buffer.events.end());
+      events.insert(events.end(), buffer.events.begin(),
+                    buffer.events.begin() + buffer.next);
+    }
+  }
+
+  std::ostringstream stream;
+  const pid_t pid = getpid();
+
+  stream << "{\"traceEvents\":[";
+
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    const TraceEvent &event = events[i];
+
+    if (i > 0)
+      stream << ",";
+
+    stream << "\n{\"name\":\"" << event.name << "\",\"cat\":\""
+           << event.category << "\",\"ph\":\"X\",\"ts\":" << event.startTime
+           << ",\"dur\":" << event.duration << ",\"pid\":" << pid
+           << ",\"tid\":" << event.threadId << ",\"args\":{";
+
+    bool hasArgs = false;
+
+    if (!event.opId.empty())
+    {
+      stream << "\"op\":";
+      appendJsonString(stream, event.opId);
+      hasArgs = true;
+    }
+
+    if (!event.inode.empty())
+    {
+      stream << (hasArgs ? "," : "") << "\"inode\":";
+      appendJsonString(stream, event.inode);
+      hasArgs = true;
+    }
+
+    if (event.chunk >= 0)
+      stream << (hasArgs ? "," : "") << "\"chunk\":" << event.chunk;
+
+    stream << "}}";
+  }
+
+  stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  return stream.str();
+}
+
+void
+Tracer::clear(void)
+{
+  TraceBuffer &buffer = traceBuffer();
+  boost::unique_lock<boost::mutex> lock(buffer.mutex);
+
+  buffer.events.clear();
+  buffer.next = 0;
+}
+
+void
+TraceSpan::start(const char *name, const char *category,
+                 const std::string &opId, const std::string &inode,
+                 int64_t chunk)
+{
+  mParentSampled = threadSampled;
+  mSampled = threadSpanDepth > 0 ? threadSampled : Tracer::sample(opId);
+
+  threadSpanDepth++;
+  threadSampled = mSampled;
+  mActive = true;
+
+  if (!mSampled)
+    return;
+
+  mName = name;
+  mCategory = category;
+  mOpId = opId;
+  mInode = inode;
+  mChunk = chunk;
+  mStart = boost::chrono::steady_clock::now();
+}
+
+void
+TraceSpan::finish(void)
+{
+  threadSpanDepth--;
+  threadSampled = mParentSampled;
+
+  if (mSampled)
+    Tracer::record(mName, mCategory, mStart, boost::chrono::steady_clock::now(),
+                   mOpId, mInode, mChunk);
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,100 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __TRACER_HH__
+#define __TRACER_HH__
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <stdint.h>
+#include <string>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+class Tracer
+{
+public:
+  static boost::atomic<uint32_t> sampleRate;
+
+  static bool isEnabled(void)
+  {
+    return sampleRate.load(boost::memory_order_relaxed) != 0;
+  }
+
+  static void setSampleRate(float rate);
+
+  static float getSampleRate(void);
+
+  static void setBufferSize(size_t numSpans);
+
+  static size_t bufferSize(void);
+
+  static bool sample(const std::string &opId);
+
+  static void record(const char *name, const char *category,
+                     boost::chrono::steady_clock::time_point startTime,
+                     boost::chrono::steady_clock::time_point endTime,
+                     const std::string &opId, const std::string &inode,
+                     int64_t chunk);
+
+  static std::string toJson(void);
+
+  static void clear(void);
+};
+
+class TraceSpan
+{
+public:
+  TraceSpan(const char *name, const char *category,
+            const std::string &opId = "", const std::string &inode = "",
+            int64_t chunk = -1)
+    : mActive(false)
+  {
+    if (Tracer::isEnabled())
+      start(name, category, opId, inode, chunk);
+  }
+
+  ~TraceSpan(void)
+  {
+    if (mActive)
+      finish();
+  }
+
+private:
+  void start(const char *name, const char *category, const std::string &opId,
+             const std::string &inode, int64_t chunk);
+  void finish(void);
+
+  bool mActive;
+  bool mSampled;
+  bool mParentSampled;
+  const char *mName;
+  const char *mCategory;
+  std::string mOpId;
+  std::string mInode;
+  int64_t mChunk;
+  boost::chrono::steady_clock::time_point mStart;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __TRACER_HH__ */
@@ -0,0 +1,364 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <cstring>
+
+#include "WorkScheduler.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// The scheduler and index of the worker running in the current thread, so jobs
+// posted from a job go to the same worker's queues
+static __thread WorkScheduler *currentScheduler = 0;
+static __thread size_t currentWorker = 0;
+
+WorkScheduler::WorkScheduler(size_t numWorkers)
+  : mNumWorkers(0),
+    mTargetWorkers(numWorkers),
+    mMinWorkers(numWorkers),
+    mMaxWorkers(numWorkers),
+    mNextWorker(0),
+    mTotalQueued(0),
+    mLaunched(false),
+    mStopping(false)
+{
+  memset(mStats, 0, sizeof(mStats));
+}
+
+WorkScheduler::~WorkScheduler()
+{
+  stop();
+}
+
+void
+WorkScheduler::stop(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mStopping = true;
+  }
+
+  mCond.notify_all();
+
+  // The workers only leave once all the queued jobs are done
+  std::vector<WorkSchedulerWorker *>::iterator it;
+  for (it = mWorkers.begin(); it != mWorkers.end(); it++)
+  {
+    if ((*it)->thread)
+      (*it)->thread->join();
+  }
+
+  for (it = mWorkers.begin(); it != mWorkers.end(); it++)
+  {
+    delete (*it)->thread;
+    delete *it;
+  }
+
+  mWorkers.clear();
+}
+
+bool
+WorkScheduler::inWorkerThread(void)
+{
+  return currentScheduler != 0;
+}
+
+void
+WorkScheduler::launchWorkers(void)
+{
+  // Retire the workers above the target number; their queued jobs are taken by
+  // the other workers
+  for (size_t i = mTargetWorkers; i < mNumWorkers; i++)
+    mWorkers[i]->retired = true;
+
+  for (size_t i = mNumWorkers; i < mTargetWorkers; i++)
+  {
+    if (i == mWorkers.size())
+      mWorkers.push_back(new WorkSchedulerWorker);
+
+    WorkSchedulerWorker *worker = mWorkers[i];
+
+    // A retired worker that is still running just resumes its work
+    if (worker->thread && !worker->exited)
+    {
+      worker->retired = false;
+      continue;
+    }
+
+    if (worker->thread)
+    {
+      worker->thread->join();
+      delete worker->thread;
+    }
+
+    worker->retired = false;
+    worker->exited = false;
+    worker->thread = new boost::thread(boost::bind(&WorkScheduler::workerThread,
+                                                   this, i));
+  }
+
+  mNumWorkers = mTargetWorkers;
+  mLaunched = true;
+
+  mCond.notify_all();
+}
+
+void
+WorkScheduler::setNumWorkers(size_t minWorkers, size_t maxWorkers)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  mMinWorkers = minWorkers;
+  mMaxWorkers = std::max(minWorkers, maxWorkers);
+
+  // Keep the current number of workers if it is within the new bounds
+  mTargetWorkers = mLaunched ? mNumWorkers : mMinWorkers;
+  mTargetWorkers = std::min(std::max(mTargetWorkers, mMinWorkers), mMaxWorkers);
+
+  // Workers are only launched when the first job is posted
+  if (mLaunched && !mStopping)
+    launchWorkers();
+}
+
+size_t
+WorkScheduler::numWorkers(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mNumWorkers;
+}
+
+size_t
+WorkScheduler::queueDepth(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mTotalQueued;
+}
+
+void
+WorkScheduler::growIfNeeded(void)
+{
+  if (!mLaunched || mStopping || mTotalQueued == 0 ||
+      mNumWorkers >= mMaxWorkers)
+    return;
+
+  // Workers mostly wait for RADOS calls so having most of them busy means the
+  // pool is too small for the I/O that is going on
+  size_t running = 0;
+  for (int i = 0; i < WORK_PRIORITY_COUNT; i++)
+    running += mStats[i].running;
+
+  bool grow = running >= mNumWorkers * WORK_SCHEDULER_BUSY_RATIO;
+
+  if (!grow)
+  {
+    boost::chrono::steady_clock::time_point oldest =
+        boost::chrono::steady_clock::now() -
+        boost::chrono::milliseconds(WORK_SCHEDULER_MAX_QUEUED_TIME);
+
+    for (size_t i = 0; i < mWorkers.size() && !grow; i++)
+    {
+      for (int j = 0; j < WORK_PRIORITY_COUNT && !grow; j++)
+      {
+        const std::deque<WorkItem> &jobs = mWorkers[i]->jobs[j];
+        grow = !jobs.empty() && jobs.front().queuedTime < oldest;
+      }
+    }
+  }
+
+  if (grow)
+  {
+    mTargetWorkers = mNumWorkers + 1;
+    launchWorkers();
+  }
+}
+
+Filesystem::WorkQueueStats
+WorkScheduler::stats(Filesystem::WorkPriority priority)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mStats[priority];
+}
+
+void
+WorkScheduler::post(WorkJob job, Filesystem::WorkPriority priority)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (!mLaunched)
+    launchWorkers();
+
+  size_t index;
+
+  if (currentScheduler == this && !mWorkers[currentWorker]->retired)
+  {
+    index = currentWorker;
+  }
+  else
+  {
+    index = mNextWorker++ % mNumWorkers;
+  }
+
+  WorkItem item;
+  item.job = job;
+  item.queuedTime = boost::chrono::steady_clock::now();
+
+  mWorkers[index]->jobs[priority].push_back(item);
+
+  Filesystem::WorkQueueStats &stats = mStats[priority];
+  stats.queued++;
+  mTotalQueued++;
+
+  if (stats.queued > stats.maxQueued)
+    stats.maxQueued = stats.queued;
+
+  growIfNeeded();
+
+  lock.unlock();
+
+  mCond.notify_one();
+}
+
+bool
+WorkScheduler::canRun(int priority) const
+{
+  // Jobs of a priority (together with the ones of lower priorities) can only
+  // occupy a number of workers that leaves one worker free for each of the
+  // higher priorities, so e.g. a big find never delays writes
+  size_t running = 0;
+  for (int i = priority; i < WORK_PRIORITY_COUNT; i++)
+    running += mStats[i].running;
+
+  size_t maxRunning = 1;
+
+  if (mNumWorkers > (size_t) priority + 1)
+    maxRunning = mNumWorkers - priority;
+
+  return running < maxRunning;
+}
+
+bool
+WorkScheduler::popJob(size_t index, WorkJob &job, int *priority)
+{
+  for (int i = 0; i < WORK_PRIORITY_COUNT; i++)
+  {
+    if (mStats[i].queued == 0 || !canRun(i))
+      continue;
+
+    std::deque<WorkItem> &ownJobs = mWorkers[index]->jobs[i];
+
+    if (!ownJobs.empty())
+    {
+      job = ownJobs.front().job;
+      ownJobs.pop_front();
+      *priority = i;
+      return true;
+    }
+
+    // Steal the most recent job from another worker (including retired ones)
+    for (size_t j = 1; j < mWorkers.size(); j++)
+    {
+      std::deque<WorkItem> &otherJobs =
+          mWorkers[(index + j) % mWorkers.size()]->jobs[i];
+
+      if (!otherJobs.empty())
+      {
+        job = otherJobs.back().job;
+        otherJobs.pop_back();
+        mStats[i].stolen++;
+        *priority = i;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void
+WorkScheduler::workerThread(size_t index)
+{
+  currentScheduler = this;
+  currentWorker = index;
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  WorkSchedulerWorker *worker = mWorkers[index];
+  boost::chrono::steady_clock::time_point idleSince =
+      boost::chrono::steady_clock::now();
+
+  while (!worker->retired)
+  {
+    WorkJob job;
+    int priority;
+
+    if (!popJob(index, job, &priority))
+    {
+      if (mStopping && mTotalQueued == 0)
+        break;
+
+      // The last worker leaves if it has been idle for a while, so the pool
+      // shrinks one worker at a time down to its minimum size
+      if (index + 1 == mNumWorkers && mNumWorkers > mMinWorkers &&
+          boost::chrono::steady_clock::now() - idleSince >=
+          boost::chrono::milliseconds(WORK_SCHEDULER_IDLE_TIMEOUT))
+      {
+        mNumWorkers--;
+        mTargetWorkers = mNumWorkers;
+        break;
+      }
+
+      // Jobs may be waiting only because their priority is limited
+      growIfNeeded();
+
+      mCond.wait_for(lock,
+                     boost::chrono::milliseconds(WORK_SCHEDULER_IDLE_TIMEOUT));
+      continue;
+    }
+
+    mStats[priority].queued--;
+    mStats[priority].running++;
+    mTotalQueued--;
+
+    growIfNeeded();
+
+    lock.unlock();
+
+    job();
+
+    lock.lock();
+
+    mStats[priority].running--;
+    mStats[priority].completed++;
+    idleSince = boost::chrono::steady_clock::now();
+
+    growIfNeeded();
+
+    // Finishing a job may let a job of a limited priority run
+    if (mTotalQueued > 0 || mStopping)
+      mCond.notify_all();
+  }
+
+  worker->exited = true;
+
+  // Other workers may have been waiting for the ones of this worker to finish
+  mCond.notify_all();
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,97 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __WORK_SCHEDULER_HH__
+#define __WORK_SCHEDULER_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <vector>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+#define WORK_PRIORITY_COUNT (Filesystem::WORK_PRIORITY_BACKGROUND + 1)
+
+typedef boost::function<void ()> WorkJob;
+
+struct WorkItem
+{
+  WorkJob job;
+  boost::chrono::steady_clock::time_point queuedTime;
+};
+
+struct WorkSchedulerWorker
+{
+  WorkSchedulerWorker(void) : thread(0), retired(false), exited(false) {}
+
+  std::deque<WorkItem> jobs[WORK_PRIORITY_COUNT];
+  boost::thread *thread;
+  bool retired;
+  bool exited;
+};
+
+class WorkScheduler
+{
+public:
+  WorkScheduler(size_t numWorkers = DEFAULT_NUM_WORKER_THREADS);
+  ~WorkScheduler(void);
+
+  void post(WorkJob job, Filesystem::WorkPriority priority);
+
+  void setNumWorkers(size_t minWorkers, size_t maxWorkers = 0);
+
+  size_t numWorkers(void);
+
+  size_t queueDepth(void);
+
+  Filesystem::WorkQueueStats stats(Filesystem::WorkPriority priority);
+
+  void stop(void);
+
+  static bool inWorkerThread(void);
+
+private:
+  void launchWorkers(void);
+  void growIfNeeded(void);
+  void workerThread(size_t index);
+  bool popJob(size_t index, WorkJob &job, int *priority);
+  bool canRun(int priority) const;
+
+  boost::mutex mMutex;
+  boost::condition_variable mCond;
+  std::vector<WorkSchedulerWorker *> mWorkers;
+  size_t mNumWorkers;
+  size_t mTargetWorkers;
+  size_t mMinWorkers;
+  size_t mMaxWorkers;
+  size_t mNextWorker;
+  size_t mTotalQueued;
+  bool mLaunched;
+  bool mStopping;
+  Filesystem::WorkQueueStats mStats[WORK_PRIORITY_COUNT];
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __WORK_SCHEDULER_HH__ */
@@ -0,0 +1,158 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include "WorkScheduler.hh"
+#include "WriteThrottle.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+WriteThrottle::WriteThrottle(void)
+  : mMaxBytes(DEFAULT_WRITE_THROTTLE_MAX_BYTES),
+    mMaxOps(DEFAULT_WRITE_THROTTLE_MAX_OPS),
+    mMode(Filesystem::WRITE_THROTTLE_BLOCK),
+    mCallback(0),
+    mCallbackArg(0),
+    mNotifyPending(false)
+{
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+void
+WriteThrottle::setLimits(uint64_t maxBytes, size_t maxOps)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mMaxBytes = maxBytes;
+    mMaxOps = maxOps;
+  }
+
+  // Raising the limits may let the waiting writes in
+  mCond.notify_all();
+}
+
+void
+WriteThrottle::limits(uint64_t *maxBytes, size_t *maxOps)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (maxBytes)
+    *maxBytes = mMaxBytes;
+
+  if (maxOps)
+    *maxOps = mMaxOps;
+}
+
+void
+WriteThrottle::setMode(Filesystem::WriteThrottleMode mode,
+                       WriteSpaceCallback callback, void *arg)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mMode = mode;
+  mCallback = callback;
+  mCallbackArg = arg;
+  mNotifyPending = false;
+}
+
+Filesystem::WriteThrottleMode
+WriteThrottle::mode(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mMode;
+}
+
+bool
+WriteThrottle::fits(uint64_t bytes) const
+{
+  // A write bigger than the limit is let in alone, otherwise it would never be
+  if (mStats.ops == 0)
+    return true;
+
+  if (mMaxOps > 0 && mStats.ops >= mMaxOps)
+    return false;
+
+  return mMaxBytes == 0 || mStats.bytes + bytes <= mMaxBytes;
+}
+
+int
+WriteThrottle::acquire(uint64_t bytes)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  // Writes issued from the generic workers (e.g. from an AsyncOpCallback) are
+  // never held back since the workers are the ones giving the space back
+  if (!fits(bytes) && !WorkScheduler::inWorkerThread())
+  {
+    if (mMode != Filesystem::WRITE_THROTTLE_BLOCK)
+    {
+      mStats.rejected++;
+      mNotifyPending = mMode == Filesystem::WRITE_THROTTLE_CALLBACK;
+      return -EAGAIN;
+    }
+
+    mStats.waited++;
+
+    while (!fits(bytes))
+      mCond.wait(lock);
+  }
+
+  mStats.bytes += bytes;
+  mStats.ops++;
+
+  return 0;
+}
+
+void
+WriteThrottle::release(uint64_t bytes)
+{
+  WriteSpaceCallback callback = 0;
+  void *arg = 0;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    mStats.bytes -= bytes;
+    mStats.ops--;
+
+    // The callback is only called once after writes were refused, as soon as
+    // there is room for at least a new write
+    if (mNotifyPending && mCallback && fits(1))
+    {
+      mNotifyPending = false;
+      callback = mCallback;
+      arg = mCallbackArg;
+    }
+  }
+
+  mCond.notify_all();
+
+  if (callback)
+    callback(arg);
+}
+
+Filesystem::WriteThrottleStats
+WriteThrottle::stats(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mStats;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,66 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __WRITE_THROTTLE_HH__
+#define __WRITE_THROTTLE_HH__
+
+#include <boost/thread.hpp>
+
+#include "radosfsdefines.h"
+#include "Filesystem.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+class WriteThrottle
+{
+public:
+  WriteThrottle(void);
+
+  void setLimits(uint64_t maxBytes, size_t maxOps);
+
+  void limits(uint64_t *maxBytes, size_t *maxOps);
+
+  void setMode(Filesystem::WriteThrottleMode mode, WriteSpaceCallback callback,
+               void *arg);
+
+  Filesystem::WriteThrottleMode mode(void);
+
+  int acquire(uint64_t bytes);
+
+  void release(uint64_t bytes);
+
+  Filesystem::WriteThrottleStats stats(void);
+
+private:
+  bool fits(uint64_t bytes) const;
+
+  boost::mutex mMutex;
+  boost::condition_variable mCond;
+  uint64_t mMaxBytes;
+  size_t mMaxOps;
+  Filesystem::WriteThrottleMode mMode;
+  WriteSpaceCallback mCallback;
+  void *mCallbackArg;
+  bool mNotifyPending;
+  Filesystem::WriteThrottleStats mStats;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __WRITE_THROTTLE_HH__ */
@@ -442,9 +442,14 @@ int indexObject(const Stat *parentStat,
     xAttrKey = XATTR_FILE_PREFIX + baseName;
 
     if (op == '+')
+    {
       xAttrValue = getFileXAttrDirRecord(stat);
+    }
     else
+    {
       xattrs[XATTR_FILE_INLINE_BUFFER + baseName].append("");
+      xattrs[XATTR_FILE_SIZE_HINT + baseName].append("");
+    }
 
     xattrs[xAttrKey].append(xAttrValue);
   }
@@ -453,6 +458,9 @@ int indexObject(const Stat *parentStat,
                                      parentStat->translatedPath, contents,
                                      &xattrs);
 
+  if (ret == 0)
+    notifyDirLogChanged(parentStat->pool.get(), parentStat->translatedPath);
+
   return ret;
 }
 
@@ -495,7 +503,7 @@ getFileXAttrDirRecord(const Stat *stat)
 }
 
 int
-indexObjectMetadata(librados::IoCtx &ioctx,
+indexObjectMetadata(Pool *pool,
                     const std::string &dirName,
                     const std::string &baseName,
                     std::map<std::string, std::string> &metadata,
@@ -526,7 +534,12 @@ indexObjectMetadata(librados::IoCtx &ioctx,
 
   contents += "\n";
 
-  return writeContentsAtomically(ioctx, dirName.c_str(), contents);
+  int ret = writeContentsAtomically(pool->ioctx, dirName.c_str(), contents);
+
+  if (ret == 0)
+    notifyDirLogChanged(pool, dirName);
+
+  return ret;
 }
 
 int
@@ -577,9 +590,7 @@ writeContentsAtomically(librados::IoCtx &ioctx,
   writeOp.omap_set(omap);
   writeOp.omap_rm_keys(keysToRemove);
 
-  int ret = ioctx.operate(obj, &writeOp);
-
-  return ret;
+  return ioctx.operate(obj, &writeOp);
 }
 
 std::string
@@ -1257,6 +1268,29 @@ setInodeBacklinkAsync(PoolSP pool, const std::string &backlink,
   pool->ioctx.aio_operate(inode, &completion, &writeOp);
 }
 
+void
+notifyDirLogChangedCB(rados_completion_t comp, void *arg)
+{
+  delete static_cast<librados::bufferlist *>(arg);
+  rados_aio_release(comp);
+}
+
+void
+notifyDirLogChanged(Pool *pool, const std::string &inode)
+{
+  librados::bufferlist notification;
+  librados::bufferlist *reply = new librados::bufferlist;
+  rados_completion_t comp;
+
+  // The clients watching the dir will only need to know that it changed, so
+  // we do not wait for them to acknowledge it
+  rados_aio_create_completion(reply, notifyDirLogChangedCB, 0, &comp);
+  librados::AioCompletion completion((librados::AioCompletionImpl *) comp);
+
+  pool->ioctx.aio_notify(inode, &completion, notification,
+                         DIR_LOG_NOTIFY_TIMEOUT, reply);
+}
+
 int
 moveLogicalFile(Stat &oldParent, Stat &newParent,
                 const std::string &oldFilePath,
@@ -1268,6 +1302,8 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
   const std::string oldInlineBufferEntry = XATTR_FILE_INLINE_BUFFER + oldBaseName;
   const std::string newFileEntry = XATTR_FILE_PREFIX + newBaseName;
   const std::string newInlineBufferEntry = XATTR_FILE_INLINE_BUFFER + newBaseName;
+  const std::string oldSizeHintEntry = XATTR_FILE_SIZE_HINT + oldBaseName;
+  const std::string newSizeHintEntry = XATTR_FILE_SIZE_HINT + newBaseName;
   std::set<std::string> omapKeys;
   std::map<std::string, librados::bufferlist> omapValues, newOmapValues;
   std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
@@ -1275,6 +1311,7 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
 
   omapKeys.insert(oldFileEntry);
   omapKeys.insert(oldInlineBufferEntry);
+  omapKeys.insert(oldSizeHintEntry);
 
   int ret = oldParent.pool->ioctx.omap_get_vals_by_keys(oldParent.translatedPath,
                                                         omapKeys, &omapValues);
@@ -1300,6 +1337,15 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
     newOmapValues[newInlineBufferEntry] = (*it).second;
   }
 
+  // The size hint is also moved since it may have been marked as dirty by a
+  // writer which will clean it under the new name
+  it = omapValues.find(oldSizeHintEntry);
+
+  if (it != omapValues.end())
+  {
+    newOmapValues[newSizeHintEntry] = (*it).second;
+  }
+
   // Deindex the old file name in the old parent and index it in the new parent
   oldParentContents.append(getObjectIndexLine(oldBaseName, '-'));
   newParentContents.append(getObjectIndexLine(newBaseName, '+'));
@@ -1334,6 +1380,9 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
   ret = newParent.pool->ioctx.operate(newParent.translatedPath,
                                       &newParentWriteOp);
 
+  if (ret == 0)
+    notifyDirLogChanged(newParent.pool.get(), newParent.translatedPath);
+
   if (ret == 0 && !sameParent)
   {
     // If we succeeded in moving the file's logical contents to the new parent
@@ -1344,6 +1393,9 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
 
     ret = oldParent.pool->ioctx.operate(oldParent.translatedPath,
                                         &oldParentWriteOp);
+
+    if (ret == 0)
+      notifyDirLogChanged(oldParent.pool.get(), oldParent.translatedPath);
   }
 
   return ret;
@@ -1446,3 +1498,160 @@ xattrHasPrefix(const std::string &xattr)
   return (xattr.compare(0, strlen(XATTR_USER_PREFIX), XATTR_USER_PREFIX) == 0) ||
       (xattr.compare(0, strlen(XATTR_SYS_PREFIX), XATTR_SYS_PREFIX) == 0);
 }
+
+std::string
+makeFileSizeHint(const std::string &inode, uint64_t size, const timespec *mtime)
+{
+  std::ostringstream stream;
+
+  stream << SIZE_HINT_INODE_KEY "=\"" << inode << "\" ";
+  stream << SIZE_HINT_SIZE_KEY "=\"" << size << "\" ";
+
+  if (mtime)
+    stream << SIZE_HINT_MTIME_KEY "=\"" << timespecToStr(mtime) << "\" ";
+
+  return stream.str();
+}
+
+SizeHintState
+readFileSizeHint(const std::string &hint, const std::string &inode,
+                 uint64_t *size, timespec *mtime, bool *hasMtime)
+{
+  int startPos = 0, lastPos = 0;
+  std::string key, value, hintInode, hintSize;
+
+  if (hint.empty())
+    return SIZE_HINT_MISSING;
+
+  *hasMtime = false;
+
+  while ((lastPos = splitToken(hint, startPos, key, value)) != startPos)
+  {
+    if (key == SIZE_HINT_INODE_KEY)
+    {
+      hintInode = value;
+    }
+    else if (key == SIZE_HINT_SIZE_KEY)
+    {
+      hintSize = value;
+    }
+    else if (key == SIZE_HINT_MTIME_KEY)
+    {
+      strToTimespec(value, mtime);
+      *hasMtime = true;
+    }
+
+    startPos = lastPos;
+    key = value = "";
+  }
+
+  // The hint may have been left by a different file with the same name
+  if (hintInode != inode || hintSize.empty())
+    return SIZE_HINT_INVALID;
+
+  *size = strtoull(hintSize.c_str(), 0, 10);
+
+  return SIZE_HINT_VALID;
+}
+
+int
+setFileSizeHint(librados::IoCtx &ioctx, const std::string &parentInode,
+                const std::string &baseName, const std::string &hint,
+                const std::string *expectedHint)
+{
+  const std::string key = XATTR_FILE_SIZE_HINT + baseName;
+  std::map<std::string, librados::bufferlist> omap;
+  librados::ObjectWriteOperation op;
+
+  op.assert_exists();
+
+  // Only set the hint if it was not changed meanwhile (a missing hint compares
+  // as an empty one)
+  if (expectedHint)
+  {
+    std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+    librados::bufferlist expectedValue;
+
+    expectedValue.append(*expectedHint);
+    omapCmp[key] = std::pair<librados::bufferlist, int>(expectedValue,
+                                                        LIBRADOS_CMPXATTR_OP_EQ);
+    op.omap_cmp(omapCmp, 0);
+  }
+
+  omap[key].append(hint);
+  op.omap_set(omap);
+
+  return ioctx.operate(parentInode, &op);
+}
+
+bool
+addFileSizeHintCheck(const Stat *stat, librados::ObjectReadOperation &op)
+{
+  uint64_t size = 0;
+  timespec mtime;
+  bool hasMtime = false;
+
+  if (!stat->pool ||
+      readFileSizeHint(stat->sizeHintValue, stat->translatedPath, &size, &mtime,
+                       &hasMtime) != SIZE_HINT_VALID)
+    return false;
+
+  // Writers only change the inode, so the hint is valid as long as the inode's
+  // size and mtime are the ones it was made from
+  librados::bufferlist sizeBl, mtimeBl;
+
+  sizeBl.append(fileSizeToHex(size));
+  op.cmpxattr(XATTR_FILE_SIZE, LIBRADOS_CMPXATTR_OP_EQ, sizeBl);
+
+  if (hasMtime)
+  {
+    mtimeBl.append(timespecToStr(&mtime));
+    op.cmpxattr(XATTR_MTIME, LIBRADOS_CMPXATTR_OP_EQ, mtimeBl);
+  }
+
+  return true;
+}
+
+void
+setFileSizeHintCheckResult(Stat *stat, int checkRet)
+{
+  uint64_t size = 0;
+  timespec mtime;
+  bool hasMtime = false;
+
+  if (checkRet < 0 ||
+      readFileSizeHint(stat->sizeHintValue, stat->translatedPath, &size, &mtime,
+                       &hasMtime) != SIZE_HINT_VALID)
+  {
+    stat->sizeHint = SIZE_HINT_INVALID;
+    return;
+  }
+
+  if (size != 0)
+    stat->statBuff.st_size = size;
+
+  if (hasMtime)
+  {
+    stat->statBuff.st_mtim = mtime;
+    stat->statBuff.st_mtime = mtime.tv_sec;
+  }
+
+  stat->sizeHint = SIZE_HINT_VALID;
+}
+
+bool
+verifyFileSizeHint(Stat *stat)
+{
+  if (stat->sizeHint != SIZE_HINT_UNVERIFIED)
+    return stat->sizeHint == SIZE_HINT_VALID;
+
+  librados::ObjectReadOperation op;
+  int ret = -EINVAL;
+
+  if (addFileSizeHintCheck(stat, op))
+    ret = stat->pool->ioctx.operate(stat->translatedPath, &op, 0);
+
+  setFileSizeHintCheckResult(stat, ret);
+
+  return stat->sizeHint == SIZE_HINT_VALID;
+}
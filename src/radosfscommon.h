@@ -58,12 +58,29 @@ struct Pool {
 
 typedef std::tr1::shared_ptr<Pool> PoolSP;
 
+typedef enum {
+  SIZE_HINT_MISSING = 0,
+  SIZE_HINT_VALID,
+  SIZE_HINT_INVALID,
+  SIZE_HINT_UNVERIFIED
+} SizeHintState;
+
 struct Stat {
   std::string path;
   std::string translatedPath;
   struct stat statBuff;
   PoolSP pool;
   std::map<std::string, std::string> extraData;
+  // Whether the size and mtime in statBuff were taken from the file's parent
+  // dir (so the file inode does not need to be checked)
+  SizeHintState sizeHint;
+  // The hint read from the parent dir, which is only used once it is verified
+  // against the file inode
+  std::string sizeHintValue;
+
+  Stat(void)
+    : sizeHint(SIZE_HINT_INVALID)
+  {}
 
   void reset(void)
   {
@@ -76,6 +93,8 @@ struct Stat {
     statBuff.st_ctime = 0;
     pool.reset();
     extraData.clear();
+    sizeHint = SIZE_HINT_INVALID;
+    sizeHintValue = "";
   }
 };
 
@@ -120,7 +139,7 @@ int indexObject(const Stat *parentStat, const Stat *stat, char op);
 
 std::string getObjectIndexLine(const std::string &obj, char op);
 
-int indexObjectMetadata(librados::IoCtx &ioctx,
+int indexObjectMetadata(Pool *pool,
                         const std::string &dirName,
                         const std::string &baseName,
                         std::map<std::string, std::string> &metadata,
@@ -234,6 +253,8 @@ void setInodeBacklinkAsync(PoolSP pool, const std::string &backlink,
                            const std::string &inode, const std::string *compare = 0,
                            rados_callback_t callback = 0, void *arg = 0);
 
+void notifyDirLogChanged(Pool *pool, const std::string &inode);
+
 int moveLogicalFile(Stat &oldParent, Stat &newParent,
                     const std::string &oldFilePath,
                     const std::string &newFilePath);
@@ -261,4 +282,21 @@ int checkPermissionsForXAttr(const struct stat &statBuff,
                              const std::string &attrName, uid_t uid, gid_t gid,
                              int permission);
 
+std::string makeFileSizeHint(const std::string &inode, uint64_t size,
+                             const timespec *mtime);
+
+SizeHintState readFileSizeHint(const std::string &hint,
+                               const std::string &inode, uint64_t *size,
+                               timespec *mtime, bool *hasMtime);
+
+int setFileSizeHint(librados::IoCtx &ioctx, const std::string &parentInode,
+                    const std::string &baseName, const std::string &hint,
+                    const std::string *expectedHint);
+
+bool addFileSizeHintCheck(const Stat *stat, librados::ObjectReadOperation &op);
+
+void setFileSizeHintCheckResult(Stat *stat, int checkRet);
+
+bool verifyFileSizeHint(Stat *stat);
+
 #endif /* __RADOS_FS_COMMON_HH__ */
@@ -56,14 +56,41 @@
 #define DEFAULT_MODE_DIR (S_IFDIR | DEFAULT_MODE)
 #define INDEX_NAME_KEY "name"
 #define MEGABYTE_CONVERSION (1024 * 1024) // 1MB
-#define DEFAULT_DIR_CACHE_MAX_SIZE 1000000
-#define DEFAULT_DIR_CACHE_CLEAN_PERCENTAGE .2
+#define DEFAULT_DIR_CACHE_MAX_SIZE (256 * MEGABYTE_CONVERSION) // 256MB
+#define DIR_CACHE_NUM_SHARDS 16
+#define DIR_CACHE_ENTRY_OVERHEAD 128 // bytes
+#define DEFAULT_DIR_PATH_CACHE_MAX_SIZE 100000 // entries
+#define DEFAULT_DIR_PATH_CACHE_TTL 60 // seconds
+#define DIR_PATH_CACHE_NEGATIVE_TTL 1 // seconds
+#define DIR_PATH_CACHE_NUM_SHARDS 16
+#define MISSING_ENTRIES_CACHE_MAX_SIZE 100000 // entries
+#define MISSING_ENTRIES_CACHE_TTL 1 // seconds
+#define MISSING_ENTRIES_CACHE_NUM_SHARDS 16
+#define LINK_PREFIX_CACHE_MAX_SIZE 10000 // entries
+#define MAX_LINK_PREFIX_RESOLUTIONS 40
 #define DIR_LOG_UPDATED "updated"
 #define DIR_LOG_UPDATED_FALSE "false"
 #define DIR_LOG_UPDATED_TRUE "true"
+#define DIR_LOG_COMPACTED_SIZE "compacted-size"
+#define DIR_LOG_GENERATION "generation"
+#define DIR_LOG_READ_CHUNK_SIZE (256 * 1024) // bytes
+#define DIR_LOG_PROBE_SIZE (4 * 1024) // bytes
+#define DIR_LOG_NOTIFY_TIMEOUT 5000 // milliseconds
+#define DEFAULT_DIR_CACHE_LEASE_TIME 0 // seconds
 #define DEFAULT_DIR_COMPACT_RATIO .2
+#define DEFAULT_DIR_COMPACT_MIN_LOG_SIZE (4 * 1024) // bytes
+#define DIR_COMPACTOR_SLEEP 2000 // milliseconds
+#define DATA_POOLS_USAGE_UPDATE_SLEEP 10000 // milliseconds
+#define DEFAULT_DATA_POOL_WEIGHT 1
+#define FILE_MOVE_MAX_INFLIGHT_CHUNKS 8
+#define XATTR_INODE_MOVED_TO XATTR_RADOSFS_PREFIX "moved-to"
+#define DIR_COMPACTOR_MAX_JOBS_PER_ROUND 4
+#define DIR_COMPACTOR_MIN_BACKOFF 1000 // milliseconds
+#define DIR_COMPACTOR_MAX_BACKOFF (5 * 60 * 1000) // milliseconds
 #define INDEX_METADATA_PREFIX "md"
 #define LOG_LEVEL_CONF_FILE "/etc/libradosfs/loglevel"
+#define LOG_BUFFER_NUM_MESSAGES 4096 // must be a power of 2
+#define LOG_MESSAGE_MAX_SIZE 1024 // bytes
 #define DEFAULT_NUM_FINDER_THREADS 100
 #define FINDER_KEY_NAME "name"
 #define FINDER_KEY_INAME "iname"
@@ -90,15 +117,34 @@
 #define TMTIME_MASK (1 << 16)
 #define DEFAULT_NUM_WORKER_THREADS 4
 #define MIN_NUM_WORKER_THREADS 1
+#define WORK_SCHEDULER_MAX_QUEUED_TIME 20 // milliseconds
+#define WORK_SCHEDULER_BUSY_RATIO .75
+#define WORK_SCHEDULER_IDLE_TIMEOUT 5000 // milliseconds
+#define DEFAULT_WRITE_THROTTLE_MAX_BYTES (256 * MEGABYTE_CONVERSION) // 256MB
+#define DEFAULT_WRITE_THROTTLE_MAX_OPS 1024
+#define METRICS_NUM_SHARDS 8
+#define METRICS_HISTOGRAM_SUB_BUCKET_BITS 3
+#define METRICS_HISTOGRAM_MAX_BITS 36 // values up to 2^36 microseconds
+#define DEFAULT_METRICS_DUMP_INTERVAL 10 // seconds
+#define DEFAULT_TRACE_BUFFER_SIZE 65536 // spans
+#define TRACE_SAMPLE_RATE_SCALE 1000000
+#define DEFAULT_SLOW_OP_THRESHOLD 30 // seconds
+#define SLOW_OP_CHECK_INTERVAL 1000 // milliseconds
+#define SLOW_OP_TRACKER_NUM_SHARDS 16
 #define XATTR_FILE_SIZE XATTR_RADOSFS_PREFIX "file-size"
 #define XATTR_FILE_SIZE_LENGTH 16
 #define FILE_IDLE_LOCK_TIMEOUT 0.2 // seconds
 #define FILE_OPS_IDLE_CHECKER_SLEEP 100 // milliseconds
+#define FILE_IO_REGISTRY_NUM_SHARDS 32
 #define DEFAULT_FILE_INLINE_BUFFER_SIZE (4 * 1024) // bytes
 #define MAX_FILE_INLINE_BUFFER_SIZE (128 * 1024) // bytes
 #define XATTR_FILE_INLINE_BUFFER_SIZE "inline"
 #define XATTR_FILE_INLINE_BUFFER XATTR_RADOSFS_PREFIX "inline."
 #define XATTR_FILE_INLINE_BUFFER_HEADER_SIZE 64 // bytes
+#define XATTR_FILE_SIZE_HINT XATTR_RADOSFS_PREFIX "size-hint."
+#define SIZE_HINT_INODE_KEY "inode"
+#define SIZE_HINT_SIZE_KEY "size"
+#define SIZE_HINT_MTIME_KEY "mtime"
 #define QUOTA_OBJ_PREFIX "quota."
 #define XATTR_QUOTA_OBJECT XATTR_RADOSFS_PREFIX "quota-obj"
 #define XATTR_QUOTA_SIZE_PREFIX XATTR_RADOSFS_PREFIX "quota.size."
@@ -158,6 +158,27 @@ RadosFsTest::removeNFiles(size_t numFiles)
   }
 }
 
+// Creates numFiles files whose paths start with the given prefix and returns
+// how many of them were placed in each data pool
+std::map<std::string, int>
+RadosFsTest::createFilesPerPool(const std::string &prefix, size_t numFiles)
+{
+  std::map<std::string, int> filesPerPool;
+
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    std::ostringstream s;
+    s << i;
+    radosfs::File file(&radosFs, prefix + s.str());
+
+    EXPECT_EQ(0, file.create());
+
+    filesPerPool[radosFsFilePriv(file)->dataPool->name]++;
+  }
+
+  return filesPerPool;
+}
+
 int
 RadosFsTest::createContentsRecursively(const std::string &prefix,
                                        size_t numDirs,
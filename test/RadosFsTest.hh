@@ -19,6 +19,7 @@
 
 #include <gtest/gtest.h>
 #include <rados/librados.hpp>
+#include <map>
 #include <set>
 #include <string>
 #include "Filesystem.hh"
@@ -95,6 +96,9 @@ protected:
 
   void removeNFiles(size_t numFiles);
 
+  std::map<std::string, int> createFilesPerPool(const std::string &prefix,
+                                                size_t numFiles);
+
   int createContentsRecursively(const std::string &prefix,
                                 size_t numDirs,
                                 size_t numFiles,
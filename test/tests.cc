@@ -29,7 +29,9 @@
 
 #include "FileIO.hh"
 #include "FileInode.hh"
+#include "InstrumentedMutex.hh"
 #include "Quota.hh"
+#include "Tracer.hh"
 #include "RadosFsTest.hh"
 #include "radosfscommon.h"
 
@@ -176,6 +178,396 @@ TEST_F(RadosFsTest, Pools)
   EXPECT_EQ(2, radosFs.dataPools(poolPrefix).size());
 }
 
+TEST_F(RadosFsTest, PoolRouting)
+{
+  radosfs::FilesystemPriv *fsPriv = radosFsPriv();
+
+  // Verify that no pools are found before adding any
+
+  EXPECT_FALSE(fsPriv->getDataPool("/a/b/file"));
+
+  EXPECT_FALSE(fsPriv->getMetadataPoolFromPath("/a/b/"));
+
+  // Add data pools with nested prefixes and a metadata pool
+
+  EXPECT_EQ(0, radosFs.addDataPool(TEST_POOL, "/", 0));
+
+  EXPECT_EQ(0, radosFs.addDataPool(TEST_POOL_MTD, "/a/b", 0));
+
+  EXPECT_EQ(0, radosFs.addMetadataPool(TEST_POOL_MTD, "/"));
+
+  // Verify that the longest matching prefix is used
+
+  EXPECT_EQ(TEST_POOL_MTD, fsPriv->getDataPool("/a/b/file")->name);
+
+  EXPECT_EQ(TEST_POOL_MTD, fsPriv->getDataPool("/a/b/c/d/file")->name);
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/a/file")->name);
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/a/bc/file")->name);
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/a/b")->name);
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/ab/file")->name);
+
+  EXPECT_EQ(1, fsPriv->getDataPools("/a/b/file").size());
+
+  EXPECT_EQ(TEST_POOL_MTD, fsPriv->getMetadataPoolFromPath("/a/b/")->name);
+
+  // Verify that asking for a given pool's name falls back to shorter prefixes
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/a/b/file", TEST_POOL)->name);
+
+  EXPECT_FALSE(fsPriv->getDataPool("/a/file", "nonexistent-pool"));
+
+  // Remove the nested pool and verify the routing is updated
+
+  EXPECT_EQ(0, radosFs.removeDataPool(TEST_POOL_MTD));
+
+  EXPECT_EQ(TEST_POOL, fsPriv->getDataPool("/a/b/file")->name);
+
+  EXPECT_EQ(0, radosFs.removeMetadataPool(TEST_POOL_MTD));
+
+  EXPECT_FALSE(fsPriv->getMetadataPoolFromPath("/a/b/"));
+}
+
+TEST_F(RadosFsTest, DataPoolPlacement)
+{
+  AddPool();
+
+  // Add a second data pool to the same prefix
+
+  EXPECT_EQ(0, radosFs.addDataPool(TEST_POOL_MTD, "/", 0));
+
+  EXPECT_EQ(radosfs::Filesystem::DATA_POOL_PLACEMENT_FIRST,
+            radosFs.dataPoolPlacement());
+
+  EXPECT_EQ(DEFAULT_DATA_POOL_WEIGHT, radosFs.dataPoolWeight(TEST_POOL_MTD));
+
+  EXPECT_EQ(-ENOENT, radosFs.dataPoolWeight("nonexistent-pool"));
+
+  EXPECT_EQ(-ENOENT, radosFs.setDataPoolWeight("nonexistent-pool", 1));
+
+  // Verify that, by default, all files go to the first pool
+
+  const int numFiles = 6;
+  std::map<std::string, int> filesPerPool =
+      createFilesPerPool("/first-file", numFiles);
+
+  EXPECT_EQ(numFiles, filesPerPool[TEST_POOL]);
+
+  // Verify that with round robin the files are spread evenly
+
+  radosFs.setDataPoolPlacement(
+        radosfs::Filesystem::DATA_POOL_PLACEMENT_ROUND_ROBIN);
+
+  filesPerPool = createFilesPerPool("/round-robin-file", numFiles);
+
+  EXPECT_EQ(numFiles / 2, filesPerPool[TEST_POOL]);
+  EXPECT_EQ(numFiles / 2, filesPerPool[TEST_POOL_MTD]);
+
+  // Verify the weights are respected
+
+  EXPECT_EQ(0, radosFs.setDataPoolWeight(TEST_POOL_MTD, 2));
+
+  filesPerPool = createFilesPerPool("/weighted-file", numFiles);
+
+  EXPECT_EQ(numFiles / 3, filesPerPool[TEST_POOL]);
+  EXPECT_EQ(2 * numFiles / 3, filesPerPool[TEST_POOL_MTD]);
+
+  // Verify that a pool with no weight does not get new files
+
+  EXPECT_EQ(0, radosFs.setDataPoolWeight(TEST_POOL_MTD, 0));
+
+  radosFs.setDataPoolPlacement(
+        radosfs::Filesystem::DATA_POOL_PLACEMENT_LEAST_USED);
+
+  radosfs::File file(&radosFs, "/least-used-file");
+
+  EXPECT_EQ(0, file.create());
+
+  EXPECT_EQ(TEST_POOL, radosFsFilePriv(file)->dataPool->name);
+
+  // Verify that hashing the path always places a file in the same pool
+
+  EXPECT_EQ(0, radosFs.setDataPoolWeight(TEST_POOL_MTD, 1));
+
+  radosFs.setDataPoolPlacement(
+        radosfs::Filesystem::DATA_POOL_PLACEMENT_PATH_HASH);
+
+  radosfs::File hashedFile(&radosFs, "/hashed-file");
+
+  EXPECT_EQ(0, hashedFile.create());
+
+  const std::string hashedPool = radosFsFilePriv(hashedFile)->dataPool->name;
+
+  EXPECT_EQ(0, hashedFile.remove());
+
+  EXPECT_EQ(0, hashedFile.create());
+
+  EXPECT_EQ(hashedPool, radosFsFilePriv(hashedFile)->dataPool->name);
+
+  // Verify that an explicitly given pool is always used
+
+  radosfs::File otherFile(&radosFs, "/explicit-pool-file");
+
+  EXPECT_EQ(0, otherFile.create(-1, TEST_POOL_MTD));
+
+  EXPECT_EQ(TEST_POOL_MTD, radosFsFilePriv(otherFile)->dataPool->name);
+
+  // Verify the files are found in their pools by a different instance
+
+  radosfs::File sameFile(&radosFs, otherFile.path());
+
+  EXPECT_EQ(TEST_POOL_MTD, radosFsFilePriv(sameFile)->dataPool->name);
+}
+
+// Files are moved between data pool tiers in the background, so this waits
+// until the file's entry points to the given pool
+static void
+waitForDataPool(radosfs::Filesystem &fs, const std::string &path,
+                const std::string &pool)
+{
+  std::string currentPool;
+
+  for (int i = 0; i < 50; i++)
+  {
+    if (fs.getInodeAndPool(path, 0, &currentPool) == 0 && currentPool == pool)
+      break;
+
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  }
+}
+
+TEST_F(RadosFsTest, DataPoolTiers)
+{
+  AddPool();
+
+  // Add a second data pool for big files
+
+  const size_t bigFileSize = 1024;
+
+  EXPECT_EQ(0, radosFs.addDataPool(TEST_POOL_MTD, "/", 0));
+
+  EXPECT_EQ(-ENOENT, radosFs.setDataPoolMinFileSize("nonexistent-pool", 1));
+
+  EXPECT_EQ(0, radosFs.setDataPoolMinFileSize(TEST_POOL_MTD, bigFileSize));
+
+  EXPECT_EQ(bigFileSize, radosFs.dataPoolMinFileSize(TEST_POOL_MTD));
+
+  EXPECT_EQ(0, radosFs.dataPoolMinFileSize(TEST_POOL));
+
+  // Verify that new files go to the small files' pool
+
+  const std::string contents(bigFileSize, 'x');
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+    EXPECT_EQ(TEST_POOL, radosFsFilePriv(file)->dataPool->name);
+
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, bigFileSize / 2));
+  }
+
+  // Verify that a small file is kept in the same pool after being closed
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(TEST_POOL, radosFsFilePriv(file)->dataPool->name);
+
+    // Make the file grow over the big files' pool's minimum size
+
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  }
+
+  // Verify that the file has been moved to the big files' pool
+
+  waitForDataPool(radosFs, "/file", TEST_POOL_MTD);
+
+  EXPECT_EQ(1, radosFs.getMetrics().counters["file_tier_moves"]);
+
+  PoolSP smallFilesPool = radosFsPriv()->getDataPoolFromName(TEST_POOL);
+  std::string inode;
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(TEST_POOL_MTD, radosFsFilePriv(file)->dataPool->name);
+
+    struct stat buff;
+
+    EXPECT_EQ(0, file.stat(&buff));
+
+    EXPECT_EQ(bigFileSize, buff.st_size);
+
+    char readBuff[bigFileSize];
+
+    EXPECT_EQ(bigFileSize, file.read(readBuff, 0, bigFileSize));
+
+    EXPECT_EQ(0, contents.compare(0, bigFileSize, readBuff, bigFileSize));
+
+    // Verify that only the (empty) marked base chunk of the old inode is left
+    // in the small files' pool
+
+    inode = radosFsFilePriv(file)->getFileIO()->inode();
+
+    uint64_t size;
+    librados::bufferlist movedTo;
+
+    EXPECT_EQ(0, smallFilesPool->ioctx.stat(inode, &size, 0));
+
+    EXPECT_EQ(0, size);
+
+    EXPECT_LT(0, smallFilesPool->ioctx.getxattr(inode, XATTR_INODE_MOVED_TO,
+                                                movedTo));
+
+    // Make the file shrink under the big files' pool's minimum size
+
+    EXPECT_EQ(0, file.truncate(bigFileSize / 2));
+  }
+
+  // Verify that the file has been moved back to the small files' pool
+
+  waitForDataPool(radosFs, "/file", TEST_POOL);
+
+  radosfs::Filesystem::Metrics metrics = radosFs.getMetrics();
+
+  EXPECT_EQ(2, metrics.counters["file_tier_moves"]);
+
+  EXPECT_EQ(0, metrics.counters["file_tier_move_failures"]);
+
+  radosfs::File file(&radosFs, "/file");
+
+  EXPECT_EQ(TEST_POOL, radosFsFilePriv(file)->dataPool->name);
+
+  EXPECT_EQ(0, smallFilesPool->ioctx.stat(inode, 0, 0));
+
+  librados::bufferlist movedTo;
+
+  EXPECT_GT(0, smallFilesPool->ioctx.getxattr(inode, XATTR_INODE_MOVED_TO,
+                                              movedTo));
+
+  struct stat buff;
+
+  EXPECT_EQ(0, file.stat(&buff));
+
+  EXPECT_EQ(bigFileSize / 2, buff.st_size);
+}
+
+TEST_F(RadosFsTest, MoveFileToPool)
+{
+  AddPool();
+
+  EXPECT_EQ(0, radosFs.addDataPool(TEST_POOL_MTD, "/", 0));
+
+  // Use small chunks so the file has several of them
+
+  const size_t chunkSize = 64;
+  radosFs.setFileChunkSize(chunkSize);
+
+  const std::string contents(chunkSize * 3 + chunkSize / 2, 'x');
+  radosfs::Dir dir(&radosFs, "/dir");
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(-EINVAL, radosFs.moveFileToPool(dir.path(), TEST_POOL_MTD));
+
+  EXPECT_EQ(-ENOENT, radosFs.moveFileToPool("/nonexistent", TEST_POOL_MTD));
+
+  std::string inode;
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(0, file.create(-1, TEST_POOL, 0, 0));
+
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+    inode = radosFsFilePriv(file)->getFileIO()->inode();
+
+    EXPECT_EQ(-ENODEV, radosFs.moveFileToPool(file.path(), "nonexistent-pool"));
+
+    // Verify that a file being used cannot be moved
+
+    EXPECT_EQ(-EBUSY, radosFs.moveFileToPool(file.path(), TEST_POOL_MTD));
+  }
+
+  radosFs.setDataMoveRate(1024 * 1024);
+
+  EXPECT_EQ(1024 * 1024, radosFs.dataMoveRate());
+
+  EXPECT_EQ(0, radosFs.moveFileToPool("/file", TEST_POOL_MTD));
+
+  // Verify the contents are in the new pool and gone from the old one
+
+  PoolSP oldPool = radosFsPriv()->getDataPoolFromName(TEST_POOL);
+  PoolSP newPool = radosFsPriv()->getDataPoolFromName(TEST_POOL_MTD);
+
+  uint64_t size;
+  librados::bufferlist movedTo;
+
+  EXPECT_EQ(0, oldPool->ioctx.stat(inode, &size, 0));
+
+  EXPECT_EQ(0, size);
+
+  EXPECT_LT(0, oldPool->ioctx.getxattr(inode, XATTR_INODE_MOVED_TO, movedTo));
+
+  EXPECT_EQ(-ENOENT, oldPool->ioctx.stat(makeFileChunkName(inode, 1), 0, 0));
+
+  EXPECT_EQ(0, newPool->ioctx.stat(makeFileChunkName(inode, 1), 0, 0));
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(TEST_POOL_MTD, radosFsFilePriv(file)->dataPool->name);
+
+    char buff[contents.length()];
+
+    EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+    EXPECT_EQ(0, contents.compare(0, contents.length(), buff,
+                                  contents.length()));
+  }
+
+  // Simulate a move that was interrupted before removing the old chunks and
+  // verify that moving the file again removes them
+
+  librados::bufferlist chunk;
+  chunk.append(contents.substr(0, chunkSize));
+
+  EXPECT_EQ(0, oldPool->ioctx.write_full(makeFileChunkName(inode, 1), chunk));
+
+  EXPECT_EQ(0, radosFs.moveFileToPool("/file", TEST_POOL_MTD));
+
+  EXPECT_EQ(-ENOENT, oldPool->ioctx.stat(makeFileChunkName(inode, 1), 0, 0));
+
+  EXPECT_EQ(0, newPool->ioctx.stat(inode, 0, 0));
+
+  // Verify that the FileIO used for that is not left registered
+
+  for (int i = 0; i < 50 && radosFsPriv()->getFileIO(inode); i++)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+
+  EXPECT_FALSE(radosFsPriv()->getFileIO(inode));
+
+  // Verify that removing the file also removes the marked inode left in the
+  // old pool
+
+  {
+    radosfs::File file(&radosFs, "/file");
+
+    EXPECT_EQ(0, file.remove());
+  }
+
+  for (int i = 0; i < 50 && oldPool->ioctx.stat(inode, 0, 0) == 0; i++)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+
+  EXPECT_EQ(-ENOENT, oldPool->ioctx.stat(inode, 0, 0));
+}
+
 TEST_F(RadosFsTest, CharacterConsistency)
 {
   AddPool();
@@ -322,7 +714,7 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.sync();
 
   EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->workScheduler.numWorkers());
 
   // Increase number of worker threads
 
@@ -335,7 +727,7 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.sync();
 
   EXPECT_EQ(numWorkers, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(numWorkers, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(numWorkers, radosFsPriv()->workScheduler.numWorkers());
 
   // Diminish number of worker threads
 
@@ -347,2246 +739,3787 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.write("CERN", 2, 2);
 
   EXPECT_EQ(numWorkers, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(numWorkers, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(numWorkers, radosFsPriv()->workScheduler.numWorkers());
 }
 
-TEST_F(RadosFsTest, CreateDir)
+struct WorkGate
 {
-  AddPool();
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool open;
+  int done;
+};
 
-  // Create dir without existing parent
+void waitForWorkGate(WorkGate *gate)
+{
+  boost::unique_lock<boost::mutex> lock(gate->mutex);
 
-  radosfs::Dir subDir(&radosFs, "/testdir/testsubdir");
+  while (!gate->open)
+    gate->cond.wait(lock);
 
-  EXPECT_NE(0, subDir.create());
+  gate->done++;
+  gate->cond.notify_all();
+}
 
-  EXPECT_FALSE(subDir.exists());
+void passWorkGate(WorkGate *gate)
+{
+  boost::unique_lock<boost::mutex> lock(gate->mutex);
+  gate->done++;
+  gate->cond.notify_all();
+}
 
-  // Create dir from path without ending in /
+bool waitForWorkJobs(WorkGate *gate, int numJobs)
+{
+  boost::unique_lock<boost::mutex> lock(gate->mutex);
 
-  radosfs::Dir dir(&radosFs, "/testdir");
+  while (gate->done < numJobs)
+  {
+    if (!gate->cond.timed_wait(lock, boost::posix_time::seconds(5)))
+      return false;
+  }
 
-  std::string path(dir.path());
+  return true;
+}
 
-  EXPECT_EQ('/', path[path.length() - 1]);
+TEST_F(RadosFsTest, WorkPriorities)
+{
+  radosfs::WorkScheduler scheduler(2);
+  WorkGate gate;
+  gate.open = false;
+  gate.done = 0;
 
-  EXPECT_FALSE(dir.exists());
+  // Occupy one of the workers with a background job
 
-  EXPECT_EQ(0, dir.create());
+  scheduler.post(boost::bind(&waitForWorkGate, &gate),
+                 radosfs::Filesystem::WORK_PRIORITY_BACKGROUND);
 
-  EXPECT_TRUE(dir.exists());
+  for (int i = 0; i < 500; i++)
+  {
+    if (scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_BACKGROUND).running)
+      break;
 
-  EXPECT_TRUE(dir.isDir());
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
 
-  EXPECT_FALSE(dir.isFile());
+  // Verify that neither background nor metadata jobs can take the last worker
 
-  // Create dir from path without ending in / and set with setPath
+  scheduler.post(boost::bind(&waitForWorkGate, &gate),
+                 radosfs::Filesystem::WORK_PRIORITY_BACKGROUND);
+  scheduler.post(boost::bind(&passWorkGate, &gate),
+                 radosfs::Filesystem::WORK_PRIORITY_METADATA);
 
-  dir.setPath("/test");
+  // Verify that a data job still runs
 
-  path = dir.path();
+  scheduler.post(boost::bind(&passWorkGate, &gate),
+                 radosfs::Filesystem::WORK_PRIORITY_DATA);
 
-  EXPECT_EQ('/', path[path.length() - 1]);
+  ASSERT_TRUE(waitForWorkJobs(&gate, 1));
 
-  EXPECT_EQ(0, subDir.create());
+  radosfs::Filesystem::WorkQueueStats stats =
+      scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_BACKGROUND);
 
-  EXPECT_TRUE(subDir.exists());
+  EXPECT_EQ(1, stats.running);
+  EXPECT_EQ(1, stats.queued);
 
-  // Check path when empty string is given
+  stats = scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_METADATA);
 
-  dir = radosfs::Dir(&radosFs, "");
+  EXPECT_EQ(1, stats.queued);
+  EXPECT_EQ(0, stats.completed);
 
-  EXPECT_EQ("/", dir.path());
+  stats = scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_DATA);
 
-  // Create dir when file with same name exists
+  EXPECT_EQ(1, stats.completed);
 
-  radosfs::File file(&radosFs, "/test", radosfs::File::MODE_WRITE);
-  EXPECT_EQ(0, file.create());
+  // Let the background jobs finish and verify all jobs are done
 
-  dir.setPath("/test");
+  {
+    boost::unique_lock<boost::mutex> lock(gate.mutex);
+    gate.open = true;
+    gate.cond.notify_all();
+  }
 
-  EXPECT_EQ(-ENOTDIR, dir.create());
+  ASSERT_TRUE(waitForWorkJobs(&gate, 4));
 
-  // Create dir with mkpath
+  scheduler.stop();
 
-  dir.setPath("/testdir/1/2/3/4/5");
+  stats = scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_BACKGROUND);
 
-  EXPECT_EQ(0, dir.create(-1, true));
+  EXPECT_EQ(0, stats.queued);
+  EXPECT_EQ(2, stats.completed);
+  EXPECT_EQ(1, scheduler.stats(
+                  radosfs::Filesystem::WORK_PRIORITY_METADATA).completed);
 
-  dir.setPath(file.path() + "/d1");
+  // Verify the statistics through the filesystem
 
-  EXPECT_EQ(-ENOTDIR, dir.create(-1, true));
+  AddPool();
 
-  // Create dir with the mkdir option when the parent directory is root
-  dir.setPath("/my-dir");
+  radosfs::File file(&radosFs, "/file");
 
-  EXPECT_EQ(0, dir.create(-1, true));
-}
+  ASSERT_EQ(0, file.create());
 
-TEST_F(RadosFsTest, RemoveDir)
+  file.write("CERN", 0, 4);
+  file.sync();
+
+  EXPECT_LT(0, radosFs.workQueueStats(
+                 radosfs::Filesystem::WORK_PRIORITY_DATA).maxQueued);
+}
+
+TEST_F(RadosFsTest, AdaptiveWorkers)
 {
-  AddPool();
+  radosfs::WorkScheduler scheduler(1);
+  WorkGate gate;
+  gate.open = false;
+  gate.done = 0;
 
-  radosfs::Dir dir(&radosFs, "/testdir");
-  EXPECT_EQ(0, dir.create());
+  scheduler.setNumWorkers(1, 3);
 
-  radosfs::Dir subDir(&radosFs, "/testdir/testsubdir");
-  EXPECT_EQ(0, subDir.create());
+  // Verify the pool grows while its workers are blocked
 
-  // Remove non-empty dir
+  for (int i = 0; i < 4; i++)
+    scheduler.post(boost::bind(&waitForWorkGate, &gate),
+                   radosfs::Filesystem::WORK_PRIORITY_DATA);
 
-  EXPECT_EQ(-ENOTEMPTY, dir.remove());
+  for (int i = 0; i < 500; i++)
+  {
+    if (scheduler.stats(radosfs::Filesystem::WORK_PRIORITY_DATA).running == 3)
+      break;
 
-  EXPECT_TRUE(dir.exists());
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
 
-  // Remove empty dirs
+  // Verify it does not grow over its maximum
 
-  EXPECT_EQ(0, subDir.remove());
+  EXPECT_EQ(3, scheduler.numWorkers());
+  EXPECT_EQ(1, scheduler.queueDepth());
 
-  EXPECT_FALSE(subDir.exists());
+  {
+    boost::unique_lock<boost::mutex> lock(gate.mutex);
+    gate.open = true;
+    gate.cond.notify_all();
+  }
 
-  EXPECT_EQ(0, dir.remove());
+  ASSERT_TRUE(waitForWorkJobs(&gate, 4));
 
-  EXPECT_FALSE(dir.exists());
-}
+  // Verify the pool shrinks back to its minimum once it is idle
 
-TEST_F(RadosFsTest, DirParent)
+  for (int i = 0; i < 40 && scheduler.numWorkers() > 1; i++)
+    boost::this_thread::sleep_for(
+          boost::chrono::milliseconds(WORK_SCHEDULER_IDLE_TIMEOUT / 4));
 
-{
-  AddPool();
+  EXPECT_EQ(1, scheduler.numWorkers());
 
-  radosfs::Dir dir(&radosFs, "/testdir");
+  EXPECT_EQ(0, scheduler.queueDepth());
 
-  std::string parent = radosfs::Dir::getParent(dir.path());
+  // Verify the bounds through the filesystem
 
-  EXPECT_EQ("/", parent);
+  AddPool();
 
-  parent = radosfs::Dir::getParent("");
+  radosFs.setNumGenericWorkers(2);
+  radosFs.setMaxNumGenericWorkers(8);
 
-  EXPECT_EQ("", parent);
-}
+  EXPECT_EQ(2, radosFs.numGenericWorkers());
+  EXPECT_EQ(8, radosFs.maxNumGenericWorkers());
 
-TEST_F(RadosFsTest, CreateFile)
-{
-  // Create one extra pool apart from the ones created by default
+  radosfs::File file(&radosFs, "/file");
 
-  AddPool(1);
+  ASSERT_EQ(0, file.create());
 
-  // Create regular file
+  file.write("CERN", 0, 4);
+  file.sync();
 
-  radosfs::File file(&radosFs, "/testfile",
-                     radosfs::File::MODE_WRITE);
+  EXPECT_LE(2, radosFs.currentNumGenericWorkers());
+  EXPECT_GE(8, radosFs.currentNumGenericWorkers());
+}
 
-  EXPECT_FALSE(file.exists());
+void countWriteSpace(void *arg)
+{
+  int *count = static_cast<int *>(arg);
+  (*count)++;
+}
 
-  EXPECT_EQ(0, file.create());
+void acquireWriteThrottle(radosfs::WriteThrottle *throttle, uint64_t bytes,
+                          bool *acquired)
+{
+  throttle->acquire(bytes);
+  *acquired = true;
+}
 
-  EXPECT_TRUE(file.exists());
+TEST_F(RadosFsTest, WriteThrottle)
+{
+  radosfs::WriteThrottle throttle;
 
-  EXPECT_FALSE(file.isDir());
+  throttle.setLimits(10, 2);
+  throttle.setMode(radosfs::Filesystem::WRITE_THROTTLE_NONBLOCK, 0, 0);
 
-  EXPECT_TRUE(file.isFile());
+  // Verify that writes are refused when over the bytes or ops limits
 
-  // Create file when dir with same name exists
+  EXPECT_EQ(0, throttle.acquire(6));
+  EXPECT_EQ(-EAGAIN, throttle.acquire(6));
+  EXPECT_EQ(0, throttle.acquire(4));
+  EXPECT_EQ(-EAGAIN, throttle.acquire(1));
 
-  radosfs::Dir dir(&radosFs, "/test");
+  radosfs::Filesystem::WriteThrottleStats stats = throttle.stats();
 
-  EXPECT_EQ(0, dir.create());
+  EXPECT_EQ(10, stats.bytes);
+  EXPECT_EQ(2, stats.ops);
+  EXPECT_EQ(2, stats.rejected);
 
-  file.setPath("/test");
+  throttle.release(6);
+  throttle.release(4);
 
-  EXPECT_EQ(-EISDIR, file.create());
+  // Verify that a write bigger than the limit is let in alone
 
-  // Create file when path is a dir one
+  EXPECT_EQ(0, throttle.acquire(100));
+  EXPECT_EQ(-EAGAIN, throttle.acquire(1));
 
-  file.setPath("/test/");
+  throttle.release(100);
 
-  std::string path(file.path());
+  // Verify that the callback is called once there is room again
 
-  EXPECT_NE('/', path[path.length() - 1]);
+  int spaceCount = 0;
 
-  radosfs::File otherFile(&radosFs, "/testfile/",
-                          radosfs::File::MODE_WRITE);
+  throttle.setMode(radosfs::Filesystem::WRITE_THROTTLE_CALLBACK,
+                   countWriteSpace, &spaceCount);
 
-  path = otherFile.path();
+  EXPECT_EQ(0, throttle.acquire(10));
+  EXPECT_EQ(-EAGAIN, throttle.acquire(1));
+  EXPECT_EQ(0, spaceCount);
 
-  EXPECT_NE('/', path[path.length() - 1]);
+  throttle.release(10);
 
-  // Check the shared pointer use
+  EXPECT_EQ(1, spaceCount);
 
-  radosfs::FilePriv *filePriv = radosFsFilePriv(otherFile);
+  // Verify that a blocking write waits for the others to finish
 
-  EXPECT_TRUE(radosfs::FileIO::hasSingleClient(fileInodePriv(*filePriv->inode)->io));
+  throttle.setMode(radosfs::Filesystem::WRITE_THROTTLE_BLOCK, 0, 0);
 
-  file.setPath(otherFile.path());
+  EXPECT_EQ(0, throttle.acquire(10));
 
-  EXPECT_FALSE(radosfs::FileIO::hasSingleClient(filePriv->getFileIO()));
+  bool acquired = false;
+  boost::thread thread(&acquireWriteThrottle, &throttle, 5, &acquired);
 
-  otherFile.setPath("/file-in-different-pool");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
 
-  const std::string &poolName = TEST_POOL "1";
+  EXPECT_FALSE(acquired);
 
-  EXPECT_EQ(0, otherFile.create(-1, poolName));
+  throttle.release(10);
+  thread.join();
 
-  Stat stat;
+  EXPECT_TRUE(acquired);
+  EXPECT_EQ(1, throttle.stats().waited);
 
-  EXPECT_EQ(0, radosFsPriv()->stat(otherFile.path(), &stat));
+  throttle.release(5);
 
-  EXPECT_EQ(poolName, stat.pool->name);
+  // Verify the throttling through the filesystem
 
-  file.setPath(otherFile.path());
+  AddPool();
 
-  EXPECT_EQ(poolName, radosFsFilePriv(file)->dataPool->name);
+  uint64_t maxBytes;
+  size_t maxOps;
 
-  // Instance one file when it doesn't exist and create it when it has been
-  // already created from a different instance
+  radosFs.writeThrottle(&maxBytes, &maxOps);
 
-  radosfs::File newFile(&radosFs, "/file");
-  radosfs::File sameFile(&radosFs, newFile.path());
+  EXPECT_EQ(DEFAULT_WRITE_THROTTLE_MAX_BYTES, maxBytes);
+  EXPECT_EQ(DEFAULT_WRITE_THROTTLE_MAX_OPS, maxOps);
 
-  EXPECT_EQ(0, newFile.create());
+  radosFs.setWriteThrottle(4, 1);
 
-  EXPECT_EQ(-EEXIST, sameFile.create());
+  EXPECT_EQ(radosfs::Filesystem::WRITE_THROTTLE_BLOCK,
+            radosFs.writeThrottleMode());
 
-  // Check creating a file with a custom chunk size
+  radosfs::File file(&radosFs, "/file");
 
-  newFile.setPath("/file-with-custom-chunk-size");
+  ASSERT_EQ(0, file.create());
 
-  const size_t chunkSize(radosFs.fileChunkSize() / 2);
+  const std::string contents("CERN-LHC-CMS");
 
-  ASSERT_EQ(0, newFile.create(-1, "", chunkSize));
+  for (size_t i = 0; i < contents.length(); i += 4)
+    EXPECT_EQ(0, file.write(contents.c_str() + i, i, 4, true));
 
-  sameFile.setPath(newFile.path());
+  file.sync();
 
-  ASSERT_EQ(chunkSize, radosFsFilePriv(sameFile)->getFileIO()->chunkSize());
+  char buff[16];
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
 }
 
-TEST_F(RadosFsTest, RemoveFile)
+TEST_F(RadosFsTest, FileIOIdleChecks)
 {
   AddPool();
 
-  radosfs::File file(&radosFs, "/testfile",
-                     radosfs::File::MODE_WRITE);
+  std::string inode;
+  PoolSP pool;
+  std::list<librados::locker_t> lockers;
+  int exclusive;
+  std::string tag;
 
-  EXPECT_NE(0, file.remove());
+  {
+    radosfs::File file(&radosFs, "/file");
 
-  EXPECT_EQ(0, file.create());
+    ASSERT_EQ(0, file.create());
+    ASSERT_EQ(0, file.writeSync("CERN", 0, 4));
 
-  EXPECT_EQ(0, file.remove());
+    inode = radosFsFilePriv(file)->getFileIO()->inode();
+    pool = radosFsFilePriv(file)->getFileIO()->pool();
 
-  EXPECT_FALSE(file.exists());
+    // Verify that the idle lock is released while the file is still open
 
-  radosfs::File *file1, *file2;
+    for (int i = 0; i < 50; i++)
+    {
+      lockers.clear();
+      pool->ioctx.list_lockers(inode, FILE_CHUNK_LOCKER, &exclusive, &tag,
+                               &lockers);
 
-  file1 = new radosfs::File(&radosFs, "/testfile1",
-                            radosfs::File::MODE_WRITE);
+      if (lockers.empty())
+        break;
 
-  file2 = new radosfs::File(&radosFs, file1->path(),
-                            radosfs::File::MODE_WRITE);
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    }
 
-  EXPECT_EQ(0, file1->create());
+    EXPECT_TRUE(lockers.empty());
+    EXPECT_TRUE(radosFsPriv()->getFileIO(inode));
+  }
 
-  const size_t contentsLength = DEFAULT_FILE_INLINE_BUFFER_SIZE - 1;
-  char *inlineContents = new char[contentsLength];
+  // Verify that the FileIO is dropped once the file is no longer used
 
-  memset(inlineContents, 'x', contentsLength);
+  for (int i = 0; i < 50 && radosFsPriv()->getFileIO(inode); i++)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
 
-  file1->writeSync(inlineContents, 0, contentsLength);
+  EXPECT_FALSE(radosFsPriv()->getFileIO(inode));
 
-  file2->refresh();
+  // Verify that no checks are left scheduled for it
 
-  EXPECT_TRUE(file2->exists());
+  boost::unique_lock<boost::mutex> lock(radosFsPriv()->fileIOTimersMutex);
 
-  EXPECT_EQ(0, file1->remove());
+  EXPECT_EQ(0, radosFsPriv()->fileIOChecks.count(inode));
+}
 
-  char *inlineContents2 = new char[contentsLength];
+TEST_F(RadosFsTest, FileIORegistry)
+{
+  AddPool();
 
-  file2->read(inlineContents2, 0, contentsLength);
+  radosfs::FileIORegistry registry;
+  PoolSP pool = radosFsPriv()->getDataPoolFromName(TEST_POOL);
 
-  EXPECT_TRUE(strncmp(inlineContents, inlineContents2, contentsLength));
+  radosfs::FileIOSP io(new radosfs::FileIO(&radosFs, pool, "inode", 1024));
+  radosfs::FileIOSP otherIO(new radosfs::FileIO(&radosFs, pool, "inode", 1024));
 
-  file2->refresh();
+  // Verify that adding a FileIO for a registered inode keeps the first one
 
-  EXPECT_FALSE(file2->exists());
+  EXPECT_EQ(io, registry.add(io));
+  EXPECT_EQ(io, registry.add(otherIO));
+  EXPECT_EQ(io, registry.get("inode"));
+  EXPECT_FALSE(registry.get("other-inode"));
 
-  delete file2;
-  delete file1;
-  delete inlineContents;
-  delete inlineContents2;
+  // Verify that adding and acquiring a FileIO count the caller as its client
+  // (getting it does not)
 
-  file.setPath("/testfile1");
+  EXPECT_EQ(2, io->numClients());
+  EXPECT_EQ(io, registry.acquire("inode"));
+  EXPECT_EQ(3, io->numClients());
+  EXPECT_FALSE(registry.acquire("other-inode"));
 
-  EXPECT_FALSE(file.exists());
+  // Verify that setting replaces it and that removing an old one does nothing
 
-  // Make the files' chunk size small so many chunks will be generated
+  registry.set(otherIO);
 
-  const size_t chunkSize = 128;
-  radosFs.setFileChunkSize(chunkSize);
+  EXPECT_EQ(otherIO, registry.get("inode"));
 
-  // Create a file with several chunks
+  registry.remove(io);
 
-  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(1, registry.size());
 
-  std::string contents;
+  // Verify that a FileIO is only dropped when it has no clients
 
-  for (size_t i = 0; i < chunkSize * 3; i++)
-  {
-    contents += "test";
-  }
+  radosfs::FileIOSP removedIO;
 
-  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  EXPECT_EQ(1, otherIO->addClient());
+  EXPECT_FALSE(registry.removeIfUnused("inode", removedIO));
+  EXPECT_EQ(otherIO, removedIO);
 
-  // Remove the file, create it again and check if the size if 0
-  // (which means that no other chunks should exist)
+  EXPECT_EQ(0, otherIO->removeClient());
+  EXPECT_TRUE(registry.removeIfUnused("inode", removedIO));
+  EXPECT_EQ(otherIO, removedIO);
+  EXPECT_EQ(0, registry.size());
 
-  EXPECT_EQ(0, file.remove());
+  // Verify that a FileIO is only moved when the caller is its only client and
+  // that the FileIO of the new pool replaces it
 
-  EXPECT_EQ(0, file.create());
+  radosfs::FileIOSP movedIO(new radosfs::FileIO(&radosFs, pool, "inode", 1024));
 
-  struct stat buff;
-  buff.st_size = 1;
+  EXPECT_EQ(io, registry.add(io));
+  EXPECT_FALSE(registry.startMove(io));
 
-  EXPECT_EQ(0, file.stat(&buff));
+  io->removeClient();
+  io->removeClient();
+  io->removeClient();
 
-  EXPECT_EQ(0, buff.st_size);
-}
+  EXPECT_EQ(1, io->numClients());
+  EXPECT_TRUE(registry.startMove(io));
+  EXPECT_FALSE(registry.removeIfUnused("inode", removedIO));
 
-TEST_F(RadosFsTest, CreateFileInDir)
-{
-  AddPool();
+  registry.finishMove(io, movedIO);
 
-  // Create file in nonexisting dir
+  EXPECT_EQ(movedIO, registry.acquire("inode"));
+  EXPECT_EQ(1, movedIO->numClients());
 
-  radosfs::File file(&radosFs, "/testdir/testfile",
-                     radosfs::File::MODE_WRITE);
+  registry.clear();
 
-  EXPECT_NE(0, file.create());
+  // Verify that the files using a FileIO are counted as its clients
 
-  EXPECT_FALSE(file.exists());
+  radosfs::File file(&radosFs, "/file");
 
-  // Create file in existing dir
+  ASSERT_EQ(0, file.create());
 
-  radosfs::Dir dir(&radosFs, radosfs::Dir::getParent(file.path()).c_str());
+  radosfs::FileIOSP fileIO = radosFsFilePriv(file)->getFileIO();
 
-  EXPECT_EQ(0, dir.create());
+  EXPECT_EQ(1, fileIO->numClients());
+  EXPECT_TRUE(radosfs::FileIO::hasSingleClient(fileIO));
 
-  EXPECT_NE(0, file.create());
+  {
+    radosfs::File sameFile(&radosFs, "/file");
 
-  file.refresh();
+    EXPECT_EQ(fileIO, radosFsFilePriv(sameFile)->getFileIO());
+    EXPECT_EQ(2, fileIO->numClients());
+  }
 
-  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(1, fileIO->numClients());
 }
 
-TEST_F(RadosFsTest, StatFile)
+int countLogArgument(int *count)
 {
-  AddPool();
+  return ++(*count);
+}
 
-  size_t inlineBufferSize = 16;
+TEST_F(RadosFsTest, LogLevel)
+{
+  const radosfs::Filesystem::LogLevel previousLevel = radosFs.logLevel();
+  int count = 0;
 
-  // Create a file with a predefined inline buffer size
+  // Verify that the messages' arguments are not evaluated when logging is off
 
-  radosfs::File file(&radosFs, "/file");
+  radosFs.setLogLevel(radosfs::Filesystem::LOG_LEVEL_NONE);
 
-  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+  EXPECT_EQ(radosfs::Filesystem::LOG_LEVEL_NONE, radosFs.logLevel());
 
-  // Stat the empty file and verify its size
+  radosfs_debug("Count: %d", countLogArgument(&count));
 
-  struct stat stat1;
+  EXPECT_EQ(0, count);
 
-  EXPECT_EQ(0, radosFs.stat(file.path(), &stat1));
+  // Verify that they are when it is on and that the messages get written
 
-  EXPECT_EQ(0, stat1.st_size);
+  radosFs.setLogLevel(radosfs::Filesystem::LOG_LEVEL_DEBUG);
 
-  // Write inline contents to the file
+  EXPECT_EQ(radosfs::Filesystem::LOG_LEVEL_DEBUG, radosFs.logLevel());
 
-  std::string contents("x");
+  for (int i = 0; i < 10; i++)
+    radosfs_debug("Count: %d", countLogArgument(&count));
 
-  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  EXPECT_EQ(10, count);
 
-  // Stat the file from the file instance and from the filesystem instance, and
-  // verify that they match
+  radosfs::Logger::flush();
 
-  EXPECT_EQ(0, file.stat(&stat1));
+  radosFs.setLogLevel(previousLevel);
+}
 
-  struct stat stat2;
+TEST_F(RadosFsTest, Metrics)
+{
+  // Verify the histogram buckets' bounds
 
-  EXPECT_EQ(0, radosFs.stat(file.path(), &stat2));
+  EXPECT_EQ(0, radosfs::MetricsRegistry::bucketIndex(0));
+  EXPECT_EQ(7, radosfs::MetricsRegistry::bucketIndex(7));
+  EXPECT_EQ(8, radosfs::MetricsRegistry::bucketIndex(8));
+  EXPECT_EQ(15, radosfs::MetricsRegistry::bucketIndex(15));
+  EXPECT_EQ(16, radosfs::MetricsRegistry::bucketIndex(16));
+  EXPECT_EQ(16, radosfs::MetricsRegistry::bucketIndex(17));
 
-  EXPECT_EQ(stat1.st_size, stat2.st_size);
+  for (uint64_t value = 1; value < 100000; value = value * 3 + 1)
+  {
+    size_t index = radosfs::MetricsRegistry::bucketIndex(value);
 
-  EXPECT_EQ(contents.length(), stat2.st_size);
+    EXPECT_GE(radosfs::MetricsRegistry::bucketMaxValue(index), value);
+    EXPECT_LT(radosfs::MetricsRegistry::bucketMaxValue(index - 1), value);
+  }
 
-  // Write contents beyong the inline buffer and stat again
+  EXPECT_EQ(METRICS_HISTOGRAM_NUM_BUCKETS - 1,
+            radosfs::MetricsRegistry::bucketIndex((uint64_t) -1));
 
-  contents.assign(inlineBufferSize + 1, 'y');
+  // Verify the counters and percentiles of a registry
 
-  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  radosfs::MetricsRegistry registry;
+  radosfs::Filesystem::Metrics metrics;
 
-  EXPECT_EQ(0, radosFs.stat(file.path(), &stat1));
+  registry.add(radosfs::MetricsRegistry::COUNTER_FILE_WRITE_BYTES, 100);
+  registry.add(radosfs::MetricsRegistry::COUNTER_FILE_WRITE_BYTES, 50);
 
-  EXPECT_EQ(contents.length(), stat1.st_size);
+  for (uint64_t i = 1; i <= 1000; i++)
+    registry.record(radosfs::MetricsRegistry::HISTOGRAM_STAT, i);
 
-  // Create a new file and write to its inline buffer
+  registry.get(metrics);
 
-  radosfs::File file1(&radosFs, "/file1");
+  EXPECT_EQ(150, metrics.counters["file_write_bytes"]);
 
-  ASSERT_EQ(0, file1.create(-1, "", 0, inlineBufferSize));
+  const radosfs::Filesystem::LatencyStats &stats = metrics.latencies["stat"];
 
-  EXPECT_EQ(0, file1.writeSync(contents.c_str(), 0, contents.length() / 2));
+  EXPECT_EQ(1000, stats.count);
+  EXPECT_EQ(500500, stats.sum);
+  EXPECT_EQ(1000, stats.max);
 
-  // Stat three paths in parallel and verify the stat operations' return codes
-  // and sizes
+  // The percentiles are precise within the width of their buckets
 
-  std::vector<std::pair<int, struct stat> > statResult;
-  std::vector<std::string> paths;
+  EXPECT_GE(stats.p50, 500);
+  EXPECT_LE(stats.p50, 500 * 1.125);
+  EXPECT_GE(stats.p99, 990);
+  EXPECT_LE(stats.p99, 1000);
 
-  paths.push_back(file.path());
-  paths.push_back(file1.path());
-  paths.push_back("/non-existing");
+  EXPECT_EQ(0, metrics.latencies["dir_find"].count);
 
-  statResult = radosFs.stat(paths);
+  std::string text = radosfs::metricsToPrometheusText(metrics);
 
-  EXPECT_EQ(paths.size(), statResult.size());
+  EXPECT_NE(std::string::npos, text.find("radosfs_file_write_bytes_total 150"));
+  EXPECT_NE(std::string::npos, text.find("radosfs_stat_latency_seconds_count "
+                                         "1000"));
 
-  const int retCodes[] = {0, 0, -ENOENT};
-  const size_t sizes[] = {contents.length(), contents.length() / 2, 0};
+  // Verify that the filesystem's operations are measured
 
-  std::vector<std::pair<int, struct stat> >::iterator it;
-  int i;
-  for (it = statResult.begin(), i = 0; it != statResult.end(); it++, i++)
-  {
-    int retCode = (*it).first;
-    struct stat fileStat = (*it).second;
+  AddPool();
 
-    EXPECT_EQ(retCodes[i], retCode);
+  radosfs::File file(&radosFs, "/file",
+                     radosfs::File::MODE_READ_WRITE);
 
-    if (retCode == 0)
-      EXPECT_EQ(sizes[i], fileStat.st_size);
-  }
-}
+  EXPECT_EQ(0, file.create());
 
-TEST_F(RadosFsTest, DirPermissions)
-{
-  AddPool();
+  const char contents[] = "metrics";
 
-  // Create dir with owner
+  EXPECT_EQ(0, file.writeSync(contents, 0, sizeof(contents)));
 
-  radosfs::Dir dir(&radosFs, "/userdir");
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+  struct stat buff;
 
-  EXPECT_TRUE(dir.isWritable());
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  metrics = radosFs.getMetrics();
 
-  dir.refresh();
+  EXPECT_EQ(sizeof(contents), metrics.counters["file_write_bytes"]);
+  EXPECT_EQ(1, metrics.latencies["file_write_sync"].count);
+  EXPECT_LT(0, metrics.latencies["stat"].count);
+  EXPECT_EQ(1, metrics.gauges.count("open_files"));
 
-  EXPECT_TRUE(dir.isWritable());
+  // Verify that the metrics are dumped to the given file
 
-  // Create dir by owner in a not writable path
+  const std::string dumpPath = "/tmp/radosfs-test-metrics.prom";
 
-  radosfs::Dir subDir(&radosFs, "/testdir");
+  unlink(dumpPath.c_str());
 
-  EXPECT_EQ(-EACCES, subDir.create());
+  EXPECT_EQ(-EINVAL, radosFs.setMetricsDumpInterval(0));
+  EXPECT_EQ(0, radosFs.setMetricsDumpInterval(.1));
+  EXPECT_EQ(0, radosFs.setMetricsDumpFile(dumpPath));
 
-  // Create dir by owner in a writable path
+  EXPECT_EQ(dumpPath, radosFs.metricsDumpFile());
 
-  subDir.setPath(dir.path() + "testdir");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
 
-  EXPECT_EQ(0, subDir.create());
+  EXPECT_EQ(0, radosFs.setMetricsDumpFile(""));
 
-  // Remove dir by a user who is not the owner
+  struct stat dumpStat;
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  EXPECT_EQ(0, ::stat(dumpPath.c_str(), &dumpStat));
 
-  EXPECT_EQ(-EACCES, subDir.remove());
+  unlink(dumpPath.c_str());
+}
 
-  radosFs.setIds(TEST_UID, TEST_GID);
-
-  EXPECT_EQ(-EACCES, dir.remove());
-
-  radosFs.setIds(0, 0);
-
-  // Remove dir by root
+static size_t
+countSubstring(const std::string &str, const std::string &substr)
+{
+  size_t count = 0;
 
-  EXPECT_EQ(0, subDir.remove());
+  for (size_t pos = str.find(substr); pos != std::string::npos;
+       pos = str.find(substr, pos + 1))
+    count++;
 
-  // Change permissions using chmod and check them
+  return count;
+}
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+TEST_F(RadosFsTest, Tracing)
+{
+  radosFs.clearTrace();
 
-  subDir.refresh();
+  // Verify that nothing is recorded when the tracing is disabled
 
-  EXPECT_EQ(0, subDir.create(S_IRWXU));
+  EXPECT_EQ(0, radosFs.traceSampleRate());
 
-  EXPECT_EQ(0, subDir.chmod(S_IRWXU | S_IROTH));
+  {
+    radosfs::TraceSpan span("TestSpan", "test");
+  }
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  EXPECT_EQ(0, countSubstring(radosFs.getTrace(), "TestSpan"));
 
-  subDir.refresh();
+  // Verify that the spans and their arguments are recorded
 
-  EXPECT_TRUE(subDir.isReadable());
+  radosFs.setTraceSampleRate(1);
 
-  EXPECT_EQ(-EPERM, subDir.chmod(777));
+  EXPECT_EQ(1, radosFs.traceSampleRate());
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  {
+    radosfs::TraceSpan span("TestSpan", "test", "op-id", "inode", 3);
+    radosfs::TraceSpan childSpan("TestChildSpan", "test");
+  }
 
-  subDir.refresh();
+  std::string trace = radosFs.getTrace();
 
-  EXPECT_EQ(0, subDir.chmod(0));
+  EXPECT_EQ(0, trace.find("{\"traceEvents\":["));
+  EXPECT_EQ(1, countSubstring(trace, "\"name\":\"TestSpan\""));
+  EXPECT_EQ(1, countSubstring(trace, "\"name\":\"TestChildSpan\""));
+  EXPECT_EQ(1, countSubstring(trace, "\"op\":\"op-id\",\"inode\":\"inode\","
+                                     "\"chunk\":3"));
 
-  subDir.refresh();
+  // Verify that the buffer keeps only the most recent spans
 
-  EXPECT_FALSE(subDir.isReadable());
+  radosFs.setTraceBufferSize(5);
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  EXPECT_EQ(5, radosFs.traceBufferSize());
 
-  subDir.refresh();
+  for (int i = 0; i < 20; i++)
+    radosfs::TraceSpan span("TestSpan", "test");
 
-  EXPECT_TRUE(subDir.isWritable());
+  EXPECT_EQ(5, countSubstring(radosFs.getTrace(), "TestSpan"));
 
-  EXPECT_EQ(0, subDir.chmod(S_IWRITE));
+  radosFs.clearTrace();
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  EXPECT_EQ(0, countSubstring(radosFs.getTrace(), "TestSpan"));
 
-  EXPECT_EQ(0, subDir.chmod(S_IREAD));
+  // Verify that spans of the same operation are sampled together
 
-  subDir.refresh();
+  radosFs.setTraceSampleRate(.5);
 
-  EXPECT_TRUE(subDir.isReadable());
-}
+  size_t numSampled = 0;
 
-TEST_F(RadosFsTest, FilePermissions)
-{
-  AddPool();
+  for (int i = 0; i < 1000; i++)
+  {
+    std::ostringstream opId;
+    opId << "op-" << i;
 
-  // Create file by root
+    bool sampled = radosfs::Tracer::sample(opId.str());
 
-  radosfs::Dir dir(&radosFs, "/userdir");
+    EXPECT_EQ(sampled, radosfs::Tracer::sample(opId.str()));
 
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+    if (sampled)
+      numSampled++;
+  }
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  EXPECT_GT(numSampled, 300);
+  EXPECT_LT(numSampled, 700);
 
-  // Create file by non-root in a not writable path
+  // Verify that a write is traced with its stages
 
-  radosfs::File file(&radosFs, "/userfile",
-                     radosfs::File::MODE_WRITE);
-  EXPECT_EQ(-EACCES, file.create());
+  radosFs.setTraceSampleRate(1);
+  radosFs.setTraceBufferSize(DEFAULT_TRACE_BUFFER_SIZE);
 
-  // Create file by non-root in a writable path
+  AddPool();
 
-  file.setPath(dir.path() + "userfile");
+  radosfs::File file(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
 
   EXPECT_EQ(0, file.create());
 
-  // Remove file by a different owner
-
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  const char contents[] = "trace";
+  std::string opId;
 
-  EXPECT_EQ(-EACCES, file.remove());
+  EXPECT_EQ(0, file.write(contents, 0, sizeof(contents), true, &opId));
+  EXPECT_EQ(0, file.sync(opId));
 
-  // Create file in another owner's folder
+  trace = radosFs.getTrace();
 
-  radosfs::File otherFile(&radosFs, dir.path() + "otheruserfile",
-                          radosfs::File::MODE_WRITE);
-  EXPECT_EQ(-EACCES, otherFile.create());
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"FileIO::write\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"FileIO::writeChunk\""));
+  EXPECT_NE(std::string::npos, trace.find("\"op\":\"" + opId + "\""));
 
-  // Remove file by owner
+  radosFs.setTraceSampleRate(0);
+  radosFs.clearTrace();
+}
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+struct SlowOpsCallbackArgs
+{
+  radosfs::SlowOpTracker *tracker;
+  size_t numOps;
+};
 
-  EXPECT_EQ(0, file.remove());
+static void
+countSlowOpsCallback(const std::string &opId, int retCode, void *arg)
+{
+  SlowOpsCallbackArgs *args = static_cast<SlowOpsCallbackArgs *>(arg);
 
-  // Create file by owner and readable by others
+  // The callback is called with the op's AsyncOp still alive
+  args->numOps = args->tracker->size();
+}
 
-  file = radosfs::File(&radosFs, dir.path() + "userfile");
-  EXPECT_EQ(0, file.create());
+TEST_F(RadosFsTest, SlowOps)
+{
+  radosfs::SlowOpTracker tracker;
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  EXPECT_EQ(DEFAULT_SLOW_OP_THRESHOLD, tracker.threshold());
 
-  // Check if file is readable by non-owner
+  tracker.setThreshold(.05);
 
-  otherFile = radosfs::File(&radosFs, file.path(),
-                            radosfs::File::MODE_READ);
+  // Verify that an outstanding op is only listed once it is over the threshold
 
-  EXPECT_TRUE(otherFile.isReadable());
+  {
+    radosfs::SlowOpScope scope(tracker, "TestOp", "op-id", "inode");
 
-  // Remove file by owner
+    EXPECT_EQ(1, tracker.size());
+    EXPECT_EQ("", tracker.dump());
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+    // Verify that the time waiting for the lock and its attempts are counted
 
-  file.remove();
+    {
+      radosfs::SlowOpStage stage(radosfs::SlowOp::STAGE_LOCK);
 
-  // Create file by owner and not readable by others
+      for (int i = 0; i < 3; i++)
+        radosfs::SlowOpTracker::countLockAttempt();
 
-  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP)));
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    }
 
-  // Check if file is readable by non-owner
+    std::string dump = tracker.dump();
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+    EXPECT_NE(std::string::npos, dump.find("TestOp op='op-id' target='inode'"));
+    EXPECT_NE(std::string::npos, dump.find("stage=running"));
+    EXPECT_NE(std::string::npos, dump.find("lock_attempts=3"));
+    EXPECT_EQ(std::string::npos, dump.find("lock=0.0"));
+  }
 
-  otherFile.refresh();
+  // Verify that finished ops are no longer tracked
 
-  EXPECT_FALSE(otherFile.isReadable());
+  EXPECT_EQ(0, tracker.size());
 
-  // Change permissions using chmod and check them
+  // Verify that an async op that is never waited for is tracked until it is
+  // released
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  {
+    radosfs::AsyncOpSP asyncOp(new radosfs::AsyncOp("async-op-id"));
+    tracker.startAsync("TestAsyncOp", asyncOp, "inode");
 
-  EXPECT_EQ(0, file.chmod(S_IRWXU | S_IROTH));
+    EXPECT_EQ(1, tracker.size());
+  }
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  EXPECT_EQ(0, tracker.size());
 
-  file.refresh();
+  // Verify that ops are not tracked when the threshold is 0
 
-  EXPECT_TRUE(file.isReadable());
+  tracker.setThreshold(0);
 
-  EXPECT_EQ(-EPERM, file.chmod(777));
+  {
+    radosfs::SlowOpScope scope(tracker, "TestOp", "op-id", "inode");
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+    EXPECT_EQ(0, tracker.size());
+    EXPECT_EQ(0, radosfs::SlowOpTracker::current());
 
-  file.refresh();
+    radosfs::AsyncOpSP asyncOp(new radosfs::AsyncOp("async-op-id"));
+    tracker.startAsync("TestAsyncOp", asyncOp, "inode");
 
-  EXPECT_EQ(0, file.chmod(0));
+    EXPECT_EQ(0, tracker.size());
+  }
 
-  file.refresh();
+  // Verify that an async read stops being tracked once it completes (before
+  // its AsyncOp is released)
 
-  EXPECT_FALSE(file.isReadable());
+  AddPool();
 
-  EXPECT_EQ(-EACCES, file.truncate(100));
+  radosFs.setSlowOpThreshold(30);
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  radosfs::File file(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(0, file.writeSync("contents", 0, 8));
 
-  file.refresh();
+  char buff[8];
+  ssize_t readRet;
+  std::string opId;
+  std::vector<radosfs::FileReadData> intervals;
+  intervals.push_back(radosfs::FileReadData(buff, 0, 8, &readRet));
 
-  EXPECT_TRUE(file.isWritable());
+  SlowOpsCallbackArgs args;
+  args.tracker = &radosFsPriv()->slowOps;
+  args.numOps = 1;
 
-  EXPECT_EQ(0, file.truncate(100));
+  EXPECT_EQ(0, file.read(intervals, &opId, countSlowOpsCallback, &args));
+  EXPECT_EQ(0, file.sync(opId));
 
-  EXPECT_EQ(0, file.chmod(S_IWRITE));
+  EXPECT_EQ(0, args.numOps);
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  // Verify the filesystem's threshold
 
-  EXPECT_EQ(0, file.chmod(S_IREAD));
+  radosFs.setSlowOpThreshold(1.5);
 
-  file.refresh();
+  EXPECT_EQ(1.5, radosFs.slowOpThreshold());
+  EXPECT_EQ("", radosFs.dumpSlowOps());
 
-  EXPECT_TRUE(file.isReadable());
+  radosFs.setSlowOpThreshold(DEFAULT_SLOW_OP_THRESHOLD);
 }
 
-TEST_F(RadosFsTest, DirContents)
+static void
+holdInstrumentedMutex(radosfs::InstrumentedMutex *mutex)
 {
-  AddPool();
+  boost::unique_lock<radosfs::InstrumentedMutex> lock(*mutex);
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+}
 
-  // Create dir and check entries
+TEST_F(RadosFsTest, InstrumentedLocks)
+{
+  radosfs::InstrumentedMutex mutex("test_lock");
 
-  radosfs::Dir dir(&radosFs, "/userdir");
+  // Verify that a lock held by another thread has to be waited for
 
-  EXPECT_EQ(0, dir.create());
+  boost::thread thread(boost::bind(holdInstrumentedMutex, &mutex));
 
-  std::set<std::string> entries;
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_FALSE(mutex.try_lock());
 
-  EXPECT_EQ(0, entries.size());
+  {
+    boost::unique_lock<radosfs::InstrumentedMutex> lock(mutex);
+  }
 
-  // Create file in dir and check entries
+  thread.join();
 
-  radosfs::File file(&radosFs, dir.path() + "userfile",
-                     radosfs::File::MODE_WRITE);
+  radosfs::Filesystem::Metrics metrics;
+  radosfs::InstrumentedMutex::getStats(metrics);
 
-  EXPECT_EQ(0, file.create());
+#ifdef RADOSFS_INSTRUMENTED_LOCKS
+  // Verify the acquisitions, contentions and the time waiting for the lock
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(2, metrics.counters["lock_test_lock_acquisitions"]);
+  EXPECT_EQ(1, metrics.counters["lock_test_lock_contentions"]);
+  EXPECT_LT(10000, metrics.counters["lock_test_lock_wait_microseconds"]);
+  EXPECT_LT(40000, metrics.counters["lock_test_lock_hold_microseconds"]);
 
-  EXPECT_EQ(0, entries.size());
+  // Verify that the internal locks are reported in the filesystem's metrics
 
-  dir.refresh();
+  metrics = radosFs.getMetrics();
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(1, metrics.counters.count("lock_pool_acquisitions"));
+#else
+  EXPECT_EQ(0, metrics.counters.size());
+#endif
+}
 
-  EXPECT_EQ(1, entries.size());
+TEST_F(RadosFsTest, MigrateTree)
+{
+  AddPool(1);
 
-  // Try to create file with an existing path and check entries
+  const std::string otherPool = std::string(TEST_POOL) + "1";
+  const char contents[] = "migrated contents";
 
-  radosfs::File sameFile(file);
+  radosfs::Dir dir(&radosFs, "/migrate/sub/");
 
-  EXPECT_EQ(-EEXIST, sameFile.create());
+  EXPECT_EQ(0, dir.create(-1, true));
 
-  dir.refresh();
+  const char *filePaths[] = {"/migrate/file1", "/migrate/file2",
+                             "/migrate/sub/file3"};
 
-  entries.clear();
+  for (size_t i = 0; i < 3; i++)
+  {
+    radosfs::File file(&radosFs, filePaths[i],
+                       radosfs::File::MODE_READ_WRITE);
 
-  EXPECT_EQ(0, dir.entryList(entries));
+    EXPECT_EQ(0, file.create(-1, TEST_POOL));
+    EXPECT_EQ(0, file.writeSync(contents, 0, sizeof(contents)));
+  }
 
-  EXPECT_EQ(1, entries.size());
+  // Keep a file (without an inline buffer) open in this client while the
+  // other one moves it
 
-  // Create a nonexisting file and check entries
+  radosfs::File openFile(&radosFs, "/migrate/open",
+                         radosfs::File::MODE_READ_WRITE);
 
-  const std::string &otherFileName("userfile1");
+  EXPECT_EQ(0, openFile.create(-1, TEST_POOL, 0, 0));
+  EXPECT_EQ(0, openFile.writeSync(contents, 0, sizeof(contents)));
 
-  radosfs::File otherFile(&radosFs, dir.path() + otherFileName,
-                          radosfs::File::MODE_WRITE);
+  // Migrate the tree from a different client, whose dir cache is empty
 
-  EXPECT_EQ(0, otherFile.create());
+  radosfs::Filesystem migrationFs;
+  migrationFs.init("", conf());
 
-  dir.refresh();
+  EXPECT_EQ(0, migrationFs.addDataPool(TEST_POOL, "/"));
+  EXPECT_EQ(0, migrationFs.addDataPool(otherPool, "/"));
+  EXPECT_EQ(0, migrationFs.addMetadataPool(TEST_POOL_MTD, "/"));
 
-  entries.clear();
+  radosfs::Dir migrationDir(&migrationFs, "/migrate/", false);
+  std::vector<std::string> files;
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(0, migrationDir.listFilesRecursively(files));
+  EXPECT_EQ(4, files.size());
 
-  EXPECT_EQ(2, entries.size());
+  for (size_t i = 0; i < files.size(); i++)
+    EXPECT_EQ(0, migrationFs.moveFileToPool(files[i], otherPool));
 
-  // Create a subdir and check entries
+  // Verify that the client that has the file open cannot write to the old pool
+  // anymore, where its contents would be lost
 
-  const std::string &subDirName("subdir");
+  EXPECT_EQ(-ESTALE, openFile.writeSync(contents, 0, sizeof(contents)));
 
-  radosfs::Dir subDir(&radosFs, dir.path() + subDirName);
+  // Verify that the files were moved with their contents
 
-  EXPECT_EQ(0, subDir.create());
+  for (size_t i = 0; i < 3; i++)
+  {
+    std::string pool;
 
-  dir.refresh();
+    EXPECT_EQ(0, radosFs.getInodeAndPool(filePaths[i], 0, &pool));
+    EXPECT_EQ(otherPool, pool);
 
-  entries.clear();
+    radosfs::File file(&radosFs, filePaths[i], radosfs::File::MODE_READ);
+    char buff[sizeof(contents)];
 
-  EXPECT_EQ(0, dir.entryList(entries));
+    EXPECT_EQ(sizeof(contents), file.read(buff, 0, sizeof(contents)));
+    EXPECT_EQ(0, strcmp(contents, buff));
+  }
+}
 
-  EXPECT_EQ(3, entries.size());
+TEST_F(RadosFsTest, CreateDir)
+{
+  AddPool();
 
-  // Try to create a subdir with an existing path and check entries
+  // Create dir without existing parent
 
-  radosfs::Dir sameSubDir(subDir);
+  radosfs::Dir subDir(&radosFs, "/testdir/testsubdir");
 
-  EXPECT_EQ(0, sameSubDir.create(-1, true));
+  EXPECT_NE(0, subDir.create());
 
-  dir.refresh();
+  EXPECT_FALSE(subDir.exists());
 
-  entries.clear();
+  // Create dir from path without ending in /
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  radosfs::Dir dir(&radosFs, "/testdir");
 
-  EXPECT_EQ(3, entries.size());
+  std::string path(dir.path());
 
-  // Remove file and check entries
+  EXPECT_EQ('/', path[path.length() - 1]);
 
-  EXPECT_EQ(0, file.remove());
+  EXPECT_FALSE(dir.exists());
 
-  dir.refresh();
+  EXPECT_EQ(0, dir.create());
 
-  entries.clear();
+  EXPECT_TRUE(dir.exists());
 
-  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_TRUE(dir.isDir());
 
-  EXPECT_EQ(2, entries.size());
+  EXPECT_FALSE(dir.isFile());
 
-  // Check entries' names
+  // Create dir from path without ending in / and set with setPath
 
-  std::set<std::string>::const_iterator it = entries.begin();
+  dir.setPath("/test");
 
-  EXPECT_EQ(*it, subDirName + "/");
+  path = dir.path();
 
-  it++;
-  EXPECT_EQ(*it, otherFileName);
+  EXPECT_EQ('/', path[path.length() - 1]);
 
-  // Create file and write to it
+  EXPECT_EQ(0, subDir.create());
 
-  file = radosfs::File(&radosFs, "/my-file",
-                       radosfs::File::MODE_READ_WRITE);
+  EXPECT_TRUE(subDir.exists());
 
-  EXPECT_EQ(0, file.create());
+  // Check path when empty string is given
 
-  const std::string contents = "my file contents";
+  dir = radosfs::Dir(&radosFs, "");
 
-  EXPECT_EQ(0, file.write(contents.c_str(), 0, contents.length()));
+  EXPECT_EQ("/", dir.path());
 
-  // Verify it was correctly written
+  // Create dir when file with same name exists
 
-  char buff[contents.length() + 1];
+  radosfs::File file(&radosFs, "/test", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, file.create());
 
-  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  dir.setPath("/test");
 
-  buff[contents.length()] = '\0';
+  EXPECT_EQ(-ENOTDIR, dir.create());
 
-  EXPECT_EQ(0, strcmp(contents.c_str(), buff));
+  // Create dir with mkpath
 
-  // Set the file path to a dir and list it
+  dir.setPath("/testdir/1/2/3/4/5");
 
-  dir.setPath(file.path());
+  EXPECT_EQ(0, dir.create(-1, true));
 
-  entries.clear();
+  dir.setPath(file.path() + "/d1");
 
-  EXPECT_EQ(-ENOTDIR, dir.entryList(entries));
+  EXPECT_EQ(-ENOTDIR, dir.create(-1, true));
 
-  EXPECT_EQ(0, entries.size());
+  // Create dir with the mkdir option when the parent directory is root
+  dir.setPath("/my-dir");
 
-  std::string entry;
+  EXPECT_EQ(0, dir.create(-1, true));
+}
 
-  EXPECT_EQ(-ENOTDIR, dir.entry(0, entry));
+TEST_F(RadosFsTest, RemoveDir)
+{
+  AddPool();
 
-  // Verify that the file contents were not touched
+  radosfs::Dir dir(&radosFs, "/testdir");
+  EXPECT_EQ(0, dir.create());
 
-  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  radosfs::Dir subDir(&radosFs, "/testdir/testsubdir");
+  EXPECT_EQ(0, subDir.create());
 
-  EXPECT_EQ(0, strcmp(contents.c_str(), buff));
-}
+  // Remove non-empty dir
 
-TEST_F(RadosFsTest, FileInode)
-{
-  AddPool();
+  EXPECT_EQ(-ENOTEMPTY, dir.remove());
 
-  Stat stat;
-  const std::string fileName("/test");
+  EXPECT_TRUE(dir.exists());
 
-  radosfs::File file(&radosFs, fileName);
+  // Remove empty dirs
 
-  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+  EXPECT_EQ(0, subDir.remove());
 
-  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+  EXPECT_FALSE(subDir.exists());
 
-  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+  EXPECT_EQ(0, dir.remove());
 
-  EXPECT_EQ(0, file.truncate(1));
+  EXPECT_FALSE(dir.exists());
+}
 
-  EXPECT_EQ(0, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+TEST_F(RadosFsTest, DirParent)
 
-  testFileInodeBackLink(file.path());
+{
+  AddPool();
 
-  EXPECT_EQ(0, stat.pool->ioctx.remove(stat.translatedPath));
+  radosfs::Dir dir(&radosFs, "/testdir");
 
-  // Override the hasBackLink var in the FileIO instance because it is not aware
-  // that the inode object has been removed
+  std::string parent = radosfs::Dir::getParent(dir.path());
 
-  radosfs::FilePriv *filePriv = radosFsFilePriv(file);
+  EXPECT_EQ("/", parent);
 
-  fileInodePriv(*filePriv->inode)->io->setHasBackLink(false);
+  parent = radosfs::Dir::getParent("");
 
-  EXPECT_EQ(0, file.write("X", 0, 1));
+  EXPECT_EQ("", parent);
+}
 
-  file.sync();
+TEST_F(RadosFsTest, CreateFile)
+{
+  // Create one extra pool apart from the ones created by default
 
-  testFileInodeBackLink(file.path());
+  AddPool(1);
 
-  EXPECT_EQ(0, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+  // Create regular file
 
-  std::string inode, pool;
+  radosfs::File file(&radosFs, "/testfile",
+                     radosfs::File::MODE_WRITE);
 
-  ASSERT_EQ(0, radosFs.getInodeAndPool(file.path(), &inode, &pool));
+  EXPECT_FALSE(file.exists());
 
-  EXPECT_EQ(stat.translatedPath, inode);
+  EXPECT_EQ(0, file.create());
 
-  EXPECT_EQ(stat.pool->name, pool);
-}
+  EXPECT_TRUE(file.exists());
 
-TEST_F(RadosFsTest, FileInodeDirect)
-{
-  AddPool();
+  EXPECT_FALSE(file.isDir());
 
-  // Create an inode with a given name
+  EXPECT_TRUE(file.isFile());
 
-  std::string inodeName(generateUuid());
+  // Create file when dir with same name exists
 
-  radosfs::FileInode inode(&radosFs, TEST_POOL, inodeName);
+  radosfs::Dir dir(&radosFs, "/test");
 
-  EXPECT_EQ(inode.name(), inodeName);
+  EXPECT_EQ(0, dir.create());
 
-  // Create an inode with an automatic generated name
+  file.setPath("/test");
 
-  radosfs::FileInode otherInode(&radosFs, TEST_POOL);
+  EXPECT_EQ(-EISDIR, file.create());
 
-  EXPECT_NE(inode.name(), otherInode.name());
+  // Create file when path is a dir one
 
-  size_t contentsSize = 1024;
+  file.setPath("/test/");
 
-  char buff[contentsSize];
+  std::string path(file.path());
 
-  // Read an inode that does not exist (doesn't have any chunks)
+  EXPECT_NE('/', path[path.length() - 1]);
 
-  EXPECT_EQ(-ENOENT, inode.read(buff, 0, contentsSize));
+  radosfs::File otherFile(&radosFs, "/testfile/",
+                          radosfs::File::MODE_WRITE);
 
-  // Write synchronously into an inode
+  path = otherFile.path();
 
-  char contents[contentsSize];
-  memset(contents, 'x', contentsSize);
-  contents[contentsSize - 1] = '\0';
+  EXPECT_NE('/', path[path.length() - 1]);
 
-  ASSERT_EQ(0, inode.writeSync(contents, 0, contentsSize));
+  // Check the shared pointer use
 
-  // Check the size of the inode
+  radosfs::FilePriv *filePriv = radosFsFilePriv(otherFile);
 
-  u_int64_t size = 0;
+  EXPECT_TRUE(radosfs::FileIO::hasSingleClient(fileInodePriv(*filePriv->inode)->io));
 
-  ASSERT_EQ(0, inode.getSize(size));
+  file.setPath(otherFile.path());
 
-  ASSERT_EQ(static_cast<u_int64_t>(contentsSize), size);
+  EXPECT_FALSE(radosfs::FileIO::hasSingleClient(filePriv->getFileIO()));
 
-  // Read its contents
+  otherFile.setPath("/file-in-different-pool");
 
-  ASSERT_GT(inode.read(buff, 0, contentsSize), 0);
+  const std::string &poolName = TEST_POOL "1";
 
-  EXPECT_EQ(0, strcmp(contents, buff));
+  EXPECT_EQ(0, otherFile.create(-1, poolName));
 
-  memset(contents, 'y', contentsSize / 2);
+  Stat stat;
 
-  // Write asynchronously into an inode
+  EXPECT_EQ(0, radosFsPriv()->stat(otherFile.path(), &stat));
 
-  ASSERT_EQ(0, inode.write(contents, 0, contentsSize));
+  EXPECT_EQ(poolName, stat.pool->name);
 
-  inode.sync();
+  file.setPath(otherFile.path());
 
-  // Read its contents
+  EXPECT_EQ(poolName, radosFsFilePriv(file)->dataPool->name);
 
-  ASSERT_GT(inode.read(buff, 0, contentsSize), 0);
+  // Instance one file when it doesn't exist and create it when it has been
+  // already created from a different instance
 
-  EXPECT_EQ(0, strcmp(contents, buff));
+  radosfs::File newFile(&radosFs, "/file");
+  radosfs::File sameFile(&radosFs, newFile.path());
 
-  // Truncate the inode to half and read it again
+  EXPECT_EQ(0, newFile.create());
 
-  ASSERT_EQ(0, inode.truncate(contentsSize / 2));
+  EXPECT_EQ(-EEXIST, sameFile.create());
 
-  EXPECT_EQ(contentsSize / 2, inode.read(buff, 0, contentsSize));
+  // Check creating a file with a custom chunk size
 
-  EXPECT_EQ(contentsSize / 3, inode.read(buff, 0, contentsSize / 3));
+  newFile.setPath("/file-with-custom-chunk-size");
 
-  // Set xattr on the inode
+  const size_t chunkSize(radosFs.fileChunkSize() / 2);
 
-  std::string xattrKey("xattr-test-key");
-  std::string xattrValue("xattr-test-value");
+  ASSERT_EQ(0, newFile.create(-1, "", chunkSize));
 
-  EXPECT_EQ(0, inode.setXAttr(xattrKey, xattrValue));
+  sameFile.setPath(newFile.path());
 
-  // Get xattr from the inode
-  std::string xattrOutValue;
+  ASSERT_EQ(chunkSize, radosFsFilePriv(sameFile)->getFileIO()->chunkSize());
+}
 
-  EXPECT_EQ(xattrValue.length(), inode.getXAttr(xattrKey, xattrOutValue));
+TEST_F(RadosFsTest, RemoveFile)
+{
+  AddPool();
 
-  EXPECT_EQ(xattrValue, xattrOutValue);
+  radosfs::File file(&radosFs, "/testfile",
+                     radosfs::File::MODE_WRITE);
 
-  // Get the map of xattributes from the inode
-  std::map<std::string, std::string> xattrsMap;
+  EXPECT_NE(0, file.remove());
 
-  EXPECT_EQ(0, inode.getXAttrsMap(xattrsMap));
+  EXPECT_EQ(0, file.create());
 
-  ASSERT_EQ(1, xattrsMap.count(XATTR_SYS_PREFIX + xattrKey));
+  EXPECT_EQ(0, file.remove());
 
-  EXPECT_EQ(xattrValue, xattrsMap[XATTR_SYS_PREFIX + xattrKey]);
+  EXPECT_FALSE(file.exists());
 
-  // Check the backlink set on the inode
+  radosfs::File *file1, *file2;
 
-  std::string backLink;
+  file1 = new radosfs::File(&radosFs, "/testfile1",
+                            radosfs::File::MODE_WRITE);
 
-  EXPECT_EQ(-ENODATA, inode.getBackLink(&backLink));
+  file2 = new radosfs::File(&radosFs, file1->path(),
+                            radosfs::File::MODE_WRITE);
 
-  radosfs::File file(&radosFs, "/file");
+  EXPECT_EQ(0, file1->create());
 
-  EXPECT_FALSE(file.exists());
+  const size_t contentsLength = DEFAULT_FILE_INLINE_BUFFER_SIZE - 1;
+  char *inlineContents = new char[contentsLength];
 
-  // Create a file
+  memset(inlineContents, 'x', contentsLength);
 
-  radosfs::File file1(&radosFs, "/file1");
+  file1->writeSync(inlineContents, 0, contentsLength);
 
-  ASSERT_EQ(0, file1.create());
+  file2->refresh();
 
-  // Register the inode with an invalid file path
+  EXPECT_TRUE(file2->exists());
 
-  ASSERT_EQ(-EISDIR, inode.registerFile("/", TEST_UID, TEST_GID, O_RDWR));
+  EXPECT_EQ(0, file1->remove());
 
-  ASSERT_EQ(-EINVAL, inode.registerFile("", TEST_UID, TEST_GID, O_RDWR));
+  char *inlineContents2 = new char[contentsLength];
 
-  ASSERT_EQ(-EINVAL, inode.registerFile("no-slash-file", TEST_UID, TEST_GID,
-                                        O_RDWR));
+  file2->read(inlineContents2, 0, contentsLength);
 
-  ASSERT_EQ(-ENOENT, inode.registerFile("/nonexitent/file", TEST_UID, TEST_GID,
-                                        O_RDWR));
+  EXPECT_TRUE(strncmp(inlineContents, inlineContents2, contentsLength));
 
-  ASSERT_EQ(-EINVAL, inode.registerFile("/file1/file", TEST_UID, TEST_GID,
-                                        O_RDWR));
+  file2->refresh();
 
-  // Register the inode with an existing file path
+  EXPECT_FALSE(file2->exists());
 
-  ASSERT_EQ(-EEXIST, inode.registerFile(file1.path(), TEST_UID, TEST_GID,
-                                        O_RDWR));
+  delete file2;
+  delete file1;
+  delete inlineContents;
+  delete inlineContents2;
 
-  radosfs::Dir dir(&radosFs, "/");
+  file.setPath("/testfile1");
 
-  ASSERT_EQ(0, dir.createLink("/dir-link/"));
+  EXPECT_FALSE(file.exists());
 
-  // Register the inode with a link path
+  // Make the files' chunk size small so many chunks will be generated
 
-  ASSERT_EQ(-EINVAL, inode.registerFile("/dir-link/file", TEST_UID, TEST_GID,
-                                        O_RDWR));
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
 
-  // Register the inode with a new file path
+  // Create a file with several chunks
 
-  ASSERT_EQ(0, inode.registerFile(file.path(), TEST_UID, TEST_GID, O_RDWR));
+  EXPECT_EQ(0, file.create());
 
-  file.refresh();
+  std::string contents;
 
-  // Verify the xattributes previously set on the inode
+  for (size_t i = 0; i < chunkSize * 3; i++)
+  {
+    contents += "test";
+  }
 
-  xattrOutValue.clear();
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  ASSERT_EQ(xattrValue.length(),
-            file.getXAttr(XATTR_SYS_PREFIX + xattrKey, xattrOutValue));
+  // Remove the file, create it again and check if the size if 0
+  // (which means that no other chunks should exist)
 
-  EXPECT_EQ(xattrValue, xattrOutValue);
+  EXPECT_EQ(0, file.remove());
 
-  xattrsMap.clear();
+  EXPECT_EQ(0, file.create());
 
-  ASSERT_EQ(0, file.getXAttrsMap(xattrsMap));
+  struct stat buff;
+  buff.st_size = 1;
 
-  ASSERT_EQ(1, xattrsMap.count(XATTR_SYS_PREFIX + xattrKey));
+  EXPECT_EQ(0, file.stat(&buff));
 
-  // Set xattribute from file
+  EXPECT_EQ(0, buff.st_size);
+}
 
-  xattrKey = "xattr-from-file";
-  xattrValue = "value-from-file";
+TEST_F(RadosFsTest, CreateFileInDir)
+{
+  AddPool();
 
-  ASSERT_EQ(0, file.setXAttr(xattrKey, xattrValue));
+  // Create file in nonexisting dir
 
-  // Verify the xattribute from inode
+  radosfs::File file(&radosFs, "/testdir/testfile",
+                     radosfs::File::MODE_WRITE);
 
-  ASSERT_EQ(xattrValue.length(), file.getXAttr(XATTR_USER_PREFIX + xattrKey,
-                                               xattrOutValue));
+  EXPECT_NE(0, file.create());
 
-  ASSERT_EQ(xattrValue, xattrOutValue);
+  EXPECT_FALSE(file.exists());
 
-  // Remove the xattribute from the inode
+  // Create file in existing dir
 
-  ASSERT_EQ(0, inode.removeXAttr(XATTR_USER_PREFIX + xattrKey));
+  radosfs::Dir dir(&radosFs, radosfs::Dir::getParent(file.path()).c_str());
 
-  // Verify that the xattribute no longer exists
+  EXPECT_EQ(0, dir.create());
 
-  ASSERT_EQ(-ENODATA, inode.getXAttr(XATTR_USER_PREFIX + xattrKey,
-                                     xattrOutValue));
+  EXPECT_NE(0, file.create());
 
-  ASSERT_EQ(-ENODATA, file.getXAttr(XATTR_USER_PREFIX + xattrKey,
-                                    xattrOutValue));
+  file.refresh();
 
-  // Verify the registered file exists
+  EXPECT_EQ(0, file.create());
+}
 
-  EXPECT_TRUE(file.exists());
+TEST_F(RadosFsTest, StatFile)
+{
+  AddPool();
 
-  // Check the backlink set on the inode
+  size_t inlineBufferSize = 16;
 
-  EXPECT_EQ(0, inode.getBackLink(&backLink));
+  // Create a file with a predefined inline buffer size
 
-  EXPECT_EQ(file.path(), backLink);
+  radosfs::File file(&radosFs, "/file");
 
-  // Read from the registered file
+  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
 
-  memset(buff, 0, contentsSize / 2);
+  // Stat the empty file and verify its size
 
-  ASSERT_EQ(contentsSize / 2, file.read(buff, 0, contentsSize / 2));
+  struct stat stat1;
 
-  EXPECT_EQ(0, strncmp(contents, buff, contentsSize / 2));
+  EXPECT_EQ(0, radosFs.stat(file.path(), &stat1));
 
-  // Stat from the registered file and check it
+  EXPECT_EQ(0, stat1.st_size);
 
-  Stat fileStat;
+  // Write inline contents to the file
 
-  ASSERT_EQ(0, radosFsPriv()->stat(file.path(), &fileStat));
+  std::string contents("x");
 
-  EXPECT_EQ(TEST_UID, fileStat.statBuff.st_uid);
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  EXPECT_EQ(TEST_GID, fileStat.statBuff.st_gid);
+  // Stat the file from the file instance and from the filesystem instance, and
+  // verify that they match
 
-  EXPECT_TRUE((fileStat.statBuff.st_mode & O_RDWR) != 0);
+  EXPECT_EQ(0, file.stat(&stat1));
 
-  EXPECT_EQ(inode.name(), fileStat.translatedPath);
+  struct stat stat2;
 
-  // Remove the inode and try to read it
+  EXPECT_EQ(0, radosFs.stat(file.path(), &stat2));
 
-  ASSERT_EQ(0, inode.remove());
+  EXPECT_EQ(stat1.st_size, stat2.st_size);
 
-  EXPECT_EQ(-ENOENT, inode.read(buff, 0, 1));
-}
+  EXPECT_EQ(contents.length(), stat2.st_size);
 
-TEST_F(RadosFsTest, FileTruncate)
-{
-  AddPool();
+  // Write contents beyong the inline buffer and stat again
 
-  // Make the files' chunk size small so many chunks will be generated
+  contents.assign(inlineBufferSize + 1, 'y');
 
-  const size_t chunkSize = 128;
-  radosFs.setFileChunkSize(chunkSize);
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  const std::string fileName("/test");
-  char contents[chunkSize * 10];
-  memset(contents, 'x', chunkSize * 10);
-  unsigned long long size = 1024;
+  EXPECT_EQ(0, radosFs.stat(file.path(), &stat1));
 
-  // Create a file and truncate it to the content's size
+  EXPECT_EQ(contents.length(), stat1.st_size);
 
-  radosfs::File file(&radosFs, fileName,
-                     radosfs::File::MODE_WRITE);
+  // Create a new file and write to its inline buffer
 
-  EXPECT_EQ(0, file.create());
+  radosfs::File file1(&radosFs, "/file1");
 
-  EXPECT_EQ(0, file.write(contents, 0, chunkSize * 10));
+  ASSERT_EQ(0, file1.create(-1, "", 0, inlineBufferSize));
 
-  EXPECT_EQ(0, file.truncate(size));
+  EXPECT_EQ(0, file1.writeSync(contents.c_str(), 0, contents.length() / 2));
 
-  // Setting a fake path to file so its cache is dumped and we have a "fresh"
-  // new instance below with sameFile which is necessary to check if the
-  // file chunk size persistency is working
+  // Stat three paths in parallel and verify the stat operations' return codes
+  // and sizes
 
-  file.setPath("/fake");
+  std::vector<std::pair<int, struct stat> > statResult;
+  std::vector<std::string> paths;
 
-  // Create a new instance of the same file and check the size
+  paths.push_back(file.path());
+  paths.push_back(file1.path());
+  paths.push_back("/non-existing");
 
-  radosfs::File sameFile(&radosFs, fileName,
-                         radosfs::File::MODE_READ);
+  statResult = radosFs.stat(paths);
 
-  struct stat buff;
+  EXPECT_EQ(paths.size(), statResult.size());
 
-  // Setting a different chunk size before checking sameFile's size because
-  // it should have been set in the file when it was written
+  const int retCodes[] = {0, 0, -ENOENT};
+  const size_t sizes[] = {contents.length(), contents.length() / 2, 0};
 
-  radosFs.setFileChunkSize(chunkSize + 1);
+  std::vector<std::pair<int, struct stat> >::iterator it;
+  int i;
+  for (it = statResult.begin(), i = 0; it != statResult.end(); it++, i++)
+  {
+    int retCode = (*it).first;
+    struct stat fileStat = (*it).second;
 
-  EXPECT_EQ(0, sameFile.stat(&buff));
+    EXPECT_EQ(retCodes[i], retCode);
 
-  EXPECT_EQ(size, buff.st_size);
+    if (retCode == 0)
+      EXPECT_EQ(sizes[i], fileStat.st_size);
+  }
+}
 
-  // Get the right file instance back again
+TEST_F(RadosFsTest, ParallelStatFileSizes)
+{
+  AddPool();
 
-  file = sameFile;
+  const int numFiles = 50;
+  std::vector<std::string> paths;
 
-  // Truncate the file to 0 and verify
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  EXPECT_EQ(0, file.truncate(0));
+  EXPECT_EQ(0, dir.create());
 
-  sameFile.refresh();
+  // Create files without an inline buffer and with different sizes
 
-  EXPECT_EQ(0, sameFile.stat(&buff));
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << dir.path() << "file" << i;
 
-  EXPECT_EQ(0, buff.st_size);
+    radosfs::File file(&radosFs, stream.str());
 
-  // Truncate the file to a non-multiple of the chunk size and verify
+    EXPECT_EQ(0, file.create(-1, "", 0, 0));
 
-  size = chunkSize * 5.3;
+    const std::string contents(i + 1, 'x');
 
-  EXPECT_EQ(0, file.truncate(size));
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  sameFile.refresh();
+    paths.push_back(file.path());
+  }
 
-  EXPECT_EQ(0, sameFile.stat(&buff));
+  // Stat all files from a different client and verify their sizes
 
-  EXPECT_EQ(size, buff.st_size);
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
 
-  // Truncate the file to a half of the chunk size and verify
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  size = chunkSize / 2;
+  std::vector<std::pair<int, struct stat> > statResult;
 
-  EXPECT_EQ(0, file.truncate(size));
+  statResult = otherClient.stat(paths);
 
-  sameFile.refresh();
+  ASSERT_EQ(paths.size(), statResult.size());
 
-  EXPECT_EQ(0, sameFile.stat(&buff));
+  for (int i = 0; i < numFiles; i++)
+  {
+    EXPECT_EQ(0, statResult[i].first);
+    EXPECT_EQ(i + 1, statResult[i].second.st_size);
+  }
 
-  EXPECT_EQ(size, buff.st_size);
+  // Stat the files again from this client and verify that it did not need to
+  // open them
+
+  const size_t numOpenFiles = radosFsPriv()->operations.size();
+
+  statResult = radosFs.stat(paths);
+
+  for (int i = 0; i < numFiles; i++)
+    EXPECT_EQ(i + 1, statResult[i].second.st_size);
+
+  EXPECT_LE(radosFsPriv()->operations.size(), numOpenFiles);
 }
 
-TEST_F(RadosFsTest, FileReadWrite)
+TEST_F(RadosFsTest, DirEntryListWithStats)
 {
   AddPool();
 
-  // Set a small file chunk size so many chunks will be created
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  const size_t chunkSize = 128;
-  radosFs.setFileChunkSize(chunkSize);
+  // Check that listing a nonexistent dir fails
 
-  // Write contents in file synchronously
+  std::map<std::string, struct stat> entries;
 
-  const std::string fileName("/test");
-  const std::string contents("this is a test");
+  EXPECT_EQ(-ENOENT, dir.entryListWithStats(entries));
 
-  radosfs::File file(&radosFs, fileName,
-                     radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, dir.create());
 
-  EXPECT_EQ(0, file.create());
+  // Create some files, a subdir and a link
 
-  // Read from an empty file
+  const int numFiles = 10;
 
-  char *buff = new char[contents.length() + 1];
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << dir.path() << "file" << i;
 
-  EXPECT_EQ(0, file.read(buff, 0, contents.length()));
+    radosfs::File file(&radosFs, stream.str());
 
-  delete[] buff;
+    EXPECT_EQ(0, file.create());
 
-  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+    const std::string contents(i + 1, 'x');
 
-  // Read and verify the contents
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  }
 
-  buff = new char[contents.length() + 1];
+  radosfs::Dir subDir(&radosFs, dir.path() + "subdir");
 
-  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
-  buff[contents.length()] = '\0';
+  EXPECT_EQ(0, subDir.create());
 
-  EXPECT_EQ(0, strcmp(buff, contents.c_str()));
+  radosfs::File file(&radosFs, dir.path() + "file0");
 
-  // Verify size with stat
+  EXPECT_EQ(0, file.createLink(dir.path() + "link"));
 
-  radosfs::File sameFile(&radosFs, fileName,
-                         radosfs::File::MODE_READ);
+  // List the dir with stats and check they match the ones from stat
 
-  struct stat statBuff;
+  dir.refresh();
 
-  EXPECT_EQ(0, sameFile.stat(&statBuff));
+  std::set<std::string> entryNames;
 
-  EXPECT_EQ(contents.length(), statBuff.st_size);
+  EXPECT_EQ(0, dir.entryList(entryNames));
+  EXPECT_EQ(0, dir.entryListWithStats(entries));
 
-  delete[] buff;
+  ASSERT_EQ(entryNames.size(), entries.size());
 
-  // Write other contents in file asynchronously
+  std::set<std::string>::iterator it;
+  for (it = entryNames.begin(); it != entryNames.end(); it++)
+  {
+    const std::string &entry = *it;
+    struct stat buff;
 
-  std::string contents2("this is another test ");
+    ASSERT_EQ(1, entries.count(entry));
+    EXPECT_EQ(0, radosFs.stat(dir.path() + entry, &buff));
 
-  for (size_t i = 0; i < chunkSize; i++)
-    contents2 += "this is another test ";
+    EXPECT_EQ(buff.st_mode, entries[entry].st_mode);
+    EXPECT_EQ(buff.st_size, entries[entry].st_size);
+    EXPECT_EQ(buff.st_uid, entries[entry].st_uid);
+  }
 
-  buff = new char[contents2.length() + 1];
+  EXPECT_TRUE(S_ISDIR(entries["subdir/"].st_mode));
+  EXPECT_TRUE(S_ISLNK(entries["link"].st_mode));
+  EXPECT_EQ(numFiles, entries["file9"].st_size);
 
-  EXPECT_EQ(0, file.write(contents2.c_str(), 0, contents2.length()));
+  // Check that listing a file fails
 
-  // Read and verify the contents
+  radosfs::Dir fileDir(&radosFs, dir.path() + "file0");
 
-  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+  entries.clear();
 
-  buff[contents2.length()] = '\0';
+  EXPECT_EQ(-ENOTDIR, fileDir.entryListWithStats(entries));
+}
 
-  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+TEST_F(RadosFsTest, DirPermissions)
+{
+  AddPool();
 
-  // Change the contents of the file and verify them
+  // Create dir with owner
 
-  int charToChange = chunkSize * 1.3;
-  EXPECT_EQ(0, file.writeSync("d", charToChange, 1));
+  radosfs::Dir dir(&radosFs, "/userdir");
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
 
-  contents2[charToChange] = 'd';
+  EXPECT_TRUE(dir.isWritable());
 
-  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+  dir.refresh();
 
-  charToChange = chunkSize * 1.9;
-  EXPECT_EQ(0, file.write("x", charToChange, 1, true));
+  EXPECT_TRUE(dir.isWritable());
 
-  contents2[charToChange] = 'x';
+  // Create dir by owner in a not writable path
 
-  EXPECT_EQ(0, file.sync());
+  radosfs::Dir subDir(&radosFs, "/testdir");
 
-  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+  EXPECT_EQ(-EACCES, subDir.create());
 
-  buff[contents2.length()] = '\0';
+  // Create dir by owner in a writable path
 
-  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+  subDir.setPath(dir.path() + "testdir");
 
-  EXPECT_EQ(0, file.stat(&statBuff));
+  EXPECT_EQ(0, subDir.create());
 
-  EXPECT_EQ(contents2.length(), statBuff.st_size);
+  // Remove dir by a user who is not the owner
 
-  // Read outside of the file's size (from the file size to 2x file size)
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  ASSERT_EQ(0, file.read(buff, statBuff.st_size, statBuff.st_size * 2));
+  EXPECT_EQ(-EACCES, subDir.remove());
 
-  // Increase the file size and read a region that doesn't have corresponding
-  // chunks
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  const size_t fileOldSize = statBuff.st_size;
+  EXPECT_EQ(-EACCES, dir.remove());
 
-  ASSERT_EQ(0, file.truncate(fileOldSize * 2));
+  radosFs.setIds(0, 0);
 
-  // Read in a region of the file without existing chunks
-  // (read the second half of the file)
+  // Remove dir by root
 
-  ASSERT_EQ(fileOldSize, file.read(buff, fileOldSize,
-                                   (fileOldSize * 2) - fileOldSize));
+  EXPECT_EQ(0, subDir.remove());
 
-  char *blankContents = new char[contents2.length() + 1];
-  memset(blankContents, '\0', contents2.length());
+  // Change permissions using chmod and check them
 
-  EXPECT_EQ(0, strcmp(buff, blankContents));
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  delete[] buff;
-  delete[] blankContents;
-}
+  subDir.refresh();
 
-TEST_F(RadosFsTest, FileVectorRead)
-{
-  AddPool();
+  EXPECT_EQ(0, subDir.create(S_IRWXU));
 
-  // Set a small file chunk size so many chunks will be created
+  EXPECT_EQ(0, subDir.chmod(S_IRWXU | S_IROTH));
 
-  const size_t chunkSize = 64;
-  radosFs.setFileChunkSize(chunkSize);
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  // Write contents in file synchronously
+  subDir.refresh();
 
-  const std::string fileName("/test");
-  std::stringstream sstream;
-  for (size_t i = 0; i < chunkSize * 1.5; i++)
-    sstream << i << ".";
+  EXPECT_TRUE(subDir.isReadable());
 
-  const std::string contents(sstream.str());
+  EXPECT_EQ(-EPERM, subDir.chmod(777));
 
-  radosfs::File file(&radosFs, fileName);
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  const size_t inlineSize = 8;
-  EXPECT_EQ(0, file.create(-1, "", 0, inlineSize));
+  subDir.refresh();
 
-  // Write contents to file
+  EXPECT_EQ(0, subDir.chmod(0));
 
-  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  subDir.refresh();
 
-  const size_t fileSize = contents.length() + contents.length() / 2;
-  EXPECT_EQ(0, file.truncate(fileSize));
+  EXPECT_FALSE(subDir.isReadable());
 
-  // Read and verify the contents
+  radosFs.setIds(ROOT_UID, ROOT_UID);
 
-  char *buff = new char[fileSize + 1];
-  char *buff2 = new char[fileSize + 1];
+  subDir.refresh();
 
-  memcpy(buff2, contents.c_str(), contents.length());
-  bzero(buff2 + contents.length(), fileSize - contents.length());
+  EXPECT_TRUE(subDir.isWritable());
 
-  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  EXPECT_EQ(0, subDir.chmod(S_IWRITE));
 
-  EXPECT_EQ(0, strncmp(buff, contents.c_str(), contents.length()));
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  ssize_t retValue, retValue1, retValue2, retValue3;
-  size_t readLength = inlineSize / 2;
-  size_t readLength1 = inlineSize;
-  size_t readLength2 = fileSize * 2;
+  EXPECT_EQ(0, subDir.chmod(S_IREAD));
 
-  std::vector<radosfs::FileReadData> intervals;
-  intervals.push_back(radosfs::FileReadData(buff, 0, readLength, &retValue));
-  intervals.push_back(radosfs::FileReadData(buff + readLength, readLength,
-                                            readLength1, &retValue1));
+  subDir.refresh();
 
-  intervals.push_back(radosfs::FileReadData(buff + readLength + readLength1,
-                                            readLength + readLength1,
-                                            readLength2, &retValue2));
-  intervals.push_back(radosfs::FileReadData(buff, fileSize + 2, 1,
-                                            &retValue3));
-  std::string opId;
+  EXPECT_TRUE(subDir.isReadable());
+}
 
-  memset(buff, 'x', fileSize + 1);
+TEST_F(RadosFsTest, FilePermissions)
+{
+  AddPool();
 
-  EXPECT_EQ(0, file.read(intervals, &opId));
+  // Create file by root
 
-  int ret = file.sync(opId);
+  radosfs::Dir dir(&radosFs, "/userdir");
 
-  // -ENOENT Because one of the operations goes beyond the file size
-  ASSERT_EQ(-ENOENT, ret);
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
 
-  EXPECT_EQ(readLength, retValue);
-  EXPECT_EQ(readLength1, retValue1);
-  EXPECT_EQ(fileSize - (readLength + readLength1), retValue2);
-  EXPECT_EQ(0, retValue3);
-  EXPECT_EQ(0, strncmp(buff, contents.c_str(), contents.length()));
-  EXPECT_EQ(0, strncmp(buff, buff2, fileSize));
-  EXPECT_EQ(0, strncmp(buff, contents.c_str(), readLength + readLength1));
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  radosfs::File otherFile(&radosFs, "/test1");
+  // Create file by non-root in a not writable path
 
-  EXPECT_EQ(-ENOENT, otherFile.read(intervals, &opId));
+  radosfs::File file(&radosFs, "/userfile",
+                     radosfs::File::MODE_WRITE);
+  EXPECT_EQ(-EACCES, file.create());
 
-  EXPECT_EQ(0, otherFile.create(-1, "", 0, 0));
+  // Create file by non-root in a writable path
 
-  EXPECT_EQ(0, otherFile.read(intervals, &opId));
+  file.setPath(dir.path() + "userfile");
 
-  ret = otherFile.sync(opId);
+  EXPECT_EQ(0, file.create());
 
-  // -ENOENT Because one of the operations goes beyond the file size
-  ASSERT_EQ(-ENOENT, ret);
+  // Remove file by a different owner
 
-  EXPECT_EQ(0, retValue);
-  EXPECT_EQ(0, retValue1);
-  EXPECT_EQ(0, retValue2);
-  EXPECT_EQ(0, retValue3);
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  EXPECT_EQ(0, otherFile.truncate(readLength));
+  EXPECT_EQ(-EACCES, file.remove());
 
-  EXPECT_EQ(0, otherFile.read(intervals, &opId));
+  // Create file in another owner's folder
 
-  ret = otherFile.sync(opId);
+  radosfs::File otherFile(&radosFs, dir.path() + "otheruserfile",
+                          radosfs::File::MODE_WRITE);
+  EXPECT_EQ(-EACCES, otherFile.create());
 
-  // -ENOENT Because one of the operations goes beyond the file size
-  ASSERT_EQ(-ENOENT, ret);
+  // Remove file by owner
 
-  bzero(buff2, readLength);
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  EXPECT_EQ(readLength, retValue);
-  EXPECT_EQ(0, strncmp(buff, buff2, readLength));
-  EXPECT_EQ(0, retValue1);
-  EXPECT_EQ(0, retValue2);
-  EXPECT_EQ(0, retValue3);
+  EXPECT_EQ(0, file.remove());
 
+  // Create file by owner and readable by others
 
-  delete buff;
-  delete buff2;
-}
+  file = radosfs::File(&radosFs, dir.path() + "userfile");
+  EXPECT_EQ(0, file.create());
 
-void fileReadWriteCallback(const std::string &opId, int retCode, void *arg)
-{
-  std::string *argStr = static_cast<std::string *>(arg);
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  ASSERT_EQ(0, retCode);
+  // Check if file is readable by non-owner
 
-  argStr->assign(opId);
-}
+  otherFile = radosfs::File(&radosFs, file.path(),
+                            radosfs::File::MODE_READ);
 
-TEST_F(RadosFsTest, FileReadWriteWithCallbacks)
-{
-  AddPool();
+  EXPECT_TRUE(otherFile.isReadable());
 
-  // Create file
+  // Remove file by owner
 
-  radosfs::File file(&radosFs, "/file");
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  ASSERT_EQ(0, file.create());
+  file.remove();
 
-  // Write contents into file, getting its op id providing a callback
+  // Create file by owner and not readable by others
 
-  std::string *cbArg = new std::string;
-  std::string opId;
-  std::string contents("testing...");
+  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP)));
 
-  file.write(contents.c_str(), 0, contents.length(), false, &opId,
-             fileReadWriteCallback, cbArg);
+  // Check if file is readable by non-owner
 
-  file.sync();
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  // Check that the callback was called
+  otherFile.refresh();
 
-  ASSERT_GT(cbArg->length(), 0);
+  EXPECT_FALSE(otherFile.isReadable());
 
-  ASSERT_EQ(opId, *cbArg);
+  // Change permissions using chmod and check them
 
-  // Clear reusable vars
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  cbArg->clear();
-  opId.clear();
+  EXPECT_EQ(0, file.chmod(S_IRWXU | S_IROTH));
 
-  // Read contents from file, getting its op id providing a callback
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  char *buff = new char[contents.length()];
-  std::vector<radosfs::FileReadData> intervals;
-  intervals.push_back(radosfs::FileReadData(buff, 0, contents.length(), 0));
+  file.refresh();
 
-  file.read(intervals, &opId, fileReadWriteCallback, cbArg);
+  EXPECT_TRUE(file.isReadable());
 
-  file.sync();
+  EXPECT_EQ(-EPERM, file.chmod(777));
 
-  // Check that the callback was called
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  ASSERT_GT(cbArg->length(), 0);
+  file.refresh();
 
-  ASSERT_EQ(opId, *cbArg);
+  EXPECT_EQ(0, file.chmod(0));
 
-  delete[] buff;
-  delete cbArg;
-}
+  file.refresh();
 
-TEST_F(RadosFsTest, FileInline)
-{
-  AddPool();
+  EXPECT_FALSE(file.isReadable());
 
-  radosfs::File file(&radosFs, "/file");
+  EXPECT_EQ(-EACCES, file.truncate(100));
 
-  // Create a file with an inline buffer size that is too big
+  radosFs.setIds(ROOT_UID, ROOT_UID);
 
-  ASSERT_EQ(-EINVAL, file.create(-1, "", 0, MAX_FILE_INLINE_BUFFER_SIZE + 1));
+  file.refresh();
 
-  // Create a file with a custom inline buffer size
+  EXPECT_TRUE(file.isWritable());
 
-  const size_t inlineBufferSize(512);
+  EXPECT_EQ(0, file.truncate(100));
 
-  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+  EXPECT_EQ(0, file.chmod(S_IWRITE));
 
-  EXPECT_EQ(inlineBufferSize, file.inlineBufferSize());
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  // Write contents only in the inline buffer
+  EXPECT_EQ(0, file.chmod(S_IREAD));
 
-  char contents[inlineBufferSize * 2];
-  memset(contents, 'x', inlineBufferSize * 2);
-  contents[inlineBufferSize * 2 - 1] = '\0';
+  file.refresh();
 
-  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize));
+  EXPECT_TRUE(file.isReadable());
+}
 
-  // Verify that the inode object was not created
+TEST_F(RadosFsTest, DirContents)
+{
+  AddPool();
 
-  std::string inodeObj = radosFsFilePriv(file)->inode->name();
+  // Create dir and check entries
 
-  Stat stat;
-  radosFsPriv()->stat(file.path(), &stat);
+  radosfs::Dir dir(&radosFs, "/userdir");
 
-  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(inodeObj, 0, 0));
+  EXPECT_EQ(0, dir.create());
 
-  // Read the inline contetns
+  std::set<std::string> entries;
 
-  char contents2[inlineBufferSize * 2];
+  EXPECT_EQ(0, dir.entryList(entries));
 
-  ASSERT_EQ(inlineBufferSize - 1, file.read(contents2, 0,
-                                            inlineBufferSize - 1));
+  EXPECT_EQ(0, entries.size());
 
-  EXPECT_TRUE(strncmp(contents2, contents, inlineBufferSize - 1) == 0);
+  // Create file in dir and check entries
 
-  // Write beyond than the inline buffer size and verify it creates the inode
-  // object
+  radosfs::File file(&radosFs, dir.path() + "userfile",
+                     radosfs::File::MODE_WRITE);
 
-  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+  EXPECT_EQ(0, file.create());
 
-  file.sync();
+  EXPECT_EQ(0, dir.entryList(entries));
 
-  EXPECT_EQ(0, stat.pool->ioctx.stat(inodeObj, 0, 0));
+  EXPECT_EQ(0, entries.size());
 
-  // Read the full file length
+  dir.refresh();
 
-  bzero(contents2, inlineBufferSize);
+  EXPECT_EQ(0, dir.entryList(entries));
 
-  ASSERT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+  EXPECT_EQ(1, entries.size());
 
-  contents2[inlineBufferSize * 2 - 1] = '\0';
+  // Try to create file with an existing path and check entries
 
-  EXPECT_TRUE(strcmp(contents2, contents) == 0);
+  radosfs::File sameFile(file);
+
+  EXPECT_EQ(-EEXIST, sameFile.create());
+
+  dir.refresh();
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  EXPECT_EQ(1, entries.size());
+
+  // Create a nonexisting file and check entries
+
+  const std::string &otherFileName("userfile1");
+
+  radosfs::File otherFile(&radosFs, dir.path() + otherFileName,
+                          radosfs::File::MODE_WRITE);
+
+  EXPECT_EQ(0, otherFile.create());
+
+  dir.refresh();
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  EXPECT_EQ(2, entries.size());
+
+  // Create a subdir and check entries
+
+  const std::string &subDirName("subdir");
+
+  radosfs::Dir subDir(&radosFs, dir.path() + subDirName);
+
+  EXPECT_EQ(0, subDir.create());
+
+  dir.refresh();
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  EXPECT_EQ(3, entries.size());
+
+  // Try to create a subdir with an existing path and check entries
+
+  radosfs::Dir sameSubDir(subDir);
+
+  EXPECT_EQ(0, sameSubDir.create(-1, true));
+
+  dir.refresh();
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  EXPECT_EQ(3, entries.size());
+
+  // Remove file and check entries
+
+  EXPECT_EQ(0, file.remove());
+
+  dir.refresh();
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  EXPECT_EQ(2, entries.size());
+
+  // Check entries' names
+
+  std::set<std::string>::const_iterator it = entries.begin();
+
+  EXPECT_EQ(*it, subDirName + "/");
+
+  it++;
+  EXPECT_EQ(*it, otherFileName);
+
+  // Create file and write to it
+
+  file = radosfs::File(&radosFs, "/my-file",
+                       radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create());
+
+  const std::string contents = "my file contents";
+
+  EXPECT_EQ(0, file.write(contents.c_str(), 0, contents.length()));
+
+  // Verify it was correctly written
+
+  char buff[contents.length() + 1];
+
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  buff[contents.length()] = '\0';
+
+  EXPECT_EQ(0, strcmp(contents.c_str(), buff));
+
+  // Set the file path to a dir and list it
+
+  dir.setPath(file.path());
+
+  entries.clear();
+
+  EXPECT_EQ(-ENOTDIR, dir.entryList(entries));
+
+  EXPECT_EQ(0, entries.size());
+
+  std::string entry;
+
+  EXPECT_EQ(-ENOTDIR, dir.entry(0, entry));
+
+  // Verify that the file contents were not touched
+
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  EXPECT_EQ(0, strcmp(contents.c_str(), buff));
+}
+
+TEST_F(RadosFsTest, FileInode)
+{
+  AddPool();
+
+  Stat stat;
+  const std::string fileName("/test");
+
+  radosfs::File file(&radosFs, fileName);
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+
+  EXPECT_EQ(0, file.truncate(1));
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+
+  testFileInodeBackLink(file.path());
+
+  EXPECT_EQ(0, stat.pool->ioctx.remove(stat.translatedPath));
+
+  // Override the hasBackLink var in the FileIO instance because it is not aware
+  // that the inode object has been removed
+
+  radosfs::FilePriv *filePriv = radosFsFilePriv(file);
+
+  fileInodePriv(*filePriv->inode)->io->setHasBackLink(false);
+
+  EXPECT_EQ(0, file.write("X", 0, 1));
+
+  file.sync();
+
+  testFileInodeBackLink(file.path());
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+
+  std::string inode, pool;
+
+  ASSERT_EQ(0, radosFs.getInodeAndPool(file.path(), &inode, &pool));
+
+  EXPECT_EQ(stat.translatedPath, inode);
+
+  EXPECT_EQ(stat.pool->name, pool);
+}
+
+TEST_F(RadosFsTest, FileInodeDirect)
+{
+  AddPool();
+
+  // Create an inode with a given name
+
+  std::string inodeName(generateUuid());
+
+  radosfs::FileInode inode(&radosFs, TEST_POOL, inodeName);
+
+  EXPECT_EQ(inode.name(), inodeName);
+
+  // Create an inode with an automatic generated name
+
+  radosfs::FileInode otherInode(&radosFs, TEST_POOL);
+
+  EXPECT_NE(inode.name(), otherInode.name());
+
+  size_t contentsSize = 1024;
+
+  char buff[contentsSize];
+
+  // Read an inode that does not exist (doesn't have any chunks)
+
+  EXPECT_EQ(-ENOENT, inode.read(buff, 0, contentsSize));
+
+  // Write synchronously into an inode
+
+  char contents[contentsSize];
+  memset(contents, 'x', contentsSize);
+  contents[contentsSize - 1] = '\0';
+
+  ASSERT_EQ(0, inode.writeSync(contents, 0, contentsSize));
+
+  // Check the size of the inode
+
+  u_int64_t size = 0;
+
+  ASSERT_EQ(0, inode.getSize(size));
+
+  ASSERT_EQ(static_cast<u_int64_t>(contentsSize), size);
+
+  // Read its contents
+
+  ASSERT_GT(inode.read(buff, 0, contentsSize), 0);
+
+  EXPECT_EQ(0, strcmp(contents, buff));
+
+  memset(contents, 'y', contentsSize / 2);
+
+  // Write asynchronously into an inode
+
+  ASSERT_EQ(0, inode.write(contents, 0, contentsSize));
+
+  inode.sync();
+
+  // Read its contents
+
+  ASSERT_GT(inode.read(buff, 0, contentsSize), 0);
+
+  EXPECT_EQ(0, strcmp(contents, buff));
+
+  // Truncate the inode to half and read it again
+
+  ASSERT_EQ(0, inode.truncate(contentsSize / 2));
+
+  EXPECT_EQ(contentsSize / 2, inode.read(buff, 0, contentsSize));
+
+  EXPECT_EQ(contentsSize / 3, inode.read(buff, 0, contentsSize / 3));
+
+  // Set xattr on the inode
+
+  std::string xattrKey("xattr-test-key");
+  std::string xattrValue("xattr-test-value");
+
+  EXPECT_EQ(0, inode.setXAttr(xattrKey, xattrValue));
+
+  // Get xattr from the inode
+  std::string xattrOutValue;
+
+  EXPECT_EQ(xattrValue.length(), inode.getXAttr(xattrKey, xattrOutValue));
+
+  EXPECT_EQ(xattrValue, xattrOutValue);
+
+  // Get the map of xattributes from the inode
+  std::map<std::string, std::string> xattrsMap;
+
+  EXPECT_EQ(0, inode.getXAttrsMap(xattrsMap));
+
+  ASSERT_EQ(1, xattrsMap.count(XATTR_SYS_PREFIX + xattrKey));
+
+  EXPECT_EQ(xattrValue, xattrsMap[XATTR_SYS_PREFIX + xattrKey]);
+
+  // Check the backlink set on the inode
+
+  std::string backLink;
+
+  EXPECT_EQ(-ENODATA, inode.getBackLink(&backLink));
+
+  radosfs::File file(&radosFs, "/file");
+
+  EXPECT_FALSE(file.exists());
+
+  // Create a file
+
+  radosfs::File file1(&radosFs, "/file1");
+
+  ASSERT_EQ(0, file1.create());
+
+  // Register the inode with an invalid file path
+
+  ASSERT_EQ(-EISDIR, inode.registerFile("/", TEST_UID, TEST_GID, O_RDWR));
+
+  ASSERT_EQ(-EINVAL, inode.registerFile("", TEST_UID, TEST_GID, O_RDWR));
+
+  ASSERT_EQ(-EINVAL, inode.registerFile("no-slash-file", TEST_UID, TEST_GID,
+                                        O_RDWR));
+
+  ASSERT_EQ(-ENOENT, inode.registerFile("/nonexitent/file", TEST_UID, TEST_GID,
+                                        O_RDWR));
+
+  ASSERT_EQ(-EINVAL, inode.registerFile("/file1/file", TEST_UID, TEST_GID,
+                                        O_RDWR));
+
+  // Register the inode with an existing file path
+
+  ASSERT_EQ(-EEXIST, inode.registerFile(file1.path(), TEST_UID, TEST_GID,
+                                        O_RDWR));
+
+  radosfs::Dir dir(&radosFs, "/");
+
+  ASSERT_EQ(0, dir.createLink("/dir-link/"));
+
+  // Register the inode with a link path
+
+  ASSERT_EQ(-EINVAL, inode.registerFile("/dir-link/file", TEST_UID, TEST_GID,
+                                        O_RDWR));
+
+  // Register the inode with a new file path
+
+  ASSERT_EQ(0, inode.registerFile(file.path(), TEST_UID, TEST_GID, O_RDWR));
+
+  file.refresh();
+
+  // Verify the xattributes previously set on the inode
+
+  xattrOutValue.clear();
+
+  ASSERT_EQ(xattrValue.length(),
+            file.getXAttr(XATTR_SYS_PREFIX + xattrKey, xattrOutValue));
+
+  EXPECT_EQ(xattrValue, xattrOutValue);
+
+  xattrsMap.clear();
+
+  ASSERT_EQ(0, file.getXAttrsMap(xattrsMap));
+
+  ASSERT_EQ(1, xattrsMap.count(XATTR_SYS_PREFIX + xattrKey));
+
+  // Set xattribute from file
+
+  xattrKey = "xattr-from-file";
+  xattrValue = "value-from-file";
+
+  ASSERT_EQ(0, file.setXAttr(xattrKey, xattrValue));
+
+  // Verify the xattribute from inode
+
+  ASSERT_EQ(xattrValue.length(), file.getXAttr(XATTR_USER_PREFIX + xattrKey,
+                                               xattrOutValue));
+
+  ASSERT_EQ(xattrValue, xattrOutValue);
+
+  // Remove the xattribute from the inode
+
+  ASSERT_EQ(0, inode.removeXAttr(XATTR_USER_PREFIX + xattrKey));
+
+  // Verify that the xattribute no longer exists
+
+  ASSERT_EQ(-ENODATA, inode.getXAttr(XATTR_USER_PREFIX + xattrKey,
+                                     xattrOutValue));
+
+  ASSERT_EQ(-ENODATA, file.getXAttr(XATTR_USER_PREFIX + xattrKey,
+                                    xattrOutValue));
+
+  // Verify the registered file exists
+
+  EXPECT_TRUE(file.exists());
+
+  // Check the backlink set on the inode
+
+  EXPECT_EQ(0, inode.getBackLink(&backLink));
+
+  EXPECT_EQ(file.path(), backLink);
+
+  // Read from the registered file
+
+  memset(buff, 0, contentsSize / 2);
+
+  ASSERT_EQ(contentsSize / 2, file.read(buff, 0, contentsSize / 2));
+
+  EXPECT_EQ(0, strncmp(contents, buff, contentsSize / 2));
+
+  // Stat from the registered file and check it
+
+  Stat fileStat;
+
+  ASSERT_EQ(0, radosFsPriv()->stat(file.path(), &fileStat));
+
+  EXPECT_EQ(TEST_UID, fileStat.statBuff.st_uid);
+
+  EXPECT_EQ(TEST_GID, fileStat.statBuff.st_gid);
+
+  EXPECT_TRUE((fileStat.statBuff.st_mode & O_RDWR) != 0);
+
+  EXPECT_EQ(inode.name(), fileStat.translatedPath);
+
+  // Remove the inode and try to read it
+
+  ASSERT_EQ(0, inode.remove());
+
+  EXPECT_EQ(-ENOENT, inode.read(buff, 0, 1));
+}
+
+TEST_F(RadosFsTest, FileTruncate)
+{
+  AddPool();
+
+  // Make the files' chunk size small so many chunks will be generated
+
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
+
+  const std::string fileName("/test");
+  char contents[chunkSize * 10];
+  memset(contents, 'x', chunkSize * 10);
+  unsigned long long size = 1024;
+
+  // Create a file and truncate it to the content's size
+
+  radosfs::File file(&radosFs, fileName,
+                     radosfs::File::MODE_WRITE);
+
+  EXPECT_EQ(0, file.create());
+
+  EXPECT_EQ(0, file.write(contents, 0, chunkSize * 10));
+
+  EXPECT_EQ(0, file.truncate(size));
+
+  // Setting a fake path to file so its cache is dumped and we have a "fresh"
+  // new instance below with sameFile which is necessary to check if the
+  // file chunk size persistency is working
+
+  file.setPath("/fake");
+
+  // Create a new instance of the same file and check the size
+
+  radosfs::File sameFile(&radosFs, fileName,
+                         radosfs::File::MODE_READ);
+
+  struct stat buff;
+
+  // Setting a different chunk size before checking sameFile's size because
+  // it should have been set in the file when it was written
+
+  radosFs.setFileChunkSize(chunkSize + 1);
+
+  EXPECT_EQ(0, sameFile.stat(&buff));
+
+  EXPECT_EQ(size, buff.st_size);
+
+  // Get the right file instance back again
+
+  file = sameFile;
+
+  // Truncate the file to 0 and verify
+
+  EXPECT_EQ(0, file.truncate(0));
+
+  sameFile.refresh();
+
+  EXPECT_EQ(0, sameFile.stat(&buff));
+
+  EXPECT_EQ(0, buff.st_size);
+
+  // Truncate the file to a non-multiple of the chunk size and verify
+
+  size = chunkSize * 5.3;
+
+  EXPECT_EQ(0, file.truncate(size));
+
+  sameFile.refresh();
+
+  EXPECT_EQ(0, sameFile.stat(&buff));
+
+  EXPECT_EQ(size, buff.st_size);
+
+  // Truncate the file to a half of the chunk size and verify
+
+  size = chunkSize / 2;
+
+  EXPECT_EQ(0, file.truncate(size));
+
+  sameFile.refresh();
+
+  EXPECT_EQ(0, sameFile.stat(&buff));
+
+  EXPECT_EQ(size, buff.st_size);
+}
+
+TEST_F(RadosFsTest, FileReadWrite)
+{
+  AddPool();
+
+  // Set a small file chunk size so many chunks will be created
+
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
+
+  // Write contents in file synchronously
+
+  const std::string fileName("/test");
+  const std::string contents("this is a test");
+
+  radosfs::File file(&radosFs, fileName,
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create());
+
+  // Read from an empty file
+
+  char *buff = new char[contents.length() + 1];
+
+  EXPECT_EQ(0, file.read(buff, 0, contents.length()));
+
+  delete[] buff;
+
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  // Read and verify the contents
+
+  buff = new char[contents.length() + 1];
+
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  buff[contents.length()] = '\0';
+
+  EXPECT_EQ(0, strcmp(buff, contents.c_str()));
+
+  // Verify size with stat
+
+  radosfs::File sameFile(&radosFs, fileName,
+                         radosfs::File::MODE_READ);
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, sameFile.stat(&statBuff));
+
+  EXPECT_EQ(contents.length(), statBuff.st_size);
+
+  delete[] buff;
+
+  // Write other contents in file asynchronously
+
+  std::string contents2("this is another test ");
+
+  for (size_t i = 0; i < chunkSize; i++)
+    contents2 += "this is another test ";
+
+  buff = new char[contents2.length() + 1];
+
+  EXPECT_EQ(0, file.write(contents2.c_str(), 0, contents2.length()));
+
+  // Read and verify the contents
+
+  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+
+  buff[contents2.length()] = '\0';
+
+  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+
+  // Change the contents of the file and verify them
+
+  int charToChange = chunkSize * 1.3;
+  EXPECT_EQ(0, file.writeSync("d", charToChange, 1));
+
+  contents2[charToChange] = 'd';
+
+  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+
+  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+
+  charToChange = chunkSize * 1.9;
+  EXPECT_EQ(0, file.write("x", charToChange, 1, true));
+
+  contents2[charToChange] = 'x';
+
+  EXPECT_EQ(0, file.sync());
+
+  EXPECT_EQ(contents2.length(), file.read(buff, 0, contents2.length()));
+
+  buff[contents2.length()] = '\0';
+
+  EXPECT_EQ(0, strcmp(buff, contents2.c_str()));
+
+  EXPECT_EQ(0, file.stat(&statBuff));
+
+  EXPECT_EQ(contents2.length(), statBuff.st_size);
+
+  // Read outside of the file's size (from the file size to 2x file size)
+
+  ASSERT_EQ(0, file.read(buff, statBuff.st_size, statBuff.st_size * 2));
+
+  // Increase the file size and read a region that doesn't have corresponding
+  // chunks
+
+  const size_t fileOldSize = statBuff.st_size;
+
+  ASSERT_EQ(0, file.truncate(fileOldSize * 2));
+
+  // Read in a region of the file without existing chunks
+  // (read the second half of the file)
+
+  ASSERT_EQ(fileOldSize, file.read(buff, fileOldSize,
+                                   (fileOldSize * 2) - fileOldSize));
+
+  char *blankContents = new char[contents2.length() + 1];
+  memset(blankContents, '\0', contents2.length());
+
+  EXPECT_EQ(0, strcmp(buff, blankContents));
+
+  delete[] buff;
+  delete[] blankContents;
+}
+
+TEST_F(RadosFsTest, FileVectorRead)
+{
+  AddPool();
+
+  // Set a small file chunk size so many chunks will be created
+
+  const size_t chunkSize = 64;
+  radosFs.setFileChunkSize(chunkSize);
+
+  // Write contents in file synchronously
+
+  const std::string fileName("/test");
+  std::stringstream sstream;
+  for (size_t i = 0; i < chunkSize * 1.5; i++)
+    sstream << i << ".";
+
+  const std::string contents(sstream.str());
+
+  radosfs::File file(&radosFs, fileName);
+
+  const size_t inlineSize = 8;
+  EXPECT_EQ(0, file.create(-1, "", 0, inlineSize));
+
+  // Write contents to file
+
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  const size_t fileSize = contents.length() + contents.length() / 2;
+  EXPECT_EQ(0, file.truncate(fileSize));
+
+  // Read and verify the contents
+
+  char *buff = new char[fileSize + 1];
+  char *buff2 = new char[fileSize + 1];
+
+  memcpy(buff2, contents.c_str(), contents.length());
+  bzero(buff2 + contents.length(), fileSize - contents.length());
+
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  EXPECT_EQ(0, strncmp(buff, contents.c_str(), contents.length()));
+
+  ssize_t retValue, retValue1, retValue2, retValue3;
+  size_t readLength = inlineSize / 2;
+  size_t readLength1 = inlineSize;
+  size_t readLength2 = fileSize * 2;
+
+  std::vector<radosfs::FileReadData> intervals;
+  intervals.push_back(radosfs::FileReadData(buff, 0, readLength, &retValue));
+  intervals.push_back(radosfs::FileReadData(buff + readLength, readLength,
+                                            readLength1, &retValue1));
+
+  intervals.push_back(radosfs::FileReadData(buff + readLength + readLength1,
+                                            readLength + readLength1,
+                                            readLength2, &retValue2));
+  intervals.push_back(radosfs::FileReadData(buff, fileSize + 2, 1,
+                                            &retValue3));
+  std::string opId;
+
+  memset(buff, 'x', fileSize + 1);
+
+  EXPECT_EQ(0, file.read(intervals, &opId));
+
+  int ret = file.sync(opId);
+
+  // -ENOENT Because one of the operations goes beyond the file size
+  ASSERT_EQ(-ENOENT, ret);
+
+  EXPECT_EQ(readLength, retValue);
+  EXPECT_EQ(readLength1, retValue1);
+  EXPECT_EQ(fileSize - (readLength + readLength1), retValue2);
+  EXPECT_EQ(0, retValue3);
+  EXPECT_EQ(0, strncmp(buff, contents.c_str(), contents.length()));
+  EXPECT_EQ(0, strncmp(buff, buff2, fileSize));
+  EXPECT_EQ(0, strncmp(buff, contents.c_str(), readLength + readLength1));
+
+  radosfs::File otherFile(&radosFs, "/test1");
+
+  EXPECT_EQ(-ENOENT, otherFile.read(intervals, &opId));
+
+  EXPECT_EQ(0, otherFile.create(-1, "", 0, 0));
+
+  EXPECT_EQ(0, otherFile.read(intervals, &opId));
+
+  ret = otherFile.sync(opId);
+
+  // -ENOENT Because one of the operations goes beyond the file size
+  ASSERT_EQ(-ENOENT, ret);
+
+  EXPECT_EQ(0, retValue);
+  EXPECT_EQ(0, retValue1);
+  EXPECT_EQ(0, retValue2);
+  EXPECT_EQ(0, retValue3);
+
+  EXPECT_EQ(0, otherFile.truncate(readLength));
+
+  EXPECT_EQ(0, otherFile.read(intervals, &opId));
+
+  ret = otherFile.sync(opId);
+
+  // -ENOENT Because one of the operations goes beyond the file size
+  ASSERT_EQ(-ENOENT, ret);
+
+  bzero(buff2, readLength);
+
+  EXPECT_EQ(readLength, retValue);
+  EXPECT_EQ(0, strncmp(buff, buff2, readLength));
+  EXPECT_EQ(0, retValue1);
+  EXPECT_EQ(0, retValue2);
+  EXPECT_EQ(0, retValue3);
+
+
+  delete buff;
+  delete buff2;
+}
+
+void fileReadWriteCallback(const std::string &opId, int retCode, void *arg)
+{
+  std::string *argStr = static_cast<std::string *>(arg);
+
+  ASSERT_EQ(0, retCode);
+
+  argStr->assign(opId);
+}
+
+TEST_F(RadosFsTest, FileReadWriteWithCallbacks)
+{
+  AddPool();
+
+  // Create file
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create());
+
+  // Write contents into file, getting its op id providing a callback
+
+  std::string *cbArg = new std::string;
+  std::string opId;
+  std::string contents("testing...");
+
+  file.write(contents.c_str(), 0, contents.length(), false, &opId,
+             fileReadWriteCallback, cbArg);
+
+  file.sync();
+
+  // Check that the callback was called
+
+  ASSERT_GT(cbArg->length(), 0);
+
+  ASSERT_EQ(opId, *cbArg);
+
+  // Clear reusable vars
+
+  cbArg->clear();
+  opId.clear();
+
+  // Read contents from file, getting its op id providing a callback
+
+  char *buff = new char[contents.length()];
+  std::vector<radosfs::FileReadData> intervals;
+  intervals.push_back(radosfs::FileReadData(buff, 0, contents.length(), 0));
+
+  file.read(intervals, &opId, fileReadWriteCallback, cbArg);
+
+  file.sync();
+
+  // Check that the callback was called
+
+  ASSERT_GT(cbArg->length(), 0);
+
+  ASSERT_EQ(opId, *cbArg);
+
+  delete[] buff;
+  delete cbArg;
+}
+
+TEST_F(RadosFsTest, FileInline)
+{
+  AddPool();
+
+  radosfs::File file(&radosFs, "/file");
+
+  // Create a file with an inline buffer size that is too big
+
+  ASSERT_EQ(-EINVAL, file.create(-1, "", 0, MAX_FILE_INLINE_BUFFER_SIZE + 1));
+
+  // Create a file with a custom inline buffer size
+
+  const size_t inlineBufferSize(512);
+
+  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+
+  EXPECT_EQ(inlineBufferSize, file.inlineBufferSize());
+
+  // Write contents only in the inline buffer
+
+  char contents[inlineBufferSize * 2];
+  memset(contents, 'x', inlineBufferSize * 2);
+  contents[inlineBufferSize * 2 - 1] = '\0';
+
+  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize));
+
+  // Verify that the inode object was not created
+
+  std::string inodeObj = radosFsFilePriv(file)->inode->name();
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  // Read the inline contetns
+
+  char contents2[inlineBufferSize * 2];
+
+  ASSERT_EQ(inlineBufferSize - 1, file.read(contents2, 0,
+                                            inlineBufferSize - 1));
+
+  EXPECT_TRUE(strncmp(contents2, contents, inlineBufferSize - 1) == 0);
+
+  // Write beyond than the inline buffer size and verify it creates the inode
+  // object
+
+  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+
+  file.sync();
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  // Read the full file length
+
+  bzero(contents2, inlineBufferSize);
+
+  ASSERT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+
+  contents2[inlineBufferSize * 2 - 1] = '\0';
+
+  EXPECT_TRUE(strcmp(contents2, contents) == 0);
+
+  // Truncate so contents only exist in the inline buffer
+
+  ASSERT_EQ(0, file.truncate(inlineBufferSize / 2));
+
+  // Verify that the size of the contents read match what was truncated
+
+  EXPECT_EQ(inlineBufferSize / 2, file.read(contents2, 0, inlineBufferSize / 2));
+
+  // Truncate to 0
+
+  ASSERT_EQ(0, file.truncate(0));
+
+  // Write beyond the inline buffer when it is not full and then only up to
+  // half of it
+
+  bzero(contents2, inlineBufferSize * 2);
+
+  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+
+  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize / 2));
+
+  // Verify that all contents are read
+
+  EXPECT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+
+  char blankContents[inlineBufferSize / 2];
+  memset(blankContents, '\0', inlineBufferSize / 2);
+
+  EXPECT_TRUE(strncmp(contents2 + inlineBufferSize / 2, blankContents,
+                      inlineBufferSize / 2) == 0);
+}
+
+TEST_F(RadosFsTest, RenameFile)
+{
+  AddPool();
+
+  std::string originalPath("/my-file");
+  std::string path("/moved-file");
+
+  radosfs::File file(&radosFs, originalPath);
+
+  // Rename file that doesn't exist
+
+  EXPECT_EQ(-ENOENT, file.rename(path));
+
+  EXPECT_EQ(0, file.create());
+
+  // Move file into a directory that doesn't exist
+
+  EXPECT_EQ(-ENOENT, file.rename("/phony/" + path));
+
+  // Move file in the same directory
+
+  EXPECT_EQ(0, file.rename(path));
+
+  EXPECT_EQ(path, file.path());
+
+  EXPECT_TRUE(file.exists());
+
+  // Make sure that renaming didn't create the inode
+
+  Stat stat;
+
+  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+
+  file.setPath(originalPath);
+
+  EXPECT_FALSE(file.exists());
+
+  // Create a user directory
+
+  radosfs::Dir userDir(&radosFs, "/user-dir");
+
+  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  file.setPath(path);
+
+  // Rename file without the required permissions
+
+  EXPECT_EQ(-EACCES, file.rename(originalPath));
+
+  // Rename a file as user
+
+  path = userDir.path() + "user-file";
+
+  file.setPath(path);
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 124));
+
+  // Add contents to the file's inline buffer
+
+  std::string fileContents = "abcdef";
+  char *fileContsBuff = new char[fileContents.length()];
+
+  EXPECT_EQ(0, file.writeSync(fileContents.c_str(), 0, fileContents.length()));
+
+  EXPECT_EQ(fileContents.length(),
+            file.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Move the file inside the same directory
+
+  path = userDir.path() + "file";
+
+  EXPECT_EQ(0, file.rename(path));
+
+  radosfs::File sameFile(&radosFs, path);
+
+  EXPECT_TRUE(sameFile.exists());
+
+  // Check the contents
+
+  bzero(fileContsBuff, fileContents.length());
+
+  EXPECT_EQ(fileContents.length(),
+            sameFile.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Get the user dir's entries
+
+  std::set<std::string> entries;
+
+  userDir.refresh();
+
+  EXPECT_EQ(0, userDir.entryList(entries));
+
+  // Rename the file (owned by the user) as root
+
+  radosFs.setIds(ROOT_UID, ROOT_UID);
+
+  path = "/file-moved";
+
+  EXPECT_EQ(0, sameFile.rename(path));
+
+  file.setPath(path);
+
+  EXPECT_TRUE(file.exists());
+
+  // Check the contents again
+
+  bzero(fileContsBuff, fileContents.length());
+
+  EXPECT_EQ(fileContents.length(),
+            file.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Get the user dir's contents again and compare them with the old ones
+
+  std::set<std::string> entries1;
+
+  userDir.refresh();
+
+  EXPECT_EQ(0, userDir.entryList(entries1));
+
+  EXPECT_LT(entries1.size(), entries.size());
+
+  EXPECT_EQ(entries1.find("file"), entries1.end());
+
+  // Verify that the new file's parent can list it
+
+  entries.clear();
+
+  radosfs::Dir rootDir(&radosFs, "/");
+
+  rootDir.refresh();
+
+  EXPECT_EQ(0, rootDir.entryList(entries));
+
+  EXPECT_NE(entries.find("file-moved"), entries.end());
+
+  // Move the file to the user's dir
+
+  path = userDir.path() + path;
+
+  EXPECT_EQ(0, file.rename(path));
+
+  sameFile.setPath(path);
+
+  EXPECT_TRUE(sameFile.exists());
+
+  // Rename the file to an empty path argument
+
+  EXPECT_EQ(-EINVAL, file.rename(""));
+
+  // Rename the file to its own name
+
+  EXPECT_EQ(-EPERM, file.rename(file.path()));
+
+  // Rename the file to a directory path
+
+  EXPECT_EQ(-EISDIR, file.rename(userDir.path()));
+
+  // Rename the file to be in the root directory
+
+  path = "/file";
+
+  EXPECT_EQ(0, file.rename(path));
+
+  EXPECT_EQ(path, file.path());
+
+  sameFile.refresh();
+
+  EXPECT_FALSE(sameFile.exists());
+
+  // Create a file without an inline buffer so we check if the backlink in its
+  // inode gets updated when the file is renamed
+
+  file = radosfs::File(&radosFs, "/new-file");
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  EXPECT_EQ(0, file.writeSync("x", 0, 1));
+
+  testFileInodeBackLink(file.path());
+
+  path = "/new-file-renamed";
 
-  // Truncate so contents only exist in the inline buffer
+  EXPECT_EQ(0, file.rename(path));
 
-  ASSERT_EQ(0, file.truncate(inlineBufferSize / 2));
+  ASSERT_EQ(path, file.path());
 
-  // Verify that the size of the contents read match what was truncated
+  testFileInodeBackLink(file.path());
 
-  EXPECT_EQ(inlineBufferSize / 2, file.read(contents2, 0, inlineBufferSize / 2));
+  delete[] fileContsBuff;
+}
 
-  // Truncate to 0
+bool
+checkChunksExistence(librados::IoCtx ioctx, const std::string &baseName,
+                      size_t firstChunk, size_t lastChunk, bool shouldExist)
+{
+  bool checkResult = true;
+  for (size_t i = firstChunk; i <= lastChunk; i++)
+  {
+    std::string chunk = makeFileChunkName(baseName, i);
 
-  ASSERT_EQ(0, file.truncate(0));
+    if (ioctx.stat(chunk, 0, 0) != 0)
+    {
+      if (shouldExist)
+      {
+        fprintf(stderr, "Error: Chunk %s does not exist!\n", chunk.c_str());
+        checkResult = false;
+      }
+    }
+    else if (!shouldExist)
+    {
+      fprintf(stderr, "Error: Chunk %s exist!\n", chunk.c_str());
+      checkResult = false;
+    }
+  }
 
-  // Write beyond the inline buffer when it is not full and then only up to
-  // half of it
+  return checkResult;
+}
 
-  bzero(contents2, inlineBufferSize * 2);
+TEST_F(RadosFsTest, FileOpsMultClientsWriteTruncate)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, 0, true));
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 1, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, FileOpsMultClientsWriteRemove)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, FileOpsMultClientsTruncateRemove)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, DirOpsMultipleClients)
+{
+  radosFs.addDataPool(TEST_POOL, "/", 50 * 1024);
+  radosFs.addMetadataPool(TEST_POOL, "/");
+
+  // Create another RadosFs instance to be used as a different client
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL, "/");
+
+  // Create the same directory from both clients
+
+  radosfs::Dir cli1DirInst(&radosFs, "/dir");
+  radosfs::Dir cli2DirInst(&otherClient, "/dir");
+
+  EXPECT_EQ(0, cli1DirInst.create());
+  EXPECT_EQ(-EEXIST, cli2DirInst.create());
+
+  // Launch 10 threads for each client, creating files and dirs in the same
+  // directory
+
+  const int numOps = 10;
+  boost::thread *cli1Threads[numOps], *cli2Threads[numOps];
+  FsActionInfo *cli1ActionInfos[numOps];
+  FsActionInfo *cli2ActionInfos[numOps];
+
+  for (int i = 0; i < numOps; i++)
+  {
+    bool createDir = (i % 2) == 0;
+    FsActionType actionType = FS_ACTION_TYPE_FILE;
+    std::stringstream stream;
+    stream << cli1DirInst.path();
+
+    if (createDir)
+    {
+      stream << "client-1-dir-" << i;
+      actionType = FS_ACTION_TYPE_DIR;
+    }
+    else
+    {
+      stream << "client-1-file-" << i;
+    }
+
+    cli1ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
+                                          "create", "", 0, 0, 0);
+    cli1Threads[i] = new boost::thread(&RadosFsTest::runInThread,
+                                       cli1ActionInfos[i]);
+  }
+
+  for (int i = 0; i < numOps; i++)
+  {
+    bool createDir = (i % 2) != 0;
+    FsActionType actionType = FS_ACTION_TYPE_FILE;
+    std::stringstream stream;
+    stream << cli2DirInst.path();
+
+    if (createDir)
+    {
+      stream << "client-1-dir-" << i;
+      actionType = FS_ACTION_TYPE_DIR;
+    }
+    else
+    {
+      stream << "client-1-file-" << i;
+    }
+
+    cli2ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
+                                          "create", "", 0, 0, 0);
+
+    cli2Threads[i] = new boost::thread(&RadosFsTest::runInThread,
+                                       cli2ActionInfos[i]);
+  }
+
+  for (int i = 0; i < numOps; i++)
+  {
+    cli1Threads[i]->join();
+    cli2Threads[i]->join();
+
+    delete cli1Threads[i];
+    delete cli1ActionInfos[i];
+    delete cli2Threads[i];
+    delete cli2ActionInfos[i];
+  }
+
+  // Verify that both dir instances have the same number of entries
+
+  cli1DirInst.refresh();
+
+  std::set<std::string> entries;
+
+  EXPECT_EQ(0, cli1DirInst.entryList(entries));
+
+  EXPECT_EQ(2 * numOps, entries.size());
+
+  entries.clear();
+  cli2DirInst.refresh();
+
+  EXPECT_EQ(0, cli2DirInst.entryList(entries));
+
+  EXPECT_EQ(2 * numOps, entries.size());
+}
+
+TEST_F(RadosFsTest, StatCluster)
+{
+  AddPool();
+
+  uint64_t total = 0, used = 1, available = 1, numberOfObjects;
+
+  int ret = radosFs.statCluster(&total, &used, &available, &numberOfObjects);
+
+  EXPECT_EQ(0, ret);
+
+  EXPECT_GT(total, used);
+
+  EXPECT_GT(total, available);
+}
+
+TEST_F(RadosFsTest, XAttrs)
+{
+  AddPool();
+
+  // Create a folder for the user
+
+  radosfs::Dir dir(&radosFs, "/user");
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+
+  const std::string &fileName(dir.path() + "file");
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  // Create a file for the xattrs
+
+  radosfs::File file(&radosFs, fileName,
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+
+  // Get an inexistent
+
+  std::string xAttrValue;
+
+  EXPECT_EQ(-ENODATA, radosFs.getXAttr(fileName, "inexistent", xAttrValue));
 
-  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+  // Set a user attribute
 
-  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize / 2));
+  const std::string attr("usr.attr");
+  const std::string value("value");
+  EXPECT_EQ(0, radosFs.setXAttr(fileName, attr, value));
 
-  // Verify that all contents are read
+  testFileInodeBackLink(fileName);
 
-  EXPECT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+  // Check if the attribute got into the file inode's omap
 
-  char blankContents[inlineBufferSize / 2];
-  memset(blankContents, '\0', inlineBufferSize / 2);
+  Stat stat;
+  ASSERT_EQ(0, radosFsPriv()->stat(fileName, &stat));
 
-  EXPECT_TRUE(strncmp(contents2 + inlineBufferSize / 2, blankContents,
-                      inlineBufferSize / 2) == 0);
-}
+  std::map<std::string, librados::bufferlist> omap;
+  std::set<std::string> omapKeys;
 
-TEST_F(RadosFsTest, RenameFile)
-{
-  AddPool();
+  omapKeys.insert(attr);
+  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
+                                              &omap));
 
-  std::string originalPath("/my-file");
-  std::string path("/moved-file");
+  ASSERT_TRUE(omap.find(attr) != omap.end());
 
-  radosfs::File file(&radosFs, originalPath);
+  // Get the attribute set above
 
-  // Rename file that doesn't exist
+  std::string xAttrValue1;
 
-  EXPECT_EQ(-ENOENT, file.rename(path));
+  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
 
-  EXPECT_EQ(0, file.create());
+  // Verify that using the xattr with or without the "usr." prefix is the same
 
-  // Move file into a directory that doesn't exist
+  EXPECT_EQ(xAttrValue.length(), radosFs.getXAttr(fileName, "attr",
+                                                  xAttrValue1));
 
-  EXPECT_EQ(-ENOENT, file.rename("/phony/" + path));
+  EXPECT_EQ(xAttrValue, xAttrValue1);
 
-  // Move file in the same directory
+  // Check the attribtue's value
 
-  EXPECT_EQ(0, file.rename(path));
+  EXPECT_EQ(value, xAttrValue);
 
-  EXPECT_EQ(path, file.path());
+  // Change to another user
 
-  EXPECT_TRUE(file.exists());
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
 
-  // Make sure that renaming didn't create the inode
+  // Set an xattr by an unauthorized user
 
-  Stat stat;
+  EXPECT_EQ(-EACCES, radosFs.setXAttr(fileName, attr, value));
 
-  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+  // Get an xattr by a user who can only read
 
-  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
 
-  file.setPath(originalPath);
+  // Check the attribute's value
 
-  EXPECT_FALSE(file.exists());
+  EXPECT_EQ(value, xAttrValue);
 
-  // Create a user directory
+  // Remove an xattr by an unauthorized user
 
-  radosfs::Dir userDir(&radosFs, "/user-dir");
+  EXPECT_EQ(-EACCES, radosFs.removeXAttr(fileName, attr));
 
-  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+  // Get the xattrs map
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  std::map<std::string, std::string> map;
 
-  file.setPath(path);
+  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
 
-  // Rename file without the required permissions
+  // Check the xattrs map's size
 
-  EXPECT_EQ(-EACCES, file.rename(originalPath));
+  EXPECT_EQ(1, map.size());
 
-  // Rename a file as user
+  // Switch to the root user
 
-  path = userDir.path() + "user-file";
+  radosFs.setIds(ROOT_UID, ROOT_UID);
 
-  file.setPath(path);
+  map.clear();
 
-  EXPECT_EQ(0, file.create(-1, "", 0, 124));
+  // Set an xattr -- when being root -- in a different user's file
 
-  // Add contents to the file's inline buffer
+  EXPECT_EQ(0, radosFs.setXAttr(fileName, "sys.attribute", "check"));
 
-  std::string fileContents = "abcdef";
-  char *fileContsBuff = new char[fileContents.length()];
+  // Get the xattrs map
 
-  EXPECT_EQ(0, file.writeSync(fileContents.c_str(), 0, fileContents.length()));
+  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
 
-  EXPECT_EQ(fileContents.length(),
-            file.read(fileContsBuff, 0, fileContents.length()));
+  // Check the xattrs map's size
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  EXPECT_EQ(2, map.size());
 
-  // Move the file inside the same directory
+  // Check the xattrs map's value
 
-  path = userDir.path() + "file";
+  EXPECT_EQ(map[attr], value);
 
-  EXPECT_EQ(0, file.rename(path));
+  // Set an attribute in a directory
 
-  radosfs::File sameFile(&radosFs, path);
+  const std::string dirAttr("usr.dir-attr");
+  EXPECT_EQ(0, radosFs.setXAttr(dir.path(), dirAttr, "check"));
 
-  EXPECT_TRUE(sameFile.exists());
+  // Check if the attribute got into the dir inode's omap
 
-  // Check the contents
+  stat.reset();
+  ASSERT_EQ(0, radosFsPriv()->stat(dir.path(), &stat));
 
-  bzero(fileContsBuff, fileContents.length());
+  omap.clear();
+  omapKeys.clear();
 
-  EXPECT_EQ(fileContents.length(),
-            sameFile.read(fileContsBuff, 0, fileContents.length()));
+  omapKeys.insert(dirAttr);
+  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
+                                              &omap));
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  ASSERT_TRUE(omap.find(dirAttr) != omap.end());
+}
 
-  // Get the user dir's entries
+TEST_F(RadosFsTest, XAttrsInInfo)
+{
+  AddPool();
 
-  std::set<std::string> entries;
+  radosfs::Dir dir(&radosFs, "/user");
 
-  userDir.refresh();
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH),
+                          false, TEST_UID, TEST_GID));
 
-  EXPECT_EQ(0, userDir.entryList(entries));
+  testXAttrInFsInfo(dir);
 
-  // Rename the file (owned by the user) as root
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  // Create a file for the xattrs
 
-  path = "/file-moved";
+  radosfs::File file(&radosFs, dir.path() + "file",
+                     radosfs::File::MODE_READ_WRITE);
 
-  EXPECT_EQ(0, sameFile.rename(path));
+  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
 
-  file.setPath(path);
+  testXAttrInFsInfo(file);
+}
 
-  EXPECT_TRUE(file.exists());
+TEST_F(RadosFsTest, DirCache)
+{
+  AddPool();
 
-  // Check the contents again
+  const size_t maxSize = 4 * 1024 * 1024;
 
-  bzero(fileContsBuff, fileContents.length());
+  // Set a maximum size (in bytes) for the cache and verify
 
-  EXPECT_EQ(fileContents.length(),
-            file.read(fileContsBuff, 0, fileContents.length()));
+  radosFs.setDirCacheMaxSize(maxSize);
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  EXPECT_EQ(maxSize, radosFs.dirCacheMaxSize());
 
-  // Get the user dir's contents again and compare them with the old ones
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
 
-  std::set<std::string> entries1;
+  // Instantiate a dir and check that the cache stays the same
 
-  userDir.refresh();
+  radosfs::Dir dir(&radosFs, "/dir");
 
-  EXPECT_EQ(0, userDir.entryList(entries1));
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
 
-  EXPECT_LT(entries1.size(), entries.size());
+  // Create that dir and check that it gets cached
 
-  EXPECT_EQ(entries1.find("file"), entries1.end());
+  EXPECT_EQ(0, dir.create());
 
-  // Verify that the new file's parent can list it
+  EXPECT_EQ(1, radosFsPriv()->dirCache.numDirs());
 
-  entries.clear();
+  const std::string dirInode = radosFsDirPriv(dir)->fsStat()->translatedPath;
 
-  radosfs::Dir rootDir(&radosFs, "/");
+  EXPECT_TRUE(radosFsPriv()->dirCache.get(dirInode).get() != 0);
 
-  rootDir.refresh();
+  size_t cacheSize = radosFsPriv()->dirCache.size();
 
-  EXPECT_EQ(0, rootDir.entryList(entries));
+  EXPECT_GT(cacheSize, 0);
 
-  EXPECT_NE(entries.find("file-moved"), entries.end());
+  // Instantiate another dir from the one before and verify the cache
+  // stays the same
 
-  // Move the file to the user's dir
+  radosfs::Dir otherDir(dir);
 
-  path = userDir.path() + path;
+  EXPECT_EQ(1, radosFsPriv()->dirCache.numDirs());
 
-  EXPECT_EQ(0, file.rename(path));
+  // Change the path and verify the new dir gets cached
 
-  sameFile.setPath(path);
+  otherDir.setPath("/dir1");
+  otherDir.create();
 
-  EXPECT_TRUE(sameFile.exists());
+  EXPECT_EQ(2, radosFsPriv()->dirCache.numDirs());
 
-  // Rename the file to an empty path argument
+  EXPECT_TRUE(radosFsPriv()->dirCache.get(
+                radosFsDirPriv(otherDir)->fsStat()->translatedPath).get() != 0);
 
-  EXPECT_EQ(-EINVAL, file.rename(""));
+  // Create a sub directory and verify that it gets cached
 
-  // Rename the file to its own name
+  radosfs::Dir subdir(&radosFs, "/dir/subdir");
+  EXPECT_EQ(0, subdir.create());
 
-  EXPECT_EQ(-EPERM, file.rename(file.path()));
+  EXPECT_EQ(3, radosFsPriv()->dirCache.numDirs());
 
-  // Rename the file to a directory path
+  cacheSize = radosFsPriv()->dirCache.size();
 
-  EXPECT_EQ(-EISDIR, file.rename(userDir.path()));
+  // Update the parent dir of the one we created and verify that the number of
+  // cached dirs stays the same but the cache size grows (because now it has an
+  // entry)
 
-  // Rename the file to be in the root directory
+  dir.refresh();
 
-  path = "/file";
+  EXPECT_EQ(3, radosFsPriv()->dirCache.numDirs());
 
-  EXPECT_EQ(0, file.rename(path));
+  EXPECT_GT(radosFsPriv()->dirCache.size(), cacheSize);
 
-  EXPECT_EQ(path, file.path());
+  // Change the cache's max size so it cannot hold any dir
 
-  sameFile.refresh();
+  radosFs.setDirCacheMaxSize(1);
 
-  EXPECT_FALSE(sameFile.exists());
+  // Verify that the cache's contents were cleaned due to the
+  // ridiculously small size
 
-  // Create a file without an inline buffer so we check if the backlink in its
-  // inode gets updated when the file is renamed
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
 
-  file = radosfs::File(&radosFs, "/new-file");
+  // Update dir and verify it doesn't get cached (because its size is greater
+  // than the maximum)
 
-  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+  dir.refresh();
 
-  EXPECT_EQ(0, file.writeSync("x", 0, 1));
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
 
-  testFileInodeBackLink(file.path());
+  EXPECT_TRUE(radosFsPriv()->dirCache.get(dirInode).get() == 0);
 
-  path = "/new-file-renamed";
+  // Allow the cache to hold dirs again and verify the subdir gets cached
 
-  EXPECT_EQ(0, file.rename(path));
+  radosFs.setDirCacheMaxSize(maxSize);
 
-  ASSERT_EQ(path, file.path());
+  subdir.refresh();
 
-  testFileInodeBackLink(file.path());
+  EXPECT_EQ(1, radosFsPriv()->dirCache.numDirs());
 
-  delete[] fileContsBuff;
-}
+  // Remove the cached dir and verify the cache gets empty
 
-bool
-checkChunksExistence(librados::IoCtx ioctx, const std::string &baseName,
-                      size_t firstChunk, size_t lastChunk, bool shouldExist)
-{
-  bool checkResult = true;
-  for (size_t i = firstChunk; i <= lastChunk; i++)
-  {
-    std::string chunk = makeFileChunkName(baseName, i);
+  subdir.remove();
 
-    if (ioctx.stat(chunk, 0, 0) != 0)
-    {
-      if (shouldExist)
-      {
-        fprintf(stderr, "Error: Chunk %s does not exist!\n", chunk.c_str());
-        checkResult = false;
-      }
-    }
-    else if (!shouldExist)
-    {
-      fprintf(stderr, "Error: Chunk %s exist!\n", chunk.c_str());
-      checkResult = false;
-    }
-  }
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
 
-  return checkResult;
-}
+  // Create an uncacheable dir and verify the cache isn't affected
 
-TEST_F(RadosFsTest, FileOpsMultClientsWriteTruncate)
-{
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
-                    0, 0, 0, 0);
+  radosfs::Dir notCachedDir(&radosFs, "/notcached", false);
+  EXPECT_EQ(0, notCachedDir.create());
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  notCachedDir.refresh();
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, 0, true));
+  // Fill the cache with a few dirs, shrink it so it can only hold some of them
+  // and verify only the needed dirs are evicted
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 1, numChunks, false));
+  for (int i = 0; i < 10; i++)
+  {
+    std::stringstream stream;
+    stream << "/filler" << i << "/";
 
-    delete file;
-    delete [] contents;
+    radosfs::Dir fillerDir(&radosFs, stream.str());
+    EXPECT_EQ(0, fillerDir.create());
+  }
+
+  const size_t numDirs = radosFsPriv()->dirCache.numDirs();
+  cacheSize = radosFsPriv()->dirCache.size();
+
+  EXPECT_GE(numDirs, 10);
+
+  radosFs.setDirCacheMaxSize(cacheSize / 2);
+
+  EXPECT_LE(radosFsPriv()->dirCache.size(), cacheSize / 2);
+  EXPECT_GT(radosFsPriv()->dirCache.numDirs(), 0);
+  EXPECT_LT(radosFsPriv()->dirCache.numDirs(), numDirs);
 }
 
-TEST_F(RadosFsTest, FileOpsMultClientsWriteRemove)
+TEST_F(RadosFsTest, DirPathCache)
 {
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
-                    0, 0, 0, 0);
+  AddPool();
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  radosfs::FilesystemPriv *fsPriv = radosFsPriv();
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  // Set a maximum size for the cache and verify
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+  radosFs.setDirPathCacheMaxSize(32);
 
-    delete file;
-    delete [] contents;
-}
+  EXPECT_EQ(32, radosFs.dirPathCacheMaxSize());
 
-TEST_F(RadosFsTest, FileOpsMultClientsTruncateRemove)
-{
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
-                    0, 0, 0, 0);
+  radosFs.setDirPathCacheTTL(30);
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  EXPECT_EQ(30, radosFs.dirPathCacheTTL());
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  // Look up a dir that does not exist and verify it is cached as missing
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+  Inode inode;
 
-    delete file;
-    delete [] contents;
-}
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode("/dir/", inode));
 
-TEST_F(RadosFsTest, DirOpsMultipleClients)
-{
-  radosFs.addDataPool(TEST_POOL, "/", 50 * 1024);
-  radosFs.addMetadataPool(TEST_POOL, "/");
+  EXPECT_TRUE(fsPriv->dirPathCache.get("/dir/", inode));
+  EXPECT_EQ("", inode.inode);
 
-  // Create another RadosFs instance to be used as a different client
+  // Create the dir and verify that the missing entry is gone
 
-  radosfs::Filesystem otherClient;
-  otherClient.init("", conf());
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
-  otherClient.addMetadataPool(TEST_POOL, "/");
+  EXPECT_EQ(0, dir.create());
 
-  // Create the same directory from both clients
+  EXPECT_FALSE(fsPriv->dirPathCache.get("/dir/", inode) && inode.inode == "");
 
-  radosfs::Dir cli1DirInst(&radosFs, "/dir");
-  radosfs::Dir cli2DirInst(&otherClient, "/dir");
+  EXPECT_EQ(0, fsPriv->getDirInode("/dir/", inode));
 
-  EXPECT_EQ(0, cli1DirInst.create());
-  EXPECT_EQ(-EEXIST, cli2DirInst.create());
+  EXPECT_EQ(radosFsDirPriv(dir)->fsStat()->translatedPath, inode.inode);
 
-  // Launch 10 threads for each client, creating files and dirs in the same
-  // directory
+  // Rename the dir and verify the cache follows it
 
-  const int numOps = 10;
-  boost::thread *cli1Threads[numOps], *cli2Threads[numOps];
-  FsActionInfo *cli1ActionInfos[numOps];
-  FsActionInfo *cli2ActionInfos[numOps];
+  const std::string dirInode = inode.inode;
 
-  for (int i = 0; i < numOps; i++)
-  {
-    bool createDir = (i % 2) == 0;
-    FsActionType actionType = FS_ACTION_TYPE_FILE;
-    std::stringstream stream;
-    stream << cli1DirInst.path();
+  EXPECT_EQ(0, dir.rename("/renamed/"));
 
-    if (createDir)
-    {
-      stream << "client-1-dir-" << i;
-      actionType = FS_ACTION_TYPE_DIR;
-    }
-    else
-    {
-      stream << "client-1-file-" << i;
-    }
+  Inode renamedInode;
 
-    cli1ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
-                                          "create", "", 0, 0, 0);
-    cli1Threads[i] = new boost::thread(&RadosFsTest::runInThread,
-                                       cli1ActionInfos[i]);
-  }
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode("/dir/", inode));
 
-  for (int i = 0; i < numOps; i++)
-  {
-    bool createDir = (i % 2) != 0;
-    FsActionType actionType = FS_ACTION_TYPE_FILE;
-    std::stringstream stream;
-    stream << cli2DirInst.path();
+  EXPECT_EQ(0, fsPriv->getDirInode("/renamed/", renamedInode));
 
-    if (createDir)
-    {
-      stream << "client-1-dir-" << i;
-      actionType = FS_ACTION_TYPE_DIR;
-    }
-    else
-    {
-      stream << "client-1-file-" << i;
-    }
+  EXPECT_EQ(dirInode, renamedInode.inode);
 
-    cli2ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
-                                          "create", "", 0, 0, 0);
+  // Remove the dir and verify it is not found anymore
 
-    cli2Threads[i] = new boost::thread(&RadosFsTest::runInThread,
-                                       cli2ActionInfos[i]);
-  }
+  radosfs::Dir renamedDir(&radosFs, "/renamed/");
 
-  for (int i = 0; i < numOps; i++)
+  EXPECT_EQ(0, renamedDir.remove());
+
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode("/renamed/", inode));
+
+  // Look up many dirs and verify the cache never grows over its maximum
+
+  for (int i = 0; i < 100; i++)
   {
-    cli1Threads[i]->join();
-    cli2Threads[i]->join();
+    std::stringstream stream;
+    stream << "/missing" << i << "/";
 
-    delete cli1Threads[i];
-    delete cli1ActionInfos[i];
-    delete cli2Threads[i];
-    delete cli2ActionInfos[i];
+    fsPriv->getDirInode(stream.str(), inode);
   }
 
-  // Verify that both dir instances have the same number of entries
+  EXPECT_LE(fsPriv->dirPathCache.size(), radosFs.dirPathCacheMaxSize());
 
-  cli1DirInst.refresh();
+  // Set a very short time to live and verify the entries expire
 
-  std::set<std::string> entries;
+  radosFs.setDirPathCacheTTL(.1);
 
-  EXPECT_EQ(0, cli1DirInst.entryList(entries));
+  radosfs::Dir otherDir(&radosFs, "/other/");
 
-  EXPECT_EQ(2 * numOps, entries.size());
+  EXPECT_EQ(0, otherDir.create());
 
-  entries.clear();
-  cli2DirInst.refresh();
+  EXPECT_EQ(0, fsPriv->getDirInode("/other/", inode));
 
-  EXPECT_EQ(0, cli2DirInst.entryList(entries));
+  EXPECT_TRUE(fsPriv->dirPathCache.get("/other/", inode));
 
-  EXPECT_EQ(2 * numOps, entries.size());
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+
+  EXPECT_FALSE(fsPriv->dirPathCache.get("/other/", inode));
 }
 
-TEST_F(RadosFsTest, StatCluster)
+TEST_F(RadosFsTest, MissingEntriesCache)
 {
   AddPool();
 
-  uint64_t total = 0, used = 1, available = 1, numberOfObjects;
+  radosfs::FilesystemPriv *fsPriv = radosFsPriv();
 
-  int ret = radosFs.statCluster(&total, &used, &available, &numberOfObjects);
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  EXPECT_EQ(0, ret);
+  EXPECT_EQ(0, dir.create());
 
-  EXPECT_GT(total, used);
+  // Stat a file that does not exist and verify it is cached as missing
 
-  EXPECT_GT(total, available);
+  struct stat buff;
+
+  EXPECT_EQ(-ENOENT, radosFs.stat("/dir/file", &buff));
+
+  const std::string parentInode = radosFsDirPriv(dir)->fsStat()->translatedPath;
+  const uint64_t generation = fsPriv->dirGeneration(parentInode);
+
+  EXPECT_TRUE(fsPriv->missingEntries.isMissing(parentInode, generation,
+                                               "file"));
+
+  // Create the file and verify it is found
+
+  radosfs::File file(&radosFs, "/dir/file");
+
+  EXPECT_EQ(0, file.create());
+
+  EXPECT_FALSE(fsPriv->missingEntries.isMissing(parentInode, generation,
+                                                "file"));
+
+  EXPECT_EQ(0, radosFs.stat("/dir/file", &buff));
+
+  // Create the file from a different client and verify that it is found after
+  // the missing entry expires
+
+  EXPECT_EQ(-ENOENT, radosFs.stat("/dir/otherfile", &buff));
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+
+  radosfs::File otherFile(&otherClient, "/dir/otherfile");
+
+  EXPECT_EQ(0, otherFile.create());
+
+  boost::this_thread::sleep_for(
+        boost::chrono::milliseconds(MISSING_ENTRIES_CACHE_TTL * 1000 + 100));
+
+  EXPECT_EQ(0, radosFs.stat("/dir/otherfile", &buff));
+
+  // Verify that refreshing the parent dir (whose log grew) also invalidates
+  // the missing entries
+
+  EXPECT_EQ(-ENOENT, radosFs.stat("/dir/anotherfile", &buff));
+
+  radosfs::File anotherFile(&otherClient, "/dir/anotherfile");
+
+  EXPECT_EQ(0, anotherFile.create());
+
+  dir.refresh();
+
+  EXPECT_EQ(0, radosFs.stat("/dir/anotherfile", &buff));
 }
 
-TEST_F(RadosFsTest, XAttrs)
+TEST_F(RadosFsTest, LinkPrefixCache)
 {
   AddPool();
 
-  // Create a folder for the user
+  radosfs::FilesystemPriv *fsPriv = radosFsPriv();
 
-  radosfs::Dir dir(&radosFs, "/user");
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+  radosfs::Dir dir(&radosFs, "/dir/subdir/");
 
-  const std::string &fileName(dir.path() + "file");
+  EXPECT_EQ(0, dir.create(-1, true));
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  // Create a link to a dir and a file under it through the link
 
-  // Create a file for the xattrs
+  radosfs::Dir topDir(&radosFs, "/dir/");
 
-  radosfs::File file(&radosFs, fileName,
-                     radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, topDir.createLink("/link/"));
 
-  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+  EXPECT_EQ(0, fsPriv->linkPrefixes.size());
 
-  // Get an inexistent
+  radosfs::File file(&radosFs, "/link/subdir/file");
 
-  std::string xAttrValue;
+  EXPECT_EQ(0, file.create());
 
-  EXPECT_EQ(-ENODATA, radosFs.getXAttr(fileName, "inexistent", xAttrValue));
+  EXPECT_EQ("/dir/subdir/file", file.path());
 
-  // Set a user attribute
+  // Verify that the link is now cached and resolves the paths under it
 
-  const std::string attr("usr.attr");
-  const std::string value("value");
-  EXPECT_EQ(0, radosFs.setXAttr(fileName, attr, value));
+  EXPECT_EQ(1, fsPriv->linkPrefixes.size());
 
-  testFileInodeBackLink(fileName);
+  std::string path("/link/subdir/file");
 
-  // Check if the attribute got into the file inode's omap
+  EXPECT_TRUE(fsPriv->resolveLinkPrefix(path));
 
-  Stat stat;
-  ASSERT_EQ(0, radosFsPriv()->stat(fileName, &stat));
+  EXPECT_EQ("/dir/subdir/file", path);
 
-  std::map<std::string, librados::bufferlist> omap;
-  std::set<std::string> omapKeys;
+  // The link itself should not be resolved
 
-  omapKeys.insert(attr);
-  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
-                                              &omap));
+  path = "/link/";
 
-  ASSERT_TRUE(omap.find(attr) != omap.end());
+  EXPECT_FALSE(fsPriv->resolveLinkPrefix(path));
 
-  // Get the attribute set above
+  Stat stat;
+  std::string realPath;
 
-  std::string xAttrValue1;
+  EXPECT_EQ(0, fsPriv->getRealPath("/link/subdir/file", &stat, realPath));
 
-  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+  EXPECT_EQ("/dir/subdir/file", realPath);
 
-  // Verify that using the xattr with or without the "usr." prefix is the same
+  // Create a link inside the linked dir and verify the longest prefix is used
 
-  EXPECT_EQ(xAttrValue.length(), radosFs.getXAttr(fileName, "attr",
-                                                  xAttrValue1));
+  radosfs::Dir otherDir(&radosFs, "/other/");
 
-  EXPECT_EQ(xAttrValue, xAttrValue1);
+  EXPECT_EQ(0, otherDir.create());
 
-  // Check the attribtue's value
+  EXPECT_EQ(0, otherDir.createLink("/dir/subdir/other-link/"));
 
-  EXPECT_EQ(value, xAttrValue);
+  radosfs::File otherFile(&radosFs, "/link/subdir/other-link/file");
 
-  // Change to another user
+  EXPECT_EQ(0, otherFile.create());
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  EXPECT_EQ("/other/file", otherFile.path());
 
-  // Set an xattr by an unauthorized user
+  EXPECT_EQ(0, fsPriv->getRealPath("/link/subdir/other-link/file", &stat,
+                                   realPath));
 
-  EXPECT_EQ(-EACCES, radosFs.setXAttr(fileName, attr, value));
+  EXPECT_EQ("/other/file", realPath);
 
-  // Get an xattr by a user who can only read
+  // Remove the link and verify it is not cached anymore
 
-  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+  radosfs::Dir link(&radosFs, "/link/");
 
-  // Check the attribute's value
+  EXPECT_TRUE(link.isLink());
 
-  EXPECT_EQ(value, xAttrValue);
+  EXPECT_EQ(0, link.remove());
 
-  // Remove an xattr by an unauthorized user
+  path = "/link/subdir/file";
 
-  EXPECT_EQ(-EACCES, radosFs.removeXAttr(fileName, attr));
+  EXPECT_FALSE(fsPriv->resolveLinkPrefix(path));
 
-  // Get the xattrs map
+  struct stat buff;
 
-  std::map<std::string, std::string> map;
+  EXPECT_EQ(-ENOENT, radosFs.stat("/link/subdir/file", &buff));
+}
 
-  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+TEST_F(RadosFsTest, FileSizeHint)
+{
+  AddPool();
 
-  // Check the xattrs map's size
+  // Create a file without an inline buffer so its size is kept in its inode
 
-  EXPECT_EQ(1, map.size());
+  radosfs::File file(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
 
-  // Switch to the root user
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  const std::string contents("some contents");
 
-  map.clear();
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  // Set an xattr -- when being root -- in a different user's file
+  // Verify that the size is read from the inode while the writer has not set
+  // the size hint
 
-  EXPECT_EQ(0, radosFs.setXAttr(fileName, "sys.attribute", "check"));
+  struct stat buff;
 
-  // Get the xattrs map
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
 
-  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+  EXPECT_EQ(contents.length(), buff.st_size);
 
-  // Check the xattrs map's size
+  Stat *stat = radosFsFilePriv(file)->fsStat();
 
-  EXPECT_EQ(2, map.size());
+  // Update the size hint as the writer would do when it is done and verify
+  // the file is statted from it once it is checked against the inode
 
-  // Check the xattrs map's value
+  radosFsFilePriv(file)->getFileIO()->updateSizeHint();
 
-  EXPECT_EQ(map[attr], value);
+  file.refresh();
 
-  // Set an attribute in a directory
+  EXPECT_EQ(SIZE_HINT_UNVERIFIED, stat->sizeHint);
+  EXPECT_TRUE(verifyFileSizeHint(stat));
+  EXPECT_EQ(contents.length(), stat->statBuff.st_size);
+
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
+
+  EXPECT_EQ(contents.length(), buff.st_size);
 
-  const std::string dirAttr("usr.dir-attr");
-  EXPECT_EQ(0, radosFs.setXAttr(dir.path(), dirAttr, "check"));
+  // Write more contents and verify the hint (which writers do not change) is
+  // found to be stale
 
-  // Check if the attribute got into the dir inode's omap
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), contents.length(),
+                              contents.length()));
 
-  stat.reset();
-  ASSERT_EQ(0, radosFsPriv()->stat(dir.path(), &stat));
+  file.refresh();
 
-  omap.clear();
-  omapKeys.clear();
+  EXPECT_FALSE(verifyFileSizeHint(stat));
+  EXPECT_EQ(SIZE_HINT_INVALID, stat->sizeHint);
 
-  omapKeys.insert(dirAttr);
-  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
-                                              &omap));
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
 
-  ASSERT_TRUE(omap.find(dirAttr) != omap.end());
-}
+  EXPECT_EQ(contents.length() * 2, buff.st_size);
 
-TEST_F(RadosFsTest, XAttrsInInfo)
-{
-  AddPool();
+  // Verify that statting the file replaces the stale hint (as it would for one
+  // left by a writer that crashed)
 
-  radosfs::Dir dir(&radosFs, "/user");
+  EXPECT_EQ(0, file.stat(&buff));
 
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH),
-                          false, TEST_UID, TEST_GID));
+  EXPECT_EQ(contents.length() * 2, buff.st_size);
 
-  testXAttrInFsInfo(dir);
+  file.refresh();
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  EXPECT_TRUE(verifyFileSizeHint(stat));
+  EXPECT_EQ(contents.length() * 2, stat->statBuff.st_size);
 
-  // Create a file for the xattrs
+  // Have a writer in another client set the hint when it is done, then verify
+  // that the hint is found to be stale once the first writer changes the size
 
-  radosfs::File file(&radosFs, dir.path() + "file",
-                     radosfs::File::MODE_READ_WRITE);
+  {
+    radosfs::Filesystem otherClient;
+    otherClient.init("", conf());
 
-  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+    otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+    otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  testXAttrInFsInfo(file);
-}
+    radosfs::File otherWriter(&otherClient, "/file",
+                              radosfs::File::MODE_READ_WRITE);
 
-TEST_F(RadosFsTest, DirCache)
-{
-  AddPool();
+    EXPECT_EQ(0, otherWriter.writeSync(contents.c_str(), 0, contents.length()));
 
-  const size_t maxSize = 4;
+    radosFsFilePriv(otherWriter)->getFileIO()->updateSizeHint();
+  }
 
-  // Set a maximum size for the cache and verify
+  file.refresh();
 
-  radosFs.setDirCacheMaxSize(maxSize);
+  EXPECT_TRUE(verifyFileSizeHint(stat));
 
-  EXPECT_EQ(maxSize, radosFs.dirCacheMaxSize());
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), contents.length() * 2,
+                              contents.length()));
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  file.refresh();
 
-  // Instantiate a dir and check that the cache size stays the same
+  EXPECT_FALSE(verifyFileSizeHint(stat));
 
-  radosfs::Dir dir(&radosFs, "/dir");
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(contents.length() * 3, buff.st_size);
 
-  // Create that dir and check that the cache size increments
+  // Remove the file and create a new one with the same name, verifying that
+  // the old hint is not used for it
 
-  EXPECT_EQ(0, dir.create());
+  EXPECT_EQ(0, file.remove());
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+  radosfs::File otherFile(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  EXPECT_EQ(0, otherFile.create(-1, "", 0, 0));
 
-  EXPECT_EQ(radosFsDirPriv(dir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  EXPECT_EQ(0, radosFs.stat(otherFile.path(), &buff));
 
-  // Instantiate another dir from the one before and verify the cache
-  // stays the same
+  EXPECT_EQ(0, buff.st_size);
 
-  radosfs::Dir otherDir(dir);
+  // Verify that the parallel stat also uses the size hint, and that it reads
+  // the size from the inode when the hint is stale
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(0, otherFile.writeSync(contents.c_str(), 0, contents.length()));
 
-  // Change the path and verify the cache size increments
+  radosFsFilePriv(otherFile)->getFileIO()->updateSizeHint();
 
-  otherDir.setPath("/dir1");
-  otherDir.create();
+  std::vector<std::string> paths;
+  paths.push_back(otherFile.path());
 
-  EXPECT_EQ(2, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(contents.length(), radosFs.stat(paths)[0].second.st_size);
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  EXPECT_EQ(0, otherFile.writeSync(contents.c_str(), contents.length(),
+                                   contents.length()));
 
-  EXPECT_EQ(radosFsDirPriv(otherDir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  EXPECT_EQ(contents.length() * 2, radosFs.stat(paths)[0].second.st_size);
+}
 
-  // Create a sub directory and verify that the cache size increments
+TEST_F(RadosFsTest, DirCacheLease)
+{
+  AddPool();
 
-  radosfs::Dir subdir(&radosFs, "/dir/subdir");
-  EXPECT_EQ(0, subdir.create());
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
 
-  EXPECT_EQ(3, radosFsPriv()->dirCache.size());
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  const float leaseTime = 60;
 
-  EXPECT_EQ(radosFsDirPriv(subdir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  radosFs.setDirCacheLeaseTime(leaseTime);
+  EXPECT_EQ(leaseTime, radosFs.dirCacheLeaseTime());
 
-  // Update the parent dir of the one we created and verify
-  // that the cache size increments (because now it has an entry)
+  radosfs::Dir dir(&radosFs, "/dir");
+  EXPECT_EQ(0, dir.create());
 
   dir.refresh();
 
-  EXPECT_EQ(4, radosFsPriv()->dirCache.size());
+  std::set<std::string> entries;
+  dir.entryList(entries);
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we updated
+  EXPECT_EQ(0, entries.size());
 
-  EXPECT_EQ(radosFsDirPriv(dir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  // Create a file from a different client (which does not use leases) and
+  // verify that the change was notified so the dir gets read when refreshed
 
-  // Change the cache's max size so it allows to hold only one dir
-  // with no entries
+  radosfs::File file(&otherClient, "/dir/file", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, file.create());
 
-  radosFs.setDirCacheMaxSize(1);
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
 
-  // Verify that the cache's contents were cleaned due to the
-  // ridiculously small size
+  dir.refresh();
+  dir.entryList(entries);
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(1, entries.size());
 
-  // Update dir with one entry and verify it doesn't get cached
-  // (because the cache size would be greater than the maximum)
+  // Change the dir's log directly (so no notification is sent) and verify that
+  // the dir is not read while its lease is valid
+
+  const Stat *dirStat = radosFsDirPriv(dir)->fsStat();
+  librados::bufferlist contents;
+  contents.append(getObjectIndexLine("otherfile", '+'));
+
+  EXPECT_EQ(0, dirStat->pool->ioctx.append(dirStat->translatedPath, contents,
+                                           contents.length()));
 
   dir.refresh();
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  entries.clear();
+  dir.entryList(entries);
 
-  // Update the subdir (with no entries) and verify the cache
-  // size increments
+  EXPECT_EQ(1, entries.size());
 
-  subdir.refresh();
+  // Disable the lease and verify the dir gets read again
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+  radosFs.setDirCacheLeaseTime(0);
 
-  // Remove the cached dir and verify the cache size decrements
+  dir.refresh();
 
-  subdir.remove();
+  entries.clear();
+  dir.entryList(entries);
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(2, entries.size());
 
-  // Create an uncacheable dir and verify the cache isn't affected
+  // Use the lease again and verify that a file created by this client is seen
+  // as soon as the dir is refreshed (without waiting for the notification)
 
-  radosFs.setDirCacheMaxSize(100);
+  radosFs.setDirCacheLeaseTime(leaseTime);
 
-  radosfs::Dir notCachedDir(&radosFs, "/notcached", false);
-  EXPECT_EQ(0, notCachedDir.create());
+  dir.refresh();
 
-  notCachedDir.refresh();
+  radosfs::File ownFile(&radosFs, "/dir/ownfile", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, ownFile.create());
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  dir.refresh();
+
+  entries.clear();
+  dir.entryList(entries);
+
+  EXPECT_EQ(3, entries.size());
 }
 
 TEST_F(RadosFsTest, CompactDir)
@@ -2734,6 +4667,286 @@ TEST_F(RadosFsTest, CompactDir)
   }
 }
 
+TEST_F(RadosFsTest, CompactDirFromOtherClient)
+{
+  AddPool();
+
+  radosFs.setBackgroundDirCompaction(false);
+  radosFs.setDirCompactRatio(0.01);
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+  otherClient.setBackgroundDirCompaction(false);
+  otherClient.setDirCompactRatio(0.01);
+
+  const size_t numFiles = 10;
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  radosfs::Dir dir(&radosFs, "/");
+  dir.refresh();
+
+  struct stat statBefore, statAfter;
+  radosFs.stat(dir.path(), &statBefore);
+
+  // Compact the dir from the other client and then make its log grow beyond
+  // the size it had before, so the first client cannot rely on the size for
+  // knowing that the log was compacted
+
+  radosfs::Dir otherDir(&otherClient, dir.path());
+  otherDir.refresh();
+
+  EXPECT_EQ(0, otherDir.compact());
+
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    std::ostringstream s;
+    s << "/newfile" << i;
+    radosfs::File file(&otherClient, s.str(), radosfs::File::MODE_WRITE);
+    EXPECT_EQ(0, file.create());
+  }
+
+  radosFs.stat(dir.path(), &statAfter);
+
+  EXPECT_GT(statAfter.st_size, statBefore.st_size);
+
+  // Verify that both clients see the same entries
+
+  std::set<std::string> entries, otherEntries;
+
+  dir.refresh();
+  dir.entryList(entries);
+
+  otherDir.refresh();
+  otherDir.entryList(otherEntries);
+
+  EXPECT_EQ(numFiles / 2 + numFiles, entries.size());
+  EXPECT_EQ(otherEntries, entries);
+}
+
+TEST_F(RadosFsTest, BackgroundDirCompaction)
+{
+  AddPool();
+
+  EXPECT_TRUE(radosFs.backgroundDirCompaction());
+
+  // Use a low compact ratio so the dir does not get compacted when refreshed
+
+  radosFs.setDirCompactRatio(0.01);
+  radosFs.setDirCompactMinLogSize(0);
+  EXPECT_EQ(0, radosFs.dirCompactMinLogSize());
+
+  const size_t numFiles = 10;
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  const std::string dirPath("/");
+  struct stat statBefore, statAfter;
+
+  radosfs::Dir dir(&radosFs, dirPath);
+  dir.refresh();
+
+  std::set<std::string> entriesBefore, entriesAfter;
+  dir.entryList(entriesBefore);
+
+  radosFs.stat(dirPath, &statBefore);
+
+  // Disable the background compaction and set a ratio that would trigger it,
+  // then verify the dir does not get compacted
+
+  radosFs.setBackgroundDirCompaction(false);
+  EXPECT_FALSE(radosFs.backgroundDirCompaction());
+
+  radosFs.setDirCompactRatio(0.9);
+
+  boost::this_thread::sleep_for(
+        boost::chrono::milliseconds(DIR_COMPACTOR_SLEEP * 2));
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_EQ(statBefore.st_size, statAfter.st_size);
+
+  // Enable it and verify the dir gets compacted without being refreshed
+
+  radosFs.setBackgroundDirCompaction(true);
+
+  boost::this_thread::sleep_for(
+        boost::chrono::milliseconds(DIR_COMPACTOR_SLEEP * 2));
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  // Check the integrity of the entries after the compaction
+
+  radosFs.setDirCompactRatio(0.01);
+
+  radosfs::Dir sameDir(&radosFs, dirPath, false);
+  sameDir.refresh();
+  sameDir.entryList(entriesAfter);
+
+  EXPECT_EQ(entriesBefore, entriesAfter);
+}
+
+int dirListCallback(const std::string &entry, void *arg)
+{
+  std::vector<std::string> *entries = static_cast<std::vector<std::string> *>(arg);
+
+  entries->push_back(entry);
+
+  return 0;
+}
+
+TEST_F(RadosFsTest, DirList)
+{
+  AddPool();
+
+  radosFs.setBackgroundDirCompaction(false);
+  radosFs.setDirCompactRatio(0.01);
+
+  // Create files, compact the dir and then change its contents so its log
+  // has both a compacted and a non compacted part
+
+  const size_t numFiles = 20;
+
+  createNFiles(numFiles);
+
+  radosfs::Dir dir(&radosFs, "/");
+  dir.refresh();
+
+  EXPECT_EQ(0, dir.compact());
+
+  removeNFiles(numFiles / 4);
+
+  radosfs::File file(&radosFs, "/newfile", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, file.create());
+
+  dir.refresh();
+
+  std::set<std::string> entries;
+  dir.entryList(entries);
+
+  // List the dir from a different client (so it is read from the log) in
+  // pages, and verify it gets the same entries in the same order
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+  otherClient.setBackgroundDirCompaction(false);
+
+  radosfs::Dir sameDir(&otherClient, "/");
+
+  EXPECT_EQ(-EINVAL, sameDir.list("", 3, 0));
+
+  const size_t pageSize = 3;
+  std::vector<std::string> listedEntries, page;
+  std::string lastEntry("");
+
+  do
+  {
+    page.clear();
+
+    EXPECT_EQ(0, sameDir.list(lastEntry, pageSize, dirListCallback, &page));
+    EXPECT_LE(page.size(), pageSize);
+
+    if (!page.empty())
+      lastEntry = page.back();
+
+    listedEntries.insert(listedEntries.end(), page.begin(), page.end());
+  } while (page.size() == pageSize);
+
+  EXPECT_EQ(std::vector<std::string>(entries.begin(), entries.end()),
+            listedEntries);
+
+  // List the whole dir from the cached instance
+
+  listedEntries.clear();
+
+  EXPECT_EQ(0, dir.list("", 0, dirListCallback, &listedEntries));
+
+  EXPECT_EQ(std::vector<std::string>(entries.begin(), entries.end()),
+            listedEntries);
+
+  // List after an entry that does not exist
+
+  listedEntries.clear();
+
+  EXPECT_EQ(0, sameDir.list("file5a", 1, dirListCallback, &listedEntries));
+
+  ASSERT_EQ(1, listedEntries.size());
+  EXPECT_EQ("file6", listedEntries.front());
+
+  // Have the other client compact a cached dir and make its log grow back to
+  // the same size, and verify that the cached entries are not used to list it
+
+  radosfs::Dir cachedDir(&radosFs, "/samesize/");
+  EXPECT_EQ(0, cachedDir.create());
+
+  radosfs::File fileA(&radosFs, "/samesize/a", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, fileA.create());
+
+  radosfs::File fileB(&radosFs, "/samesize/b", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, fileB.create());
+
+  cachedDir.refresh();
+
+  radosfs::File otherFileB(&otherClient, "/samesize/b",
+                           radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, otherFileB.remove());
+
+  radosfs::Dir otherCachedDir(&otherClient, "/samesize/");
+  otherCachedDir.refresh();
+
+  EXPECT_EQ(0, otherCachedDir.compact());
+
+  radosfs::File otherFileC(&otherClient, "/samesize/c",
+                           radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, otherFileC.create());
+
+  listedEntries.clear();
+
+  EXPECT_EQ(0, cachedDir.list("", 0, dirListCallback, &listedEntries));
+
+  ASSERT_EQ(2, listedEntries.size());
+  EXPECT_EQ("a", listedEntries.front());
+  EXPECT_EQ("c", listedEntries.back());
+
+  // List a dir that has never been compacted (so all its entries are in the
+  // unsorted part of its log) from the other client, in pages
+
+  radosfs::Dir uncompactedDir(&radosFs, "/uncompacted/");
+  EXPECT_EQ(0, uncompactedDir.create());
+
+  const char *fileNames[] = {"c", "a", "b"};
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    radosfs::File file(&radosFs, std::string("/uncompacted/") + fileNames[i],
+                       radosfs::File::MODE_WRITE);
+    EXPECT_EQ(0, file.create());
+  }
+
+  radosfs::Dir otherUncompactedDir(&otherClient, "/uncompacted/");
+
+  listedEntries.clear();
+
+  EXPECT_EQ(0, otherUncompactedDir.list("", 2, dirListCallback,
+                                        &listedEntries));
+  EXPECT_EQ(0, otherUncompactedDir.list("b", 2, dirListCallback,
+                                        &listedEntries));
+
+  ASSERT_EQ(3, listedEntries.size());
+  EXPECT_EQ("a", listedEntries[0]);
+  EXPECT_EQ("b", listedEntries[1]);
+  EXPECT_EQ("c", listedEntries[2]);
+}
+
 TEST_F(RadosFsTest, RenameDir)
 {
   AddPool();
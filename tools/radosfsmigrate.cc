@@ -0,0 +1,532 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "Dir.hh"
+#include "Filesystem.hh"
+#include "radosfscommon.h"
+
+#define CONF_ENV_VAR "RADOSFS_CLUSTER_CONF"
+#define CLUSTER_CONF_ARG "conf"
+#define CLUSTER_CONF_ARG_CHAR 'c'
+#define DIRS_ARG "dirs"
+#define DIRS_ARG_CHAR 'd'
+#define FROM_POOL_ARG "from"
+#define FROM_POOL_ARG_CHAR 'f'
+#define TO_POOL_ARG "to"
+#define TO_POOL_ARG_CHAR 't'
+#define RATE_ARG "rate"
+#define RATE_ARG_CHAR 'r'
+#define PROGRESS_ARG "progress"
+#define PROGRESS_ARG_CHAR 'p'
+#define NUM_THREADS_ARG "threads"
+#define NUM_THREADS_ARG_CHAR 'j'
+#define DEFAULT_NUM_THREADS 4
+#define USER_ARG "user"
+#define USER_ARG_CHAR 'u'
+#define DRY_ARG "dry"
+#define DRY_ARG_CHAR 'n'
+#define VERBOSE_ARG "verbose"
+#define VERBOSE_ARG_CHAR 'v'
+#define HELP_ARG "help"
+#define HELP_ARG_CHAR 'h'
+#define MAX_MOVE_RETRIES 3
+#define OUTPUT_SPAN "%-50s"
+#define OPTION_SPAN "    " OUTPUT_SPAN " "
+
+struct MigrationArgs
+{
+  std::string confPath;
+  std::string userName;
+  std::string fromPool;
+  std::string toPool;
+  std::string progressPath;
+  std::vector<std::string> pools;
+  std::vector<std::string> dirs;
+  uint64_t rate;
+  int numThreads;
+  bool dry;
+  bool verbose;
+};
+
+struct Migration
+{
+  Migration(radosfs::Filesystem *fs, const MigrationArgs *args)
+    : fs(fs),
+      args(args),
+      next(0),
+      moved(0),
+      skipped(0),
+      failed(0),
+      progress(0)
+  {}
+
+  radosfs::Filesystem *fs;
+  const MigrationArgs *args;
+  std::vector<std::string> files;
+  std::set<std::string> done;
+  size_t next;
+  size_t moved;
+  size_t skipped;
+  size_t failed;
+  FILE *progress;
+  boost::mutex mutex;
+};
+
+static void
+showUsage(const char *name)
+{
+  fprintf(stdout, "Usage:\n%s --%s=DIR1[,DIR2] --%s=DATA_POOL [OPTIONS] "
+          "--%s=CLUSTER_CONF POOL_PREFIX:DATA_POOL[,DATA_POOL_2]:MTD_POOL "
+          "[POOL_PREFIX_2:DATA_POOL_3:MTD_POOL_2]\n\n",
+          name,
+          DIRS_ARG,
+          TO_POOL_ARG,
+          CLUSTER_CONF_ARG
+         );
+  fprintf(stdout,
+          "  CLUSTER_CONF\t- path to the cluster's configuration file\n"
+          "  POOL_PREFIX\t- is the path prefix corresponding to the pools"
+          "  DATA_POOL and MTD_POOL\n"
+          "  DATA_POOL\t- is the name of a data pool to assign to POOL_PREFIX "
+          "(several can be given, separated by commas)\n"
+          "  MTD_POOL\t- is the name of the metadata pool to assign to "
+          "POOL_PREFIX\n"
+          "\n"
+          "  Moves the files in the given directories (recursively) to the "
+          "data pool given by --%s. The pool needs to be one of the data pools "
+          "assigned to the files' prefix.\n\n"
+          "OPTIONS can be:\n", TO_POOL_ARG
+         );
+
+  std::stringstream arg;
+  arg << "--" << FROM_POOL_ARG << "=DATA_POOL, -" << FROM_POOL_ARG_CHAR <<
+         " DATA_POOL";
+  fprintf(stdout, OPTION_SPAN "only move the files that are in the given "
+                  "data pool\n", arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << RATE_ARG << "=MB_PER_SEC, -" << RATE_ARG_CHAR <<
+         " MB_PER_SEC";
+  fprintf(stdout, OPTION_SPAN "limit the rate at which each file's contents "
+                  "are copied (default is no limit)\n", arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << PROGRESS_ARG << "=FILE, -" << PROGRESS_ARG_CHAR << " FILE";
+  fprintf(stdout, OPTION_SPAN "record the files that were processed in FILE "
+                  "and skip the ones already recorded there, so an "
+                  "interrupted migration can be resumed\n", arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << NUM_THREADS_ARG << "=NUM_THREADS, -" << NUM_THREADS_ARG_CHAR <<
+         " NUM_THREADS";
+  fprintf(stdout, OPTION_SPAN "specify number of files to be moved at the same "
+                  "time (default=%d)\n", arg.str().c_str(),
+                  DEFAULT_NUM_THREADS);
+
+  arg.str("");
+  arg << "--" << USER_ARG << "=USER_NAME, -" << USER_ARG_CHAR << " USER_NAME";
+  fprintf(stdout, OPTION_SPAN "the user name to use when initializing the "
+                              "Ceph cluster\n", arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << DRY_ARG << ", -" << DRY_ARG_CHAR;
+  fprintf(stdout, OPTION_SPAN "dry run, shows which files would be moved\n",
+          arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << VERBOSE_ARG << ", -" << VERBOSE_ARG_CHAR;
+  fprintf(stdout, OPTION_SPAN "display more details about what is being "
+                  "done\n", arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << HELP_ARG << ", -" << HELP_ARG_CHAR;
+  fprintf(stdout, OPTION_SPAN "display help information\n",
+          arg.str().c_str());
+}
+
+static int
+parseArguments(int argc, char **argv, MigrationArgs &migrationArgs)
+{
+  const char *confFromEnv(getenv(CONF_ENV_VAR));
+
+  if (confFromEnv != 0)
+    migrationArgs.confPath = confFromEnv;
+
+  int optionIndex = 0;
+  struct option options[] =
+  {{CLUSTER_CONF_ARG, required_argument, 0, CLUSTER_CONF_ARG_CHAR},
+   {DIRS_ARG, required_argument, 0, DIRS_ARG_CHAR},
+   {FROM_POOL_ARG, required_argument, 0, FROM_POOL_ARG_CHAR},
+   {TO_POOL_ARG, required_argument, 0, TO_POOL_ARG_CHAR},
+   {RATE_ARG, required_argument, 0, RATE_ARG_CHAR},
+   {PROGRESS_ARG, required_argument, 0, PROGRESS_ARG_CHAR},
+   {NUM_THREADS_ARG, required_argument, 0, NUM_THREADS_ARG_CHAR},
+   {USER_ARG, required_argument, 0, USER_ARG_CHAR},
+   {DRY_ARG, no_argument, 0, DRY_ARG_CHAR},
+   {VERBOSE_ARG, no_argument, 0, VERBOSE_ARG_CHAR},
+   {HELP_ARG, no_argument, 0, HELP_ARG_CHAR},
+   {0, 0, 0, 0}
+  };
+
+  migrationArgs.rate = 0;
+  migrationArgs.numThreads = DEFAULT_NUM_THREADS;
+  migrationArgs.dry = false;
+  migrationArgs.verbose = false;
+
+  std::string args;
+
+  for (int i = 0; options[i].name != 0; i++)
+  {
+    args += options[i].val;
+
+    if (options[i].has_arg == required_argument)
+      args += ":";
+  }
+
+  int c;
+  while ((c = getopt_long(argc, argv, args.c_str(), options, &optionIndex)) != -1)
+  {
+    switch(c)
+    {
+      case CLUSTER_CONF_ARG_CHAR:
+        migrationArgs.confPath = optarg;
+        break;
+      case DIRS_ARG_CHAR:
+        splitToVector(optarg, migrationArgs.dirs);
+        break;
+      case FROM_POOL_ARG_CHAR:
+        migrationArgs.fromPool = optarg;
+        break;
+      case TO_POOL_ARG_CHAR:
+        migrationArgs.toPool = optarg;
+        break;
+      case RATE_ARG_CHAR:
+        migrationArgs.rate = strtoull(optarg, 0, 10) * 1024 * 1024;
+        break;
+      case PROGRESS_ARG_CHAR:
+        migrationArgs.progressPath = optarg;
+        break;
+      case NUM_THREADS_ARG_CHAR:
+        migrationArgs.numThreads = atoi(optarg);
+        if (migrationArgs.numThreads <= 0)
+        {
+          fprintf(stderr, "Error: The number of threads requested (%d) seems "
+                          "to be a mistake, please verify that you have chosen"
+                          "a number > 0!", migrationArgs.numThreads);
+          return -EINVAL;
+        }
+        break;
+      case USER_ARG_CHAR:
+        migrationArgs.userName = optarg;
+        break;
+      case DRY_ARG_CHAR:
+        migrationArgs.dry = true;
+        break;
+      case VERBOSE_ARG_CHAR:
+        migrationArgs.verbose = true;
+        break;
+      case HELP_ARG_CHAR:
+        showUsage(argv[0]);
+      default:
+        return -1;
+    }
+  }
+
+  if (migrationArgs.confPath == "")
+  {
+    fprintf(stdout, "Error: Please specify the " CONF_ENV_VAR " environment "
+            "variable or use the --" CLUSTER_CONF_ARG "=... argument.\n\n");
+
+    showUsage(argv[0]);
+
+    return -1;
+  }
+
+  if (migrationArgs.dirs.empty() || migrationArgs.toPool == "")
+  {
+    fprintf(stderr, "Please specify the directories to migrate (--%s) and the "
+                    "data pool to move the files to (--%s).\n\n", DIRS_ARG,
+            TO_POOL_ARG);
+
+    showUsage(argv[0]);
+
+    return -1;
+  }
+
+  for (int posArg = optind; posArg < argc; posArg++)
+  {
+    migrationArgs.pools.push_back(argv[posArg]);
+  }
+
+  if (migrationArgs.pools.empty())
+  {
+    fprintf(stderr, "No pools and prefixes were configured. This is needed "
+                    "in order to migrate the directories.\n");
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+void
+addPools(radosfs::Filesystem &fs, std::vector<std::string> poolsArg)
+{
+  for (size_t i = 0; i < poolsArg.size(); i++)
+  {
+    std::vector<std::string> poolsForPrefix;
+    splitToVector(poolsArg[i], poolsForPrefix, ':');
+
+    if (poolsForPrefix.size() != 3)
+    {
+      fprintf(stderr, "Invalid argument for describing a prefix and pool: "
+                      "'%s'", poolsArg[i].c_str());
+      exit(EINVAL);
+    }
+
+    const std::string &prefix = poolsForPrefix[0];
+    const std::string &mtdPool = poolsForPrefix[2];
+    std::vector<std::string> dataPools;
+    splitToVector(poolsForPrefix[1], dataPools);
+
+    int ret;
+    for (size_t j = 0; j < dataPools.size(); j++)
+    {
+      if ((ret = fs.addDataPool(dataPools[j], prefix)) != 0)
+      {
+        fprintf(stderr, "Problem adding data pool '%s': %s (retcode=%d)",
+                dataPools[j].c_str(), strerror(abs(ret)), ret);
+        exit(abs(ret));
+      }
+    }
+
+    if ((ret = fs.addMetadataPool(mtdPool, prefix)) != 0)
+    {
+      fprintf(stderr, "Problem adding metadata pool '%s': %s (retcode=%d)",
+              mtdPool.c_str(), strerror(abs(ret)), ret);
+      exit(abs(ret));
+    }
+  }
+}
+
+static int
+gatherFiles(Migration &migration, const std::string &dirPath)
+{
+  radosfs::Dir dir(migration.fs, dirPath, false);
+  std::vector<std::string> files;
+
+  int ret = dir.listFilesRecursively(files);
+
+  if (ret != 0)
+    fprintf(stderr, "Error listing the files in '%s': %s (retcode=%d)\n",
+            dirPath.c_str(), strerror(abs(ret)), ret);
+
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    if (migration.done.count(files[i]) == 0)
+      migration.files.push_back(files[i]);
+  }
+
+  return ret;
+}
+
+static void
+loadProgress(Migration &migration)
+{
+  std::ifstream progress(migration.args->progressPath.c_str());
+  std::string path;
+
+  while (std::getline(progress, path))
+  {
+    if (!path.empty())
+      migration.done.insert(path);
+  }
+}
+
+static int
+migrateFile(Migration &migration, const std::string &path)
+{
+  const MigrationArgs *args = migration.args;
+  std::string pool;
+
+  int ret = migration.fs->getInodeAndPool(path, 0, &pool);
+
+  if (ret != 0)
+    return ret;
+
+  // Files in the destination pool are still given to moveFileToPool so the
+  // leftovers of an interrupted move are removed
+  if (args->fromPool != "" && pool != args->fromPool && pool != args->toPool)
+    return -ENOTSUP;
+
+  if (args->dry)
+  {
+    if (pool != args->toPool)
+      fprintf(stdout, "Would move '%s' from %s to %s\n", path.c_str(),
+              pool.c_str(), args->toPool.c_str());
+
+    return 0;
+  }
+
+  for (int i = 0; i < MAX_MOVE_RETRIES; i++)
+  {
+    ret = migration.fs->moveFileToPool(path, args->toPool);
+
+    // The file was changed while it was being copied
+    if (ret != -EAGAIN)
+      break;
+  }
+
+  if (ret == 0 && args->verbose && pool != args->toPool)
+    fprintf(stdout, "Moved '%s' from %s to %s\n", path.c_str(), pool.c_str(),
+            args->toPool.c_str());
+
+  return ret;
+}
+
+static void
+migrationWorker(Migration *migration)
+{
+  while (true)
+  {
+    std::string path;
+
+    {
+      boost::unique_lock<boost::mutex> lock(migration->mutex);
+
+      if (migration->next >= migration->files.size())
+        break;
+
+      path = migration->files[migration->next++];
+    }
+
+    int ret = migrateFile(*migration, path);
+
+    boost::unique_lock<boost::mutex> lock(migration->mutex);
+
+    if (ret == 0)
+      migration->moved++;
+    else if (ret == -ENOTSUP)
+      migration->skipped++;
+    else
+    {
+      migration->failed++;
+      fprintf(stderr, "Error moving '%s': %s (retcode=%d)\n", path.c_str(),
+              strerror(abs(ret)), ret);
+      continue;
+    }
+
+    if (migration->progress)
+    {
+      fprintf(migration->progress, "%s\n", path.c_str());
+      fflush(migration->progress);
+    }
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  MigrationArgs args;
+
+  int ret = parseArguments(argc, argv, args);
+
+  if (ret != 0)
+    return abs(ret);
+
+  radosfs::Filesystem radosFs;
+  ret = radosFs.init(args.userName, args.confPath);
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "Error initializing the filesystem: %s (retcode=%d)\n",
+            strerror(abs(ret)), ret);
+    return abs(ret);
+  }
+
+  addPools(radosFs, args.pools);
+
+  radosFs.setDataMoveRate(args.rate);
+
+  Migration migration(&radosFs, &args);
+
+  if (args.progressPath != "")
+  {
+    loadProgress(migration);
+
+    if (!args.dry)
+    {
+      migration.progress = fopen(args.progressPath.c_str(), "a");
+
+      if (!migration.progress)
+      {
+        ret = errno;
+        fprintf(stderr, "Cannot open the progress file '%s': %s\n",
+                args.progressPath.c_str(), strerror(ret));
+        return ret;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < args.dirs.size(); i++)
+  {
+    const std::string &dir(args.dirs[i]);
+
+    if (dir[0] != '/')
+    {
+      fprintf(stderr, "Cannot migrate '%s'. Please use an absolute path.\n",
+              dir.c_str());
+      exit(EINVAL);
+    }
+
+    gatherFiles(migration, getDirPath(dir));
+  }
+
+  if (args.verbose)
+    fprintf(stdout, "Migrating %lu files (%lu already done)\n",
+            migration.files.size(), migration.done.size());
+
+  boost::thread_group workers;
+
+  for (int i = 0; i < args.numThreads; i++)
+    workers.create_thread(boost::bind(&migrationWorker, &migration));
+
+  workers.join_all();
+
+  if (migration.progress)
+    fclose(migration.progress);
+
+  fprintf(stdout, "%lu files migrated, %lu skipped, %lu failed\n",
+          migration.moved, migration.skipped, migration.failed);
+
+  return migration.failed > 0 ? EIO : 0;
+}